@@ -24,6 +24,15 @@
 #define EP_IN 0x01  // For some reason it is 0x01 that returns the info. Why is 0x81 not working???
 
 #define SWITCH_PIN 22
+#define SWITCH_ON HIGH
+#define SWITCH_OFF LOW
+
+// Fast start: the endpoint layout above is used as is, descriptor dumps and fixed delays are
+// skipped, and the MCA is powered through SWITCH_PIN only after the USB host is initialized so
+// it enumerates without being reconnected. Set to 0 for the original verbose start up.
+#define FAST_START 1
+#define ENUMERATION_TIMEOUT_MS 5000  // power cycle the MCA if it has not enumerated by then
+#define POWER_OFF_MS 500             // off time of a power cycle
 
 USB Usb;
 EpInfo ep_info[CapeMCA_NUM_EP];
@@ -31,6 +40,13 @@ bool is_CapeMCA_configured = false;
 
 static unsigned char mca_status;
 
+static unsigned long start_ms;        // setup() entry
+static unsigned long power_on_ms;     // last time SWITCH_PIN turned the MCA on
+static unsigned long power_off_ms;    // nonzero while the MCA is held off
+static unsigned long waiting_ms;      // power on, or when the task state last left USB_STATE_RUNNING
+static bool first_frame_reported = false;
+static uint8_t last_task_state = 0;
+
 uint8_t cmd[2] = { 0, 1 };  // returns 256x32-bit spectrum
 #define SPECTRUM_SIZE 256
 
@@ -42,6 +58,7 @@ void wdt_setup();
 
 void CapeMCA_init();
 byte CapeMCA_request();
+void CapeMCA_power_sequence(uint8_t state);
 
 void setup() {
   Serial.begin(115200);
@@ -50,17 +67,28 @@ void setup() {
     ;  // Wait for serial port to connect - used on Leonardo, Teensy and other boards with built-in USB CDC serial connection
 #endif
   Serial.println("Start");
+  start_ms = millis();
 
   // For switching spectrometer on and off
   pinMode(SWITCH_PIN, OUTPUT);
-  digitalWrite(SWITCH_PIN, LOW);
+  digitalWrite(SWITCH_PIN, SWITCH_OFF);
 
   while (Usb.Init() == -1) {
     Serial.println("USB Initialization FAILED.");
+#if FAST_START
+    delay(10);
+#else
     delay(200);
+#endif
   }
   Serial.println("USB Initialization Succeeded.");
+#if FAST_START
+  digitalWrite(SWITCH_PIN, SWITCH_ON);  // host is ready, let the MCA enumerate now
+  power_on_ms = millis();
+  waiting_ms = power_on_ms;
+#else
   delay(200);
+#endif
 
   // wdt_setup();
 }
@@ -68,8 +96,13 @@ void setup() {
 void loop() {
 
   Usb.Task();
+#if FAST_START
+  CapeMCA_power_sequence(Usb.getUsbTaskState());
+#endif
   if (Usb.getUsbTaskState() == USB_STATE_RUNNING) {
+#if !FAST_START
     Serial.println("USB_STATE_RUNNING");
+#endif
 
     if (!is_CapeMCA_configured) {
       CapeMCA_init();
@@ -79,7 +112,9 @@ void loop() {
         wdt_reset();
       }
     }
-  } else if (Usb.getUsbTaskState() != 0x20 && Usb.getUsbTaskState() != 0x40 && Usb.getUsbTaskState() != 0x51 && Usb.getUsbTaskState() != 0x50) {
+  }
+#if !FAST_START
+  else if (Usb.getUsbTaskState() != 0x20 && Usb.getUsbTaskState() != 0x40 && Usb.getUsbTaskState() != 0x51 && Usb.getUsbTaskState() != 0x50) {
       Serial.print("USB Task State: ");
       Serial.println(Usb.getUsbTaskState(), HEX);
       // // Turn spectrometer off and on again
@@ -90,6 +125,7 @@ void loop() {
       // delay(5000);
       // wdt_setup();
   }
+#endif
 }
 
 void CapeMCA_init() {
@@ -136,12 +172,51 @@ void CapeMCA_init() {
   is_CapeMCA_configured = true;
 
   Serial.println("Device connected");
+#if FAST_START
+  Serial.print("Enumerated ");
+  Serial.print(millis() - power_on_ms);
+  Serial.println(" ms after power on.");
+#else
   delay(200);
 
   AddressPool& addrPool = Usb.GetAddressPool();
   UsbDevice* p = addrPool.GetUsbDevicePtr(CapeMCA_ADDR);
   PrintAllAddresses(p);
   PrintAllDescriptors(p, &Usb);
+#endif
+}
+
+// Sequence SWITCH_PIN against the enumeration state instead of fixed delays: a MCA that
+// errors out or has not enumerated ENUMERATION_TIMEOUT_MS after power on, or after it left
+// USB_STATE_RUNNING, is switched off for POWER_OFF_MS and on again. Never blocks, so Usb.Task()
+// keeps running.
+void CapeMCA_power_sequence(uint8_t state) {
+  unsigned long now = millis();
+
+  if (state != last_task_state) {
+    if (state == USB_STATE_ERROR) {
+      Serial.print("USB Task State: ");
+      Serial.println(state, HEX);
+    }
+    if (last_task_state == USB_STATE_RUNNING) waiting_ms = now;  // detached, give it time to come back
+    last_task_state = state;
+  }
+  if (power_off_ms) {
+    if (now - power_off_ms >= POWER_OFF_MS) {
+      digitalWrite(SWITCH_PIN, SWITCH_ON);
+      power_on_ms = now;
+      waiting_ms = now;
+      power_off_ms = 0;
+    }
+    return;
+  }
+  if (state == USB_STATE_RUNNING) return;
+  is_CapeMCA_configured = false;  // detached or failed, configure again once it is back
+  if (state == USB_STATE_ERROR || now - waiting_ms >= ENUMERATION_TIMEOUT_MS) {
+    Serial.println("MCA did not enumerate, power cycling.");
+    digitalWrite(SWITCH_PIN, SWITCH_OFF);
+    power_off_ms = now ? now : 1;
+  }
 }
 
 byte CapeMCA_request() {
@@ -174,6 +249,15 @@ byte CapeMCA_request() {
     Serial.println("Succeeded in reading reply.");
     memcpy(spectrum, buf, sizeof(buf));
 
+    if (!first_frame_reported && len == sizeof buf) {
+      first_frame_reported = true;
+      Serial.print("First valid frame ");
+      Serial.print(millis() - start_ms);
+      Serial.print(" ms after start, ");
+      Serial.print(millis() - power_on_ms);
+      Serial.println(" ms after power on.");
+    }
+
     for (int i = 0; i < SPECTRUM_SIZE; i++) { 
       Serial.print(i);
       Serial.print(", ");
@@ -0,0 +1,129 @@
+///////////////////////////////////////////////////////////////////////////////////////////
+//  Summed spectrum and packet0 statistics of any time window from a partitioned        //
+//  archive (see mcaArchive.h), built by capeMCAreplay -A                                //
+//                                                                                       //
+//  Example: $ ./capeMCAarchive -a=1718000000 -b=1718086400 flight                       //
+//  prints the spectrum of every interval starting in that day as channel,count CSV,     //
+//  read from 24 hourly rollups instead of 86400 intervals once compacted.               //
+//                                                                                       //
+///////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "version.h"
+#include "mcaArchive.h"
+
+static char help[] = "CapeMCA Archive Query\n\n\
+Usage: capeMCAarchive [flags] dir\n\n\
+Flags:\n\
+  -a=t1 : window start, seconds on the archive clock (default start of archive)\n\
+  -b=t2 : window stop, intervals starting before this are summed (default end of archive)\n\
+  -c : build the rollups that are missing, then query if -a or -b is given\n\
+  -r : read the intervals only, not the rollups (for comparison)\n\
+  -s : print the statistics only, not the spectrum\n\
+  -i : show partitions and rollup progress only\n\
+  -h : display this help message\n\
+  -v : print version info\n";
+
+int main( int argc, char * argv[] )
+{
+	bool usage = false, info = false, compact = false, raw = false, statsOnly = false, window = false;
+	char *dir = NULL;
+	double t1 = -1.0e300, t2 = 1.0e300, t;
+	SpectrumArchive archive;
+	ARCHIVE_FILE_HEADER h;
+	ARCHIVE_RECORD stats;
+	static uint64_t sum[MAX_SPECTRUM_SIZE];
+
+	for (int i=1; i<argc; i++)						// parse command line
+		{
+		if ( argv[i][0] != '-' )
+			{
+			dir = argv[i];
+			continue;
+			}
+		switch (argv[i][1])
+			{
+			case 'a':
+				if ( argv[i][2] == '=' ) t1 = atof(argv[i]+3);
+				else usage = true;
+				window = true;
+				break;
+			case 'b':
+				if ( argv[i][2] == '=' ) t2 = atof(argv[i]+3);
+				else usage = true;
+				window = true;
+				break;
+			case 'c': compact = true; break;
+			case 'r': raw = true; break;
+			case 's': statsOnly = true; break;
+			case 'i': info = true; break;
+			case 'v':
+				printf("\nCapeMCA Archive Query %s\n\n",VERSION_STRING);
+				return( 0 );
+			default:
+				usage = true;
+			}
+		}
+	if ( !dir || (t2 < t1) ) usage = true;
+	if ( usage )
+		{
+		printf("%s",help);
+		return( 1 );
+		}
+
+	if ( !archive.Open(dir) ) return( 1 );
+	if ( compact )
+		{
+		t = MonotonicSeconds();
+		int bins = archive.Compact();
+		printf("%d bins rolled up in %.3f s\n",bins,MonotonicSeconds() - t);
+		if ( !window ) return( 0 );
+		}
+	if ( info )
+		{
+		printf("capemcaId %u, %u channels, %d partitions of %.0f s\n",archive.header.capemcaId,
+				archive.header.channels,archive.partitions,archive.header.partitionSeconds);
+		printf("partition,intervals,L1 bins,L2 bins,L3 bins,rolled up to\n");
+		for (int p=0; p<archive.partitions; p++)
+			{
+			double built = archive.partitionStart[p];
+			printf("%.0f",archive.partitionStart[p]);
+			for (int level=0; level<ARCHIVE_LEVELS; level++)
+				{
+				bool have = archive.Level(p,level,&h);
+				printf(",%u",have ? h.records : 0);
+				if ( have && (level == ARCHIVE_LEVELS-1) ) built = h.builtUntil;
+				}
+			printf(",%.0f\n",built);
+			}
+		return( 0 );
+		}
+
+	if ( raw ) archive.maxLevel = 0;
+	t = MonotonicSeconds();
+	if ( !archive.Sum(t1,t2,sum,&stats) )
+		{
+		printf("Archive read failed.\n");
+		return( 1 );
+		}
+	t = MonotonicSeconds() - t;
+	printf("%u intervals, %.3f s live, %llu counts, %.6f to %.6f\n",stats.intervals,stats.seconds,
+			(unsigned long long)stats.counts,stats.startTime,stats.stopTime);
+	if ( stats.packets )
+		{
+		double mean = stats.cpsSum/stats.packets;
+		printf("cps mean %.3f, sd %.3f, min %g, max %g over %u packet0\n",mean,
+				sqrt(fmax(stats.cpsSquares/stats.packets - mean*mean,0.0)),stats.cpsMin,stats.cpsMax,stats.packets);
+		}
+	printf("read %llu bytes in %.3f ms: %llu intervals, %llu 1 min, %llu 10 min and %llu 1 h bins\n",
+			(unsigned long long)archive.bytesRead,t*1.0e3,(unsigned long long)archive.recordsRead[0],
+			(unsigned long long)archive.recordsRead[1],(unsigned long long)archive.recordsRead[2],
+			(unsigned long long)archive.recordsRead[3]);
+	if ( statsOnly ) return( 0 );
+	printf("channel,count\n");
+	for (uint32_t i=1; i<archive.header.channels; i++)
+		printf("%u,%llu\n",i,(unsigned long long)sum[i]);
+	return( 0 );
+}
@@ -0,0 +1,852 @@
+///////////////////////////////////////////////////////////////////////////////////////////
+//  Microbenchmarks for the host-side decode, accumulate, output and read paths          //
+//                                                                                       //
+//  Each case is timed over several runs of enough frames to last at least -t= seconds;  //
+//  the median run is reported as ns/frame and MB/s of MCA data so regressions show up.  //
+//  The USB and UART read paths run against the simulated MCA in mcaSim.cpp.             //
+//                                                                                       //
+///////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "version.h"
+#include "mcaArchive.h"
+#include "mcaCapture.h"
+#include "mcaClock.h"
+#include "mcaCoincidence.h"
+#include "mcaDeadTime.h"
+#include "mcaFit.h"
+#include "mcaFrame.h"
+#include "mcaGain.h"
+#include "mcaIdentify.h"
+#include "mcaIndex.h"
+#include "mcaLightCurve.h"
+#include "mcaOutput.h"
+#include "mcaShared.h"
+#include "mcaSim.h"
+#include "mcaSparse.h"
+#include "mcaTransport.h"
+#include "mcaUartEngine.h"
+#include "mcaUnfold.h"
+
+static char help[] = "CapeMCA Benchmarks\n\n\
+Usage: capeMCAbench [flags] [case ...]\n\n\
+Flags:\n\
+  -r=7 : number of timed runs per case, median is reported (default 7)\n\
+  -t=0.2 : minimum seconds per timed run (default 0.2)\n\
+  -l : list the benchmark cases and exit\n\
+  -h : display this help message\n\
+  -v : print version info\n\
+\nRuns every case whose name contains one of the case arguments, or all cases.\n";
+
+typedef void (*BENCH_FUNCTION)( long frames );		// process this many frames
+
+typedef struct
+{
+	const char *name;
+	BENCH_FUNCTION function;
+	double bytesPerFrame;							// MCA bytes handled per frame, for MB/s
+} BENCH_CASE;
+
+volatile uint64_t benchSink;						// keeps results live past the optimizer
+
+////// fixtures shared by the cases /////////////////////////////////////////////////////////////////
+
+static McaSim sim(1,12345);							// simulated MCA with a realistic spectrum
+static uint8_t response33[MAX_RESPONSE_BYTES];		// recorded responses to {0,request}
+static uint8_t response34[MAX_RESPONSE_BYTES];
+static uint8_t response48[MAX_RESPONSE_BYTES];
+static uint8_t response0[MAX_RESPONSE_BYTES];
+static McaFrame frame512, frame4096;
+static SpectrumAccumulator accumulator;
+static uint32_t previous[MAX_SPECTRUM_SIZE], interval[MAX_SPECTRUM_SIZE];
+static McaFrame quiet4096;							// frame4096 plus a low-rate interval
+static McaFrame live4096;							// gains a low-rate interval every frame
+static SparseDelta sparseDelta;
+static SparseFrameWriter *sparseWriter = NULL;
+#define BENCH_QUIET_COUNTS	50						// counts per low-rate interval
+static FILE *devNull = NULL;
+static char devNullBuffer[1<<16];
+static SimTransport *usbSim = NULL;
+static SimPty simPty;
+static McaSim ptySim(2,777);
+static UartTransport uart;
+static bool uartReady = false;
+#define BENCH_PORTS		4							// pty simulators per multi-port case
+static McaSim *portSim[2*BENCH_PORTS];
+static SimPty portPty[2*BENCH_PORTS];				// first half sequential, second half epoll
+static UartTransport portUart[BENCH_PORTS];
+static UartEngine *engine = NULL;
+static bool portsReady = false;
+static ReplayTransport replay;						// looping capture of simulator traffic
+static char capturePath[] = "/tmp/capeMCAbench.cap";
+static SpectrumIndex spectrumIndex;					// 4096 channels, checkpoint every 16
+static char indexBase[] = "/tmp/capeMCAbench";
+static uint64_t windowSum[MAX_SPECTRUM_SIZE];
+static SpectrumArchive archive, archiveWriter;		// two hours of 1 s intervals, and an append target
+static char archiveDir[] = "/tmp/capeMCAbench.arch", archiveWriterDir[] = "/tmp/capeMCAbench.app";
+static double archiveStart = 1800000000.0;			// a whole hour on the archive clock
+static SharedSpectra sharedWriter, sharedReader;	// same region, writer and reader mappings
+static SHARED_DEVICE sharedCopy;
+static float scaledSpectrum[MAX_SPECTRUM_SIZE];
+static double stableSpectrum[MAX_SPECTRUM_SIZE];		// gain stabilized accumulation
+static LightCurve lightCurve;						// default bands plus a narrow line band
+static IdentifyLibrary *identify = NULL;			// 2000 line lists, one of them the simulator's
+static Unfolder *unfold = NULL;						// model response, 4096 channels x 256 bins
+static CoincidenceEngine *coincidence = NULL;		// 16 detectors, one a veto
+static double fitCounts[MAX_SPECTRUM_SIZE];			// frame4096 as doubles for the fitter
+static PEAK_MODEL fitModel = { true, 1 };			// gaussian, tail and linear background
+static FitPool *fitPool = NULL;
+static PEAK_FIT poolFit[16];
+static FIT_JOB poolJob[16];
+
+static void SetupFixtures( void )
+{
+	uint8_t cmd[2] = { 0, 0 };
+
+	sim.meanCps = 20000.0;
+	sim.Acquire(60);								// a minute of counts in every channel
+	cmd[1] = 0;  sim.Respond(cmd,2,response0);
+	cmd[1] = 33; sim.Respond(cmd,2,response33);
+	cmd[1] = 34; sim.Respond(cmd,2,response34);
+	cmd[1] = 48; sim.Respond(cmd,2,response48);
+	frame512.Decode(response34,RequestResponseBytes(34),34);
+	frame4096.Decode(response48,RequestResponseBytes(48),48);
+	for (int i=0; i<MAX_SPECTRUM_SIZE; i++)
+		previous[i] = frame4096.spectrum[i] - (frame4096.spectrum[i] & 3);
+
+	devNull = fopen("/dev/null","w");
+	if ( devNull ) setvbuf(devNull,devNullBuffer,_IOFBF,sizeof(devNullBuffer));
+	quiet4096 = frame4096;
+	for (int j=0; j<BENCH_QUIET_COUNTS; j++) quiet4096.spectrum[(j*977 + 1100) & 4095]++;
+	live4096 = frame4096;
+	sparseWriter = new SparseFrameWriter(devNull);
+	usbSim = new SimTransport(&sim,64);				// full-speed bulk packets
+
+	McaSim recordSim(3,99);							// capture 256 frames for replay
+	SimTransport recordTransport(&recordSim,0);
+	RecordingTransport recorder(&recordTransport);
+	McaFrame frame;
+	if ( recorder.Open(capturePath,CAPTURE_SOURCE_SIM,"bench") )
+		{
+		for (int n=0; n<256; n++)
+			{
+			recordSim.Acquire(1);
+			McaRequest(&recorder,34,&frame);
+			}
+		recorder.Close();
+		replay.Open(capturePath);
+		replay.loop = true;
+		}
+
+	if ( spectrumIndex.Create(indexBase,MAX_SPECTRUM_SIZE,16,1) )
+		for (int n=0; n<1024; n++)					// 1024 intervals to query
+			spectrumIndex.Append(n,n+1,interval);
+
+	if ( archiveWriter.Create(archiveDir,512,1) )
+		{
+		for (int n=0; n<7200; n++)
+			archiveWriter.Append(archiveStart+n,archiveStart+n+1,interval,&frame512.packet0);
+		archiveWriter.Close();
+		archive.Open(archiveDir);
+		archive.Compact();
+		}
+	archiveWriter.Create(archiveWriterDir,512,1);
+
+	if ( sharedWriter.Create("/capeMCAbench",1) )
+		{
+		sharedWriter.Slot(1);
+		sharedWriter.Publish(0,frame4096,&accumulator);
+		sharedReader.Attach("/capeMCAbench");
+		}
+
+	for (int i=0; i<MAX_SPECTRUM_SIZE; i++) fitCounts[i] = frame4096.spectrum[i];
+	coincidence = new CoincidenceEngine(MAX_SPECTRUM_SIZE);
+	for (int d=0; d<16; d++)
+		{
+		coincidence->AddDevice(d,d == 15,1100,1300,1);
+		coincidence->AddReadout(d,frame4096);		// primes the differences
+		}
+	fitPool = new FitPool();
+	for (int j=0; j<16; j++)						// 16 windows, alternating over the two lines
+		{
+		poolJob[j].spectrum = fitCounts;
+		poolJob[j].lo = (j & 1) ? 2400 : 1050;
+		poolJob[j].hi = (j & 1) ? 2800 : 1350;
+		poolJob[j].model = fitModel;
+		poolJob[j].fit = &poolFit[j];
+		}
+
+	ptySim.Acquire(10);
+	if ( simPty.Start(&ptySim) )
+		uartReady = uart.Open(simPty.slaveName,115200);
+
+	engine = new UartEngine;
+	portsReady = true;
+	for (int n=0; n<2*BENCH_PORTS; n++)
+		{
+		portSim[n] = new McaSim(10+n,10+n);
+		portSim[n]->Acquire(10);
+		if ( !portPty[n].Start(portSim[n]) ) portsReady = false;
+		else if ( n < BENCH_PORTS ) portsReady &= portUart[n].Open(portPty[n].slaveName,115200);
+		else portsReady &= (engine->Open(portPty[n].slaveName,115200,34) >= 0);
+		}
+}
+
+static void TeardownFixtures( void )
+{
+	uart.Close();
+	simPty.Stop();
+	delete engine;									// closes its ports
+	for (int n=0; n<BENCH_PORTS; n++) portUart[n].Close();
+	for (int n=0; n<2*BENCH_PORTS; n++)
+		{
+		portPty[n].Stop();
+		delete portSim[n];
+		}
+	delete usbSim;
+	delete sparseWriter;
+	delete fitPool;
+	delete coincidence;
+	delete unfold;
+	replay.Close();
+	remove(capturePath);
+	spectrumIndex.Close();
+	sharedReader.Detach();
+	sharedWriter.Detach();
+	remove("/tmp/capeMCAbench.sidx");
+	remove("/tmp/capeMCAbench.sivl");
+	archive.Close();
+	archiveWriter.Close();
+	archiveWriter.Create(archiveDir,512,1);			// empties both directories
+	archiveWriter.Close();
+	rmdir(archiveDir);
+	archiveWriter.Create(archiveWriterDir,512,1);
+	archiveWriter.Close();
+	rmdir(archiveWriterDir);
+	if ( devNull ) fclose(devNull);
+}
+
+////// benchmark cases //////////////////////////////////////////////////////////////////////////////
+
+static void BenchDecodePacket0( long frames )
+{
+	McaFrame frame;
+	for (long n=0; n<frames; n++)
+		{
+		frame.Decode(response0,sizeof(PACKET0_TYPE),0);
+		benchSink += frame.packet0.totalIntervals;
+		}
+}
+
+static void BenchDecode256( long frames )
+{
+	McaFrame frame;
+	for (long n=0; n<frames; n++)
+		{
+		frame.Decode(response33,RequestResponseBytes(33),33);
+		benchSink += frame.spectrum[n & 255];
+		}
+}
+
+static void BenchDecode512( long frames )
+{
+	McaFrame frame;
+	for (long n=0; n<frames; n++)
+		{
+		frame.Decode(response34,RequestResponseBytes(34),34);
+		benchSink += frame.spectrum[n & 511];
+		}
+}
+
+static void BenchDecode4096( long frames )
+{
+	McaFrame frame;
+	for (long n=0; n<frames; n++)
+		{
+		frame.Decode(response48,RequestResponseBytes(48),48);
+		benchSink += frame.spectrum[n & 4095];
+		}
+}
+
+static void BenchAccumulate512( long frames )
+{
+	accumulator.channels = 512;
+	for (long n=0; n<frames; n++)
+		accumulator.Add(frame512);
+	benchSink += accumulator.sum[100];
+	accumulator.Clear();
+}
+
+static void BenchAccumulate4096( long frames )
+{
+	accumulator.channels = 4096;
+	for (long n=0; n<frames; n++)
+		accumulator.Add(frame4096);
+	benchSink += accumulator.sum[1200];
+	accumulator.Clear();
+}
+
+static void BenchInterval4096( long frames )
+{
+	for (long n=0; n<frames; n++)
+		benchSink += IntervalSpectrum(frame4096.spectrum,previous,interval,MAX_SPECTRUM_SIZE);
+}
+
+static void BenchCsv512( long frames )
+{
+	for (long n=0; n<frames; n++)
+		{
+		WriteSpectrumCsv(devNull,frame512.spectrum,frame512.channels);
+		WritePacket0Csv(devNull,frame512.packet0);
+		}
+}
+
+static void BenchCsv4096( long frames )
+{
+	for (long n=0; n<frames; n++)
+		{
+		WriteSpectrumCsv(devNull,frame4096.spectrum,frame4096.channels);
+		WritePacket0Csv(devNull,frame4096.packet0);
+		}
+}
+
+static void BenchCsvPrintf4096( long frames )		// a printf per channel, as the tools used to
+{
+	for (long n=0; n<frames; n++)
+		{
+		fprintf(devNull,"channel,count\n");
+		for (int i=1; i<frame4096.channels; i++)
+			fprintf(devNull,"%d,%u\n", i,frame4096.spectrum[i]);
+		WritePacket0Csv(devNull,frame4096.packet0);
+		}
+}
+
+static void BenchCsvWriter4096( long frames )		// one writer and buffer for every frame
+{
+	CsvWriter csv(devNull);
+
+	for (long n=0; n<frames; n++)
+		{
+		csv.Spectrum(frame4096.spectrum,frame4096.channels);
+		csv.Packet0(frame4096.packet0);
+		}
+}
+
+static void BenchCsvSparse4096( long frames )
+{
+	CsvWriter csv(devNull);
+
+	csv.nonzeroOnly = true;
+	for (long n=0; n<frames; n++)
+		{
+		csv.Spectrum(frame4096.spectrum,frame4096.channels);
+		csv.Packet0(frame4096.packet0);
+		}
+}
+
+static void QuietInterval( McaFrame *frame, long n )	// BENCH_QUIET_COUNTS more counts
+{
+	for (int j=0; j<BENCH_QUIET_COUNTS; j++) frame->spectrum[(n*131 + j*977) & 4095]++;
+}
+
+static void BenchSparseEncode4096( long frames )	// a low-rate interval, against interval/4096
+{
+	for (long n=0; n<frames; n++)
+		benchSink += sparseDelta.Encode(quiet4096.spectrum,frame4096.spectrum,MAX_SPECTRUM_SIZE);
+}
+
+static void BenchSparseEncodeBusy4096( long frames )	// most channels changed
+{
+	for (long n=0; n<frames; n++)
+		benchSink += sparseDelta.Encode(frame4096.spectrum,previous,MAX_SPECTRUM_SIZE);
+}
+
+static void BenchSparseApply4096( long frames )		// low-rate delta into a readout and a sum
+{
+	sparseDelta.Encode(quiet4096.spectrum,frame4096.spectrum,MAX_SPECTRUM_SIZE);
+	for (long n=0; n<frames; n++)
+		{
+		sparseDelta.ApplyTo(interval);
+		sparseDelta.AddTo(windowSum);
+		}
+	benchSink += interval[1100];
+}
+
+static void BenchBinarySparse4096( long frames )	// low-rate readouts as sparse records
+{
+	for (long n=0; n<frames; n++)
+		{
+		QuietInterval(&live4096,n);
+		benchSink += sparseWriter->Write(live4096);
+		}
+}
+
+static void BenchBinary4096( long frames )
+{
+	for (long n=0; n<frames; n++)
+		benchSink += WriteFrameBinary(devNull,frame4096);
+}
+
+static void BenchUsbSim512( long frames )
+{
+	McaFrame frame;
+	for (long n=0; n<frames; n++)
+		benchSink += McaRequest(usbSim,34,&frame);
+}
+
+static void BenchUsbSim4096( long frames )
+{
+	McaFrame frame;
+	for (long n=0; n<frames; n++)
+		benchSink += McaRequest(usbSim,48,&frame);
+}
+
+static void BenchUartPty512( long frames )
+{
+	McaFrame frame;
+	for (long n=0; n<frames; n++)
+		if ( uartReady ) benchSink += McaRequest(&uart,34,&frame);
+}
+
+static void BenchUartPtySequential( long frames )	// one frame = a readout of every port in turn
+{
+	McaFrame frame;
+	for (long n=0; n<frames; n++)
+		for (int k=0; portsReady && (k<BENCH_PORTS); k++) benchSink += McaRequest(&portUart[k],34,&frame);
+}
+
+static void BenchUartEpoll( long frames )			// same readouts, all ports in flight at once
+{
+	if ( portsReady ) benchSink += engine->RunFrames(frames*BENCH_PORTS);
+}
+
+static void BenchReplay512( long frames )
+{
+	McaFrame frame;
+	for (long n=0; n<frames; n++)
+		benchSink += McaRequest(&replay,34,&frame);
+}
+
+static void BenchIndexAppend4096( long frames )
+{
+	for (long n=0; n<frames; n++)					// appends past the query range are
+		{											// truncated again at the end
+		spectrumIndex.Append(spectrumIndex.intervals,spectrumIndex.intervals+1,interval);
+		if ( spectrumIndex.intervals >= 1024+4096 )
+			{
+			spectrumIndex.Close();
+			spectrumIndex.Open(indexBase);
+			ftruncate(spectrumIndex.intervalFd,1024*(sizeof(INDEX_INTERVAL_HEADER)+MAX_SPECTRUM_SIZE*4));
+			spectrumIndex.Open(indexBase);
+			}
+		}
+}
+
+static void BenchIndexWindowAligned( long frames )	// both ends on checkpoints
+{
+	for (long n=0; n<frames; n++)
+		{
+		spectrumIndex.SumIntervals(16*(n & 31),512+16*(n & 31),windowSum);
+		benchSink += windowSum[1200];
+		}
+}
+
+static void BenchIndexWindowAny( long frames )		// ends anywhere, up to K/2 records walked
+{
+	for (long n=0; n<frames; n++)
+		{
+		spectrumIndex.SumIntervals(n & 511,512+(n*7 & 511),windowSum);
+		benchSink += windowSum[1200];
+		}
+}
+
+static void BenchArchiveAppend512( long frames )
+{
+	for (long n=0; n<frames; n++)					// an hour at most, then start over
+		{
+		if ( archiveWriter.rawRecords >= 3600 ) archiveWriter.Create(archiveWriterDir,512,1);
+		benchSink += archiveWriter.Append(archiveStart+archiveWriter.rawRecords,
+										   archiveStart+archiveWriter.rawRecords+1,interval,&frame512.packet0);
+		}
+}
+
+static void BenchArchiveHour512( long frames )		// an hour starting anywhere, from the rollups
+{
+	ARCHIVE_RECORD stats;
+	archive.maxLevel = ARCHIVE_LEVELS-1;
+	for (long n=0; n<frames; n++)
+		{
+		double t1 = archiveStart + (n*37 % 3600);
+		archive.Sum(t1,t1+3600,windowSum,&stats);
+		benchSink += windowSum[200];
+		}
+}
+
+static void BenchArchiveHourRaw512( long frames )	// the same windows, every interval read
+{
+	ARCHIVE_RECORD stats;
+	archive.maxLevel = 0;
+	for (long n=0; n<frames; n++)
+		{
+		double t1 = archiveStart + (n*37 % 3600);
+		archive.Sum(t1,t1+3600,windowSum,&stats);
+		benchSink += windowSum[200];
+		}
+	archive.maxLevel = ARCHIVE_LEVELS-1;
+}
+
+static void BenchSharedPublish4096( long frames )
+{
+	accumulator.channels = MAX_SPECTRUM_SIZE;
+	for (long n=0; n<frames; n++)
+		sharedWriter.Publish(0,frame4096,&accumulator);
+}
+
+static void BenchSharedPublishDelta4096( long frames )	// encode and publish a low-rate readout
+{
+	for (long n=0; n<frames; n++)
+		{
+		QuietInterval(&live4096,n);
+		sparseDelta.Encode(live4096.spectrum,sharedWriter.region->device[0].latest,MAX_SPECTRUM_SIZE);
+		sharedWriter.PublishDelta(0,live4096,sparseDelta);
+		}
+}
+
+static void BenchSharedSnapshot4096( long frames )
+{
+	for (long n=0; n<frames; n++)
+		if ( sharedReader.Snapshot(0,&sharedCopy) ) benchSink += sharedCopy.latest[1200];
+}
+
+static void BenchSharedInPlace4096( long frames )	// zero-copy read of one band
+{
+	uint32_t seq, band;
+	SHARED_DEVICE *d;
+
+	if ( !sharedReader.region ) return;
+	d = &sharedReader.region->device[0];
+	for (long n=0; n<frames; n++)
+		{
+		do
+			{
+			seq = sharedReader.BeginRead(0);
+			band = 0;
+			for (int i=1100; i<1300; i++) band += d->latest[i];
+			}
+		while ( !sharedReader.EndRead(0,seq) );
+		benchSink += band;
+		}
+}
+
+static void BenchFitCold( long frames )			// initial guess every time
+{
+	PEAK_FIT fit;
+
+	for (long n=0; n<frames; n++)
+		{
+		memset(&fit,0,sizeof(fit));
+		FitPeak(fitCounts,1050,1350,fitModel,&fit);
+		benchSink += fit.iterations;
+		}
+}
+
+static void BenchFitWarm( long frames )			// start from a previous solution
+{
+	PEAK_FIT fit, start;
+
+	memset(&start,0,sizeof(start));
+	FitPeak(fitCounts,1050,1350,fitModel,&start);
+	for (long n=0; n<frames; n++)
+		{
+		fit = start;
+		FitPeak(fitCounts,1050,1350,fitModel,&fit);
+		benchSink += fit.iterations;
+		}
+}
+
+static void BenchFitPool16( long frames )			// one frame = a batch of 16 cold fits
+{
+	for (long n=0; n<frames; n++)
+		{
+		memset(poolFit,0,sizeof(poolFit));
+		fitPool->Run(poolJob,16);
+		benchSink += poolFit[0].iterations;
+		}
+}
+
+static void BenchDeadTime4096( long frames )		// rate correction and spectrum scaling
+{
+	DEADTIME_PARAMS params = { 1, DEADTIME_PARALYZABLE, 2.0e-6, 0.0 };
+	DEADTIME_RESULT result;
+	const PACKET0_TYPE &p = frame4096.packet0;
+
+	for (long n=0; n<frames; n++)
+		{
+		DeadTimeCorrect(params,p.usPerInterval*1.0e-6,p.totalPulseTime/p.totalIntervals,
+						p.totalCount/p.totalIntervals,&result);
+		ScaleSpectrum(interval,scaledSpectrum,MAX_SPECTRUM_SIZE,(float)result.factor);
+		benchSink += (uint64_t)scaledSpectrum[1200];
+		}
+}
+
+static void BenchClock16( long frames )				// one frame = a readout of each of 16 detectors
+{
+	static ClockTracker clocks;
+	static McaFrame readout;
+	static long readouts = 0;
+	CLOCK_INTERVAL timing;
+
+	readout.hasPacket0 = true;
+	readout.packet0.usPerInterval = 100000;
+	for (long n=0; n<frames; n++, readouts++)
+		for (int d=0; d<16; d++)
+			{
+			readout.packet0.capemcaId = d;
+			readout.packet0.totalIntervals = (uint32_t)(readouts*10 + d);
+			readout.sendTime = readouts*1.00002 + d*0.001;
+			readout.hostTime = readout.sendTime + 0.004;
+			benchSink += clocks.Process(readout,&timing);
+			}
+}
+
+static void BenchCoincidence16( long frames )		// one frame = an aligned group of 16 readouts
+{
+	for (long n=0; n<frames; n++)
+		{
+		frame4096.hostTime = n;
+		for (int d=0; d<16; d++) coincidence->AddReadout(d,frame4096);
+		coincidence->Process();
+		}
+	benchSink += coincidence->groups;
+}
+
+static void BenchGain4096( long frames )			// track two lines, rebin the interval
+{
+	double centroid, net, gain = 1.0;
+
+	for (long n=0; n<frames; n++)
+		{
+		PeakCentroid(interval,MAX_SPECTRUM_SIZE,1200.0*gain,60.0,GAIN_CENTROID,&centroid,&net);
+		gain = 0.5*(centroid/1200.0 + gain);
+		PeakCentroid(interval,MAX_SPECTRUM_SIZE,2600.0*gain,90.0,GAIN_CENTROID,&centroid,&net);
+		RebinSpectrum(interval,MAX_SPECTRUM_SIZE,1.0137,-1.5,stableSpectrum);
+		}
+	benchSink += (uint64_t)stableSpectrum[1200];
+}
+
+static void BenchLightCurve4096( long frames )		// every band of a readout in one pass
+{
+	uint64_t sums[LIGHT_MAX_BANDS];
+
+	if ( !lightCurve.bands )
+		{
+		lightCurve.DefaultBands();
+		lightCurve.AddBand("line",1104,1296);
+		}
+	for (long n=0; n<frames; n++)
+		{
+		lightCurve.Sums(frame4096,sums);
+		benchSink += sums[0];
+		}
+}
+
+static void BenchIdentify2000( long frames )		// one frame = an interval against the library
+{
+	IDENTIFY_CANDIDATE top[5];
+
+	if ( !identify )
+		{
+		float channel[3], sigma[3], intensity[3] = { 1.0f, 0.5f, 0.2f };
+		identify = new IdentifyLibrary;
+		for (int n=0; n<2000; n++)					// decoys spread over the spectrum
+			{
+			for (int l=0; l<3; l++)
+				{
+				channel[l] = 100.0f + (n*37 + l*1291) % 3900;
+				sigma[l] = 20.0f + (n + l) % 40;
+				}
+			identify->AddLines("decoy",1 + n % 3,channel,sigma,intensity);
+			}
+		channel[0] = 1200.0f;
+		channel[1] = 2600.0f;
+		sigma[0] = 30.0f;
+		sigma[1] = 45.0f;
+		identify->AddLines("sim",2,channel,sigma,intensity);
+		identify->Project(MAX_SPECTRUM_SIZE);
+		}
+	for (long n=0; n<frames; n++)
+		benchSink += identify->Score(interval,MAX_SPECTRUM_SIZE,5,top);
+}
+
+static void BenchUnfold4096( long frames )			// one frame = 20 MLEM passes over a minute of counts
+{
+	if ( !unfold )
+		{
+		unfold = new Unfolder;
+		unfold->iterations = 20;
+		unfold->tolerance = 0.0;
+		unfold->SetThreads(0);
+		unfold->Build(MAX_SPECTRUM_SIZE);
+		}
+	for (long n=0; n<frames; n++)
+		benchSink += unfold->Unfold(frame4096.spectrum,MAX_SPECTRUM_SIZE);
+}
+
+static BENCH_CASE benchCases[] = {
+	{ "decode/packet0",		BenchDecodePacket0,		64 },
+	{ "decode/256+packet0",	BenchDecode256,			256*4+64 },
+	{ "decode/512+packet0",	BenchDecode512,			512*4+64 },
+	{ "decode/4096+packet0",	BenchDecode4096,		4096*4+64 },
+	{ "accumulate/512",		BenchAccumulate512,		512*4 },
+	{ "accumulate/4096",	BenchAccumulate4096,	4096*4 },
+	{ "interval/4096",		BenchInterval4096,		4096*4 },
+	{ "csv/512",			BenchCsv512,			512*4+64 },
+	{ "csv/4096",			BenchCsv4096,			4096*4+64 },
+	{ "csv-printf/4096",	BenchCsvPrintf4096,		4096*4+64 },
+	{ "csv-writer/4096",	BenchCsvWriter4096,		4096*4+64 },
+	{ "csv-sparse/4096",	BenchCsvSparse4096,		4096*4+64 },
+	{ "binary/4096",		BenchBinary4096,		4096*4+64 },
+	{ "binary-sparse/4096",	BenchBinarySparse4096,	4096*4+64 },
+	{ "sparse/encode/4096",	BenchSparseEncode4096,	4096*4 },
+	{ "sparse/encode-busy/4096",	BenchSparseEncodeBusy4096,	4096*4 },
+	{ "sparse/apply/4096",	BenchSparseApply4096,	4096*4 },
+	{ "usb-sim/512",		BenchUsbSim512,			512*4+64 },
+	{ "usb-sim/4096",		BenchUsbSim4096,		4096*4+64 },
+	{ "uart-pty/512",		BenchUartPty512,		512*4+64 },
+	{ "uart-pty/4x512",		BenchUartPtySequential,	BENCH_PORTS*(512*4+64) },
+	{ "uart-epoll/4x512",	BenchUartEpoll,			BENCH_PORTS*(512*4+64) },
+	{ "replay/512",			BenchReplay512,			512*4+64 },
+	{ "index/append/4096",	BenchIndexAppend4096,	4096*4 },
+	{ "index/window-k/4096",	BenchIndexWindowAligned,	4096*8 },
+	{ "index/window/4096",	BenchIndexWindowAny,	4096*8 },
+	{ "archive/append/512",	BenchArchiveAppend512,	512*4+64 },
+	{ "archive/hour/512",	BenchArchiveHour512,	3600*(512*4+64) },
+	{ "archive/hour-raw/512",	BenchArchiveHourRaw512,	3600*(512*4+64) },
+	{ "shared/publish/4096",	BenchSharedPublish4096,	4096*12+64 },
+	{ "shared/publish-delta/4096",	BenchSharedPublishDelta4096,	4096*4+64 },
+	{ "shared/snapshot/4096",	BenchSharedSnapshot4096,	sizeof(SHARED_DEVICE) },
+	{ "shared/in-place/band",	BenchSharedInPlace4096,	200*4 },
+	{ "deadtime/4096",		BenchDeadTime4096,		4096*4+64 },
+	{ "clock/16",			BenchClock16,			16*64 },
+	{ "coinc/16x4096",		BenchCoincidence16,		16*4096*4 },
+	{ "gain/4096",			BenchGain4096,			4096*4 },
+	{ "lightcurve/4096",	BenchLightCurve4096,	4096*4 },
+	{ "identify/2000",		BenchIdentify2000,		4096*4 },
+	{ "unfold/4096",		BenchUnfold4096,		4096*4 },
+	{ "fit/cold",			BenchFitCold,			300*8 },
+	{ "fit/warm",			BenchFitWarm,			300*8 },
+	{ "fit/pool-16",		BenchFitPool16,			16*350*8 },
+	{ NULL, NULL, 0 }
+};
+
+////// timing ///////////////////////////////////////////////////////////////////////////////////////
+
+static double NowSeconds( void )					// monotonic clock in seconds
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return( ts.tv_sec + ts.tv_nsec*1.0e-9 );
+}
+
+static int CompareDoubles( const void *a, const void *b )
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return( (x > y) - (x < y) );
+}
+
+static void RunCase( const BENCH_CASE &bench, int runs, double minSeconds )
+{
+	double t, elapsed, nsPerFrame[64], median;
+	long frames = 1;
+
+	bench.function(1);								// warm caches and page in buffers
+	for (;;)										// calibrate frames per run
+		{
+		t = NowSeconds();
+		bench.function(frames);
+		elapsed = NowSeconds() - t;
+		if ( (elapsed >= minSeconds) || (frames >= (1L << 40)) ) break;
+		if ( elapsed < minSeconds/16 ) frames *= 8;
+		else frames = (long)(frames*1.2*minSeconds/elapsed) + 1;
+		}
+
+	for (int r=0; r<runs; r++)
+		{
+		t = NowSeconds();
+		bench.function(frames);
+		nsPerFrame[r] = (NowSeconds() - t)*1.0e9/frames;
+		}
+	qsort(nsPerFrame,runs,sizeof(double),CompareDoubles);
+	median = nsPerFrame[runs/2];
+
+	printf("%-24s %12.1f ns/frame %10.1f MB/s   (min %.1f, max %.1f, %ld frames/run)\n",
+			bench.name,median,bench.bytesPerFrame*1.0e3/median,nsPerFrame[0],nsPerFrame[runs-1],frames);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main( int argc, char * argv[] )
+{
+	bool usage = false, list = false, selected;
+	int runs = 7, patterns = 0;
+	double minSeconds = 0.2;
+	char *pattern[64];
+
+	for (int i=1; i<argc; i++)						// parse command line
+		{
+		if ( argv[i][0] == '-' )
+		  {
+		  switch (argv[i][1])
+			{
+			case 'r':
+				if ( (argv[i][2] == '=') ) runs = atoi(argv[i]+3);
+				else usage = true;
+				break;
+			case 't':
+				if ( (argv[i][2] == '=') ) minSeconds = atof(argv[i]+3);
+				else usage = true;
+				break;
+			case 'l':
+				list = true;
+				break;
+			case 'V':
+			case 'v':
+				printf("\nCapeMCA Benchmarks %s\n\n",VERSION_STRING);
+				return( 0 );
+			default:
+				usage = true;
+			}
+		  }
+		else if ( patterns < 64 ) pattern[patterns++] = argv[i];
+		}
+	if ( (runs < 1) || (runs > 64) || (minSeconds <= 0) ) usage = true;
+	if ( usage )
+		{
+		printf("%s",help);
+		return( 1 );
+		}
+
+	if ( list )
+		{
+		for (int c=0; benchCases[c].name; c++) printf("%s\n",benchCases[c].name);
+		return( 0 );
+		}
+
+	SetupFixtures();
+	if ( !uartReady || !portsReady ) printf("pty unavailable, uart-pty and uart-epoll cases measure nothing\n");
+
+	for (int c=0; benchCases[c].name; c++)
+		{
+		selected = (patterns == 0);
+		for (int p=0; p<patterns; p++)
+			if ( strstr(benchCases[c].name,pattern[p]) ) selected = true;
+		if ( selected ) RunCase(benchCases[c],runs,minSeconds);
+		}
+
+	TeardownFixtures();
+	return( 0 );
+}
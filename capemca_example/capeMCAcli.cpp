@@ -7,11 +7,13 @@
 
 #include "version.h"
 #include "winUSBD.h"
+#include "mcaOutput.h"
 
 /* #define SPECTRUM_SIZE 4096							// number of channels in spectrum */
 #define SPECTRUM_SIZE 512							// number of channels in spectrum
 
 WinUSBDs winUSBDs;									// USB devices that have been enumerated
+DeviceCache deviceCache;							// endpoints found on earlier connects
 													// Linux-style command-line help message
 
 static char help[] = "CapeMCA Command Line Interface\n\n\
@@ -41,6 +43,9 @@ bool Connect( WinUSBD *winUSBD )	// open USB device and start the communication
 	HRESULT hr;
     BOOL noDevice;									// find by GUID of Device Interface
 
+	DEVICE_CACHE_ENTRY entry;
+	char name[MAX_PATH];
+
 	hr = winUSBD->OpenDevice(GUID_DEVINTERFACE_USBDevice, &noDevice,false);	
 
     if ( FAILED(hr) )
@@ -51,16 +56,28 @@ bool Connect( WinUSBD *winUSBD )	// open USB device and start the communication
             printf("Failed looking for device, HRESULT 0x%x\n", hr);
         return false;
 		}
-													// find bulk transfer endpoints
-	hr = winUSBD->FindBulkTransferEndpoints(false);	// and set timeout for ReadPipe
-
-	if ( FAILED(hr) )
+													// reuse endpoints cached for this MCA
+	winUSBD->ExtractIdentifierFromPath(name);
+	name[sizeof(entry.serial)-1] = 0;
+	if ( winUSBD->UseCachedEndpoints(deviceCache.Find(name)) ) return( true );
+													// else find bulk transfer endpoints
+	if ( !winUSBD->FindBulkTransferEndpoints(false) )	// and set timeout for ReadPipe
 		{
 		hr = HRESULT_FROM_WIN32(GetLastError());
         printf("Error finding bulk transfer endpoints: %d\n", hr);
 		return( false );
 		}
 
+	if ( winUSBD->FillCacheEntry(&entry) )
+		{
+		DEVICE_CACHE_ENTRY *cached = deviceCache.Find(entry.serial);
+		if ( cached )								// keep what only the protocol knows
+			{
+			entry.capemcaId = cached->capemcaId;
+			entry.lastRequest = cached->lastRequest;
+			}
+		deviceCache.Update(entry);
+		}
 	return( true );
 }
 
@@ -143,6 +160,8 @@ int main( int argc, char * argv[] )
 
 		for (int i=1; i<SPECTRUM_SIZE; i++) spectrum[i] = 0;
 
+		deviceCache.Load(DEVICE_CACHE_PATH);
+
 		printf("\nEnumerating MCAs..");
 
 		winUSBDs.EnumerateDevices(GUID_DEVINTERFACE_USBDevice);	// find all STM32 WINUSB MCAs
@@ -173,6 +192,7 @@ int main( int argc, char * argv[] )
 
 			winUSBD = winUSBD->next;						// until all attached MCAs are tried
 			}
+		deviceCache.Save();
 
 		printf("\nRequesting spectra from MCAs\n");
 
@@ -207,9 +227,7 @@ int main( int argc, char * argv[] )
 			winUSBD = winUSBD->next;						// until all attached MCAs are tried
 			}
 
-		printf("channel,count\n");
-		for (int i=1; i<SPECTRUM_SIZE; i++)
-			printf("%d,%u\n", i,spectrum[i]);				// print spectrum to console
+		WriteSpectrumCsv(stdout,spectrum,SPECTRUM_SIZE);	// print spectrum to console
 
 Exit:							
 		winUSBDs.UnenumerateDevices();						// release all MCAs
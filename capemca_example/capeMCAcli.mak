@@ -7,10 +7,19 @@ EXEFILE = capeMCAcli.exe
 HDRFILES = \
 	lists.h \
 	version.h \
+	mcaDeviceCache.h \
+	mcaFrame.h \
+	mcaOutput.h \
+	mcaSparse.h \
+	packet0type.h \
 	winUSBD.h
 #	
 #					Object files (targets of compilation)
 OBJFILES = \
+	mcaDeviceCache.obj \
+	mcaFrame.obj \
+	mcaOutput.obj \
+	mcaSparse.obj \
 	winUSBD.obj \
 	capeMCAcli.obj
 #
@@ -0,0 +1,148 @@
+///////////////////////////////////////////////////////////////////////////////////////////
+//  Coincidence and veto analysis of several detectors (see mcaCoincidence.h)            //
+//                                                                                       //
+//  Each argument is a binary frame file of one detector (capeMCAreplay -o=frames.bin).  //
+//  Readouts of all files are merged in hostTime order, aligned into interval groups,   //
+//  and the all / coincident / veto-subtracted spectra of every detector are written.   //
+//                                                                                       //
+///////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "version.h"
+#include "mcaCoincidence.h"
+#include "mcaOutput.h"
+
+static char help[] = "CapeMCA Coincidence\n\n\
+Usage: capeMCAcoinc [flags] detector0.bin detector1.bin ...\n\n\
+Flags:\n\
+  -r=lo:hi : region of interest for the hit test (default whole spectrum)\n\
+  -t=1 : counts in the region of interest for a hit (default 1)\n\
+  -x=1 : detector number (order on the command line) that is a veto, may be repeated\n\
+  -k=1 : other non-veto detectors that must be hit for coincidence (default 1)\n\
+  -w=0.25 : seconds between readouts aligned into one interval (default 0.25)\n\
+  -o=base : write base<n>.csv with channel,all,coincident,anticoincident per detector\n\
+  -h : display this help message\n\
+  -v : print version info\n";
+
+int main( int argc, char * argv[] )
+{
+	bool usage = false, isVeto[COINC_MAX_DEVICES];
+	char *path[COINC_MAX_DEVICES], *outBase = NULL;
+	int files = 0, roiLo = 0, roiHi = MAX_SPECTRUM_SIZE, minOthers = 1, veto;
+	uint32_t threshold = 1;
+	double tolerance = 0.25;
+	FILE *f[COINC_MAX_DEVICES];
+	McaFrame *next[COINC_MAX_DEVICES];
+	bool pending[COINC_MAX_DEVICES];
+
+	memset(isVeto,0,sizeof(isVeto));
+	for (int i=1; i<argc; i++)						// parse command line
+		{
+		const char *value = (argv[i][0] == '-') && (argv[i][1] != 0) && (argv[i][2] == '=') ? argv[i]+3 : NULL;
+
+		if ( argv[i][0] != '-' )
+			{
+			if ( files < COINC_MAX_DEVICES ) path[files++] = argv[i];
+			else usage = true;
+			continue;
+			}
+		switch (argv[i][1])
+			{
+			case 'r': if ( !value || (sscanf(value,"%d:%d",&roiLo,&roiHi) != 2) ) usage = true; break;
+			case 't': if ( value ) threshold = (uint32_t)atoi(value); else usage = true; break;
+			case 'k': if ( value ) minOthers = atoi(value); else usage = true; break;
+			case 'w': if ( value ) tolerance = atof(value); else usage = true; break;
+			case 'o': if ( value ) outBase = (char *)value; else usage = true; break;
+			case 'x':
+				if ( value && ((veto = atoi(value)) >= 0) && (veto < COINC_MAX_DEVICES) ) isVeto[veto] = true;
+				else usage = true;
+				break;
+			case 'v':
+				printf("\nCapeMCA Coincidence %s\n\n",VERSION_STRING);
+				return( 0 );
+			default:
+				usage = true;
+			}
+		}
+	if ( (files < 2) || (roiHi <= roiLo) ) usage = true;
+	if ( usage )
+		{
+		printf("%s",help);
+		return( 1 );
+		}
+
+	int channels = 0;
+	for (int d=0; d<files; d++)						// first frame of each file sets up the engine
+		{
+		if ( !(f[d] = fopen(path[d],"rb")) )
+			{
+			printf("Cannot open %s\n",path[d]);
+			return( 1 );
+			}
+		next[d] = new McaFrame;
+		pending[d] = ReadFrameBinary(f[d],next[d]);
+		if ( pending[d] && !channels ) channels = next[d]->channels;
+		}
+	if ( !channels )
+		{
+		printf("No spectra in the frame files\n");
+		return( 1 );
+		}
+	CoincidenceEngine engine(channels,tolerance,minOthers);
+	for (int d=0; d<files; d++)
+		engine.AddDevice(d,isVeto[d],roiLo,roiHi,threshold);
+
+	for (;;)										// merge readouts in time order
+		{
+		int first = -1;
+		for (int d=0; d<files; d++)
+			if ( pending[d] && ((first < 0) || (next[d]->hostTime < next[first]->hostTime)) ) first = d;
+		if ( first < 0 ) break;
+		engine.AddReadout(first,*next[first]);
+		engine.Process();
+		pending[first] = ReadFrameBinary(f[first],next[first]);
+		}
+	engine.Process(true);
+
+	printf("%llu interval groups\n",(unsigned long long)engine.groups);
+	printf("detector,file,veto,intervals,coincidentIntervals,vetoedIntervals,dropped,all,coincident,anticoincident\n");
+	for (int d=0; d<files; d++)
+		{
+		COINC_DEVICE *c = engine.device[d];
+		uint64_t all = 0, coincident = 0, anticoincident = 0;
+		for (int i=0; i<channels; i++)
+			{
+			all += c->all[i];
+			coincident += c->coincident[i];
+			anticoincident += c->anticoincident[i];
+			}
+		printf("%d,%s,%d,%llu,%llu,%llu,%llu,%llu,%llu,%llu\n",d,path[d],c->veto,(unsigned long long)c->intervals,
+				(unsigned long long)c->coincidentIntervals,(unsigned long long)c->vetoedIntervals,
+				(unsigned long long)c->dropped,(unsigned long long)all,(unsigned long long)coincident,
+				(unsigned long long)anticoincident);
+		if ( outBase )
+			{
+			char name[512];
+			FILE *out;
+			snprintf(name,sizeof(name),"%s%d.csv",outBase,d);
+			if ( !(out = fopen(name,"w")) )
+				{
+				printf("Cannot create %s\n",name);
+				continue;
+				}
+			fprintf(out,"channel,all,coincident,anticoincident\n");
+			for (int i=1; i<channels; i++)
+				fprintf(out,"%d,%llu,%llu,%llu\n",i,(unsigned long long)c->all[i],
+						(unsigned long long)c->coincident[i],(unsigned long long)c->anticoincident[i]);
+			fclose(out);
+			}
+		}
+	for (int d=0; d<files; d++)
+		{
+		fclose(f[d]);
+		delete next[d];
+		}
+	return( 0 );
+}
@@ -0,0 +1,744 @@
+///////////////////////////////////////////////////////////////////////////////////////////
+//  Headless acquisition daemon serving the protocol in mcaDaemon.h                      //
+//                                                                                       //
+//  Opens every MCA given on the command line once and keeps polling each on its own     //
+//  thread. Any number of local clients (capeMCAquery, scripts) connect to the Unix      //
+//  socket to list, zero, change the request code, snapshot or stream spectra without    //
+//  ever touching USB or the serial ports themselves. A device that keeps failing is     //
+//  reopened, USB ones from the endpoint cache given with -c. With -k the accumulators   //
+//  and running totals are checkpointed (see mcaCheckpoint.h) and picked up again by the //
+//  next daemon, which reconciles them with what each MCA counted in between.            //
+//                                                                                       //
+///////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "version.h"
+#include "mcaDaemon.h"
+#include "mcaTransport.h"
+#include "mcaCheckpoint.h"
+#include "mcaDeadTime.h"
+
+#define MAX_CLIENTS				64
+#define CLIENT_OUT_LIMIT		(8<<20)				// queued bytes before stream frames are dropped
+#define MAX_PENDING_ZEROS		16					// per client
+#define REOPEN_ERRORS			3					// consecutive failed readouts before reopening
+
+static char help[] = "CapeMCA Acquisition Daemon\n\n\
+Usage: capeMCAd [flags]\n\n\
+Flags:\n\
+  -S=/tmp/capemca.sock : Unix socket to serve (default)\n\
+  -p=/dev/ttyUSB0 : poll the MCA uart on this serial port, may be repeated\n\
+  -b=115200 : baud rate for serial ports (default)\n\
+  -u=1 : poll this many USB MCAs (libusb builds)\n\
+  -c=capemca.cache : USB endpoint cache to reconnect from, - for none (default capemca.cache)\n\
+  -s=1 : poll this many simulated MCAs (for testing)\n\
+  -q=34 : initial request type {0,1,2,4,8,16,32+1,32+2,32+4,32+8,32+16}\n\
+          (default the last one cached for the device, else 34)\n\
+  -i=1000 : milliseconds between readouts of each MCA\n\
+  -k=capemca.ckpt : checkpoint to resume from and keep up to date (files .0 and .1)\n\
+  -K=10 : seconds between checkpoints (default 10)\n\
+  -l=deadtime.cfg : dead-time models per capemcaId for corrected spectra (default: live time)\n\
+  -h : display this help message\n\
+  -v : print version info\n";
+
+class DaemonDevice {								// one MCA and its polling thread
+public:
+	char name[32];
+	McaTransport *transport;
+	McaSim *sim;									// simulated MCA is acquired before each read
+	int intervalMs;
+	pthread_t thread;
+	pthread_mutex_t mutex;							// guards latest, accumulator and counters
+	McaFrame latest;
+	ReadoutAccumulator accumulator;					// counts since the daemon started or zeroed it
+	DeadTimeCorrector deadTime;
+	CorrectedSpectrum corrected;					// the same, each interval dead-time corrected
+	DeviceTally tally;								// device counts since the run began
+	bool resumed;									// accumulator came from a checkpoint
+	uint64_t frames;
+	uint32_t errors;
+	uint32_t request;								// written by server thread, read atomically
+	uint32_t zeroRequested, zeroDone;				// zero requests issued and completed
+	bool zeroOk;
+
+	DaemonDevice()
+	{
+		memset(name,0,sizeof(name));
+		transport = NULL;
+		sim = NULL;
+		resumed = false;
+		frames = 0;
+		errors = 0;
+		zeroRequested = zeroDone = 0;
+		zeroOk = false;
+		pthread_mutex_init(&mutex,NULL);
+	}
+};
+
+typedef struct
+{
+	uint32_t tag;
+	uint16_t device;								// as requested, echoed in the reply
+	uint32_t mask;									// devices still to zero
+	uint32_t target[DAEMON_MAX_DEVICES];			// zeroDone value that completes each
+	bool ok;
+} PENDING_ZERO;
+
+typedef struct
+{
+	int fd;
+	uint8_t in[4096];								// partial requests
+	int inLength;
+	uint8_t *out;									// replies not yet sent
+	size_t outLength, outOffset, outAllocated;
+	uint32_t subscribed;							// device mask
+	uint32_t subscribeFlags[DAEMON_MAX_DEVICES];
+	uint32_t subscribeTag[DAEMON_MAX_DEVICES];
+	uint64_t dropped;								// stream frames over CLIENT_OUT_LIMIT
+	int pendingZeros;
+	PENDING_ZERO pending[MAX_PENDING_ZEROS];
+} CLIENT;
+
+static DaemonDevice *devices[DAEMON_MAX_DEVICES];
+static int deviceCount = 0;
+static CLIENT *clients[MAX_CLIENTS];
+static int notifyPipe[2] = { -1, -1 };				// device threads wake the server
+static volatile bool running = true;
+static Checkpoint checkpoint;
+static int checkpointMs = 10000;
+
+static void Stop( int signalNumber )
+{
+	running = false;
+}
+
+static void Notify( void )
+{
+	uint8_t b = 1;
+
+	if ( write(notifyPipe[1],&b,1) < 0 ) {}			// full pipe already wakes the server
+}
+
+////// device threads ///////////////////////////////////////////////////////////////////////////////
+
+static void *DeviceThread( void *arg )
+{
+	DaemonDevice *d = (DaemonDevice *)arg;
+	static __thread McaFrame frame;
+	uint32_t zeroTarget, failed = 0;
+	bool remembered = false, counted;
+	DEADTIME_RESULT rate;
+	int change;
+	double t;
+
+	while ( running )
+		{
+		zeroTarget = __atomic_load_n(&d->zeroRequested,__ATOMIC_ACQUIRE);
+		if ( zeroTarget != d->zeroDone )
+			{
+			bool ok = McaZero(d->transport);
+			pthread_mutex_lock(&d->mutex);
+			if ( ok )
+				{
+				d->accumulator.Clear();
+				d->corrected.Clear();
+				}
+			d->zeroOk = ok;
+			pthread_mutex_unlock(&d->mutex);
+			__atomic_store_n(&d->zeroDone,zeroTarget,__ATOMIC_RELEASE);
+			Notify();
+			}
+
+		if ( d->sim ) d->sim->Acquire(1);
+		if ( McaRequest(d->transport,__atomic_load_n(&d->request,__ATOMIC_RELAXED),&frame) )
+			{
+			pthread_mutex_lock(&d->mutex);
+			if ( d->resumed && frame.hasPacket0 && d->tally.state.capemcaId &&
+				 (d->tally.state.capemcaId != frame.packet0.capemcaId) )
+				{
+				printf("%s is now MCA %u, not %u, checkpoint dropped\n",d->name,frame.packet0.capemcaId,
+						d->tally.state.capemcaId);
+				d->tally.Clear();
+				d->accumulator.Clear();
+				d->corrected.Clear();
+				d->resumed = false;
+				}
+			change = d->tally.Update(frame);
+			counted = d->resumed && (change == TALLY_SAME);	// the checkpointed readout again
+			if ( change == TALLY_ZEROED )			// packet0 saw it even if no channel went down
+				{
+				if ( d->resumed ) printf("%s was zeroed or restarted while the daemon was down\n",d->name);
+				d->accumulator.lastChannels = 0;	// whole readout is new counts
+				d->corrected.lastChannels = 0;
+				}
+			d->resumed = false;
+			memcpy(&d->latest,&frame,sizeof(McaFrame));
+			if ( !counted ) d->accumulator.AddReadout(frame);	// restarts the sum if the resolution changed
+			d->corrected.Add(frame,d->deadTime.Correct(frame,&rate) ? &rate : NULL);
+			d->frames++;
+			pthread_mutex_unlock(&d->mutex);
+			Notify();
+			if ( !remembered ) d->transport->Remember();	// endpoints proven, note the id
+			remembered = true;
+			failed = 0;
+			}
+		else
+			{
+			pthread_mutex_lock(&d->mutex);
+			d->errors++;
+			pthread_mutex_unlock(&d->mutex);
+			if ( ++failed >= REOPEN_ERRORS )
+				{
+				t = MonotonicSeconds();
+				if ( d->transport->Reopen() )
+					{
+					printf("Reopened %s in %.1f ms\n",d->name,(MonotonicSeconds() - t)*1000.0);
+					remembered = false;
+					}
+				failed = 0;
+				}
+			}
+
+		for (int ms=0; running && (ms<d->intervalMs); ms+=10)	// zero requests cut the wait short
+			{
+			if ( __atomic_load_n(&d->zeroRequested,__ATOMIC_ACQUIRE) != d->zeroDone ) break;
+			usleep(10000);
+			}
+		}
+	return( NULL );
+}
+
+////// checkpoints ////////////////////////////////////////////////////////////////////////////////
+
+static void SaveCheckpoint( void )
+{
+	checkpoint.Begin();
+	for (int n=0; n<deviceCount; n++)				// each device is held only while copied
+		{
+		pthread_mutex_lock(&devices[n]->mutex);
+		devices[n]->tally.state.request = devices[n]->request;
+		checkpoint.Add(devices[n]->tally,devices[n]->accumulator,devices[n]->corrected);
+		pthread_mutex_unlock(&devices[n]->mutex);
+		}
+	checkpoint.Commit();
+}
+
+static void *CheckpointThread( void *arg )
+{
+	while ( running )
+		{
+		for (int ms=0; running && (ms<checkpointMs); ms+=100) usleep(100000);
+		if ( running ) SaveCheckpoint();
+		}
+	return( NULL );
+}
+
+static void Resume( int request )					// devices found in the checkpoint
+{
+	double t = MonotonicSeconds();
+	int resumed = 0;
+
+	if ( !checkpoint.Load(checkpoint.path) ) return;
+	for (int n=0; n<deviceCount; n++)
+		{
+		DaemonDevice *d = devices[n];
+		int k = checkpoint.Find(d->name);
+		if ( (k < 0) || !checkpoint.Restore(k,&d->tally,&d->accumulator,&d->corrected) ) continue;
+		memcpy(d->tally.state.name,d->name,sizeof(d->name));
+		d->latest.request = d->tally.state.request;
+		d->latest.channels = d->tally.state.lastChannels;
+		memcpy(d->latest.spectrum,d->tally.last,d->latest.channels*4);
+		d->latest.hasPacket0 = d->tally.state.hasPacket0;
+		d->latest.packet0 = d->tally.state.packet0;
+		if ( d->latest.hasPacket0 )					// next factor is for the intervals since then
+			{
+			DEADTIME_DEVICE *dt = d->deadTime.Device(d->latest.packet0.capemcaId);
+			if ( dt )
+				{
+				dt->previous = d->latest.packet0;
+				dt->havePrevious = true;
+				}
+			}
+		d->frames = d->tally.state.readouts;
+		if ( !request && ValidRequest(d->tally.state.request) ) d->request = d->tally.state.request;
+		d->resumed = true;
+		resumed++;
+		}
+	printf("Resumed %d of %d MCA from checkpoint %llu of %s in %.1f ms\n",resumed,deviceCount,
+			(unsigned long long)checkpoint.sequence,checkpoint.path,(MonotonicSeconds() - t)*1000.0);
+}
+
+////// replies //////////////////////////////////////////////////////////////////////////////////////
+
+static bool Reserve( CLIENT *c, size_t bytes )		// room for bytes more output
+{
+	if ( c->outOffset && (c->outOffset == c->outLength) ) c->outOffset = c->outLength = 0;
+	if ( c->outLength + bytes <= c->outAllocated ) return( true );
+	if ( c->outOffset )								// slide unsent bytes to the front
+		{
+		memmove(c->out,c->out+c->outOffset,c->outLength-c->outOffset);
+		c->outLength -= c->outOffset;
+		c->outOffset = 0;
+		if ( c->outLength + bytes <= c->outAllocated ) return( true );
+		}
+	size_t size = c->outAllocated ? c->outAllocated : 65536;
+	while ( size < c->outLength + bytes ) size *= 2;
+	uint8_t *grown = (uint8_t *)realloc(c->out,size);
+	if ( !grown ) return( false );
+	c->out = grown;
+	c->outAllocated = size;
+	return( true );
+}
+
+static void Append( CLIENT *c, const void *bytes, size_t length )	// after Reserve
+{
+	memcpy(c->out+c->outLength,bytes,length);
+	c->outLength += length;
+}
+
+static void Reply( CLIENT *c, const DAEMON_MESSAGE &request, uint32_t status, const void *payload = NULL, uint32_t length = 0 )
+{
+	DAEMON_MESSAGE m = request;
+
+	m.command = request.command | DAEMON_REPLY;
+	m.arg = status;
+	m.length = length;
+	if ( !Reserve(c,sizeof(m) + length) ) return;
+	Append(c,&m,sizeof(m));
+	if ( length ) Append(c,payload,length);
+}
+
+static void DeviceInfo( int n, DAEMON_DEVICE_INFO *info )	// caller holds the device mutex
+{
+	DaemonDevice *d = devices[n];
+
+	memset(info,0,sizeof(DAEMON_DEVICE_INFO));
+	info->capemcaId = d->latest.hasPacket0 ? d->latest.packet0.capemcaId : 0;
+	info->channels = d->latest.channels;
+	info->request = d->request;
+	info->errors = d->errors;
+	info->frames = d->frames;
+	info->hostTime = d->latest.hostTime;
+	memcpy(info->name,d->name,sizeof(info->name));	// both hold 31 characters at most
+}
+
+static void Snapshot( CLIENT *c, uint16_t command, int n, uint32_t tag, uint32_t flags )
+{												// SNAPSHOT reply or pushed FRAME
+	DaemonDevice *d = devices[n];
+	DAEMON_MESSAGE m;
+	DAEMON_DEVICE_INFO info;
+	uint32_t channels;
+
+	pthread_mutex_lock(&d->mutex);
+	channels = d->latest.channels;
+	m.command = command | DAEMON_REPLY;
+	m.device = n;
+	m.tag = tag;
+	m.arg = d->frames ? DAEMON_STATUS_OK : DAEMON_STATUS_NO_DATA;
+	m.length = sizeof(info) + sizeof(PACKET0_TYPE);
+	if ( flags & DAEMON_FLAG_LATEST ) m.length += channels*4;
+	if ( (flags & DAEMON_FLAG_ACCUMULATED) && (d->accumulator.channels == (int)channels) ) m.length += channels*8;
+	if ( (flags & DAEMON_FLAG_CORRECTED) && (d->corrected.channels == (int)channels) ) m.length += channels*8;
+	if ( Reserve(c,sizeof(m) + m.length) )
+		{
+		DeviceInfo(n,&info);
+		Append(c,&m,sizeof(m));
+		Append(c,&info,sizeof(info));
+		Append(c,&d->latest.packet0,sizeof(PACKET0_TYPE));
+		if ( flags & DAEMON_FLAG_LATEST ) Append(c,d->latest.spectrum,channels*4);
+		if ( (flags & DAEMON_FLAG_ACCUMULATED) && (d->accumulator.channels == (int)channels) )
+			Append(c,d->accumulator.sum,channels*8);
+		if ( (flags & DAEMON_FLAG_CORRECTED) && (d->corrected.channels == (int)channels) )
+			Append(c,d->corrected.sum,channels*8);
+		}
+	pthread_mutex_unlock(&d->mutex);
+}
+
+static uint32_t DeviceMask( uint16_t device )		// 0 if no such device
+{
+	if ( device == DAEMON_ALL_DEVICES ) return( deviceCount == 32 ? 0xFFFFFFFFU : (1U << deviceCount) - 1 );
+	return( device < deviceCount ? 1U << device : 0 );
+}
+
+static void Handle( CLIENT *c, const DAEMON_MESSAGE &m )
+{
+	uint32_t mask = DeviceMask(m.device);
+	DAEMON_DEVICE_INFO info[DAEMON_MAX_DEVICES];
+
+	switch (m.command)
+		{
+		case DAEMON_CMD_LIST:
+			for (int n=0; n<deviceCount; n++)
+				{
+				pthread_mutex_lock(&devices[n]->mutex);
+				DeviceInfo(n,&info[n]);
+				pthread_mutex_unlock(&devices[n]->mutex);
+				}
+			Reply(c,m,DAEMON_STATUS_OK,info,deviceCount*sizeof(DAEMON_DEVICE_INFO));
+			break;
+		case DAEMON_CMD_ZERO:
+			if ( !mask ) Reply(c,m,DAEMON_STATUS_BAD_DEVICE);
+			else if ( c->pendingZeros == MAX_PENDING_ZEROS ) Reply(c,m,DAEMON_STATUS_FAILED);
+			else
+				{
+				PENDING_ZERO *p = &c->pending[c->pendingZeros++];
+				p->tag = m.tag;
+				p->device = m.device;
+				p->mask = mask;
+				p->ok = true;
+				for (int n=0; n<deviceCount; n++)	// device threads zero at their next turn
+					if ( mask & (1U << n) )
+						p->target[n] = __atomic_add_fetch(&devices[n]->zeroRequested,1,__ATOMIC_RELEASE);
+				}
+			break;
+		case DAEMON_CMD_SET_REQUEST:
+			if ( !mask || (m.device == DAEMON_ALL_DEVICES) ) Reply(c,m,DAEMON_STATUS_BAD_DEVICE);
+			else if ( !ValidRequest(m.arg) ) Reply(c,m,DAEMON_STATUS_BAD_ARG);
+			else
+				{
+				__atomic_store_n(&devices[m.device]->request,m.arg,__ATOMIC_RELAXED);
+				Reply(c,m,DAEMON_STATUS_OK);
+				}
+			break;
+		case DAEMON_CMD_SNAPSHOT:
+			if ( !mask || (m.device == DAEMON_ALL_DEVICES) ) Reply(c,m,DAEMON_STATUS_BAD_DEVICE);
+			else Snapshot(c,DAEMON_CMD_SNAPSHOT,m.device,m.tag,m.arg);
+			break;
+		case DAEMON_CMD_SUBSCRIBE:
+			if ( !mask ) Reply(c,m,DAEMON_STATUS_BAD_DEVICE);
+			else
+				{
+				for (int n=0; n<deviceCount; n++)
+					if ( mask & (1U << n) )
+						{
+						c->subscribeFlags[n] = m.arg;
+						c->subscribeTag[n] = m.tag;
+						}
+				c->subscribed |= mask;
+				Reply(c,m,DAEMON_STATUS_OK);
+				}
+			break;
+		case DAEMON_CMD_UNSUBSCRIBE:
+			c->subscribed &= ~mask;
+			Reply(c,m,mask ? DAEMON_STATUS_OK : DAEMON_STATUS_BAD_DEVICE);
+			break;
+		default:
+			Reply(c,m,DAEMON_STATUS_BAD_COMMAND);
+		}
+}
+
+static void CompleteZeros( CLIENT *c )				// reply to zeros every device has done
+{
+	for (int i=0; i<c->pendingZeros; )
+		{
+		PENDING_ZERO *p = &c->pending[i];
+		for (int n=0; n<deviceCount; n++)
+			if ( (p->mask & (1U << n)) &&
+				 ((int32_t)(__atomic_load_n(&devices[n]->zeroDone,__ATOMIC_ACQUIRE) - p->target[n]) >= 0) )
+				{
+				pthread_mutex_lock(&devices[n]->mutex);
+				p->ok &= devices[n]->zeroOk;
+				pthread_mutex_unlock(&devices[n]->mutex);
+				p->mask &= ~(1U << n);
+				}
+		if ( p->mask )
+			{
+			i++;
+			continue;
+			}
+		DAEMON_MESSAGE m = { DAEMON_CMD_ZERO, p->device, p->tag, 0, 0 };
+		Reply(c,m,p->ok ? DAEMON_STATUS_OK : DAEMON_STATUS_FAILED);
+		*p = c->pending[--c->pendingZeros];
+		}
+}
+
+static void DropClient( int i )
+{
+	close(clients[i]->fd);
+	free(clients[i]->out);
+	delete clients[i];
+	clients[i] = NULL;
+}
+
+static bool ReadClient( CLIENT *c )					// false when the client went away
+{
+	ssize_t n;
+	int used = 0;
+	DAEMON_MESSAGE m;
+
+	n = recv(c->fd,c->in+c->inLength,sizeof(c->in)-c->inLength,0);
+	if ( (n < 0) && ((errno == EAGAIN) || (errno == EINTR)) ) return( true );
+	if ( n <= 0 ) return( false );
+	c->inLength += n;
+	while ( c->inLength - used >= (int)sizeof(m) )	// every complete request in the batch
+		{
+		memcpy(&m,c->in+used,sizeof(m));
+		if ( m.length ) return( false );			// requests carry no payload
+		Handle(c,m);
+		used += sizeof(m);
+		}
+	memmove(c->in,c->in+used,c->inLength-used);
+	c->inLength -= used;
+	return( true );
+}
+
+static bool WriteClient( CLIENT *c )
+{
+	ssize_t n;
+
+	while ( c->outOffset < c->outLength )
+		{
+		n = send(c->fd,c->out+c->outOffset,c->outLength-c->outOffset,MSG_NOSIGNAL | MSG_DONTWAIT);
+		if ( n < 0 ) return( (errno == EAGAIN) || (errno == EINTR) );
+		c->outOffset += n;
+		}
+	return( true );
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main( int argc, char * argv[] )
+{
+	bool usage = false;
+	char socketPath[108] = DAEMON_SOCKET_PATH;
+	const char *ports[DAEMON_MAX_DEVICES];
+	int portCount = 0, baudRate = 115200, usbCount = 0, simCount = 0, request = 0, intervalMs = 1000;
+	const char *cachePath = DEVICE_CACHE_PATH;
+	const char *deadTimeConfig = NULL;
+	static DeadTimeCorrector deadTime;				// copied to every device
+	DeviceCache *cache = NULL;
+	pthread_t checkpointThread;
+	uint64_t pushed[DAEMON_MAX_DEVICES];
+	struct sockaddr_un address;
+	int listenFd;
+
+	for (int i=1; i<argc; i++)						// parse command line
+		{
+		const char *value = (argv[i][0] == '-') && (argv[i][1] != 0) && (argv[i][2] == '=') ? argv[i]+3 : NULL;
+
+		if ( argv[i][0] != '-' )
+			{
+			usage = true;
+			continue;
+			}
+		switch (argv[i][1])
+			{
+			case 'S': if ( value ) strncpy(socketPath,value,sizeof(socketPath)-1); else usage = true; break;
+			case 'p':
+				if ( value && (portCount < DAEMON_MAX_DEVICES) ) ports[portCount++] = value;
+				else usage = true;
+				break;
+			case 'b': if ( value ) baudRate = atoi(value); else usage = true; break;
+			case 'u': if ( value ) usbCount = atoi(value); else usage = true; break;
+			case 'c': if ( value ) cachePath = value; else usage = true; break;
+			case 's': if ( value ) simCount = atoi(value); else usage = true; break;
+			case 'q': if ( value ) request = atoi(value); else usage = true; break;
+			case 'i': if ( value ) intervalMs = atoi(value); else usage = true; break;
+			case 'k': if ( value ) strncpy(checkpoint.path,value,sizeof(checkpoint.path)-1); else usage = true; break;
+			case 'K': if ( value ) checkpointMs = (int)(atof(value)*1000.0); else usage = true; break;
+			case 'l': if ( value ) deadTimeConfig = value; else usage = true; break;
+			case 'v':
+				printf("\nCapeMCA Acquisition Daemon %s\n\n",VERSION_STRING);
+				return( 0 );
+			default:
+				usage = true;
+			}
+		}
+	if ( (request && !ValidRequest(request)) || (intervalMs < 0) || (portCount + usbCount + simCount < 1) || (checkpointMs < 100) ||
+		 (portCount + usbCount + simCount > DAEMON_MAX_DEVICES) ) usage = true;
+	if ( usage )
+		{
+		printf("%s",help);
+		return( 1 );
+		}
+	if ( deadTimeConfig && !deadTime.LoadConfig(deadTimeConfig) ) return( 1 );
+
+////////////////////////// Open devices /////////////////////////////////////////////////////////////////////////////////
+
+	for (int n=0; n<portCount; n++)
+		{
+		UartTransport *uart = new UartTransport;
+		if ( !uart->Open(ports[n],baudRate) )
+			{
+			delete uart;
+			continue;
+			}
+		devices[deviceCount] = new DaemonDevice;
+		devices[deviceCount]->transport = uart;
+		strncpy(devices[deviceCount]->name,ports[n],sizeof(devices[0]->name)-1);
+		deviceCount++;
+		}
+	if ( usbCount && strcmp(cachePath,"-") )
+		{
+		cache = new DeviceCache;
+		cache->Load(cachePath);
+		}
+#ifdef HAVE_LIBUSB
+	for (int n=0; n<usbCount; n++)
+		{
+		UsbTransport *usb = new UsbTransport;
+		double t = MonotonicSeconds();
+		if ( !usb->Open(n,cache) )
+			{
+			delete usb;
+			break;
+			}
+		devices[deviceCount] = new DaemonDevice;
+		devices[deviceCount]->transport = usb;
+		snprintf(devices[deviceCount]->name,sizeof(devices[0]->name),"usb %s",usb->serial);
+		printf("Opened %s at %s in %.1f ms%s\n",devices[deviceCount]->name,usb->port,(MonotonicSeconds() - t)*1000.0,
+				usb->cached ? " from cache" : "");
+		deviceCount++;
+		}
+	if ( cache ) cache->Save();
+#else
+	if ( usbCount ) printf("This build has no libusb support.\n");
+#endif
+	for (int n=0; n<simCount; n++)
+		{
+		McaSim *sim = new McaSim(n+1,n+1);
+		devices[deviceCount] = new DaemonDevice;
+		devices[deviceCount]->sim = sim;
+		devices[deviceCount]->transport = new SimTransport(sim,64);
+		snprintf(devices[deviceCount]->name,sizeof(devices[0]->name),"simulator %d",n+1);
+		deviceCount++;
+		}
+	if ( !deviceCount )
+		{
+		printf("No MCA connected.\n");
+		return( 1 );
+		}
+
+////////////////////////// Serve ////////////////////////////////////////////////////////////////////////////////////////
+
+	listenFd = socket(AF_UNIX,SOCK_STREAM,0);
+	memset(&address,0,sizeof(address));
+	address.sun_family = AF_UNIX;
+	memcpy(address.sun_path,socketPath,sizeof(address.sun_path));
+	unlink(socketPath);								// left over from a daemon that crashed
+	if ( (listenFd < 0) || (bind(listenFd,(struct sockaddr *)&address,sizeof(address)) < 0) ||
+		 (listen(listenFd,16) < 0) || (pipe(notifyPipe) < 0) )
+		{
+		printf("Cannot serve %s: %s\n",socketPath,strerror(errno));
+		return( 1 );
+		}
+	fcntl(listenFd,F_SETFL,O_NONBLOCK);
+	fcntl(notifyPipe[0],F_SETFL,O_NONBLOCK);
+	fcntl(notifyPipe[1],F_SETFL,O_NONBLOCK);
+	signal(SIGINT,Stop);
+	signal(SIGTERM,Stop);
+	signal(SIGPIPE,SIG_IGN);
+
+	for (int n=0; n<deviceCount; n++)
+		{
+		devices[n]->request = request ? request : (devices[n]->transport->lastRequest ? devices[n]->transport->lastRequest : 34);
+		devices[n]->intervalMs = intervalMs;
+		devices[n]->deadTime = deadTime;
+		memcpy(devices[n]->tally.state.name,devices[n]->name,sizeof(devices[n]->name));
+		}
+	if ( checkpoint.path[0] ) Resume(request);
+	for (int n=0; n<deviceCount; n++)
+		{
+		pushed[n] = 0;
+		pthread_create(&devices[n]->thread,NULL,DeviceThread,devices[n]);
+		printf("Polling %s\n",devices[n]->name);
+		}
+	if ( checkpoint.path[0] ) pthread_create(&checkpointThread,NULL,CheckpointThread,NULL);
+	printf("Serving %d MCA on %s\n",deviceCount,socketPath);
+
+	while ( running )
+		{
+		struct pollfd fds[MAX_CLIENTS+2];
+		int owner[MAX_CLIENTS+2], nfds = 2;
+
+		fds[0].fd = listenFd;
+		fds[0].events = POLLIN;
+		fds[1].fd = notifyPipe[0];
+		fds[1].events = POLLIN;
+		for (int i=0; i<MAX_CLIENTS; i++)
+			if ( clients[i] )
+				{
+				fds[nfds].fd = clients[i]->fd;
+				fds[nfds].events = POLLIN | (clients[i]->outOffset < clients[i]->outLength ? POLLOUT : 0);
+				owner[nfds++] = i;
+				}
+		if ( poll(fds,nfds,500) < 0 ) continue;		// EINTR from the stop signal
+
+		if ( fds[1].revents & POLLIN )				// new readouts or finished zeros
+			{
+			uint8_t drain[256];
+			while ( read(notifyPipe[0],drain,sizeof(drain)) > 0 ) {}
+			for (int n=0; n<deviceCount; n++)
+				{
+				uint64_t frames = __atomic_load_n(&devices[n]->frames,__ATOMIC_RELAXED);
+				if ( frames == pushed[n] ) continue;
+				pushed[n] = frames;
+				for (int i=0; i<MAX_CLIENTS; i++)
+					if ( clients[i] && (clients[i]->subscribed & (1U << n)) )
+						{
+						if ( clients[i]->outLength - clients[i]->outOffset > CLIENT_OUT_LIMIT ) clients[i]->dropped++;
+						else Snapshot(clients[i],DAEMON_CMD_FRAME,n,clients[i]->subscribeTag[n],clients[i]->subscribeFlags[n]);
+						}
+				}
+			for (int i=0; i<MAX_CLIENTS; i++)
+				if ( clients[i] && clients[i]->pendingZeros ) CompleteZeros(clients[i]);
+			}
+
+		if ( fds[0].revents & POLLIN )				// new clients
+			{
+			int fd;
+			while ( (fd = accept(listenFd,NULL,NULL)) >= 0 )
+				{
+				int i;
+				for (i=0; (i<MAX_CLIENTS) && clients[i]; i++) {}
+				if ( i == MAX_CLIENTS )
+					{
+					close(fd);
+					continue;
+					}
+				fcntl(fd,F_SETFL,O_NONBLOCK);
+				clients[i] = new CLIENT;
+				memset(clients[i],0,sizeof(CLIENT));
+				clients[i]->fd = fd;
+				}
+			}
+
+		for (int k=2; k<nfds; k++)					// requests and pending output
+			{
+			CLIENT *c = clients[owner[k]];
+			bool alive = true;
+			if ( fds[k].revents & (POLLIN | POLLHUP | POLLERR) ) alive = ReadClient(c);
+			if ( alive ) alive = WriteClient(c);
+			if ( !alive ) DropClient(owner[k]);
+			}
+		}
+
+	printf("Stopping\n");
+	for (int n=0; n<deviceCount; n++) pthread_join(devices[n]->thread,NULL);
+	if ( checkpoint.path[0] )						// final state for the next daemon
+		{
+		pthread_join(checkpointThread,NULL);
+		SaveCheckpoint();
+		printf("Checkpoint %llu written in %.1f ms\n",(unsigned long long)checkpoint.sequence,checkpoint.commitSeconds*1000.0);
+		}
+	for (int i=0; i<MAX_CLIENTS; i++)
+		if ( clients[i] ) DropClient(i);
+	for (int n=0; n<deviceCount; n++)
+		{
+		devices[n]->transport->Remember();			// last request in use and capemcaId
+		devices[n]->transport->Close();
+		}
+	if ( cache ) cache->Save();
+	close(listenFd);
+	unlink(socketPath);
+	return( 0 );
+}
@@ -0,0 +1,160 @@
+///////////////////////////////////////////////////////////////////////////////////////////
+//  Fit peaks in every interval of a binary frame file (capeMCAreplay -o=frames.bin)     //
+//                                                                                       //
+//  Each -w= window is fitted in each interval spectrum (difference of consecutive       //
+//  cumulative readouts) on the FitPool threads, starting from the previous interval's   //
+//  solution. Output is one CSV line per interval and window.                            //
+//                                                                                       //
+///////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "version.h"
+#include "mcaFit.h"
+#include "mcaOutput.h"
+
+#define MAX_WINDOWS		64
+
+static char help[] = "CapeMCA Peak Fit\n\n\
+Usage: capeMCAfit [flags] frames.bin\n\n\
+Flags:\n\
+  -w=lo:hi : fit window of channels [lo,hi), may be repeated (required)\n\
+  -t : include low-side exponential tail in the model\n\
+  -q=1 : background polynomial order -1 (none), 0, 1 or 2 (default 1)\n\
+  -c : fit only the last readout (all counts since the MCA was zeroed)\n\
+  -j=0 : number of threads, 0 = one per cpu (default)\n\
+  -h : display this help message\n\
+  -v : print version info\n";
+
+int main( int argc, char * argv[] )
+{
+	bool usage = false, cumulative = false;
+	char *path = NULL;
+	int windows = 0, lo[MAX_WINDOWS], hi[MAX_WINDOWS], threads = 0, intervalNumber = 0;
+	PEAK_MODEL model = { false, 1 };
+	static PEAK_FIT fit[MAX_WINDOWS];
+	FIT_JOB job[MAX_WINDOWS];
+	static McaFrame frame;
+	static uint32_t previous[MAX_SPECTRUM_SIZE], interval[MAX_SPECTRUM_SIZE];
+	static double counts[MAX_SPECTRUM_SIZE];
+	int previousChannels = 0;
+	FILE *f;
+
+	for (int i=1; i<argc; i++)						// parse command line
+		{
+		if ( argv[i][0] != '-' )
+			{
+			path = argv[i];
+			continue;
+			}
+		switch (argv[i][1])
+			{
+			case 'w':
+				if ( (argv[i][2] == '=') && (windows < MAX_WINDOWS) &&
+					 (sscanf(argv[i]+3,"%d:%d",&lo[windows],&hi[windows]) == 2) &&
+					 (lo[windows] >= 0) && (hi[windows] > lo[windows]) ) windows++;
+				else usage = true;
+				break;
+			case 't':
+				model.tail = true;
+				break;
+			case 'q':
+				if ( argv[i][2] == '=' ) model.background = atoi(argv[i]+3);
+				else usage = true;
+				if ( (model.background < -1) || (model.background > 2) ) usage = true;
+				break;
+			case 'c':
+				cumulative = true;
+				break;
+			case 'j':
+				if ( argv[i][2] == '=' ) threads = atoi(argv[i]+3);
+				else usage = true;
+				break;
+			case 'v':
+				printf("\nCapeMCA Peak Fit %s\n\n",VERSION_STRING);
+				return( 0 );
+			default:
+				usage = true;
+			}
+		}
+	if ( !path || (windows == 0) ) usage = true;
+	if ( usage )
+		{
+		printf("%s",help);
+		return( 1 );
+		}
+	if ( !(f = fopen(path,"rb")) )
+		{
+		printf("Cannot open %s\n",path);
+		return( 1 );
+		}
+
+	FitPool pool(threads);
+	memset(fit,0,sizeof(fit));						// no previous solutions yet
+	printf("interval,window,centroid,centroidError,fwhm,fwhmError,area,areaError,chi2PerDof,iterations,converged\n");
+
+	while ( ReadFrameBinary(f,&frame) )
+		{
+		if ( !frame.channels ) continue;
+		if ( cumulative )
+			{
+			memcpy(previous,frame.spectrum,frame.channels*4);	// fitted once at end of file
+			previousChannels = frame.channels;
+			continue;
+			}
+		if ( previousChannels != frame.channels )
+			{
+			memcpy(previous,frame.spectrum,frame.channels*4);	// first readout primes the difference
+			previousChannels = frame.channels;
+			continue;
+			}
+		IntervalSpectrum(frame.spectrum,previous,interval,frame.channels);
+		memcpy(previous,frame.spectrum,frame.channels*4);
+		for (int i=0; i<frame.channels; i++) counts[i] = interval[i];
+
+		int n = 0;
+		for (int w=0; w<windows; w++)
+			if ( hi[w] <= frame.channels )
+				{
+				job[n].spectrum = counts;
+				job[n].lo = lo[w];
+				job[n].hi = hi[w];
+				job[n].model = model;
+				job[n].fit = &fit[w];
+				n++;
+				}
+		pool.Run(job,n);
+
+		for (int w=0; w<n; w++)
+			if ( job[w].ok )
+				printf("%d,%d,%.4f,%.4f,%.4f,%.4f,%.1f,%.1f,%.4f,%d,%d\n",intervalNumber,(int)(job[w].fit - fit),
+						job[w].fit->centroid,job[w].fit->centroidError,job[w].fit->fwhm,job[w].fit->fwhmError,job[w].fit->area,
+						job[w].fit->areaError,job[w].fit->chi2/job[w].fit->dof,job[w].fit->iterations,job[w].fit->converged);
+		intervalNumber++;
+		}
+	fclose(f);
+
+	if ( cumulative && previousChannels )			// single fit of the whole run
+		{
+		int n = 0;
+		for (int i=0; i<previousChannels; i++) counts[i] = previous[i];
+		for (int w=0; w<windows; w++)
+			if ( hi[w] <= previousChannels )
+				{
+				job[n].spectrum = counts;
+				job[n].lo = lo[w];
+				job[n].hi = hi[w];
+				job[n].model = model;
+				job[n].fit = &fit[w];
+				n++;
+				}
+		pool.Run(job,n);
+		for (int w=0; w<n; w++)
+			if ( job[w].ok )
+				printf("all,%d,%.4f,%.4f,%.4f,%.4f,%.1f,%.1f,%.4f,%d,%d\n",(int)(job[w].fit - fit),
+						job[w].fit->centroid,job[w].fit->centroidError,job[w].fit->fwhm,job[w].fit->fwhmError,job[w].fit->area,
+						job[w].fit->areaError,job[w].fit->chi2/job[w].fit->dof,job[w].fit->iterations,job[w].fit->converged);
+		}
+	return( 0 );
+}
@@ -0,0 +1,119 @@
+///////////////////////////////////////////////////////////////////////////////////////////
+//  Identify lines and sources in recorded spectra (see mcaIdentify.h)                   //
+//                                                                                       //
+//  Each argument is a binary frame file of one detector (capeMCAreplay -o=frames.bin).  //
+//  Every interval spectrum, or with -a the whole file, is scored against the template   //
+//  library and the best -k candidates are printed.                                      //
+//                                                                                       //
+///////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "version.h"
+#include "mcaIdentify.h"
+#include "mcaOutput.h"
+
+static char help[] = "CapeMCA Identification\n\n\
+Usage: capeMCAid [flags] detector0.bin ...\n\n\
+Flags:\n\
+  -l=library.txt : template library, lines of \"name channel:sigma[:intensity] ...\"\n\
+                   (4096-channel units) or \"name @template.csv\"\n\
+  -k=5 : candidates per spectrum (default 5)\n\
+  -m=3 : least significance to report (default 3)\n\
+  -a : score the last readout of each file instead of every interval\n\
+  -h : display this help message\n\
+  -v : print version info\n";
+
+static void PrintTop( IdentifyLibrary &library, const char *path, double hostTime, int found, const IDENTIFY_CANDIDATE *top )
+{
+	for (int n=0; n<found; n++)
+		printf("%s,%.6f,%d,%s,%.2f,%.1f\n",path,hostTime,n+1,library.entry[top[n].index].name,top[n].score,
+				top[n].amplitude);
+}
+
+int main( int argc, char * argv[] )
+{
+	bool usage = false, whole = false;
+	char *libraryPath = NULL;
+	int k = 5, files = 0, found;
+	float minScore = 3.0f;
+	static IdentifyLibrary library;
+	static McaFrame frame, previous;
+	static uint32_t interval[MAX_SPECTRUM_SIZE];
+	IDENTIFY_CANDIDATE top[IDENTIFY_MAX_TOP];
+	uint64_t spectra = 0;
+	double t = 0.0, t0;
+
+	for (int i=1; i<argc; i++)						// parse command line
+		{
+		const char *value = (argv[i][0] == '-') && (argv[i][1] != 0) && (argv[i][2] == '=') ? argv[i]+3 : NULL;
+
+		if ( argv[i][0] != '-' )
+			{
+			files++;
+			continue;
+			}
+		switch (argv[i][1])
+			{
+			case 'l': if ( value ) libraryPath = (char *)value; else usage = true; break;
+			case 'k': if ( value ) k = atoi(value); else usage = true; break;
+			case 'm': if ( value ) minScore = atof(value); else usage = true; break;
+			case 'a': whole = true; break;
+			case 'v':
+				printf("\nCapeMCA Identification %s\n\n",VERSION_STRING);
+				return( 0 );
+			default:
+				usage = true;
+			}
+		}
+	if ( !libraryPath || !files || (k < 1) || (k > IDENTIFY_MAX_TOP) ) usage = true;
+	if ( usage )
+		{
+		printf("%s",help);
+		return( 1 );
+		}
+	if ( !library.Load(libraryPath) ) return( 1 );
+	printf("file,hostTime,rank,name,score,amplitude\n");
+
+	for (int i=1; i<argc; i++)
+		{
+		FILE *f;
+		bool havePrevious = false;
+		if ( argv[i][0] == '-' ) continue;
+		if ( !(f = fopen(argv[i],"rb")) )
+			{
+			printf("Cannot open %s\n",argv[i]);
+			return( 1 );
+			}
+		while ( ReadFrameBinary(f,&frame) )
+			{
+			if ( !frame.channels ) continue;
+			if ( !whole && havePrevious && (previous.channels == frame.channels) )
+				{
+				if ( !IntervalSpectrum(frame.spectrum,previous.spectrum,interval,frame.channels) )
+					memcpy(interval,frame.spectrum,frame.channels*sizeof(uint32_t));	// zeroed since
+				t0 = MonotonicSeconds();
+				found = library.Score(interval,frame.channels,k,top,minScore);
+				t += MonotonicSeconds() - t0;
+				spectra++;
+				PrintTop(library,argv[i],frame.hostTime,found,top);
+				}
+			previous = frame;
+			havePrevious = true;
+			}
+		fclose(f);
+		if ( whole && havePrevious )				// cumulative since the last zero
+			{
+			t0 = MonotonicSeconds();
+			found = library.Score(previous.spectrum,previous.channels,k,top,minScore);
+			t += MonotonicSeconds() - t0;
+			spectra++;
+			PrintTop(library,argv[i],previous.hostTime,found,top);
+			}
+		}
+	printf("%llu spectra, %d templates, %llu of %llu scores pruned, %.0f templates/s\n",(unsigned long long)spectra,
+			library.templates,(unsigned long long)library.pruned,(unsigned long long)library.scored,
+			t > 0.0 ? library.scored/t : 0.0);
+	return( 0 );
+}
@@ -0,0 +1,168 @@
+///////////////////////////////////////////////////////////////////////////////////////////
+//  Multi-band light curves of one or more detectors (see mcaLightCurve.h)               //
+//                                                                                       //
+//  Each argument is a binary frame file (capeMCAreplay -o=frames.bin). Readouts of all  //
+//  files are merged in hostTime order and the live-time normalized rate of every band  //
+//  is printed per interval and detector, and kept in a light curve store with -o.      //
+//  -r prints a store written earlier. -c adds "change," lines for rate change points    //
+//  found online in every band (see mcaChange.h).                                        //
+//                                                                                       //
+///////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "version.h"
+#include "mcaChange.h"
+#include "mcaLightCurve.h"
+#include "mcaOutput.h"
+
+#define MAX_FILES		64
+
+static char help[] = "CapeMCA Light Curves\n\n\
+Usage: capeMCAlight [flags] detector0.bin detector1.bin ...\n\n\
+Flags:\n\
+  -b=name:lo:hi : band of 4096-channel units [lo,hi), widened to multiples of 16,\n\
+                  may be repeated (default\n\
+                  soft:16:512 mid:512:1536 hard:1536:4096 range:range)\n\
+  -b=name:range : band of packet0 countInRangeArray\n\
+  -o=curves.lc : also write the light curve store\n\
+  -r=curves.lc : print a light curve store instead of reading frame files\n\
+  -c=8 : report rate changes with at least this log-likelihood ratio\n\
+  -x=1.5 : smallest rate step looked for by -c (default 1.5)\n\
+  -q : no rates on the console, only the summary and changes\n\
+  -h : display this help message\n\
+  -v : print version info\n";
+
+static void PrintHeader( int bands, const LIGHT_BAND *band )
+{
+	printf("hostTime,capemcaId,realTime,liveTime");
+	for (int k=0; k<bands; k++) printf(",%sCps",band[k].name);
+	printf("\n");
+}
+
+static void PrintRecord( int bands, const LIGHT_RECORD_HEADER &record, const uint32_t *counts )
+{
+	printf("%.6f,%u,%.6f,%.6f",record.hostTime,record.capemcaId,record.realTime,record.liveTime);
+	for (int k=0; k<bands; k++) printf(",%.3f",record.liveTime > 0.0f ? counts[k]/record.liveTime : 0.0);
+	printf("\n");
+}
+
+int main( int argc, char * argv[] )
+{
+	bool usage = false, quiet = false;
+	char *path[MAX_FILES], *storePath = NULL, *readPath = NULL;
+	int files = 0;
+	static LightCurve curve;
+	LIGHT_RECORD_HEADER record;
+	uint32_t counts[LIGHT_MAX_BANDS];
+	FILE *f[MAX_FILES];
+	McaFrame *next[MAX_FILES];
+	uint32_t id[MAX_FILES];
+	bool pending[MAX_FILES];
+	uint64_t frames = 0, intervals = 0;
+	double t;
+	static ChangeDetector detector;
+	CHANGE_POINT changes[LIGHT_MAX_BANDS];
+	bool findChanges = false;
+	int found;
+
+	for (int i=1; i<argc; i++)						// parse command line
+		{
+		const char *value = (argv[i][0] == '-') && (argv[i][1] != 0) && (argv[i][2] == '=') ? argv[i]+3 : NULL;
+
+		if ( argv[i][0] != '-' )
+			{
+			if ( files < MAX_FILES ) path[files++] = argv[i];
+			else usage = true;
+			continue;
+			}
+		switch (argv[i][1])
+			{
+			case 'b': if ( !value || !curve.ParseBand(value) ) usage = true; break;
+			case 'o': if ( value ) storePath = (char *)value; else usage = true; break;
+			case 'r': if ( value ) readPath = (char *)value; else usage = true; break;
+			case 'q': quiet = true; break;
+			case 'c':
+				if ( value && ((detector.params.threshold = atof(value)) > 0.0) ) findChanges = true;
+				else usage = true;
+				break;
+			case 'x': if ( !value || ((detector.params.ratio = atof(value)) <= 1.0) ) usage = true; break;
+			case 'v':
+				printf("\nCapeMCA Light Curves %s\n\n",VERSION_STRING);
+				return( 0 );
+			default:
+				usage = true;
+			}
+		}
+	if ( readPath ? files > 0 : files < 1 ) usage = true;
+	if ( usage )
+		{
+		printf("%s",help);
+		return( 1 );
+		}
+
+	if ( readPath )									// print a store
+		{
+		FILE *in;
+		LIGHT_FILE_HEADER header;
+		if ( !OpenLightStore(readPath,&in,&header) ) return( 1 );
+		PrintHeader(header.bands,header.band);
+		while ( ReadLightRecord(in,header,&record,counts) ) PrintRecord(header.bands,record,counts);
+		fclose(in);
+		return( 0 );
+		}
+
+	if ( !curve.bands ) curve.DefaultBands();
+	for (int d=0; d<files; d++)
+		{
+		if ( !(f[d] = fopen(path[d],"rb")) )
+			{
+			printf("Cannot open %s\n",path[d]);
+			return( 1 );
+			}
+		next[d] = new McaFrame;
+		pending[d] = ReadFrameBinary(f[d],next[d]);
+		id[d] = d;									// file order until a packet0 names the detector
+		}
+	if ( storePath && !curve.Create(storePath) ) return( 1 );
+	if ( !quiet ) PrintHeader(curve.bands,curve.band);
+	if ( findChanges ) printf("change,capemcaId,band,direction,onsetTime,alarmTime,sigma,cpsBefore,cpsAfter\n");
+
+	t = MonotonicSeconds();
+	for (;;)										// merge readouts in time order
+		{
+		int first = -1;
+		for (int d=0; d<files; d++)
+			if ( pending[d] && ((first < 0) || (next[d]->hostTime < next[first]->hostTime)) ) first = d;
+		if ( first < 0 ) break;
+		frames++;
+		if ( next[first]->hasPacket0 ) id[first] = next[first]->packet0.capemcaId;
+		if ( curve.Process(id[first],*next[first],&record,counts) )
+			{
+			intervals++;
+			if ( !quiet ) PrintRecord(curve.bands,record,counts);
+			if ( findChanges && (found = detector.Update(record,counts,curve.bands,changes)) )
+				for (int c=0; c<found; c++)
+					printf("change,%u,%s,%s,%.6f,%.6f,%.1f,%.1f,%.1f\n",changes[c].capemcaId,curve.band[changes[c].band].name,
+							changes[c].direction > 0 ? "up" : "down",changes[c].onsetTime,changes[c].alarmTime,
+							changes[c].significance,changes[c].rateBefore,changes[c].rateAfter);
+			if ( storePath && !curve.Append(record,counts) )
+				{
+				printf("Cannot write %s\n",storePath);
+				return( 1 );
+				}
+			}
+		pending[first] = ReadFrameBinary(f[first],next[first]);
+		}
+	t = MonotonicSeconds() - t;
+	curve.Close();
+
+	printf("%llu frames, %llu intervals, %d bands, %d detectors, %.1f us per frame\n",(unsigned long long)frames,
+			(unsigned long long)intervals,curve.bands,curve.devices,frames ? t/frames*1.0e6 : 0.0);
+	if ( storePath )
+		printf("%llu records, %llu bytes in %s\n",(unsigned long long)curve.records,
+				(unsigned long long)(sizeof(LIGHT_FILE_HEADER) + curve.records*(sizeof(LIGHT_RECORD_HEADER) + 4*curve.bands)),
+				storePath);
+	return( 0 );
+}
@@ -18,7 +18,9 @@
 // Compile:
 // $ gcc -o capeMCA capeMCAlinux.c `pkg-config --libs --cflags libusb-1.0`
 // Run:
-//   $ ./capeMCA
+//   $ ./capeMCA            read packet0 from every MCA that is plugged in
+//   $ ./capeMCA -d         also dump every configuration descriptor first
+//   $ ./capeMCA -w=10      wait up to 10 seconds for an MCA to enumerate
 //
 // For Documentation on libusb see:
 //   http://libusb.sourceforge.io/api-1.0/index.html
@@ -28,6 +30,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <memory.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 // here the libusb is in the folder with this program so
 #include <libusb.h>
 //change this if your libusb.h is somewhere else, e.g.
@@ -91,6 +96,65 @@ void print_configuration(struct libusb_config_descriptor *config)
 		print_interface(&config->interface[i]);
 }
 
+double now_seconds( void )								// monotonic clock for start up timing
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return( ts.tv_sec + ts.tv_nsec*1.0e-9 );
+}
+
+static int arrived = 0;
+
+int LIBUSB_CALL hotplug_arrived( libusb_context *ctx, libusb_device *dev, libusb_hotplug_event event, void *user_data )
+{
+	arrived = 1;
+	return 0;											// keep the callback registered
+}
+
+int count_mca( void )									// number of MCA devices enumerated now
+{
+	libusb_device **list;
+	struct libusb_device_descriptor d;
+	ssize_t n, k;
+	int found = 0;
+
+	n = libusb_get_device_list(NULL, &list);
+	for (k = 0; k < n; k++)
+		if ( !libusb_get_device_descriptor(list[k], &d) &&
+			 (d.idVendor == USB_VENDOR_ID) && (d.idProduct == USB_PRODUCT_ID) ) found++;
+	if ( n >= 0 ) libusb_free_device_list(list, 1);
+	return found;
+}
+
+void wait_for_mca( double seconds )						// return once an MCA enumerates or time is up
+{
+	libusb_hotplug_callback_handle callback;
+	struct timeval tv = { 0, 100000 };
+	double deadline = now_seconds() + seconds;
+	int hotplug;
+
+	if ( count_mca() ) return;
+	printf("Waiting up to %g s for an MCA to enumerate...\n",seconds);
+	hotplug = libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG) &&
+		(libusb_hotplug_register_callback(NULL, LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED, 0, USB_VENDOR_ID,
+				USB_PRODUCT_ID, LIBUSB_HOTPLUG_MATCH_ANY, hotplug_arrived, NULL, &callback) == LIBUSB_SUCCESS);
+	while ( now_seconds() < deadline )
+		{
+		if ( hotplug )									// woken by the arrival event
+			{
+			libusb_handle_events_timeout_completed(NULL, &tv, &arrived);
+			if ( arrived ) break;
+			}
+		else											// no hotplug support, poll the bus
+			{
+			if ( count_mca() ) break;
+			usleep(20000);
+			}
+		}
+	if ( hotplug ) libusb_hotplug_deregister_callback(NULL, callback);
+}
+
 void print_packet0( PACKET0_TYPE pkt0 )
 {
 	printf("    cps:                     %g\n",pkt0.cps);
@@ -123,6 +187,19 @@ int main(int argc, char **argv)
 	PACKET0_TYPE packet0;
 	unsigned char allBytes[sizeof(PACKET0_TYPE)];
 	unsigned char cmd[2] = {0, 0};
+	int dump = 0, first = 1;
+	double waitSeconds = 0, start = now_seconds();
+
+	for (i = 1; i < argc; i++)							// parse command line
+		{
+		if ( !strcmp(argv[i],"-d") ) dump = 1;
+		else if ( !strncmp(argv[i],"-w=",3) ) waitSeconds = atof(argv[i]+3);
+		else
+			{
+			printf("Usage: capeMCA [-d] [-w=seconds]\n");
+			return 1;
+			}
+		}
 
 														// initalize the libusb library
 	printf("Initializing libusb...\n");
@@ -133,6 +210,8 @@ int main(int argc, char **argv)
 		goto abortmain;
 		}
 
+	if ( waitSeconds > 0 ) wait_for_mca(waitSeconds);
+
 	cnt = libusb_get_device_list(NULL, &devs);			// list of MCA devices that are plugged in
 	if ( cnt < 0 )
 		{
@@ -161,7 +240,7 @@ int main(int argc, char **argv)
 				if ( err > 0 ) printf("%s",string);
 				}
 			printf("\n");								// show details about USB configuration...
-			for (j = 0; j < desc.bNumConfigurations; j++)
+			for (j = 0; dump && (j < desc.bNumConfigurations); j++)
 				{
 				err= libusb_get_config_descriptor(dev, j, &config);
 				if ( err < 0 ) {
@@ -196,6 +275,11 @@ int main(int argc, char **argv)
 					{
 					printf("  Read %d bytes from endpoint %d\n",bytesRead,0x81);
 					memcpy(&packet0,allBytes,sizeof(packet0));
+					if ( first && (bytesRead == sizeof(PACKET0_TYPE)) )
+						{
+						printf("  First valid frame %.1f ms after start\n",(now_seconds() - start)*1000.0);
+						first = 0;
+						}
 					print_packet0(packet0);
 					}
 				}
@@ -0,0 +1,171 @@
+///////////////////////////////////////////////////////////////////////////////////////////
+//  Poll many serial MCAs from one thread (see mcaUartEngine.h)                          //
+//                                                                                       //
+//  Every -p port, and every simulated MCA served on a pty with -s, is asked for -q      //
+//  each -i milliseconds, or back to back with -i=0. With -o each port's frames go to    //
+//  its own binary frame file (prefix0.bin, prefix1.bin, ...) for the offline tools.     //
+//  Per-port and aggregate throughput are printed at the end.                            //
+//                                                                                       //
+///////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include "version.h"
+#include "mcaOutput.h"
+#include "mcaSim.h"
+#include "mcaUartEngine.h"
+
+static char help[] = "CapeMCA Multi-port Serial Poller\n\n\
+Usage: capeMCAports [flags]\n\n\
+Flags:\n\
+  -p=/dev/ttyUSB0 : poll the MCA uart on this serial port, may be repeated\n\
+  -b=115200 : baud rate for serial ports (default)\n\
+  -s=4 : also poll this many simulated MCAs on ptys (for testing)\n\
+  -q=34 : request type {0,1,2,4,8,16,32+1,32+2,32+4,32+8,32+16}\n\
+  -i=1000 : milliseconds between requests to each port, 0 for back to back\n\
+  -t=1000 : milliseconds of silence before a response is given up (default 1000)\n\
+  -n=10 : seconds to poll (default 10), stops early on Ctrl-C\n\
+  -o=frames : write prefix0.bin, prefix1.bin, ... per port\n\
+  -S : write -o records as deltas on the previous readout where that is smaller\n\
+  -h : display this help message\n\
+  -v : print version info\n";
+
+static volatile bool running = true;
+static FILE *out[UART_ENGINE_MAX_PORTS];
+static SparseFrameWriter *sparseOut[UART_ENGINE_MAX_PORTS];
+
+static void Stop( int signalNumber )
+{
+	running = false;
+}
+
+static void Store( int port, const McaFrame &frame, void *context )
+{
+	if ( sparseOut[port] ) sparseOut[port]->Write(frame);
+	else if ( out[port] ) WriteFrameBinary(out[port],frame);
+}
+
+int main( int argc, char * argv[] )
+{
+	bool usage = false, sparse = false;
+	const char *ports[UART_ENGINE_MAX_PORTS], *outPrefix = NULL;
+	int portCount = 0, baudRate = 115200, simCount = 0, request = 34;
+	double seconds = 10.0, elapsed, start;
+	UartEngine engine;
+	McaSim *sim[UART_ENGINE_MAX_PORTS];
+	SimPty *pty[UART_ENGINE_MAX_PORTS];
+	char name[300];
+	uint64_t frames = 0, bytes = 0, written = 0, dense = 0;
+
+	engine.intervalMs = 1000;
+	for (int i=1; i<argc; i++)						// parse command line
+		{
+		const char *value = (argv[i][0] == '-') && (argv[i][1] != 0) && (argv[i][2] == '=') ? argv[i]+3 : NULL;
+
+		if ( argv[i][0] != '-' )
+			{
+			usage = true;
+			continue;
+			}
+		switch (argv[i][1])
+			{
+			case 'p':
+				if ( value && (portCount < UART_ENGINE_MAX_PORTS) ) ports[portCount++] = value;
+				else usage = true;
+				break;
+			case 'b': if ( value ) baudRate = atoi(value); else usage = true; break;
+			case 's': if ( value ) simCount = atoi(value); else usage = true; break;
+			case 'q': if ( value ) request = atoi(value); else usage = true; break;
+			case 'i': if ( value ) engine.intervalMs = atoi(value); else usage = true; break;
+			case 't': if ( value ) engine.timeoutMs = atoi(value); else usage = true; break;
+			case 'n': if ( value ) seconds = atof(value); else usage = true; break;
+			case 'o': if ( value ) outPrefix = value; else usage = true; break;
+			case 'S': sparse = true; break;
+			case 'v':
+				printf("\nCapeMCA Multi-port Serial Poller %s\n\n",VERSION_STRING);
+				return( 0 );
+			default:
+				usage = true;
+			}
+		}
+	if ( !ValidRequest(request) || (engine.intervalMs < 0) || (engine.timeoutMs < 1) || (seconds <= 0.0) ||
+		 (simCount < 0) || (portCount + simCount < 1) || (portCount + simCount > UART_ENGINE_MAX_PORTS) ) usage = true;
+	if ( usage )
+		{
+		printf("%s",help);
+		return( 1 );
+		}
+
+////////////////////////// Open ports ///////////////////////////////////////////////////////////////////////////////////
+
+	for (int n=0; n<portCount; n++)
+		if ( engine.Open(ports[n],baudRate,request) < 0 ) printf("Skipping %s\n",ports[n]);
+	for (int n=0; n<simCount; n++)
+		{
+		sim[n] = new McaSim(n+1,n+1);
+		sim[n]->Acquire(10);
+		pty[n] = new SimPty;
+		if ( !pty[n]->Start(sim[n]) || (engine.Open(pty[n]->slaveName,baudRate,request) < 0) )
+			printf("Cannot serve simulator %d on a pty\n",n+1);
+		}
+	if ( !engine.ports )
+		{
+		printf("No MCA connected.\n");
+		return( 1 );
+		}
+	for (int n=0; n<engine.ports; n++)
+		{
+		out[n] = NULL;
+		sparseOut[n] = NULL;
+		if ( !outPrefix ) continue;
+		snprintf(name,sizeof(name),"%s%d.bin",outPrefix,n);
+		if ( !(out[n] = fopen(name,"wb")) )
+			{
+			printf("Cannot open %s\n",name);
+			return( 1 );
+			}
+		if ( sparse ) sparseOut[n] = new SparseFrameWriter(out[n]);
+		}
+	engine.handler = Store;
+	signal(SIGINT,Stop);
+
+////////////////////////// Poll /////////////////////////////////////////////////////////////////////////////////////////
+
+	printf("Polling %d ports with request %d every %d ms\n",engine.ports,request,engine.intervalMs);
+	start = MonotonicSeconds();
+	while ( running && (MonotonicSeconds() - start < seconds) ) engine.Run(0.1);
+	elapsed = MonotonicSeconds() - start;
+
+	printf("port,frames,timeouts,badFrames,strayBytes,framesPerSecond,meanLatencyMs\n");
+	for (int n=0; n<engine.ports; n++)
+		{
+		UartPort *p = engine.port[n];
+		printf("%s,%llu,%llu,%llu,%llu,%.1f,%.3f\n",p->name,(unsigned long long)p->frames,(unsigned long long)p->timeouts,
+				(unsigned long long)p->badFrames,(unsigned long long)p->strayBytes,p->frames/elapsed,
+				p->frames ? p->latencySum/p->frames*1000.0 : 0.0);
+		frames += p->frames;
+		bytes += p->bytes;
+		if ( sparseOut[n] )
+			{
+			written += sparseOut[n]->bytes;
+			dense += sparseOut[n]->denseBytes;
+			delete sparseOut[n];
+			}
+		if ( out[n] ) fclose(out[n]);
+		}
+	printf("%llu frames from %d ports in %.2f s: %.1f frames/s, %.2f MB/s\n",(unsigned long long)frames,engine.ports,
+			elapsed,frames/elapsed,bytes/elapsed*1.0e-6);
+	if ( sparse && outPrefix )
+		printf("%llu bytes written instead of %llu\n",(unsigned long long)written,(unsigned long long)dense);
+
+	engine.Close();
+	for (int n=0; n<simCount; n++)
+		{
+		pty[n]->Stop();
+		delete pty[n];
+		delete sim[n];
+		}
+	return( 0 );
+}
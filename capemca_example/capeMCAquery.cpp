@@ -0,0 +1,246 @@
+///////////////////////////////////////////////////////////////////////////////////////////
+//  Command line client of the acquisition daemon (see capeMCAd.cpp and mcaDaemon.h)     //
+//                                                                                       //
+//  All commands given on the command line go to the daemon in one batch and the         //
+//  replies are printed in order. -f streams frames, -t times snapshot round trips.      //
+//                                                                                       //
+///////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "version.h"
+#include "mcaDaemon.h"
+
+#define MAX_BATCH		64
+
+static char help[] = "CapeMCA Daemon Query\n\n\
+Usage: capeMCAquery [flags]\n\n\
+Flags:\n\
+  -S=/tmp/capemca.sock : daemon socket (default)\n\
+  -l : list devices\n\
+  -z=0 : zero device 0, or -z=all\n\
+  -q=0:48 : set request code of device 0 to 48\n\
+  -g=0 : print latest spectrum of device 0 as channel,count\n\
+  -a=0 : print accumulated spectrum of device 0 as channel,count\n\
+  -c=0 : print the dead-time corrected accumulated spectrum of device 0\n\
+  -f=0:10 : stream 10 frames of device 0 (all = every device)\n\
+  -t=0:10000 : time 10000 snapshots of device 0, in batches of -k\n\
+  -k=16 : requests per batch for -t (default 16)\n\
+  -h : display this help message\n\
+  -v : print version info\n";
+
+static const char *statusNames[] = { "ok", "bad command", "bad device", "bad argument", "no data", "failed" };
+
+static const char *StatusName( uint32_t status )
+{
+	return( status <= DAEMON_STATUS_FAILED ? statusNames[status] : "unknown" );
+}
+
+static uint16_t DeviceArg( const char *value )
+{
+	return( strncmp(value,"all",3) ? (uint16_t)atoi(value) : DAEMON_ALL_DEVICES );
+}
+
+static void PrintReply( const DAEMON_MESSAGE &reply, const uint8_t *payload, uint32_t flags = 0 )
+{													// flags of the SNAPSHOT request, one spectrum
+	uint16_t command = reply.command & ~DAEMON_REPLY;
+	DAEMON_DEVICE_INFO info;
+	PACKET0_TYPE packet0;
+
+	if ( reply.arg != DAEMON_STATUS_OK )
+		{
+		printf("command %u device %u: %s\n",command,reply.device,StatusName(reply.arg));
+		return;
+		}
+	switch (command)
+		{
+		case DAEMON_CMD_LIST:
+			printf("device,name,capemcaId,channels,request,frames,errors,hostTime\n");
+			for (uint32_t n=0; n<reply.length/sizeof(info); n++)
+				{
+				memcpy(&info,payload+n*sizeof(info),sizeof(info));
+				printf("%u,%s,%u,%u,%u,%llu,%u,%.6f\n",n,info.name,info.capemcaId,info.channels,info.request,
+						(unsigned long long)info.frames,info.errors,info.hostTime);
+				}
+			break;
+		case DAEMON_CMD_SNAPSHOT:
+			memcpy(&info,payload,sizeof(info));
+			printf("channel,count\n");
+			if ( (flags == DAEMON_FLAG_LATEST) && (reply.length == sizeof(info) + sizeof(PACKET0_TYPE) + info.channels*4) )
+				for (uint32_t i=1; i<info.channels; i++)
+					{
+					uint32_t count;
+					memcpy(&count,payload+sizeof(info)+sizeof(PACKET0_TYPE)+i*4,4);
+					printf("%u,%u\n",i,count);
+					}
+			else if ( (flags == DAEMON_FLAG_ACCUMULATED) &&
+					  (reply.length == sizeof(info) + sizeof(PACKET0_TYPE) + info.channels*8) )
+				for (uint32_t i=1; i<info.channels; i++)
+					{
+					uint64_t count;
+					memcpy(&count,payload+sizeof(info)+sizeof(PACKET0_TYPE)+i*8,8);
+					printf("%u,%llu\n",i,(unsigned long long)count);
+					}
+			else if ( (flags == DAEMON_FLAG_CORRECTED) &&
+					  (reply.length == sizeof(info) + sizeof(PACKET0_TYPE) + info.channels*8) )
+				for (uint32_t i=1; i<info.channels; i++)
+					{
+					double count;
+					memcpy(&count,payload+sizeof(info)+sizeof(PACKET0_TYPE)+i*8,8);
+					printf("%u,%.1f\n",i,count);
+					}
+			break;
+		case DAEMON_CMD_FRAME:
+			memcpy(&info,payload,sizeof(info));
+			memcpy(&packet0,payload+sizeof(info),sizeof(packet0));
+			printf("%u,%s,%llu,%u,%.6f,%g,%g\n",reply.device,info.name,(unsigned long long)info.frames,
+					info.channels,info.hostTime,packet0.cps,packet0.totalCount);
+			break;
+		default:
+			printf("command %u device %u: ok\n",command,reply.device);
+		}
+}
+
+int main( int argc, char * argv[] )
+{
+	bool usage = false;
+	char socketPath[108] = DAEMON_SOCKET_PATH;
+	uint8_t batch[MAX_BATCH*sizeof(DAEMON_MESSAGE)];
+	int batchLength = 0, queued = 0, streamFrames = 0, timeCount = 0, perBatch = 16;
+	uint16_t streamDevice = 0, timeDevice = 0;
+	struct { uint16_t command, device; uint32_t arg, tag; } requests[MAX_BATCH];
+	DaemonClient client;
+	DAEMON_MESSAGE reply;
+
+	for (int i=1; i<argc; i++)						// parse command line
+		{
+		const char *value = (argv[i][0] == '-') && (argv[i][1] != 0) && (argv[i][2] == '=') ? argv[i]+3 : NULL;
+		const char *colon = value ? strchr(value,':') : NULL;
+
+		if ( (argv[i][0] != '-') || (queued == MAX_BATCH) )
+			{
+			usage = true;
+			continue;
+			}
+		switch (argv[i][1])
+			{
+			case 'S': if ( value ) strncpy(socketPath,value,sizeof(socketPath)-1); else usage = true; break;
+			case 'l':
+				requests[queued].command = DAEMON_CMD_LIST;
+				requests[queued].device = 0;
+				requests[queued++].arg = 0;
+				break;
+			case 'z':
+				if ( !value ) usage = true;
+				else
+					{
+					requests[queued].command = DAEMON_CMD_ZERO;
+					requests[queued].device = DeviceArg(value);
+					requests[queued++].arg = 0;
+					}
+				break;
+			case 'q':
+				if ( !colon ) usage = true;
+				else
+					{
+					requests[queued].command = DAEMON_CMD_SET_REQUEST;
+					requests[queued].device = DeviceArg(value);
+					requests[queued++].arg = atoi(colon+1);
+					}
+				break;
+			case 'g':
+			case 'a':
+			case 'c':
+				if ( !value ) usage = true;
+				else
+					{
+					requests[queued].command = DAEMON_CMD_SNAPSHOT;
+					requests[queued].device = DeviceArg(value);
+					requests[queued++].arg = argv[i][1] == 'g' ? DAEMON_FLAG_LATEST :
+											 argv[i][1] == 'a' ? DAEMON_FLAG_ACCUMULATED : DAEMON_FLAG_CORRECTED;
+					}
+				break;
+			case 'f':
+				if ( !colon ) usage = true;
+				else
+					{
+					streamDevice = DeviceArg(value);
+					streamFrames = atoi(colon+1);
+					}
+				break;
+			case 't':
+				if ( !colon ) usage = true;
+				else
+					{
+					timeDevice = DeviceArg(value);
+					timeCount = atoi(colon+1);
+					}
+				break;
+			case 'k': if ( value ) perBatch = atoi(value); else usage = true; break;
+			case 'v':
+				printf("\nCapeMCA Daemon Query %s\n\n",VERSION_STRING);
+				return( 0 );
+			default:
+				usage = true;
+			}
+		}
+	if ( (perBatch < 1) || (perBatch > MAX_BATCH) ) usage = true;
+	if ( usage || (!queued && !streamFrames && !timeCount) )
+		{
+		printf("%s",help);
+		return( 1 );
+		}
+	if ( !client.Connect(socketPath) )
+		{
+		printf("No daemon on %s\n",socketPath);
+		return( 1 );
+		}
+
+	for (int n=0; n<queued; n++)					// one write for every command given
+		requests[n].tag = client.Queue(batch,&batchLength,requests[n].command,requests[n].device,requests[n].arg);
+	if ( queued && !client.Send(batch,batchLength) ) return( 1 );
+	for (int n=0; n<queued; n++)
+		{
+		uint32_t flags = 0;
+		if ( !client.Receive(&reply) ) return( 1 );
+		for (int k=0; k<queued; k++)				// zeros are answered out of order
+			if ( requests[k].tag == reply.tag ) flags = requests[k].arg;
+		PrintReply(reply,client.payload,flags);
+		}
+
+	if ( timeCount )								// snapshot round trips, batched
+		{
+		double t = MonotonicSeconds();
+		int done = 0;
+		while ( done < timeCount )
+			{
+			int k = timeCount - done < perBatch ? timeCount - done : perBatch;
+			batchLength = 0;
+			for (int n=0; n<k; n++) client.Queue(batch,&batchLength,DAEMON_CMD_SNAPSHOT,timeDevice,DAEMON_FLAG_LATEST);
+			if ( !client.Send(batch,batchLength) ) return( 1 );
+			for (int n=0; n<k; n++)
+				if ( !client.Receive(&reply) ) return( 1 );
+			done += k;
+			}
+		t = MonotonicSeconds() - t;
+		printf("%d snapshots in %.3f s, %.0f snapshots/s, %.1f us each\n",timeCount,t,timeCount/t,t/timeCount*1.0e6);
+		}
+
+	if ( streamFrames )								// pushed frames as they arrive
+		{
+		if ( !client.Call(DAEMON_CMD_SUBSCRIBE,streamDevice,0,&reply) ) return( 1 );
+		if ( reply.arg != DAEMON_STATUS_OK )
+			{
+			PrintReply(reply,client.payload);
+			return( 1 );
+			}
+		printf("device,name,frames,channels,hostTime,cps,totalCount\n");
+		for (int n=0; n<streamFrames; n++)
+			{
+			if ( !client.Receive(&reply) ) return( 1 );
+			PrintReply(reply,client.payload);
+			}
+		}
+	return( 0 );
+}
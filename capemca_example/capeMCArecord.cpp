@@ -0,0 +1,257 @@
+///////////////////////////////////////////////////////////////////////////////////////////
+//  Record MCA traffic to a capture file for later replay (see capeMCAreplay.cpp)        //
+//                                                                                       //
+//  Polls one MCA over USB (libusb builds only) or a serial port, or listens passively   //
+//  to an Arduino Serial bridge, and writes every command and response byte with         //
+//  timestamps using the format in mcaCapture.h. With -t or -r the request switches     //
+//  between -q and -Q on ROI or rate triggers (see mcaTrigger.h). With -d a rate change  //
+//  in any light curve band (see mcaChange.h) gets an immediate -Q readout.              //
+//                                                                                       //
+///////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "version.h"
+#include "mcaCapture.h"
+#include "mcaShared.h"
+#include "mcaTrigger.h"
+#include "mcaChange.h"
+
+static char help[] = "CapeMCA Traffic Recorder\n\n\
+Usage: capeMCArecord [flags]\n\n\
+Flags:\n\
+  -c=mca.cap : capture file to write (default mca.cap)\n\
+  -p=/dev/ttyUSB0 : record MCA uart on this serial port (default)\n\
+  -b=115200 : baud rate for serial port (default)\n\
+  -u=0 : record the n'th USB MCA instead of a serial port (libusb builds)\n\
+  -a : serial port is an Arduino bridge, record its output without sending commands\n\
+  -s : record the simulated MCA (for testing, a 10x burst mid-run with -t, -r or -d)\n\
+  -q=34 : request type {0,1,2,4,8,16,32+1,32+2,32+4,32+8,32+16}, quiet request with -t or -r\n\
+  -Q=48 : request type while a trigger is active (default 48)\n\
+  -t=1100:1300:500 : trigger on this many new counts in the ROI channels [1100,1300)\n\
+  -r=20000 : trigger on packet0 cps at or above this rate\n\
+  -k=3 : readouts below half the thresholds before falling back (default 3)\n\
+  -d=8 : read out at -Q at once on a rate change with this log-likelihood ratio\n\
+  -n=100 : number of requests, or seconds of Arduino output\n\
+  -i=1000 : milliseconds between requests\n\
+  -z : zero spectrum before first request\n\
+  -w=10 : wait up to this many seconds for the MCA to enumerate (default 0)\n\
+  -m=/capemca : publish frames in shared memory for capeMCAview\n\
+  -l=deadtime.cfg : dead-time models per capemcaId for the -m corrected spectrum (default: live time)\n\
+  -h : display this help message\n\
+  -v : print version info\n";
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main( int argc, char * argv[] )
+{
+	bool usage = false, arduino = false, simulate = false, zero = false;
+	char capture[256] = "mca.cap", port[64] = "/dev/ttyUSB0";
+	int baudRate = 115200, usbIndex = -1, request = 34, count = 100, intervalMs = 1000;
+	int source, good = 0;
+	McaTransport *device = NULL;
+	UartTransport uart;
+	McaSim sim;
+	SimTransport simTransport(&sim,64);
+	McaFrame frame;
+	ReadoutAccumulator accumulator;					// counts between readouts, published with -m
+	SharedSpectra shared;
+	char shmName[64] = "";
+	const char *deadTimeConfig = NULL;
+	DeadTimeCorrector deadTime;
+	DEADTIME_RESULT rate;
+	static CorrectedSpectrum corrected;
+	int slot = -1;
+	ResolutionTrigger trigger;
+	bool triggered = false;
+	int roiLo = 0, roiHi = 0, highRequest = 48;
+	double roiCounts = 0.0, triggerCps = 0.0, quietCps = sim.meanCps;
+	static LightCurve curve;
+	static ChangeDetector detector;
+	LIGHT_RECORD_HEADER lightRecord;
+	uint32_t bandCounts[LIGHT_MAX_BANDS];
+	CHANGE_POINT changes[LIGHT_MAX_BANDS];
+	double changeThreshold = 0.0;
+	int found;
+	double waitSeconds = 0.0, start = MonotonicSeconds(), deadline;
+
+	for (int i=1; i<argc; i++)						// parse command line
+		{
+		const char *value = (argv[i][0] == '-') && (argv[i][1] != 0) && (argv[i][2] == '=') ? argv[i]+3 : NULL;
+
+		if ( argv[i][0] != '-' )
+			{
+			usage = true;
+			continue;
+			}
+		switch (argv[i][1])
+			{
+			case 'a': arduino = true; break;
+			case 's': simulate = true; break;
+			case 'z': zero = true; break;
+			case 'v':
+				printf("\nCapeMCA Traffic Recorder %s\n\n",VERSION_STRING);
+				return( 0 );
+			case 'm': if ( value ) strncpy(shmName,value,sizeof(shmName)-1); else usage = true; break;
+			case 'l': if ( value ) deadTimeConfig = value; else usage = true; break;
+			case 'c': if ( value ) strncpy(capture,value,sizeof(capture)-1); else usage = true; break;
+			case 'p': if ( value ) strncpy(port,value,sizeof(port)-1); else usage = true; break;
+			case 'b': if ( value ) baudRate = atoi(value); else usage = true; break;
+			case 'u': if ( value ) usbIndex = atoi(value); else usage = true; break;
+			case 'q': if ( value ) request = atoi(value); else usage = true; break;
+			case 'n': if ( value ) count = atoi(value); else usage = true; break;
+			case 'i': if ( value ) intervalMs = atoi(value); else usage = true; break;
+			case 'w': if ( value ) waitSeconds = atof(value); else usage = true; break;
+			case 'Q': if ( value ) highRequest = atoi(value); else usage = true; break;
+			case 'r': if ( value ) triggerCps = atof(value); else usage = true; break;
+			case 'k': if ( value ) trigger.holdReadouts = atoi(value); else usage = true; break;
+			case 'd': if ( value ) changeThreshold = atof(value); else usage = true; break;
+			case 't':
+				if ( !value || (sscanf(value,"%d:%d:%lf",&roiLo,&roiHi,&roiCounts) != 3) ) usage = true;
+				break;
+			default:
+				usage = true;
+			}
+		}
+	if ( !ValidRequest(request) || (count < 1) || (intervalMs < 0) ) usage = true;
+	triggered = (roiCounts > 0.0) || (triggerCps > 0.0);
+	if ( triggered )
+		{
+		trigger.lowRequest = request;
+		trigger.highRequest = highRequest;
+		trigger.roiCounts = roiCounts;
+		trigger.cps = triggerCps;
+		if ( !ValidRequest(highRequest) || (trigger.holdReadouts < 1) ) usage = true;
+		if ( (roiCounts > 0.0) && (!RequestChannels(request) || !trigger.SetRoi(roiLo,roiHi)) ) usage = true;
+		if ( (triggerCps > 0.0) && !RequestPacketBytes(request) ) usage = true;
+		}
+	if ( changeThreshold < 0.0 ) usage = true;
+	if ( changeThreshold > 0.0 )
+		{
+		curve.DefaultBands();
+		detector.params.threshold = changeThreshold;
+		}
+	if ( usage )
+		{
+		printf("%s",help);
+		return( 1 );
+		}
+
+////////////////////////// Open device //////////////////////////////////////////////////////////////////////////////////
+
+	source = arduino ? CAPTURE_SOURCE_ARDUINO : CAPTURE_SOURCE_UART;
+	if ( simulate )
+		{
+		device = &simTransport;
+		source = CAPTURE_SOURCE_SIM;
+		strcpy(port,"simulator");
+		}
+	deadline = start + waitSeconds;
+	while ( !device )								// retry until the MCA has enumerated
+		{
+		if ( usbIndex >= 0 )
+			{
+#ifdef HAVE_LIBUSB
+			static UsbTransport usb;
+			if ( usb.Open(usbIndex) )
+				{
+				device = &usb;
+				strncpy(port,usb.serial,sizeof(port)-1);
+				}
+			source = CAPTURE_SOURCE_USB;
+#else
+			printf("This build has no libusb support.\n");
+			return( 1 );
+#endif
+			}
+		else if ( access(port,F_OK) == 0 )			// serial device node exists
+			{
+			if ( uart.Open(port,baudRate) ) device = &uart;
+			}
+		if ( device || (MonotonicSeconds() >= deadline) ) break;
+		usleep(20000);
+		}
+	if ( device && (waitSeconds > 0) )
+		printf("%s ready %.1f ms after start\n",port,(MonotonicSeconds() - start)*1000.0);
+
+	if ( !device )
+		{
+		printf("Device not connected.\n");
+		return( 1 );
+		}
+
+	if ( shmName[0] && !shared.Create(shmName) ) return( 1 );
+	if ( deadTimeConfig && !deadTime.LoadConfig(deadTimeConfig) ) return( 1 );
+	RecordingTransport recorder(device);
+	if ( !recorder.Open(capture,source,port) ) return( 1 );
+	printf("Recording %s to %s\n",port,capture);
+
+////////////////////////// Record ///////////////////////////////////////////////////////////////////////////////////////
+
+	if ( arduino )									// bridge talks on its own, just listen
+		{
+		uint8_t buffer[4096];
+		int n;
+		double stop = MonotonicSeconds() + count;
+		while ( MonotonicSeconds() < stop )
+			{
+			n = device->Read(buffer,sizeof(buffer),100);	// idle gaps are not worth recording
+			if ( n > 0 ) recorder.Record(CAPTURE_FROM_DEVICE,0,buffer,n);
+			}
+		}
+	else
+		{
+		if ( zero && McaZero(&recorder) )
+			{
+			printf("Zero command was processed by MCA.\n");
+			trigger.Reset();
+			}
+		for (int n=0; n<count; n++)
+			{
+			if ( simulate )
+				{
+				sim.meanCps = (triggered || changeThreshold) && (n >= 2*count/5) && (n < 3*count/5) ? 10.0*quietCps : quietCps;
+				sim.Acquire(1);
+				}
+			if ( triggered ) request = trigger.Request();
+			if ( McaRequest(&recorder,request,&frame) )
+				{
+				if ( triggered && (trigger.Update(frame) != request) )
+					printf("Readout %d: %s resolution, ROI %.0f counts, %.0f cps\n",n,trigger.high ? "full" : "quiet",
+							trigger.lastRoiCounts,trigger.lastCps);
+				if ( changeThreshold && curve.Process(frame.hasPacket0 ? frame.packet0.capemcaId : 0,frame,&lightRecord,bandCounts) &&
+					 (found = detector.Update(lightRecord,bandCounts,curve.bands,changes)) )
+					{
+					for (int c=0; c<found; c++)
+						printf("Readout %d: %s rate %s from %.0f to %.0f cps, %.1f sigma\n",n,curve.band[changes[c].band].name,
+								changes[c].direction > 0 ? "up" : "down",changes[c].rateBefore,changes[c].rateAfter,
+								changes[c].significance);
+					if ( triggered ) trigger.Hold();	// and stay at full resolution for a while
+					if ( McaRequest(&recorder,highRequest,&frame) )	// high priority readout now
+						printf("Readout %d: immediate %d-channel readout\n",n,frame.channels);
+					}
+				if ( !good++ )
+					printf("First valid frame %.1f ms after start\n",(frame.hostTime - start)*1000.0);
+				accumulator.AddReadout(frame);
+				if ( shmName[0] )					// live view for other processes
+					{
+					if ( slot < 0 ) slot = shared.Slot(frame.hasPacket0 ? frame.packet0.capemcaId : 0);
+					corrected.Add(frame,deadTime.Correct(frame,&rate) ? &rate : NULL);
+					shared.Publish(slot,frame,&accumulator,&corrected);
+					}
+				}
+			if ( intervalMs && (n+1 < count) ) usleep(intervalMs*1000);
+			}
+		printf("%d of %d requests returned a valid frame\n",good,count);
+		if ( triggered )
+			printf("%u switches, %u of %u readouts at full resolution, %llu bytes vs %llu always at full\n",
+					trigger.switches,trigger.highReadouts,trigger.readouts,(unsigned long long)recorder.bytes,
+					(unsigned long long)count*(RequestResponseBytes(highRequest) + 2));
+		}
+
+	printf("%llu records, %llu bytes\n",(unsigned long long)recorder.records,(unsigned long long)recorder.bytes);
+	recorder.Close();
+	return( 0 );
+}
@@ -0,0 +1,370 @@
+///////////////////////////////////////////////////////////////////////////////////////////
+//  Replay a capture file through the decode pipeline (see capeMCArecord.cpp)            //
+//                                                                                       //
+//  Each recorded {0,request} command is issued again through ReplayTransport and the    //
+//  response is decoded and accumulated exactly as live data would be, at recorded      //
+//  speed (-s=1), scaled speed, or as fast as possible (-s=0, the default).             //
+//                                                                                       //
+///////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "version.h"
+#include "mcaArchive.h"
+#include "mcaCapture.h"
+#include "mcaClock.h"
+#include "mcaDeadTime.h"
+#include "mcaGain.h"
+#include "mcaIndex.h"
+#include "mcaOutput.h"
+#include "mcaShared.h"
+
+static char help[] = "CapeMCA Traffic Replay\n\n\
+Usage: capeMCAreplay [flags] capture\n\n\
+Flags:\n\
+  -s=0 : replay speed, 1 = as recorded, 0 = as fast as possible (default)\n\
+  -o=frames.bin : also write decoded frames in binary record format\n\
+  -S : write -o records as deltas on the previous readout where that is smaller\n\
+  -x=base : also build a time index base.sidx/base.sivl of the interval spectra\n\
+  -k=60 : intervals between index checkpoints (default 60)\n\
+  -A=dir : also append the interval spectra to a partitioned archive, rolled up as they arrive\n\
+  -m=/capemca : publish frames in shared memory for capeMCAview\n\
+  -r=rates.csv : write measured and dead-time corrected rates of every interval\n\
+  -c=corrected.csv : write the accumulated spectrum with every interval dead-time corrected\n\
+  -T=times.csv : write UTC start and stop of every interval from fitted device clocks\n\
+  -l=deadtime.cfg : dead-time models per capemcaId for -r, -c and -m (default: live time)\n\
+  -g=gain.cfg : reference peaks per capemcaId for gain stabilization\n\
+  -G=gain.csv : write the gain and offset after every interval (needs -g)\n\
+  -a=stable.csv : write the gain stabilized accumulated spectrum (needs -g)\n\
+  -d : dump the raw records instead of decoding\n\
+  -h : display this help message\n\
+  -v : print version info\n";
+
+static const char *sourceNames[] = { "unknown", "usb", "uart", "arduino", "simulator" };
+
+static void DumpRecords( ReplayTransport &replay )	// list every record of the capture
+{
+	CAPTURE_RECORD_HEADER record;
+	const uint8_t *payload;
+
+	while ( replay.NextRecord(&record,&payload) )
+		{
+		printf("%12.6f %s %6u%s ",record.ns*1.0e-9,record.direction == CAPTURE_TO_DEVICE ? "->" : "<-",
+				record.length,(record.flags & CAPTURE_FLAG_SHORT) ? " short" : "");
+		for (uint32_t i=0; (i<record.length) && (i<16); i++) printf(" %02x",payload[i]);
+		printf("%s\n",record.length > 16 ? " ..." : "");
+		}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main( int argc, char * argv[] )
+{
+	bool usage = false, dump = false, sparse = false;
+	char *capture = NULL, *output = NULL, *indexBase = NULL;
+	int checkpointEvery = 60;
+	SpectrumIndex *index = NULL;
+	char *archiveDir = NULL;
+	SpectrumArchive *archive = NULL;
+	char *shmName = NULL, *ratesPath = NULL, *deadTimeConfig = NULL;
+	DeadTimeCorrector deadTime;
+	DEADTIME_RESULT rate;
+	FILE *rates = NULL;
+	char *correctedPath = NULL;
+	static CorrectedSpectrum corrected;				// also published with -m
+	bool rated;
+	char *timesPath = NULL;
+	ClockTracker clocks;
+	CLOCK_INTERVAL timing;
+	FILE *times = NULL;
+	char *gainConfig = NULL, *gainPath = NULL, *stablePath = NULL;
+	GainStabilizer stabilizer;
+	GAIN_RESULT drift;
+	FILE *gains = NULL;
+	uint32_t capemcaId = 0;
+	SharedSpectra shared;
+	int slot = -1;
+	double speed = 0.0, t;
+	ReplayTransport replay;
+	CAPTURE_RECORD_HEADER record;
+	const uint8_t *payload;
+	ReadoutAccumulator accumulator;					// counts between readouts, zeros included
+	McaFrame frame;
+	FILE *out = NULL;
+	SparseFrameWriter *sparseOut = NULL;
+	uint64_t frames = 0, badFrames = 0, zeros = 0, bytes = 0;
+	size_t mark;
+
+	for (int i=1; i<argc; i++)						// parse command line
+		{
+		if ( argv[i][0] != '-' )
+			{
+			capture = argv[i];
+			continue;
+			}
+		switch (argv[i][1])
+			{
+			case 's':
+				if ( argv[i][2] == '=' ) speed = atof(argv[i]+3);
+				else usage = true;
+				break;
+			case 'o':
+				if ( argv[i][2] == '=' ) output = argv[i]+3;
+				else usage = true;
+				break;
+			case 'x':
+				if ( argv[i][2] == '=' ) indexBase = argv[i]+3;
+				else usage = true;
+				break;
+			case 'A':
+				if ( argv[i][2] == '=' ) archiveDir = argv[i]+3;
+				else usage = true;
+				break;
+			case 'm':
+				if ( argv[i][2] == '=' ) shmName = argv[i]+3;
+				else usage = true;
+				break;
+			case 'r':
+				if ( argv[i][2] == '=' ) ratesPath = argv[i]+3;
+				else usage = true;
+				break;
+			case 'c':
+				if ( argv[i][2] == '=' ) correctedPath = argv[i]+3;
+				else usage = true;
+				break;
+			case 'T':
+				if ( argv[i][2] == '=' ) timesPath = argv[i]+3;
+				else usage = true;
+				break;
+			case 'l':
+				if ( argv[i][2] == '=' ) deadTimeConfig = argv[i]+3;
+				else usage = true;
+				break;
+			case 'g':
+				if ( argv[i][2] == '=' ) gainConfig = argv[i]+3;
+				else usage = true;
+				break;
+			case 'G':
+				if ( argv[i][2] == '=' ) gainPath = argv[i]+3;
+				else usage = true;
+				break;
+			case 'a':
+				if ( argv[i][2] == '=' ) stablePath = argv[i]+3;
+				else usage = true;
+				break;
+			case 'k':
+				if ( argv[i][2] == '=' ) checkpointEvery = atoi(argv[i]+3);
+				else usage = true;
+				break;
+			case 'd':
+				dump = true;
+				break;
+			case 'S':
+				sparse = true;
+				break;
+			case 'v':
+				printf("\nCapeMCA Traffic Replay %s\n\n",VERSION_STRING);
+				return( 0 );
+			default:
+				usage = true;
+			}
+		}
+	if ( !capture || (speed < 0) || (checkpointEvery < 1) || ((gainPath || stablePath) && !gainConfig) ) usage = true;
+	if ( usage )
+		{
+		printf("%s",help);
+		return( 1 );
+		}
+
+	if ( !replay.Open(capture) ) return( 1 );
+	printf("%s: %s capture of %s\n",capture,
+			sourceNames[replay.header.source < 5 ? replay.header.source : 0],replay.header.description);
+	if ( dump )
+		{
+		DumpRecords(replay);
+		return( 0 );
+		}
+	if ( output && !(out = fopen(output,"wb")) )
+		{
+		printf("Cannot create %s\n",output);
+		return( 1 );
+		}
+	if ( out && sparse ) sparseOut = new SparseFrameWriter(out);
+
+	if ( deadTimeConfig && !deadTime.LoadConfig(deadTimeConfig) ) return( 1 );
+	if ( ratesPath )
+		{
+		if ( !(rates = fopen(ratesPath,"w")) )
+			{
+			printf("Cannot create %s\n",ratesPath);
+			return( 1 );
+			}
+		fprintf(rates,"hostTime,capemcaId,model,realTime,liveTime,measuredCps,trueCps,factor,pileupFraction\n");
+		}
+	if ( timesPath )
+		{
+		if ( !(times = fopen(timesPath,"w")) )
+			{
+			printf("Cannot create %s\n",timesPath);
+			return( 1 );
+			}
+		fprintf(times,"capemcaId,epoch,firstInterval,lastInterval,utcStart,utcStop,sigmaMs,driftPpm,hostStart,hostStop\n");
+		}
+	if ( gainConfig && !stabilizer.LoadConfig(gainConfig) ) return( 1 );
+	if ( gainPath )
+		{
+		if ( !(gains = fopen(gainPath,"w")) )
+			{
+			printf("Cannot create %s\n",gainPath);
+			return( 1 );
+			}
+		fprintf(gains,"hostTime,capemcaId,gain,offset,peaks");
+		for (int k=0; k<GAIN_MAX_PEAKS; k++) fprintf(gains,",centroid%d,counts%d",k,k);
+		fprintf(gains,"\n");
+		}
+	if ( shmName && !shared.Create(shmName) ) return( 1 );
+	replay.speed = speed;
+	t = MonotonicSeconds();
+	for (;;)										// reissue each recorded command in order
+		{
+		mark = replay.offset;
+		if ( !replay.NextRecord(&record,&payload) ) break;
+		if ( record.direction != CAPTURE_TO_DEVICE ) continue;	// responses without command
+		replay.offset = mark;						// let the transport consume it
+		if ( (record.length == 2) && (payload[0] == 1) && (payload[1] == 1) )
+			{
+			zeros += McaZero(&replay);
+			continue;
+			}
+		if ( (record.length != 2) || (payload[0] != 0) || !ValidRequest(payload[1]) )
+			{
+			uint8_t skip[2] = { 0, 0 };				// unknown command, step over it
+			replay.Write(skip,0);
+			continue;
+			}
+		if ( McaRequest(&replay,payload[1],&frame) )
+			{
+			frames++;
+			bytes += RequestResponseBytes(frame.request);
+			frame.hostTime = replay.recordTime;		// time of the original response
+			frame.sendTime = replay.commandTime;	// and of its command, both realtime already
+			accumulator.AddReadout(frame);
+			rated = (rates || correctedPath || shmName) && deadTime.Correct(frame,&rate);
+			if ( correctedPath || shmName ) corrected.Add(frame,rated ? &rate : NULL);	// this interval's factor
+			if ( indexBase && frame.channels && !index )
+				{
+				index = new SpectrumIndex;			// resolution of first frame sets index size
+				if ( !index->Create(indexBase,frame.channels,checkpointEvery,
+									frame.hasPacket0 ? frame.packet0.capemcaId : 0) ) return( 1 );
+				}
+			if ( index ) index->AppendReadout(frame);
+			if ( archiveDir && frame.channels && !archive )
+				{
+				archive = new SpectrumArchive;		// resolution of first frame sets archive size
+				if ( !archive->Create(archiveDir,frame.channels,frame.hasPacket0 ? frame.packet0.capemcaId : 0) ||
+					 !archive->StartCompactor(1.0) ) return( 1 );
+				}
+			if ( archive ) archive->AppendReadout(frame);
+			if ( shmName )
+				{
+				if ( slot < 0 ) slot = shared.Slot(frame.hasPacket0 ? frame.packet0.capemcaId : 0);
+				shared.Publish(slot,frame,&accumulator,&corrected);
+				}
+			if ( sparseOut ) sparseOut->Write(frame);
+			else if ( out ) WriteFrameBinary(out,frame);
+			if ( frame.hasPacket0 ) capemcaId = frame.packet0.capemcaId;	// spectrum-only frames keep the last id
+			if ( gainConfig && stabilizer.Process(capemcaId,frame,&drift) && gains )
+				{
+				fprintf(gains,"%.6f,%u,%.6f,%.3f,%d",frame.hostTime,capemcaId,drift.gain,drift.offset,drift.measured);
+				for (int k=0; k<GAIN_MAX_PEAKS; k++) fprintf(gains,",%.3f,%.0f",drift.centroid[k],drift.counts[k]);
+				fprintf(gains,"\n");
+				}
+			if ( times && clocks.Process(frame,&timing) )
+				fprintf(times,"%u,%d,%u,%u,%.6f,%.6f,%.3f,%.3f,%.6f,%.6f\n",timing.capemcaId,timing.epoch,
+						timing.firstInterval,timing.lastInterval,timing.utcStart,timing.utcStop,timing.sigma*1.0e3,
+						timing.drift*1.0e6,timing.hostStart,timing.hostStop);
+			if ( rates && rated )
+				fprintf(rates,"%.6f,%u,%s,%.6f,%.6f,%.3f,%.3f,%.6f,%.6f%s\n",frame.hostTime,frame.packet0.capemcaId,
+						DeadTimeModelName(deadTime.Device(frame.packet0.capemcaId)->params.model),rate.realTime,
+						rate.liveTime,rate.measuredRate,rate.trueRate,rate.factor,rate.pileupFraction,
+						rate.saturated ? ",saturated" : "");
+			}
+		else badFrames++;
+		}
+	t = MonotonicSeconds() - t;
+
+	printf("%llu frames, %llu bad frames, %llu zero commands, %llu command mismatches\n",
+			(unsigned long long)frames,(unsigned long long)badFrames,(unsigned long long)zeros,
+			(unsigned long long)replay.mismatches);
+	if ( t > 0 )
+		printf("%.3f s, %.0f frames/s, %.1f MB/s\n",t,frames/t,bytes/t*1.0e-6);
+	if ( sparseOut )
+		{
+		printf("%llu of %llu records sparse, %llu bytes written instead of %llu\n",
+				(unsigned long long)sparseOut->sparseRecords,(unsigned long long)sparseOut->records,
+				(unsigned long long)sparseOut->bytes,(unsigned long long)sparseOut->denseBytes);
+		delete sparseOut;
+		}
+	if ( out ) fclose(out);
+	if ( rates ) fclose(rates);
+	if ( times )
+		{
+		fclose(times);
+		for (int n=0; n<clocks.devices; n++)
+			{
+			CLOCK_DEVICE *d = &clocks.device[n];
+			double sigma;
+			clocks.HostTime(d,d->previousDevice,&sigma);
+			printf("capemcaId %u clock: drift %.3f ppm, %.3f ms at the last readout, %d epochs, %llu readouts dropped\n",
+					d->capemcaId,d->drift*1.0e6,sigma*1.0e3,d->epoch+1,(unsigned long long)d->rejected);
+			}
+		}
+	if ( gains ) fclose(gains);
+	if ( correctedPath )
+		{
+		FILE *f = fopen(correctedPath,"w");
+		if ( !f )
+			{
+			printf("Cannot write %s\n",correctedPath);
+			return( 1 );
+			}
+		fprintf(f,"channel,counts\n");
+		for (int i=0; i<corrected.channels; i++) fprintf(f,"%d,%.3f\n",i,corrected.sum[i]);
+		fclose(f);
+		printf("%u intervals dead-time corrected\n",corrected.frames);
+		}
+	if ( stablePath )
+		{
+		GAIN_DEVICE *d = stabilizer.Device(capemcaId);
+		FILE *f = fopen(stablePath,"w");
+		if ( !f || !d || !d->stable )
+			{
+			printf("Cannot write %s\n",stablePath);
+			if ( f ) fclose(f);
+			return( 1 );
+			}
+		fprintf(f,"channel,counts\n");
+		for (int i=0; i<d->channels; i++) fprintf(f,"%d,%.3f\n",i,d->stable[i]);
+		fclose(f);
+		printf("%u intervals gain stabilized, final gain %.5f offset %.2f\n",d->intervals,d->gain,d->offset);
+		}
+	if ( index )
+		{
+		printf("%u intervals indexed in %s.sidx/.sivl\n",index->intervals,indexBase);
+		delete index;
+		}
+	if ( archive )
+		{
+		ARCHIVE_FILE_HEADER h;
+		uint32_t intervals = 0, bins = 0;
+
+		archive->StopCompactor();					// rolls up whatever the thread had not reached
+		for (int p=0; p<archive->partitions; p++)
+			for (int level=0; level<ARCHIVE_LEVELS; level++)
+				if ( archive->Level(p,level,&h) ) *(level ? &bins : &intervals) += h.records;
+		printf("%u intervals in %d partitions of %s, %u rollup bins\n",intervals,archive->partitions,archiveDir,bins);
+		delete archive;
+		}
+	return( badFrames ? 2 : 0 );
+}
@@ -0,0 +1,172 @@
+///////////////////////////////////////////////////////////////////////////////////////////
+//  Synchronized zero and readout of an array of MCAs (see mcaSync.h)                    //
+//                                                                                       //
+//  Zeroes every MCA with back-to-back {1,1} submissions, verifies the echoes, then      //
+//  reads all of them together each interval and reports the per-device skew. With -o    //
+//  the frames of each device go to a binary frame file for capeMCAcoinc or capeMCAfit.  //
+//                                                                                       //
+///////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "version.h"
+#include "mcaOutput.h"
+#include "mcaSync.h"
+
+static char help[] = "CapeMCA Synchronized Readout\n\n\
+Usage: capeMCAsync [flags]\n\n\
+Flags:\n\
+  -p=/dev/ttyUSB0 : MCA uart on this serial port, may be repeated\n\
+  -b=115200 : baud rate for serial ports (default)\n\
+  -u=2 : this many USB MCAs (libusb builds)\n\
+  -s=2 : this many simulated MCAs (for testing)\n\
+  -q=34 : request type {0,1,2,4,8,16,32+1,32+2,32+4,32+8,32+16}\n\
+  -n=10 : number of synchronized readouts (default 10)\n\
+  -i=1000 : milliseconds between readouts\n\
+  -z : synchronized zero before the first readout\n\
+  -o=base : write frames of device n to base<n>.bin\n\
+  -h : display this help message\n\
+  -v : print version info\n";
+
+static void PrintSkew( const char *what, int round, const SYNC_RESULT &r )
+{
+	for (int d=0; d<r.devices; d++)
+		printf("%s,%d,%d,%d,%.1f,%.1f\n",what,round,d,r.ok[d],r.skew[d]*1.0e6,r.uncertainty[d]*1.0e6);
+}
+
+int main( int argc, char * argv[] )
+{
+	bool usage = false, zero = false;
+	const char *ports[SYNC_MAX_DEVICES], *outBase = NULL;
+	int portCount = 0, baudRate = 115200, usbCount = 0, simCount = 0, request = 34, count = 10, intervalMs = 1000;
+	McaTransport *devices[SYNC_MAX_DEVICES];
+	McaSim *sims[SYNC_MAX_DEVICES];
+	McaFrame *frames[SYNC_MAX_DEVICES];
+	FILE *out[SYNC_MAX_DEVICES];
+	int deviceCount = 0, good = 0;
+	double worstSkew = 0.0;
+	static SYNC_RESULT result;
+
+	for (int i=1; i<argc; i++)						// parse command line
+		{
+		const char *value = (argv[i][0] == '-') && (argv[i][1] != 0) && (argv[i][2] == '=') ? argv[i]+3 : NULL;
+
+		if ( argv[i][0] != '-' )
+			{
+			usage = true;
+			continue;
+			}
+		switch (argv[i][1])
+			{
+			case 'p':
+				if ( value && (portCount < SYNC_MAX_DEVICES) ) ports[portCount++] = value;
+				else usage = true;
+				break;
+			case 'b': if ( value ) baudRate = atoi(value); else usage = true; break;
+			case 'u': if ( value ) usbCount = atoi(value); else usage = true; break;
+			case 's': if ( value ) simCount = atoi(value); else usage = true; break;
+			case 'q': if ( value ) request = atoi(value); else usage = true; break;
+			case 'n': if ( value ) count = atoi(value); else usage = true; break;
+			case 'i': if ( value ) intervalMs = atoi(value); else usage = true; break;
+			case 'o': if ( value ) outBase = value; else usage = true; break;
+			case 'z': zero = true; break;
+			case 'v':
+				printf("\nCapeMCA Synchronized Readout %s\n\n",VERSION_STRING);
+				return( 0 );
+			default:
+				usage = true;
+			}
+		}
+	if ( !ValidRequest(request) || (count < 0) || (intervalMs < 0) || (portCount + usbCount + simCount < 1) ||
+		 (portCount + usbCount + simCount > SYNC_MAX_DEVICES) ) usage = true;
+	if ( usage )
+		{
+		printf("%s",help);
+		return( 1 );
+		}
+
+////////////////////////// Prepare every handle before the first command ///////////////////////////////////////////////
+
+	for (int n=0; n<portCount; n++)
+		{
+		UartTransport *uart = new UartTransport;
+		if ( !uart->Open(ports[n],baudRate) )
+			{
+			printf("Cannot open %s\n",ports[n]);
+			return( 1 );
+			}
+		sims[deviceCount] = NULL;
+		devices[deviceCount++] = uart;
+		}
+#ifdef HAVE_LIBUSB
+	for (int n=0; n<usbCount; n++)
+		{
+		UsbTransport *usb = new UsbTransport;
+		if ( !usb->Open(n) )
+			{
+			printf("USB MCA %d not connected\n",n);
+			return( 1 );
+			}
+		sims[deviceCount] = NULL;
+		devices[deviceCount++] = usb;
+		}
+#else
+	if ( usbCount )
+		{
+		printf("This build has no libusb support.\n");
+		return( 1 );
+		}
+#endif
+	for (int n=0; n<simCount; n++)
+		{
+		sims[deviceCount] = new McaSim(n+1,n+1);
+		devices[deviceCount] = new SimTransport(sims[deviceCount],64);
+		deviceCount++;
+		}
+	for (int d=0; d<deviceCount; d++)
+		{
+		frames[d] = new McaFrame;
+		out[d] = NULL;
+		if ( outBase )
+			{
+			char name[512];
+			snprintf(name,sizeof(name),"%s%d.bin",outBase,d);
+			if ( !(out[d] = fopen(name,"wb")) )
+				{
+				printf("Cannot create %s\n",name);
+				return( 1 );
+				}
+			}
+		}
+
+////////////////////////// Zero and read together ///////////////////////////////////////////////////////////////////////
+
+	printf("what,round,device,ok,skewUs,uncertaintyUs\n");
+	if ( zero )
+		{
+		SyncZero(devices,deviceCount,&result);
+		PrintSkew("zero",0,result);
+		if ( result.failures ) printf("%d of %d MCA did not echo the zero command\n",result.failures,deviceCount);
+		}
+	for (int n=0; n<count; n++)
+		{
+		if ( intervalMs ) usleep(intervalMs*1000);
+		for (int d=0; d<deviceCount; d++)
+			if ( sims[d] ) sims[d]->Acquire(1);
+		if ( SyncReadout(devices,deviceCount,request,frames,&result) ) good++;
+		PrintSkew("readout",n,result);
+		if ( result.maxSkew > worstSkew ) worstSkew = result.maxSkew;
+		for (int d=0; d<deviceCount; d++)
+			if ( out[d] && result.ok[d] ) WriteFrameBinary(out[d],*frames[d]);
+		}
+	printf("%d of %d synchronized readouts complete, worst skew %.1f us\n",good,count,worstSkew*1.0e6);
+
+	for (int d=0; d<deviceCount; d++)
+		{
+		if ( out[d] ) fclose(out[d]);
+		devices[d]->Close();
+		}
+	return( 0 );
+}
@@ -0,0 +1,277 @@
+///////////////////////////////////////////////////////////////////////////////////////////
+//  Downlink telemetry simulation (see mcaTelemetry.h)                                   //
+//                                                                                       //
+//  Frames from binary frame files (capeMCAreplay -o=frames.bin) or from simulated MCAs  //
+//  are turned into event, summary, light curve and packed spectrum records and sent    //
+//  through the telemetry multiplexer at a fixed byte budget, on simulated time taken    //
+//  from hostTime. A ground side parser checks the framed stream, and the records,       //
+//  bytes, drops and latency of every class are reported.                                //
+//                                                                                       //
+///////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "version.h"
+#include "mcaLightCurve.h"
+#include "mcaOutput.h"
+#include "mcaSim.h"
+#include "mcaTelemetry.h"
+
+#define MAX_FILES		64
+#define EVENT_ZEROED	1							// event codes of the simulation
+#define EVENT_RCODE		2
+
+static char help[] = "CapeMCA Telemetry Simulation\n\n\
+Usage: capeMCAtelemetry [flags] [detector0.bin detector1.bin ...]\n\n\
+Flags:\n\
+  -B=2000 : downlink budget in bytes per second (default 2000)\n\
+  -u=4000 : burst allowance in bytes (default one second of budget)\n\
+  -D=10 : send every n'th interval spectrum when the link keeps up (default 10)\n\
+  -e=0.01 : chance per frame of a simulated rcode error event (default 0)\n\
+  -t=10 : milliseconds between multiplexer services (default 10)\n\
+  -s=2 : simulate this many MCAs instead of reading frame files\n\
+  -n=600 : seconds of simulated readouts (default 600)\n\
+  -q=34 : request type of simulated readouts (default 34)\n\
+  -o=downlink.bin : also write the framed downlink bytes\n\
+  -h : display this help message\n\
+  -v : print version info\n";
+
+static const char *className[TELEMETRY_CLASSES] = { "event", "summary", "lightcurve", "spectrum" };
+
+typedef struct
+{
+	TelemetryParser parser;
+	FILE *out;
+	uint64_t bytes;
+	uint64_t records[TELEMETRY_CLASSES];
+	uint64_t badSpectra;							// did not unpack to the channels sent
+} GROUND;
+
+static void Downlink( const uint8_t *bytes, size_t length, void *context )
+{
+	GROUND *ground = (GROUND *)context;
+	const uint8_t *payload;
+	int cls, payloadLength;
+
+	if ( ground->out ) fwrite(bytes,1,length,ground->out);
+	ground->bytes += length;
+	for (size_t i=0; i<length; i++)
+		if ( ground->parser.Feed(bytes[i],&cls,&payload,&payloadLength) )
+			{
+			ground->records[cls]++;
+			if ( cls == TELEMETRY_SPECTRUM )		// ms(4) capemcaId(4) channels(2) packed
+				{
+				static uint32_t spectrum[MAX_SPECTRUM_SIZE];
+				int channels = payload[8] | (payload[9] << 8);
+				if ( (channels > MAX_SPECTRUM_SIZE) ||
+					 (TelemetryUnpackSpectrum(payload+10,payloadLength-10,spectrum,channels) != channels) )
+					ground->badSpectra++;
+				}
+			}
+}
+
+int main( int argc, char * argv[] )
+{
+	bool usage = false;
+	char *path[MAX_FILES], *outPath = NULL;
+	int files = 0, simulated = 0, seconds = 600, request = 34, serviceMs = 10;
+	uint32_t budget = 2000, burst = 0, duty = 10;
+	double errorChance = 0.0;
+	FILE *f[MAX_FILES];
+	McaFrame *next[MAX_FILES];
+	McaSim *sim[MAX_FILES];
+	uint32_t id[MAX_FILES];
+	bool pending[MAX_FILES];
+	static uint32_t previous[MAX_FILES][MAX_SPECTRUM_SIZE], interval[MAX_SPECTRUM_SIZE];
+	int previousChannels[MAX_FILES];
+	static LightCurve curve;
+	LIGHT_RECORD_HEADER record;
+	uint32_t counts[LIGHT_MAX_BANDS];
+	static uint8_t payload[TELEMETRY_MAX_PAYLOAD];
+	static GROUND ground;
+	uint64_t frames = 0, tooBig = 0;
+	uint32_t ms = 0, lastMs = 0, peakPending = 0;
+	double t0 = -1.0, t;
+	int sources;
+
+	for (int i=1; i<argc; i++)						// parse command line
+		{
+		const char *value = (argv[i][0] == '-') && (argv[i][1] != 0) && (argv[i][2] == '=') ? argv[i]+3 : NULL;
+
+		if ( argv[i][0] != '-' )
+			{
+			if ( files < MAX_FILES ) path[files++] = argv[i];
+			else usage = true;
+			continue;
+			}
+		switch (argv[i][1])
+			{
+			case 'B': if ( value ) budget = atoi(value); else usage = true; break;
+			case 'u': if ( value ) burst = atoi(value); else usage = true; break;
+			case 'D': if ( value ) duty = atoi(value); else usage = true; break;
+			case 'e': if ( value ) errorChance = atof(value); else usage = true; break;
+			case 't': if ( value ) serviceMs = atoi(value); else usage = true; break;
+			case 's': if ( value ) simulated = atoi(value); else usage = true; break;
+			case 'n': if ( value ) seconds = atoi(value); else usage = true; break;
+			case 'q': if ( value ) request = atoi(value); else usage = true; break;
+			case 'o': if ( value ) outPath = (char *)value; else usage = true; break;
+			case 'v':
+				printf("\nCapeMCA Telemetry Simulation %s\n\n",VERSION_STRING);
+				return( 0 );
+			default:
+				usage = true;
+			}
+		}
+	if ( simulated ? (files > 0) || (simulated > MAX_FILES) : files < 1 ) usage = true;
+	if ( (budget < 1) || (duty < 1) || (duty > TELEMETRY_MAX_DECIMATION) || (serviceMs < 1) || (seconds < 1) ) usage = true;
+	if ( simulated && !ValidRequest(request) ) usage = true;
+	if ( usage )
+		{
+		printf("%s",help);
+		return( 1 );
+		}
+
+	TelemetryMux mux(budget,burst,duty);
+	curve.DefaultBands();
+	sources = simulated ? simulated : files;
+	for (int d=0; d<sources; d++)
+		{
+		next[d] = new McaFrame;
+		previousChannels[d] = 0;
+		id[d] = d;									// source order until a packet0 names the detector
+		if ( simulated )
+			{
+			sim[d] = new McaSim(d+1,d+1);
+			pending[d] = true;
+			next[d]->hostTime = 0.0;
+			}
+		else
+			{
+			if ( !(f[d] = fopen(path[d],"rb")) )
+				{
+				printf("Cannot open %s\n",path[d]);
+				return( 1 );
+				}
+			pending[d] = ReadFrameBinary(f[d],next[d]);
+			}
+		}
+	if ( outPath && !(ground.out = fopen(outPath,"wb")) )
+		{
+		printf("Cannot open %s\n",outPath);
+		return( 1 );
+		}
+
+	t = MonotonicSeconds();
+	for (;;)										// readouts in time order, link serviced in between
+		{
+		int first = -1;
+		McaFrame *frame;
+
+		for (int d=0; d<sources; d++)
+			if ( pending[d] && ((first < 0) || (next[d]->hostTime < next[first]->hostTime)) ) first = d;
+		if ( first < 0 ) break;
+		frame = next[first];
+		if ( simulated )							// readout of the simulated MCA at hostTime
+			{
+			uint8_t cmd[2] = { 0, (uint8_t)request };
+			static uint8_t response[MAX_RESPONSE_BYTES];
+			double hostTime = frame->hostTime;
+			sim[first]->Acquire(1);
+			frame->Decode(response,sim[first]->Respond(cmd,2,response),request);
+			frame->hostTime = hostTime;
+			}
+		if ( t0 < 0.0 ) t0 = frame->hostTime;
+		ms = (uint32_t)((frame->hostTime - t0)*1000.0 + 0.5);
+		for (; lastMs + serviceMs <= ms; lastMs += serviceMs)	// the link runs while waiting for the frame
+			mux.Service(lastMs + serviceMs,Downlink,&ground);
+		frames++;
+		if ( frame->hasPacket0 ) id[first] = frame->packet0.capemcaId;
+
+		if ( (errorChance > 0.0) && (rand() < errorChance*RAND_MAX) )	// a failed readout on the flight side
+			{
+			uint8_t event[9];
+			memcpy(event,&ms,4);
+			memcpy(event+4,&id[first],4);
+			event[8] = EVENT_RCODE;
+			mux.Submit(TELEMETRY_EVENT,event,sizeof(event),ms);
+			}
+		if ( frame->hasPacket0 )					// every frame
+			{
+			TELEMETRY_SUMMARY_PAYLOAD summary;
+			summary.ms = ms;
+			summary.cps = frame->packet0.cps;
+			summary.totalCount = frame->packet0.totalCount;
+			summary.totalPulseTime = frame->packet0.totalPulseTime;
+			summary.totalIntervals = frame->packet0.totalIntervals;
+			summary.countInRangeArray = frame->packet0.countInRangeArray;
+			mux.Submit(TELEMETRY_SUMMARY,&summary,sizeof(summary),ms);
+			}
+		if ( curve.Process(id[first],*frame,&record,counts) )	// ms(4) capemcaId(4) liveTime(4) counts
+			{
+			memcpy(payload,&ms,4);
+			memcpy(payload+4,&record.capemcaId,4);
+			memcpy(payload+8,&record.liveTime,4);
+			memcpy(payload+12,counts,4*curve.bands);
+			mux.Submit(TELEMETRY_LIGHTCURVE,payload,12 + 4*curve.bands,ms);
+			}
+		if ( frame->channels )						// interval spectrum, ms(4) capemcaId(4) channels(2) packed
+			{
+			if ( frame->channels == previousChannels[first] )
+				{
+				if ( IntervalSpectrum(frame->spectrum,previous[first],interval,frame->channels) )
+					{
+					int packed = TelemetryPackSpectrum(interval,frame->channels,payload+10,sizeof(payload)-10);
+					memcpy(payload,&ms,4);
+					memcpy(payload+4,&id[first],4);
+					payload[8] = frame->channels & 0xFF;
+					payload[9] = frame->channels >> 8;
+					if ( packed ) mux.Submit(TELEMETRY_SPECTRUM,payload,10 + packed,ms);
+					else tooBig++;
+					}
+				else
+					{
+					uint8_t event[9];				// device was zeroed between readouts
+					memcpy(event,&ms,4);
+					memcpy(event+4,&id[first],4);
+					event[8] = EVENT_ZEROED;
+					mux.Submit(TELEMETRY_EVENT,event,sizeof(event),ms);
+					}
+				}
+			memcpy(previous[first],frame->spectrum,4*frame->channels);
+			previousChannels[first] = frame->channels;
+			}
+		if ( mux.Pending() > peakPending ) peakPending = mux.Pending();
+
+		if ( simulated )
+			{
+			frame->hostTime += sim[first]->usPerInterval*1.0e-6;
+			pending[first] = frame->hostTime - t0 < seconds;
+			}
+		else pending[first] = ReadFrameBinary(f[first],next[first]);
+		}
+	for (int drain=0; mux.Pending() && (drain < 60000/serviceMs); drain++)	// up to a minute to empty the queues
+		{
+		lastMs += serviceMs;
+		mux.Service(lastMs,Downlink,&ground);
+		}
+	t = MonotonicSeconds() - t;
+	if ( ground.out ) fclose(ground.out);
+
+	printf("class,offered,queued,sent,dropped,decimated,received,bytes,budgetShare,meanLatencyMs,maxLatencyMs\n");
+	for (int c=0; c<TELEMETRY_CLASSES; c++)
+		{
+		TELEMETRY_CLASS_STATS &s = mux.stats[c];
+		printf("%s,%u,%u,%u,%u,%u,%llu,%llu,%.3f,%.1f,%u\n",className[c],s.offered,s.queued,s.sent,s.dropped,s.decimated,
+				(unsigned long long)ground.records[c],(unsigned long long)s.bytes,
+				lastMs ? s.bytes/(budget*lastMs/1000.0) : 0.0,s.sent ? (double)s.latencySum/s.sent : 0.0,s.latencyMax);
+		}
+	printf("%llu frames over %.1f s at %u bytes/s, %llu bytes sent, %.1f%% of budget, %u bytes peak backlog\n",
+			(unsigned long long)frames,lastMs/1000.0,budget,(unsigned long long)ground.bytes,
+			lastMs ? 100.0*ground.bytes/(budget*lastMs/1000.0) : 0.0,peakPending);
+	printf("spectrum duty 1 in %u, now 1 in %u; %llu spectra over %d bytes packed\n",mux.spectrumDuty,mux.spectrumEvery,
+			(unsigned long long)tooBig,TELEMETRY_MAX_PAYLOAD);
+	printf("ground: %u frames, %u bad crc, %u lost, %llu bad spectra; %.1f us per frame\n",ground.parser.frames,
+			ground.parser.badCrc,ground.parser.lost,(unsigned long long)ground.badSpectra,frames ? t/frames*1.0e6 : 0.0);
+	return( 0 );
+}
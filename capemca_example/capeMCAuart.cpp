@@ -9,6 +9,7 @@
 #include <stdio.h>									// for printf to console
 #include "packet0type.h"
 #include "version.h"
+#include "mcaOutput.h"
 
 /* #define SPECTRUM_SIZE 4096							// max. number of channels in spectrum */
 #define SPECTRUM_SIZE 512							// max. number of channels in spectrum
@@ -50,12 +51,14 @@ HANDLE OpenComPort( char *port, DWORD baudRate, BYTE dataBits, BYTE parity, BYTE
 	COMMTIMEOUTS cto;
 	COMMCONFIG commConfig;
 	HANDLE commFile = NULL;
-	TCHAR *pcCommPort = TEXT(port);
+	char path[32];								// device namespace path also reaches COM10 and up
 	
 	SecureZeroMemory(&dcb, sizeof(DCB));		//  Initialize the DCB structure.
 	dcb.DCBlength = sizeof(DCB);
+	_snprintf(path, sizeof(path)-1, "\\\\.\\%s", port);
+	path[sizeof(path)-1] = '\0';
 												//  Open a handle to the specified com port.
-	commFile = CreateFile("\\\\.\\COM3",
+	commFile = CreateFile(path,
 							GENERIC_READ | GENERIC_WRITE,
 							0,							//  must be opened with exclusive-access
 							NULL,						//  default security attributes
@@ -162,7 +165,7 @@ int ReadComPort(HANDLE commFile, BYTE *buffer, int length )
 
 int main( int argc, char * argv[] )
 {
-	bool i, version, usage, success, zero;
+	bool version, usage, success, zero;
 	char *c, port[20] = "COM1";
 	DWORD bytesWritten, baudRate = 115200;
 	HANDLE commFile;
@@ -198,11 +201,11 @@ int main( int argc, char * argv[] )
 			case 'p':
 				if ( (argv[i][2] == '=') )
 					{
-					i = 0;
+					int k = 0;					// own index, i is still walking argv
 					c = argv[i] + 3;			// ptr to start of port name
-					while( (*c != ' ') && (i < 19) )
-						port[i++] = *c++;
-					port[i] = '\0';				// null-terminate the string
+					while( *c && (*c != ' ') && (k < 19) )
+						port[k++] = *c++;
+					port[k] = '\0';				// null-terminate the string
 					}
 				else usage = true;				// flag bad command line
 				break;
@@ -289,16 +292,13 @@ int main( int argc, char * argv[] )
 			if ( bytesInSpectrum )					// move bytes to local spectrum
 				{
 				memcpy(spectrum,allBytes,bytesInSpectrum);
-				printf("Spectrum:\nchannel,count\n");
-				for (int i=1; i<bytesInSpectrum/4; i++)
-					printf("%d,%u\n", i,spectrum[i]);	
+				printf("Spectrum:\n");
+				WriteSpectrumCsv(stdout,spectrum,bytesInSpectrum/4);
 				}
 			if ( bytesInPacket )					// move packet bytes to local struct
 				{
 				memcpy(&packet0,allBytes+bytesInSpectrum,bytesInPacket);
-				printf("cps,totalCount,totalPulseTime,usPerInterval,totalIntervals,capemcaId\n");
-				printf("%g,%g,%g,%d,%d,%d\n",packet0.cps,packet0.totalCount,packet0.totalPulseTime,
-										packet0.usPerInterval,packet0.totalIntervals,packet0.capemcaId);
+				WritePacket0Csv(stdout,packet0);
 				}
 			}
 		else printf("Data transmission error.\n");
@@ -5,11 +5,17 @@
 EXEFILE = capeMCAuart.exe
 #					These are the header files for the application
 HDRFILES = \
+	mcaFrame.h \
+	mcaOutput.h \
+	mcaSparse.h \
 	packet0type.h \
 	version.h
 #	
 #					Object files (targets of compilation)
 OBJFILES = \
+	mcaFrame.obj \
+	mcaOutput.obj \
+	mcaSparse.obj \
 	capeMCAuart.obj
 #
 #					Must explicitly list all .lib files used
@@ -0,0 +1,157 @@
+///////////////////////////////////////////////////////////////////////////////////////////
+//  Linux version of the uart command line test (see capeMCAuart.cpp for Windows)       //
+//                                                                                       //
+//  Build with the Makefile in this folder:  $ make capeMCAuartlinux                     //
+//  The serial device (e.g. /dev/ttyUSB0) must be readable and writable by the user.     //
+//                                                                                       //
+///////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "version.h"
+#include "mcaFrame.h"
+#include "mcaOutput.h"
+#include "mcaTransport.h"
+
+static char help[] = "CapeMCA Uart Interface\n\n\
+Usage: capeMCAuartlinux [flags]\n\n\
+Flags:\n\
+  -b=115200 : use baud rate 115200 bit/s (default)\n\
+  -c=count : spectrum columns, channel,count (default), channel or count\n\
+  -n : print only the channels with counts\n\
+  -p=/dev/ttyUSB0 : use /dev/ttyUSB0 for serial port (default)\n\
+  -q=8 : request type {0,1,2,4,8,16,32+1,32+2,32+4,32+8,32+16}\n\
+  -h : display this help message\n\
+  -v : print version info\n\
+  -z : zero spectrum before request\n\
+\nRead energy spectrum from 1 macropixel via serial port.\
+\nSpectral output is streamed to the console.\n";
+
+void printversion()									// Print the version number
+{
+	printf("\nCapeMCA Uart Test %d-bit Version %d.%d.%d\n",(int)sizeof(void *)*8,
+										VERSION_MAJOR,VERSION_MINOR,VERSION_RELEASE);
+	printf("Trademark (TM) 2021 CapeSym, Inc.\nCopyright (c) 2020-2023 CapeSym, Inc.\n\n");
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main( int argc, char * argv[] )
+{
+	bool version, usage, success, zero;
+	char port[64] = "/dev/ttyUSB0";
+	int baudRate = 115200, request = 8;
+	UartTransport uart;
+	McaFrame frame;
+	CsvWriter csv(stdout);
+
+	zero = false;
+	success = true;
+	usage = false;									// reset flags for all behaviors
+	version = false;
+
+	// Process Command Line Arguments ///////////////////////////////////////////////////////////
+
+	for (int i=1; i<argc; i++)						// parse command line
+		{
+		if ( argv[i][0] == '-' )
+		  {
+		  switch (argv[i][1])
+			{
+			case 'b':
+				if ( (argv[i][2] == '=') ) baudRate = atoi(argv[i]+3);
+				else usage = true;					// flag bad command line
+				break;
+			case 'p':
+				if ( (argv[i][2] == '=') )
+					{
+					strncpy(port,argv[i]+3,sizeof(port)-1);
+					port[sizeof(port)-1] = '\0';	// null-terminate the string
+					}
+				else usage = true;
+				break;
+			case 'c':
+				if ( (argv[i][2] == '=') && !strcmp(argv[i]+3,"channel,count") ) csv.columns = CSV_COLUMNS_ALL;
+				else if ( (argv[i][2] == '=') && !strcmp(argv[i]+3,"channel") ) csv.columns = CSV_COLUMN_CHANNEL;
+				else if ( (argv[i][2] == '=') && !strcmp(argv[i]+3,"count") ) csv.columns = CSV_COLUMN_COUNT;
+				else usage = true;
+				break;
+			case 'N':
+			case 'n':
+				csv.nonzeroOnly = true;
+				break;
+			case 'q':
+				if ( (argv[i][2] == '=') ) request = atoi(argv[i]+3);
+				else usage = true;
+				if ( !ValidRequest(request) ) usage = true;
+				break;
+			case 'H':
+			case 'h':								// print the help and exit
+			case '?':
+				usage = true;
+				break;
+			case 'V':
+			case 'v':								// print the code release version number
+				version = true;
+				break;
+			case 'Z':
+			case 'z':
+				zero = true;
+				break;
+			default:
+				usage = true;
+			}
+		  }
+		}
+	if ( version )
+		{
+		printversion();
+		success = false;
+		}
+	if ( usage )
+		{
+		printf("%s",help);
+		success = false;
+		}
+
+////////////////////////// Run //////////////////////////////////////////////////////////////////////////////////////////
+
+	if ( success )
+		{
+		printf("\nConnecting to MCA\n");
+		if ( !uart.Open(port,baudRate) )
+			{
+			printf("Device not connected or serial port incorrect.\n");
+			return( 1 );
+			}
+		printf("%s open at %d baud, 8 data, no parity, 1 stop, no handshaking\n",port,baudRate);
+
+		if ( zero )									// user wants to first zero out the MCA
+			if ( McaZero(&uart) )
+				printf("\nZero command was processed by MCA.\n");
+
+		printf("\nRequesting data from MCA...\n");
+		if ( McaRequest(&uart,request,&frame) )
+			{
+			if ( frame.channels )
+				{
+				printf("Spectrum:\n");
+				csv.Spectrum(frame.spectrum,frame.channels);
+				}
+			if ( frame.hasPacket0 )
+				csv.Packet0(frame.packet0);
+			csv.Flush();
+			}
+		else
+			{
+			printf("Data transmission error.\n");
+			success = false;
+			}
+
+		uart.Close();
+		printf("\nDone.\n");
+		}
+
+	return( success ? 0 : 1 );						// Linux convention, 0 on success
+}
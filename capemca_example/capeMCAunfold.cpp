@@ -0,0 +1,193 @@
+///////////////////////////////////////////////////////////////////////////////////////////
+//  Unfold measured spectra into incident photon spectra (see mcaUnfold.h)               //
+//                                                                                       //
+//  Each argument is a binary frame file (capeMCAreplay -o=frames.bin) of one detector.  //
+//  The interval spectrum between consecutive readouts is unfolded with MLEM or OSEM     //
+//  through a response matrix read with -r or built from the detector model and the      //
+//  absorber layers given with -a, starting from the previous interval's solution.       //
+//                                                                                       //
+///////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "version.h"
+#include "mcaOutput.h"
+#include "mcaUnfold.h"
+
+#define MAX_FILES		16
+
+static char help[] = "CapeMCA Spectrum Unfolding\n\n\
+Usage: capeMCAunfold [flags] detector0.bin detector1.bin ...\n\n\
+Flags:\n\
+  -r=response.csv : channel,bin,value response matrix instead of the model\n\
+  -k=0.5 : keV per 4096-channel unit for the model (default 0.5)\n\
+  -z=0 : keV at channel 0 (default 0)\n\
+  -e=20:2000:256 : incident energy range in keV and number of bins (default)\n\
+  -l : logarithmic energy bins\n\
+  -f=0.07 : fractional photopeak FWHM at 662 keV (default 0.07)\n\
+  -p=0.6 : photopeak share of the detected photons (default 0.6)\n\
+  -a=iron.csv:7.87 : absorber with keV,mu lines (cm^2/g) and g/cm^2, may be repeated\n\
+  -i=50 : largest number of passes (default 50)\n\
+  -t=1e-4 : stop when a pass changes the solution by less (default 1e-4)\n\
+  -s=4 : OSEM subsets, faster on high-count spectra (default 1, plain MLEM)\n\
+  -j=0 : threads, 0 for one per cpu (default 0)\n\
+  -c : cold start every interval instead of from the previous solution\n\
+  -o=unfolded.csv : write hostTime,capemcaId,bin,lowKeV,highKeV,photons rows\n\
+  -q : no per-interval lines on the console\n\
+  -h : display this help message\n\
+  -v : print version info\n";
+
+int main( int argc, char * argv[] )
+{
+	bool usage = false, quiet = false, cold = false;
+	char *path[MAX_FILES], *responsePath = NULL, *outPath = NULL;
+	int files = 0, threads = 0, layers = 0;
+	char *layerPath[UNFOLD_MAX_LAYERS];
+	double layerDensity[UNFOLD_MAX_LAYERS];
+	Unfolder *unfold[MAX_FILES];
+	Unfolder settings;
+	McaFrame *frame, *previous;
+	static uint32_t interval[MAX_SPECTRUM_SIZE];
+	FILE *f, *out = NULL;
+	uint64_t intervals = 0, passes = 0;
+	double seconds = 0.0, worst = 0.0, t;
+
+	for (int i=1; i<argc; i++)						// parse command line
+		{
+		const char *value = (argv[i][0] == '-') && (argv[i][1] != 0) && (argv[i][2] == '=') ? argv[i]+3 : NULL;
+
+		if ( argv[i][0] != '-' )
+			{
+			if ( files < MAX_FILES ) path[files++] = argv[i];
+			else usage = true;
+			continue;
+			}
+		switch (argv[i][1])
+			{
+			case 'r': if ( value ) responsePath = (char *)value; else usage = true; break;
+			case 'k': if ( value ) settings.model.keVPerChannel = atof(value); else usage = true; break;
+			case 'z': if ( value ) settings.model.offsetKeV = atof(value); else usage = true; break;
+			case 'e':
+				if ( !value || (sscanf(value,"%lf:%lf:%d",&settings.model.minKeV,&settings.model.maxKeV,
+										&settings.model.bins) != 3) ) usage = true;
+				break;
+			case 'l': settings.model.logBins = true; break;
+			case 'f': if ( value ) settings.model.fwhm662 = atof(value); else usage = true; break;
+			case 'p': if ( value ) settings.model.peakFraction = atof(value); else usage = true; break;
+			case 'a':
+				if ( value && strchr(value,':') && (layers < UNFOLD_MAX_LAYERS) )
+					{
+					layerPath[layers] = (char *)value;
+					layerDensity[layers++] = atof(strrchr(value,':')+1);
+					*strrchr(layerPath[layers-1],':') = 0;
+					}
+				else usage = true;
+				break;
+			case 'i': if ( value ) settings.iterations = atoi(value); else usage = true; break;
+			case 't': if ( value ) settings.tolerance = atof(value); else usage = true; break;
+			case 's': if ( value ) settings.subsets = atoi(value); else usage = true; break;
+			case 'j': if ( value ) threads = atoi(value); else usage = true; break;
+			case 'c': cold = true; break;
+			case 'o': if ( value ) outPath = (char *)value; else usage = true; break;
+			case 'q': quiet = true; break;
+			case 'v':
+				printf("\nCapeMCA Spectrum Unfolding %s\n\n",VERSION_STRING);
+				return( 0 );
+			default:
+				usage = true;
+			}
+		}
+	if ( (files < 1) || (settings.iterations < 1) || (settings.subsets < 1) || (settings.subsets > UNFOLD_MAX_SUBSETS) ||
+		 (settings.model.peakFraction < 0.0) || (settings.model.peakFraction > 1.0) || (threads < 0) ) usage = true;
+	if ( usage )
+		{
+		printf("%s",help);
+		return( 1 );
+		}
+	for (int n=0; n<layers; n++)
+		if ( !settings.AddLayer(layerPath[n],layerDensity[n]) ) return( 1 );
+	if ( outPath )
+		{
+		if ( !(out = fopen(outPath,"w")) )
+			{
+			printf("Cannot open %s\n",outPath);
+			return( 1 );
+			}
+		fprintf(out,"hostTime,capemcaId,bin,lowKeV,highKeV,photons\n");
+		}
+
+	if ( !quiet ) printf("hostTime,capemcaId,counts,photons,passes,change,ms\n");
+	frame = new McaFrame;
+	previous = new McaFrame;
+	for (int d=0; d<files; d++)						// one unfolder per detector keeps its warm start
+		{
+		uint32_t id = d;
+		unfold[d] = NULL;
+		if ( !(f = fopen(path[d],"rb")) )
+			{
+			printf("Cannot open %s\n",path[d]);
+			return( 1 );
+			}
+		previous->Clear();
+		while ( ReadFrameBinary(f,frame) )
+			{
+			if ( frame->hasPacket0 ) id = frame->packet0.capemcaId;
+			if ( frame->channels && (frame->channels == previous->channels) &&
+				 IntervalSpectrum(frame->spectrum,previous->spectrum,interval,frame->channels) )
+				{
+				uint64_t counts = 0;
+				double photons = 0.0;
+				Unfolder *u = unfold[d];
+				if ( !u || (u->channels != frame->channels) )	// matrix for this resolution
+					{
+					if ( !u )
+						{
+						u = unfold[d] = new Unfolder;
+						u->model = settings.model;
+						u->layers = settings.layers;
+						memcpy(u->layer,settings.layer,sizeof(settings.layer));
+						u->iterations = settings.iterations;
+						u->tolerance = settings.tolerance;
+						u->subsets = settings.subsets;
+						u->warm = !cold;
+						u->SetThreads(threads);
+						}
+					if ( responsePath ? !u->Load(responsePath,frame->channels) : !u->Build(frame->channels) )
+						{
+						printf("No response for %d channels\n",frame->channels);
+						return( 1 );
+						}
+					printf("%s: %d channels x %d bins, %u nonzeros, %d subsets, %d threads\n",path[d],u->channels,
+							u->bins,u->nonZeros,u->subsets,u->pool ? u->pool->threads + 1 : 1);
+					}
+				t = MonotonicSeconds();
+				u->Unfold(interval,frame->channels);
+				t = MonotonicSeconds() - t;
+				seconds += t;
+				if ( t > worst ) worst = t;
+				intervals++;
+				passes += u->lastIterations;
+				for (int i=0; i<frame->channels; i++) counts += interval[i];
+				for (int j=0; j<u->bins; j++) photons += u->x[j];
+				if ( !quiet )
+					printf("%.6f,%u,%llu,%.1f,%d,%.2e,%.3f\n",frame->hostTime,id,(unsigned long long)counts,photons,
+							u->lastIterations,u->lastChange,t*1000.0);
+				for (int j=0; out && (j<u->bins); j++)
+					if ( u->haveEdges ) fprintf(out,"%.6f,%u,%d,%.2f,%.2f,%.3f\n",frame->hostTime,id,j,u->edge[j],
+												u->edge[j+1],u->x[j]);
+					else fprintf(out,"%.6f,%u,%d,,,%.3f\n",frame->hostTime,id,j,u->x[j]);
+				}
+			McaFrame *swap = previous;
+			previous = frame;
+			frame = swap;
+			}
+		fclose(f);
+		}
+	if ( out ) fclose(out);
+
+	printf("%llu intervals, %.1f passes and %.3f ms per interval (worst %.3f ms)\n",(unsigned long long)intervals,
+			intervals ? (double)passes/intervals : 0.0,intervals ? seconds/intervals*1000.0 : 0.0,worst*1000.0);
+	for (int d=0; d<files; d++) delete unfold[d];
+	return( 0 );
+}
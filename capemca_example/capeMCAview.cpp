@@ -0,0 +1,99 @@
+///////////////////////////////////////////////////////////////////////////////////////////
+//  Read-only viewer of spectra published in shared memory (see mcaShared.h)             //
+//                                                                                       //
+//  Any number of viewers may run next to the acquiring process (capeMCArecord -m or     //
+//  capeMCAreplay -m); they never touch the device and never slow the publisher.         //
+//                                                                                       //
+///////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "version.h"
+#include "mcaShared.h"
+
+static char help[] = "CapeMCA Shared Memory Viewer\n\n\
+Usage: capeMCAview [flags]\n\n\
+Flags:\n\
+  -m=/capemca : shared memory name (default)\n\
+  -s=0 : print latest spectrum of device slot 0 as channel,count\n\
+  -a=0 : print accumulated spectrum of device slot 0 as channel,count\n\
+  -c=0 : print the dead-time corrected accumulated spectrum of device slot 0\n\
+  -n=1 : number of summaries to print (default 1)\n\
+  -i=1000 : milliseconds between summaries\n\
+  -h : display this help message\n\
+  -v : print version info\n";
+
+int main( int argc, char * argv[] )
+{
+	bool usage = false;
+	char shmName[64] = SHARED_DEFAULT_NAME;
+	int latestSlot = -1, accumulatedSlot = -1, correctedSlot = -1, count = 1, intervalMs = 1000;
+	SharedSpectra shared;
+	static SHARED_DEVICE d;
+
+	for (int i=1; i<argc; i++)						// parse command line
+		{
+		const char *value = (argv[i][0] == '-') && (argv[i][1] != 0) && (argv[i][2] == '=') ? argv[i]+3 : NULL;
+
+		if ( argv[i][0] != '-' )
+			{
+			usage = true;
+			continue;
+			}
+		switch (argv[i][1])
+			{
+			case 'm': if ( value ) strncpy(shmName,value,sizeof(shmName)-1); else usage = true; break;
+			case 's': if ( value ) latestSlot = atoi(value); else usage = true; break;
+			case 'a': if ( value ) accumulatedSlot = atoi(value); else usage = true; break;
+			case 'c': if ( value ) correctedSlot = atoi(value); else usage = true; break;
+			case 'n': if ( value ) count = atoi(value); else usage = true; break;
+			case 'i': if ( value ) intervalMs = atoi(value); else usage = true; break;
+			case 'v':
+				printf("\nCapeMCA Shared Memory Viewer %s\n\n",VERSION_STRING);
+				return( 0 );
+			default:
+				usage = true;
+			}
+		}
+	if ( usage )
+		{
+		printf("%s",help);
+		return( 1 );
+		}
+
+	if ( !shared.Attach(shmName) )
+		{
+		printf("No spectra published in %s\n",shmName);
+		return( 1 );
+		}
+
+	if ( (latestSlot >= 0) || (accumulatedSlot >= 0) || (correctedSlot >= 0) )	// one spectrum dump
+		{
+		int slot = latestSlot >= 0 ? latestSlot : accumulatedSlot >= 0 ? accumulatedSlot : correctedSlot;
+		if ( !shared.Snapshot(slot,&d) )
+			{
+			printf("No device in slot %d\n",slot);
+			return( 1 );
+			}
+		printf("channel,count\n");
+		for (uint32_t i=1; i<d.channels; i++)
+			if ( latestSlot >= 0 ) printf("%u,%u\n",i,d.latest[i]);
+			else if ( accumulatedSlot >= 0 ) printf("%u,%llu\n",i,(unsigned long long)d.accumulated[i]);
+			else printf("%u,%.1f\n",i,d.corrected[i]);
+		return( 0 );
+		}
+
+	for (int n=0; n<count; n++)						// periodic summary of every device
+		{
+		printf("slot,capemcaId,frames,channels,cps,totalCount,totalIntervals\n");
+		for (uint32_t slot=0; slot<shared.region->devices; slot++)
+			if ( shared.Snapshot(slot,&d) )
+				printf("%u,%u,%llu,%u,%g,%g,%u\n",slot,d.capemcaId,(unsigned long long)d.frames,d.channels,
+						d.hasPacket0 ? d.packet0.cps : 0.0f,d.hasPacket0 ? d.packet0.totalCount : 0.0f,
+						d.hasPacket0 ? d.packet0.totalIntervals : 0);
+		if ( n+1 < count ) usleep(intervalMs*1000);
+		}
+	return( 0 );
+}
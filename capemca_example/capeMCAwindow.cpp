@@ -0,0 +1,86 @@
+///////////////////////////////////////////////////////////////////////////////////////////
+//  Summed spectrum of any time window from a prefix-sum index (see mcaIndex.h)          //
+//                                                                                       //
+//  Example: $ ./capeMCAwindow -a=1718000000 -b=1718003600 flight                        //
+//  prints the spectrum of all intervals lying inside that hour as channel,count CSV.    //
+//                                                                                       //
+///////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "version.h"
+#include "mcaIndex.h"
+
+static char help[] = "CapeMCA Window Sum\n\n\
+Usage: capeMCAwindow [flags] base\n\n\
+Flags:\n\
+  -a=t1 : window start, seconds on the index clock (default start of index)\n\
+  -b=t2 : window stop, seconds on the index clock (default end of index)\n\
+  -i : show index summary only\n\
+  -h : display this help message\n\
+  -v : print version info\n";
+
+int main( int argc, char * argv[] )
+{
+	bool usage = false, info = false;
+	char *base = NULL;
+	double t1 = -1.0e300, t2 = 1.0e300;
+	uint32_t a, b;
+	SpectrumIndex index;
+	static uint64_t sum[MAX_SPECTRUM_SIZE];
+
+	for (int i=1; i<argc; i++)						// parse command line
+		{
+		if ( argv[i][0] != '-' )
+			{
+			base = argv[i];
+			continue;
+			}
+		switch (argv[i][1])
+			{
+			case 'a':
+				if ( argv[i][2] == '=' ) t1 = atof(argv[i]+3);
+				else usage = true;
+				break;
+			case 'b':
+				if ( argv[i][2] == '=' ) t2 = atof(argv[i]+3);
+				else usage = true;
+				break;
+			case 'i':
+				info = true;
+				break;
+			case 'v':
+				printf("\nCapeMCA Window Sum %s\n\n",VERSION_STRING);
+				return( 0 );
+			default:
+				usage = true;
+			}
+		}
+	if ( !base || (t2 < t1) ) usage = true;
+	if ( usage )
+		{
+		printf("%s",help);
+		return( 1 );
+		}
+
+	if ( !index.Open(base) ) return( 1 );
+	if ( info || (index.intervals == 0) )
+		{
+		printf("capemcaId %u, %u channels, %u intervals, checkpoint every %u\n",index.header.capemcaId,
+				index.header.channels,index.intervals,index.header.checkpointEvery);
+		if ( index.intervals )
+			printf("%.6f to %.6f\n",index.startTimes[0],index.stopTimes[index.intervals-1]);
+		return( 0 );
+		}
+
+	if ( !index.SumTime(t1,t2,sum,&a,&b) )
+		{
+		printf("Index read failed.\n");
+		return( 1 );
+		}
+	printf("intervals %u to %u\n",a,b);
+	printf("channel,count\n");
+	for (uint32_t i=1; i<index.header.channels; i++)
+		printf("%u,%llu\n",i,(unsigned long long)sum[i]);
+	return( 0 );
+}
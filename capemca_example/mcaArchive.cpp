@@ -0,0 +1,565 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Class methods for the time-partitioned spectrum archive
+//   definitions in mcaArchive.h
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "mcaArchive.h"
+
+#define ARCHIVE_READ_BLOCK		64					// records per pread when walking a level
+
+const double archiveBinSeconds[ARCHIVE_LEVELS] = { 0.0, 60.0, 600.0, 3600.0 };
+
+static size_t RecordBytes( int level, int channels )
+{
+	return( sizeof(ARCHIVE_RECORD) + channels*(level ? 8 : 4) );
+}
+
+void MergeArchiveRecord( ARCHIVE_RECORD *into, const ARCHIVE_RECORD &record )
+{
+	if ( !record.intervals ) return;
+	if ( !into->intervals || (record.startTime < into->startTime) ) into->startTime = record.startTime;
+	if ( !into->intervals || (record.stopTime > into->stopTime) ) into->stopTime = record.stopTime;
+	if ( record.packets )
+		{
+		if ( !into->packets || (record.cpsMin < into->cpsMin) ) into->cpsMin = record.cpsMin;
+		if ( !into->packets || (record.cpsMax > into->cpsMax) ) into->cpsMax = record.cpsMax;
+		}
+	into->seconds += record.seconds;
+	into->intervals += record.intervals;
+	into->packets += record.packets;
+	into->cpsSum += record.cpsSum;
+	into->cpsSquares += record.cpsSquares;
+	into->counts += record.counts;
+}
+
+static bool ReadHeader( int fd, ARCHIVE_FILE_HEADER *h )
+{
+	return( (pread(fd,h,sizeof(*h),0) == (ssize_t)sizeof(*h)) && (h->magic == ARCHIVE_MAGIC) &&
+			(h->version == ARCHIVE_VERSION) && (h->level < ARCHIVE_LEVELS) &&
+			(h->channels >= 1) && (h->channels <= MAX_SPECTRUM_SIZE) );
+}
+
+static uint32_t FileRecords( int fd, const ARCHIVE_FILE_HEADER &h )	// a torn last record is left out
+{
+	struct stat st;
+
+	if ( h.level ) return( h.records );
+	if ( (fstat(fd,&st) < 0) || (st.st_size < (off_t)sizeof(h)) ) return( 0 );
+	return( (uint32_t)((st.st_size - sizeof(h))/RecordBytes(0,h.channels)) );
+}
+
+static uint32_t FirstRecordAt( int fd, size_t recordBytes, uint32_t records, double t, uint64_t *bytes )
+{													// first record with startTime >= t
+	uint32_t lo = 0, hi = records, mid;
+	double start;
+
+	while ( lo < hi )
+		{
+		mid = lo + (hi - lo)/2;
+		if ( pread(fd,&start,sizeof(start),sizeof(ARCHIVE_FILE_HEADER) + (uint64_t)mid*recordBytes) != sizeof(start) )
+			return( records );
+		*bytes += sizeof(start);
+		if ( start < t ) lo = mid + 1;
+		else hi = mid;
+		}
+	return( lo );
+}
+
+////// SpectrumArchive //////////////////////////////////////////////////////////////////////////////
+
+SpectrumArchive::SpectrumArchive()					// constructor
+{
+	dir[0] = 0;
+	memset(&header,0,sizeof(header));
+	partitions = 0;
+	rawFd = -1;
+	rawRecords = 0;
+	lastStart = writtenUntil = -HUGE_VAL;
+	lastReadoutTime = 0.0;
+	haveReadout = false;
+	block = NULL;
+	bytesRead = 0;
+	memset(recordsRead,0,sizeof(recordsRead));
+	maxLevel = ARCHIVE_LEVELS - 1;
+	pthread_mutex_init(&lock,NULL);
+	compacting = false;
+	compactSeconds = 10.0;
+	compactedThrough = 0;
+}
+
+SpectrumArchive::~SpectrumArchive()					// destructor
+{
+	Close();
+	pthread_mutex_destroy(&lock);
+}
+
+void SpectrumArchive::Close( void )
+{
+	StopCompactor();
+	if ( rawFd >= 0 ) close(rawFd);
+	rawFd = -1;
+	free(block);
+	block = NULL;
+	partitions = 0;
+	rawRecords = 0;
+	lastStart = writtenUntil = -HUGE_VAL;
+	haveReadout = false;
+	compactedThrough = 0;
+}
+
+void SpectrumArchive::PartitionPath( char *path, size_t size, double start, int level )
+{
+	snprintf(path,size,"%s/%lld.L%d",dir,(long long)start,level);
+}
+
+static int ScanPartitions( const char *dir, double *starts, bool remove )
+{													// level 0 files, or delete every level
+	DIR *d = opendir(dir);
+	struct dirent *e;
+	char path[512];
+	int n = 0;
+
+	if ( !d ) return( 0 );
+	while ( (e = readdir(d)) )
+		{
+		long long start;
+		int level, length = 0;
+		if ( (sscanf(e->d_name,"%lld.L%d%n",&start,&level,&length) != 2) || e->d_name[length] ||
+			 (level < 0) || (level >= ARCHIVE_LEVELS) ) continue;
+		if ( remove )
+			{
+			snprintf(path,sizeof(path),"%s/%s",dir,e->d_name);
+			unlink(path);
+			}
+		else if ( (level == 0) && (n < ARCHIVE_MAX_PARTITIONS) ) starts[n++] = (double)start;
+		}
+	closedir(d);
+	for (int i=1; i<n; i++)							// insertion sort, names come in any order
+		for (int j=i; (j > 0) && (starts[j-1] > starts[j]); j--)
+			{
+			double t = starts[j];
+			starts[j] = starts[j-1];
+			starts[j-1] = t;
+			}
+	return( n );
+}
+
+bool SpectrumArchive::Create( const char *directory, int channels, uint32_t capemcaId, double partitionSeconds )
+{
+	Close();
+	if ( (channels < 1) || (channels > MAX_SPECTRUM_SIZE) || (partitionSeconds < archiveBinSeconds[ARCHIVE_LEVELS-1]) ||
+		 (fmod(partitionSeconds,archiveBinSeconds[ARCHIVE_LEVELS-1]) != 0.0) ) return( false );
+	if ( (mkdir(directory,0755) < 0) && (errno != EEXIST) )
+		{
+		printf("Cannot create archive %s\n",directory);
+		return( false );
+		}
+	snprintf(dir,sizeof(dir),"%s",directory);
+	ScanPartitions(dir,NULL,true);					// start over, like SpectrumIndex::Create
+	memset(&header,0,sizeof(header));
+	header.magic = ARCHIVE_MAGIC;
+	header.version = ARCHIVE_VERSION;
+	header.channels = channels;
+	header.capemcaId = capemcaId;
+	header.partitionSeconds = partitionSeconds;
+	block = (uint8_t *)malloc(RecordBytes(0,channels));
+	return( block != NULL );
+}
+
+bool SpectrumArchive::Open( const char *directory, bool append )
+{
+	char path[512];
+	int fd;
+
+	Close();
+	snprintf(dir,sizeof(dir),"%s",directory);
+	if ( !(partitions = ScanPartitions(dir,partitionStart,false)) )
+		{
+		printf("No archive partitions in %s\n",dir);
+		return( false );
+		}
+	PartitionPath(path,sizeof(path),partitionStart[partitions-1],0);
+	if ( ((fd = open(path,append ? O_RDWR : O_RDONLY)) < 0) || !ReadHeader(fd,&header) || header.level )
+		{
+		printf("%s is not a version %d archive partition\n",path,ARCHIVE_VERSION);
+		if ( fd >= 0 ) close(fd);
+		partitions = 0;
+		return( false );
+		}
+	rawRecords = FileRecords(fd,header);
+	if ( rawRecords )
+		{
+		pread(fd,&lastStart,sizeof(lastStart),sizeof(header) + (uint64_t)(rawRecords-1)*RecordBytes(0,header.channels));
+		writtenUntil = lastStart;
+		}
+	if ( !append )
+		{
+		close(fd);
+		return( true );
+		}
+	rawFd = fd;
+	block = (uint8_t *)malloc(RecordBytes(0,header.channels));
+	return( block != NULL );
+}
+
+bool SpectrumArchive::Append( double startTime, double stopTime, const uint32_t *interval, const PACKET0_TYPE *packet0 )
+{
+	ARCHIVE_RECORD r;
+	size_t recordBytes = RecordBytes(0,header.channels);
+	double start = floor(startTime/header.partitionSeconds)*header.partitionSeconds;
+	char path[512];
+
+	if ( !block || !(startTime > lastStart) ) return( false );	// intervals come in time order
+	if ( !partitions || (start > partitionStart[partitions-1]) )
+		{													// rotate into a new partition
+		if ( partitions == ARCHIVE_MAX_PARTITIONS ) return( false );
+		if ( rawFd >= 0 ) close(rawFd);
+		PartitionPath(path,sizeof(path),start,0);
+		if ( (rawFd = open(path,O_RDWR | O_CREAT | O_TRUNC,0644)) < 0 )
+			{
+			printf("Cannot create %s\n",path);
+			return( false );
+			}
+		header.level = 0;
+		header.records = 0;
+		header.partitionStart = start;
+		header.builtUntil = start;
+		ARCHIVE_FILE_HEADER h = header;
+		if ( pwrite(rawFd,&h,sizeof(h),0) != (ssize_t)sizeof(h) ) return( false );
+		rawRecords = 0;
+		pthread_mutex_lock(&lock);
+		partitionStart[partitions++] = start;
+		pthread_mutex_unlock(&lock);
+		}
+
+	memset(&r,0,sizeof(r));
+	r.startTime = startTime;
+	r.stopTime = stopTime;
+	r.seconds = stopTime - startTime;
+	r.intervals = 1;
+	if ( packet0 )
+		{
+		r.packets = 1;
+		r.cpsMin = r.cpsMax = packet0->cps;
+		r.cpsSum = packet0->cps;
+		r.cpsSquares = (double)packet0->cps*packet0->cps;
+		}
+	for (uint32_t i=0; i<header.channels; i++) r.counts += interval[i];
+	memcpy(block,&r,sizeof(r));						// one write, a crash tears at most this record
+	memcpy(block+sizeof(r),interval,header.channels*4);
+	if ( pwrite(rawFd,block,recordBytes,sizeof(header) + (uint64_t)rawRecords*recordBytes) != (ssize_t)recordBytes )
+		return( false );
+	rawRecords++;
+	pthread_mutex_lock(&lock);
+	lastStart = writtenUntil = startTime;
+	pthread_mutex_unlock(&lock);
+	return( true );
+}
+
+bool SpectrumArchive::AppendReadout( const McaFrame &frame )
+{
+	uint32_t interval[MAX_SPECTRUM_SIZE];
+	bool ok = true;
+
+	if ( frame.channels != (int)header.channels ) return( false );
+	if ( haveReadout )								// a zeroed device starts a new interval
+		{
+		IntervalSpectrum(frame.spectrum,lastReadout,interval,frame.channels);
+		ok = Append(lastReadoutTime,frame.hostTime,interval,frame.hasPacket0 ? &frame.packet0 : NULL);
+		}
+	memcpy(lastReadout,frame.spectrum,frame.channels*4);
+	lastReadoutTime = frame.hostTime;
+	haveReadout = true;
+	return( ok );
+}
+
+bool SpectrumArchive::Level( int partition, int level, ARCHIVE_FILE_HEADER *levelHeader )
+{
+	char path[512];
+	int fd;
+	bool ok;
+
+	if ( (partition < 0) || (partition >= partitions) || (level < 0) || (level >= ARCHIVE_LEVELS) ) return( false );
+	PartitionPath(path,sizeof(path),partitionStart[partition],level);
+	if ( (fd = open(path,O_RDONLY)) < 0 ) return( false );
+	ok = ReadHeader(fd,levelHeader);
+	if ( ok && !level ) levelHeader->records = FileRecords(fd,*levelHeader);
+	close(fd);
+	return( ok );
+}
+
+////// compaction ///////////////////////////////////////////////////////////////////////////////////
+
+int SpectrumArchive::CompactLevel( int partition, int level, double sealed )
+{
+	double B = archiveBinSeconds[level], pS = partitionStart[partition], pE = pS + header.partitionSeconds;
+	double limit, bin = 0.0;
+	int channels = header.channels, fd, finerFd, written = 0;
+	size_t bytes = RecordBytes(level,channels), finerBytes = RecordBytes(level-1,channels);
+	ARCHIVE_FILE_HEADER h, finer;
+	ARCHIVE_RECORD r, out;
+	uint32_t finerRecords, first;
+	uint64_t *acc, searched = 0;
+	uint8_t *buffer;
+	char path[512];
+
+	PartitionPath(path,sizeof(path),pS,level-1);
+	if ( (finerFd = open(path,O_RDONLY)) < 0 ) return( 0 );
+	if ( !ReadHeader(finerFd,&finer) || (finer.channels != (uint32_t)channels) )
+		{
+		close(finerFd);
+		return( 0 );
+		}
+	limit = sealed >= pE ? pE : floor(sealed/B)*B;	// whole bins no interval can still join
+	if ( level > 1 ) limit = fmin(limit,floor(finer.builtUntil/B)*B);
+
+	PartitionPath(path,sizeof(path),pS,level);
+	if ( (fd = open(path,O_RDWR | O_CREAT,0644)) < 0 )
+		{
+		close(finerFd);
+		return( 0 );
+		}
+	if ( !ReadHeader(fd,&h) || (h.level != (uint32_t)level) || (h.channels != (uint32_t)channels) )
+		{
+		h = finer;									// new level file
+		h.level = level;
+		h.records = 0;
+		h.builtUntil = pS;
+		}
+	if ( (limit <= h.builtUntil) || (ftruncate(fd,sizeof(h) + (uint64_t)h.records*bytes) < 0) )
+		{											// nothing new, or drop bins of a torn run
+		close(fd);
+		close(finerFd);
+		return( 0 );
+		}
+
+	finerRecords = FileRecords(finerFd,finer);
+	first = FirstRecordAt(finerFd,finerBytes,finerRecords,h.builtUntil,&searched);
+	buffer = (uint8_t *)malloc(ARCHIVE_READ_BLOCK*finerBytes + bytes);
+	acc = (uint64_t *)(buffer + ARCHIVE_READ_BLOCK*finerBytes + sizeof(out));
+	memset(&out,0,sizeof(out));
+	for (uint32_t x=first; buffer && (x<finerRecords); )
+		{
+		uint32_t n = finerRecords - x < ARCHIVE_READ_BLOCK ? finerRecords - x : ARCHIVE_READ_BLOCK;
+		bool done = false;
+		if ( pread(finerFd,buffer,n*finerBytes,sizeof(finer) + (uint64_t)x*finerBytes) != (ssize_t)(n*finerBytes) ) break;
+		for (uint32_t k=0; (k<n) && !done; k++)
+			{
+			const uint8_t *at = buffer + k*finerBytes;
+			memcpy(&r,at,sizeof(r));
+			if ( r.startTime >= limit )
+				{
+				done = true;
+				break;
+				}
+			double b = floor(r.startTime/B)*B;
+			if ( out.intervals && (b != bin) )		// bin complete
+				{
+				memcpy(buffer + ARCHIVE_READ_BLOCK*finerBytes,&out,sizeof(out));
+				pwrite(fd,buffer + ARCHIVE_READ_BLOCK*finerBytes,bytes,sizeof(h) + (uint64_t)h.records*bytes);
+				h.records++;
+				written++;
+				memset(&out,0,sizeof(out));
+				}
+			if ( !out.intervals ) memset(acc,0,channels*8);
+			bin = b;
+			MergeArchiveRecord(&out,r);
+			if ( level == 1 ) for (int i=0; i<channels; i++) acc[i] += ((const uint32_t *)(at + sizeof(r)))[i];
+			else for (int i=0; i<channels; i++) acc[i] += ((const uint64_t *)(at + sizeof(r)))[i];
+			}
+		if ( done ) break;
+		x += n;
+		}
+	if ( buffer && out.intervals )					// last bin, complete as it lies below limit
+		{
+		memcpy(buffer + ARCHIVE_READ_BLOCK*finerBytes,&out,sizeof(out));
+		pwrite(fd,buffer + ARCHIVE_READ_BLOCK*finerBytes,bytes,sizeof(h) + (uint64_t)h.records*bytes);
+		h.records++;
+		written++;
+		}
+	if ( buffer ) h.builtUntil = limit;				// header last, it vouches for the bins
+	pwrite(fd,&h,sizeof(h),0);
+	free(buffer);
+	close(fd);
+	close(finerFd);
+	return( written );
+}
+
+int SpectrumArchive::Compact( void )
+{
+	ARCHIVE_FILE_HEADER h;
+	double sealed;
+	int count, written = 0;
+
+	pthread_mutex_lock(&lock);
+	count = partitions;
+	sealed = writtenUntil;
+	pthread_mutex_unlock(&lock);
+	if ( (rawFd < 0) && count && Level(count-1,0,&h) && h.records )	// another process may be writing
+		{
+		char path[512];
+		int fd;
+		PartitionPath(path,sizeof(path),partitionStart[count-1],0);
+		if ( (fd = open(path,O_RDONLY)) >= 0 )
+			{
+			pread(fd,&sealed,sizeof(sealed),sizeof(h) + (uint64_t)(h.records-1)*RecordBytes(0,h.channels));
+			close(fd);
+			}
+		}
+	for (int p=compactedThrough; p<count; p++)
+		{
+		double pSealed = p < count-1 ? HUGE_VAL : sealed;	// older partitions take no more intervals
+		for (int level=1; level<ARCHIVE_LEVELS; level++)
+			written += CompactLevel(p,level,pSealed);
+		if ( (p == compactedThrough) && (p < count-1) && Level(p,ARCHIVE_LEVELS-1,&h) &&
+			 (h.builtUntil >= partitionStart[p] + header.partitionSeconds) ) compactedThrough++;
+		}
+	return( written );
+}
+
+static void *CompactorThread( void *arg )
+{
+	SpectrumArchive *archive = (SpectrumArchive *)arg;
+
+	while ( archive->compacting )
+		{
+		for (int ms=0; archive->compacting && (ms<archive->compactSeconds*1000.0); ms+=100) usleep(100000);
+		if ( archive->compacting ) archive->Compact();
+		}
+	return( NULL );
+}
+
+bool SpectrumArchive::StartCompactor( double seconds )
+{
+	if ( compacting ) return( true );
+	compactSeconds = seconds;
+	compacting = true;
+	if ( pthread_create(&compactor,NULL,CompactorThread,this) == 0 ) return( true );
+	compacting = false;
+	return( false );
+}
+
+void SpectrumArchive::StopCompactor( void )
+{
+	if ( !compacting ) return;
+	compacting = false;
+	pthread_join(compactor,NULL);
+	Compact();
+}
+
+////// queries //////////////////////////////////////////////////////////////////////////////////////
+
+int SpectrumArchive::FindPartition( double t )
+{
+	int lo = 0, hi = partitions;					// first partition starting after t, less one
+
+	while ( lo < hi )
+		{
+		int mid = lo + (hi - lo)/2;
+		if ( partitionStart[mid] <= t ) lo = mid + 1;
+		else hi = mid;
+		}
+	return( lo ? lo - 1 : 0 );						// t before the archive: the first one
+}
+
+bool SpectrumArchive::ReadRecords( int fd, int level, double t1, double t2, uint64_t *sum, ARCHIVE_RECORD *stats )
+{
+	ARCHIVE_FILE_HEADER h;
+	size_t bytes;
+	uint32_t records, x;
+	uint8_t *buffer;
+	ARCHIVE_RECORD r;
+	bool done = false;
+
+	if ( !ReadHeader(fd,&h) || (h.channels != header.channels) ) return( false );
+	bytesRead += sizeof(h);
+	bytes = RecordBytes(level,h.channels);
+	records = FileRecords(fd,h);
+	x = FirstRecordAt(fd,bytes,records,t1,&bytesRead);
+	if ( !(buffer = (uint8_t *)malloc(ARCHIVE_READ_BLOCK*bytes)) ) return( false );
+	while ( (x < records) && !done )
+		{
+		uint32_t n = records - x < ARCHIVE_READ_BLOCK ? records - x : ARCHIVE_READ_BLOCK;
+		if ( pread(fd,buffer,n*bytes,sizeof(h) + (uint64_t)x*bytes) != (ssize_t)(n*bytes) ) break;
+		bytesRead += n*bytes;
+		for (uint32_t k=0; k<n; k++)
+			{
+			const uint8_t *at = buffer + k*bytes;
+			memcpy(&r,at,sizeof(r));
+			if ( r.startTime >= t2 )
+				{
+				done = true;
+				break;
+				}
+			MergeArchiveRecord(stats,r);
+			recordsRead[level]++;
+			if ( level ) for (uint32_t i=0; i<h.channels; i++) sum[i] += ((const uint64_t *)(at + sizeof(r)))[i];
+			else for (uint32_t i=0; i<h.channels; i++) sum[i] += ((const uint32_t *)(at + sizeof(r)))[i];
+			}
+		x += n;
+		}
+	free(buffer);
+	return( true );
+}
+
+bool SpectrumArchive::SumLevel( int level, double t1, double t2, uint64_t *sum, ARCHIVE_RECORD *stats )
+{
+	double B = archiveBinSeconds[level], a, b;
+	char path[512];
+	bool ok = true;
+
+	if ( t1 >= t2 ) return( true );
+	if ( level == 0 )								// every interval, partition by partition
+		{
+		for (int p=FindPartition(t1); ok && (p<partitions) && (partitionStart[p]<t2); p++)
+			{
+			int fd;
+			PartitionPath(path,sizeof(path),partitionStart[p],0);
+			if ( (fd = open(path,O_RDONLY)) < 0 ) continue;
+			ok = ReadRecords(fd,0,t1,t2,sum,stats);
+			close(fd);
+			}
+		return( ok );
+		}
+
+	a = ceil(t1/B)*B;								// whole bins [a,b), ragged ends from finer levels
+	b = floor(t2/B)*B;
+	if ( a >= b ) return( SumLevel(level-1,t1,t2,sum,stats) );
+	ok = SumLevel(level-1,t1,a,sum,stats) && SumLevel(level-1,b,t2,sum,stats);
+	for (int p=FindPartition(a); ok && (p<partitions) && (partitionStart[p]<b); p++)
+		{
+		double lo = fmax(a,partitionStart[p]), hi = fmin(b,partitionStart[p] + header.partitionSeconds), mid = lo;
+		ARCHIVE_FILE_HEADER h;
+		int fd;
+
+		if ( lo >= hi ) continue;
+		PartitionPath(path,sizeof(path),partitionStart[p],level);
+		if ( (fd = open(path,O_RDONLY)) >= 0 )
+			{
+			if ( ReadHeader(fd,&h) ) mid = fmin(hi,fmax(lo,h.builtUntil));	// bins built so far
+			if ( mid > lo ) ok = ReadRecords(fd,level,lo,mid,sum,stats);
+			close(fd);
+			}
+		if ( ok && (hi > mid) ) ok = SumLevel(level-1,mid,hi,sum,stats);	// not compacted yet
+		}
+	return( ok );
+}
+
+bool SpectrumArchive::Sum( double t1, double t2, uint64_t *sum, ARCHIVE_RECORD *stats )
+{
+	memset(sum,0,header.channels*8);
+	memset(stats,0,sizeof(*stats));
+	if ( !partitions ) return( false );
+	t1 = fmax(t1,partitionStart[0]);				// no infinities into the bin arithmetic
+	t2 = fmin(t2,partitionStart[partitions-1] + header.partitionSeconds);
+	return( SumLevel(maxLevel < 0 ? 0 : maxLevel < ARCHIVE_LEVELS ? maxLevel : ARCHIVE_LEVELS-1,t1,t2,sum,stats) );
+}
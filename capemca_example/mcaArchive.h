@@ -0,0 +1,103 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Time-partitioned spectrum archive with rollups to coarser resolutions
+//   methods in mcaArchive.cpp
+//
+// One archive per detector, a directory of partitions, each partitionSeconds long and named by
+// its start second. A partition has one file per level:
+//   <dir>/<start>.L0 : every interval as appended, ARCHIVE_RECORD plus 32-bit channel counts
+//   <dir>/<start>.L1 : 1 minute bins, ARCHIVE_RECORD plus 64-bit channel sums
+//   <dir>/<start>.L2 : 10 minute bins, the same
+//   <dir>/<start>.L3 : 1 hour bins, the same
+// An interval belongs to the bin its startTime falls in. Compact() rolls each level into the
+// next coarser one for the bins that can no longer change and records how far it got in the
+// level's header, so it can run at any time, from the writer's compactor thread or another
+// process, and picks up after a crash. Sum() splits a window into the coarsest whole bins that
+// are built and fills the ragged ends from finer levels, down to single intervals, so the
+// answer is the same as summing every interval that starts inside the window.
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <pthread.h>
+#include "mcaFrame.h"
+
+#define ARCHIVE_MAGIC			0x5248414DU			// "MAHR" in little-endian
+#define ARCHIVE_VERSION			1
+#define ARCHIVE_LEVELS			4					// intervals, then 1 min, 10 min and 1 h bins
+#define ARCHIVE_PARTITION_SECONDS	86400			// default, a multiple of the coarsest bin
+#define ARCHIVE_MAX_PARTITIONS	4096				// over 11 years of daily partitions
+
+extern const double archiveBinSeconds[ARCHIVE_LEVELS];	// 0 for level 0, then 60, 600, 3600
+
+typedef struct
+{
+	uint32_t magic;									// ARCHIVE_MAGIC
+	uint32_t version;								// ARCHIVE_VERSION
+	uint32_t level;									// 0 = intervals, 1.. = rollups
+	uint32_t channels;
+	uint32_t capemcaId;								// detector this archive belongs to
+	uint32_t records;								// whole records of a rollup level
+	double partitionStart;							// seconds on the archive clock
+	double partitionSeconds;
+	double builtUntil;								// rollup: bins starting before this are done
+	uint32_t reserved[4];
+} ARCHIVE_FILE_HEADER;								// sizeof(ARCHIVE_FILE_HEADER) = 64 bytes
+
+typedef struct
+{
+	double startTime;								// start of the first interval in the record
+	double stopTime;								// stop of the last interval in the record
+	double seconds;									// interval durations summed
+	uint32_t intervals;								// intervals summed
+	uint32_t packets;								// of those with a packet0
+	float cpsMin, cpsMax;							// packet0 cps range over packets
+	double cpsSum;									// mean cps = cpsSum/packets
+	uint64_t counts;								// over all channels
+	double cpsSquares;								// for the cps variance
+} ARCHIVE_RECORD;									// sizeof(ARCHIVE_RECORD) = 64 bytes
+
+class SpectrumArchive {
+public:
+	char dir[256];
+	ARCHIVE_FILE_HEADER header;						// of level 0 of the newest partition
+	int partitions;
+	double partitionStart[ARCHIVE_MAX_PARTITIONS];	// ascending
+	int rawFd;										// level 0 of the newest partition, when writing
+	uint32_t rawRecords;							// in that file
+	double lastStart;								// of the last interval appended
+	double writtenUntil;							// intervals starting before this are on disk
+	uint32_t lastReadout[MAX_SPECTRUM_SIZE];		// previous cumulative readout from device
+	double lastReadoutTime;
+	bool haveReadout;
+	uint8_t *block;									// record scratch
+	uint64_t bytesRead;								// by Sum() since Open(), for comparisons
+	uint64_t recordsRead[ARCHIVE_LEVELS];
+	int maxLevel;									// coarsest level Sum() may use
+	pthread_mutex_t lock;							// writer and compactor thread
+	pthread_t compactor;
+	volatile bool compacting;
+	double compactSeconds;
+	int compactedThrough;							// partitions before this are fully rolled up
+
+	SpectrumArchive();								// constructor
+	~SpectrumArchive();								// destructor stops the compactor, closes files
+	bool Create( const char *directory, int channels, uint32_t capemcaId,
+				 double partitionSeconds = ARCHIVE_PARTITION_SECONDS );
+	bool Open( const char *directory, bool append = false );	// read, or continue appending
+	void Close( void );
+	bool Append( double startTime, double stopTime, const uint32_t *interval, const PACKET0_TYPE *packet0 );
+	bool AppendReadout( const McaFrame &frame );	// cumulative device readout, first one primes
+	int Compact( void );							// build what can be built, returns bins written
+	bool StartCompactor( double seconds );			// Compact() every so often on a thread
+	void StopCompactor( void );						// and once more at the end
+	bool Sum( double t1, double t2, uint64_t *sum, ARCHIVE_RECORD *stats );	// intervals starting in [t1,t2)
+	bool Level( int partition, int level, ARCHIVE_FILE_HEADER *levelHeader );	// header of a level file
+
+	bool SumLevel( int level, double t1, double t2, uint64_t *sum, ARCHIVE_RECORD *stats );
+	bool ReadRecords( int fd, int level, double t1, double t2, uint64_t *sum, ARCHIVE_RECORD *stats );
+	int CompactLevel( int partition, int level, double sealed );
+	int FindPartition( double t );					// last partition starting at or before t
+	void PartitionPath( char *path, size_t size, double start, int level );
+};
+
+void MergeArchiveRecord( ARCHIVE_RECORD *into, const ARCHIVE_RECORD &record );	// sums, min and max
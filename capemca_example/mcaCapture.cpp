@@ -0,0 +1,252 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Class methods for record and replay of MCA traffic
+//   definitions in mcaCapture.h
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "mcaCapture.h"
+
+////// RecordingTransport ///////////////////////////////////////////////////////////////////////////
+
+RecordingTransport::RecordingTransport( McaTransport *transport )	// constructor
+{
+	inner = transport;
+	file = NULL;
+	start = 0.0;
+	records = 0;
+	bytes = 0;
+}
+
+RecordingTransport::~RecordingTransport()			// destructor
+{
+	Close();
+}
+
+bool RecordingTransport::Open( const char *path, int source, const char *description )
+{
+	CAPTURE_FILE_HEADER header;
+	struct timespec ts;
+
+	Close();
+	file = fopen(path,"wb");
+	if ( !file )
+		{
+		printf("Cannot create capture file %s\n",path);
+		return( false );
+		}
+	memset(&header,0,sizeof(header));
+	header.magic = CAPTURE_MAGIC;
+	header.version = CAPTURE_VERSION;
+	header.source = (uint16_t)source;
+	clock_gettime(CLOCK_REALTIME,&ts);
+	header.startTime = ts.tv_sec + ts.tv_nsec*1.0e-9;
+	if ( description )
+		strncpy(header.description,description,sizeof(header.description)-1);
+	fwrite(&header,sizeof(header),1,file);
+
+	start = MonotonicSeconds();
+	records = 0;
+	bytes = sizeof(header);
+	return( true );
+}
+
+void RecordingTransport::Record( int direction, int flags, const uint8_t *data, int length )
+{
+	CAPTURE_RECORD_HEADER record;
+
+	if ( !file ) return;
+	record.direction = (uint8_t)direction;
+	record.flags = (uint8_t)flags;
+	record.reserved = 0;
+	record.length = (uint32_t)(length > 0 ? length : 0);
+	record.ns = (int64_t)((MonotonicSeconds() - start)*1.0e9);
+	fwrite(&record,sizeof(record),1,file);
+	if ( record.length ) fwrite(data,1,record.length,file);
+	records++;
+	bytes += sizeof(record) + record.length;
+}
+
+int RecordingTransport::Write( const uint8_t *data, int length )
+{
+	int n = inner->Write(data,length);
+
+	Record(CAPTURE_TO_DEVICE,(n < length) ? CAPTURE_FLAG_SHORT : 0,data,n);
+	return( n );
+}
+
+int RecordingTransport::Read( uint8_t *data, int length, int timeoutMs )
+{
+	int n = inner->Read(data,length,timeoutMs);		// timeouts are recorded as short reads
+
+	Record(CAPTURE_FROM_DEVICE,(n < length) ? CAPTURE_FLAG_SHORT : 0,data,n);
+	return( n );
+}
+
+void RecordingTransport::Close( void )
+{
+	if ( file ) fclose(file);
+	file = NULL;
+}
+
+////// ReplayTransport //////////////////////////////////////////////////////////////////////////////
+
+ReplayTransport::ReplayTransport()					// constructor
+{
+	memset(&header,0,sizeof(header));
+	data = NULL;
+	size = 0;
+	speed = 0.0;
+	loop = false;
+	Rewind();
+}
+
+ReplayTransport::~ReplayTransport()					// destructor
+{
+	Close();
+}
+
+bool ReplayTransport::Open( const char *path )
+{
+	FILE *f;
+	long length;
+
+	Close();
+	f = fopen(path,"rb");
+	if ( !f )
+		{
+		printf("Cannot open capture file %s\n",path);
+		return( false );
+		}
+	fseek(f,0,SEEK_END);
+	length = ftell(f);
+	fseek(f,0,SEEK_SET);
+	if ( length < (long)sizeof(header) ) length = 0;
+	if ( length ) data = (uint8_t *)malloc(length);
+	if ( !data || (fread(data,1,length,f) != (size_t)length) )
+		{
+		printf("Cannot read capture file %s\n",path);
+		fclose(f);
+		Close();
+		return( false );
+		}
+	fclose(f);
+
+	memcpy(&header,data,sizeof(header));
+	if ( (header.magic != CAPTURE_MAGIC) || (header.version != CAPTURE_VERSION) )
+		{
+		printf("%s is not a version %d capture file\n",path,CAPTURE_VERSION);
+		Close();
+		return( false );
+		}
+	size = length;
+	Rewind();
+	return( true );
+}
+
+void ReplayTransport::Rewind( void )
+{
+	offset = sizeof(CAPTURE_FILE_HEADER);
+	rxOffset = 0;
+	rxRemaining = 0;
+	start = 0.0;
+	recordTime = 0.0;
+	commandTime = 0.0;
+	commands = 0;
+	mismatches = 0;
+}
+
+void ReplayTransport::Close( void )
+{
+	free(data);
+	data = NULL;
+	size = 0;
+	Rewind();
+}
+
+bool ReplayTransport::NextRecord( CAPTURE_RECORD_HEADER *record, const uint8_t **payload )
+{
+	if ( offset + sizeof(CAPTURE_RECORD_HEADER) > size ) return( false );
+	memcpy(record,data+offset,sizeof(CAPTURE_RECORD_HEADER));
+	if ( offset + sizeof(CAPTURE_RECORD_HEADER) + record->length > size ) return( false );	// truncated
+	*payload = data + offset + sizeof(CAPTURE_RECORD_HEADER);
+	offset += sizeof(CAPTURE_RECORD_HEADER) + record->length;
+	return( true );
+}
+
+void ReplayTransport::Pace( int64_t ns )			// sleep until the recorded time
+{
+	double wait;
+	struct timespec ts;
+
+	if ( speed <= 0.0 ) return;
+	if ( start == 0.0 ) start = MonotonicSeconds() - ns*1.0e-9/speed;
+	wait = start + ns*1.0e-9/speed - MonotonicSeconds();
+	if ( wait <= 0.0 ) return;
+	ts.tv_sec = (time_t)wait;
+	ts.tv_nsec = (long)((wait - ts.tv_sec)*1.0e9);
+	nanosleep(&ts,NULL);
+}
+
+int ReplayTransport::Write( const uint8_t *bytes, int length )
+{
+	CAPTURE_RECORD_HEADER record;
+	const uint8_t *payload;
+	size_t mark;
+
+	rxRemaining = 0;								// unread responses are dropped, like a flush
+	for (;;)										// find next recorded command
+		{
+		mark = offset;
+		if ( !NextRecord(&record,&payload) )
+			{
+			if ( !loop || (mark == sizeof(CAPTURE_FILE_HEADER)) ) return( 0 );
+			offset = sizeof(CAPTURE_FILE_HEADER);	// start over, keep counters
+			start = 0.0;
+			continue;
+			}
+		if ( record.direction == CAPTURE_TO_DEVICE ) break;
+		}
+
+	Pace(record.ns);
+	commandTime = header.startTime + record.ns*1.0e-9;
+	commands++;
+	if ( ((int)record.length != length) || memcmp(payload,bytes,length) )
+		mismatches++;								// host sent something else this time
+	return( length );
+}
+
+int ReplayTransport::Read( uint8_t *bytes, int length, int timeoutMs )
+{
+	CAPTURE_RECORD_HEADER record;
+	const uint8_t *payload;
+	size_t mark, n;
+	int i = 0;
+
+	while ( i < length )
+		{
+		if ( rxRemaining == 0 )						// take the next response record, if any
+			{
+			mark = offset;
+			if ( !NextRecord(&record,&payload) ) break;
+			if ( record.direction != CAPTURE_FROM_DEVICE )
+				{
+				offset = mark;						// leave the command for Write()
+				break;								// which looks like a timeout here
+				}
+			Pace(record.ns);
+			rxOffset = payload - data;
+			rxRemaining = record.length;
+			recordTime = header.startTime + record.ns*1.0e-9;
+			if ( rxRemaining == 0 ) break;			// recorded timeout
+			}
+		n = rxRemaining;
+		if ( n > (size_t)(length - i) ) n = length - i;
+		memcpy(bytes+i,data+rxOffset,n);
+		i += n;
+		rxOffset += n;
+		rxRemaining -= n;
+		}
+	return( i );
+}
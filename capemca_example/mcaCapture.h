@@ -0,0 +1,85 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Record and replay of MCA traffic for desk reproduction of field problems
+//   methods in mcaCapture.cpp
+//
+// A capture file is a CAPTURE_FILE_HEADER followed by CAPTURE_RECORD_HEADERs, each followed by
+// length bytes. Every Write() to the device and every Read() from it becomes one record with
+// the host monotonic time since the capture started, so short reads and timeouts are kept too.
+// ReplayTransport plays a capture back at recorded speed, scaled speed, or as fast as possible.
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <stdio.h>
+#include "mcaTransport.h"
+
+#define CAPTURE_MAGIC			0x4341434DU			// "MCAC" in little-endian
+#define CAPTURE_VERSION			1
+
+#define CAPTURE_SOURCE_USB		1					// libusb bulk endpoints
+#define CAPTURE_SOURCE_UART		2					// MCA uart, direct
+#define CAPTURE_SOURCE_ARDUINO	3					// Arduino Serial bridge (text or binary)
+#define CAPTURE_SOURCE_SIM		4					// simulated MCA
+
+#define CAPTURE_TO_DEVICE		0					// record direction: command bytes
+#define CAPTURE_FROM_DEVICE		1					// record direction: response bytes
+
+#define CAPTURE_FLAG_SHORT		0x01				// read returned fewer bytes than asked for
+
+typedef struct
+{
+	uint32_t magic;									// CAPTURE_MAGIC
+	uint16_t version;								// CAPTURE_VERSION
+	uint16_t source;								// CAPTURE_SOURCE_xxx
+	double startTime;								// host realtime (UTC seconds) at start
+	char description[48];							// port name or device serial number
+} CAPTURE_FILE_HEADER;								// sizeof(CAPTURE_FILE_HEADER) = 64 bytes
+
+typedef struct
+{
+	uint8_t direction;								// CAPTURE_TO_DEVICE or CAPTURE_FROM_DEVICE
+	uint8_t flags;									// CAPTURE_FLAG_xxx
+	uint16_t reserved;
+	uint32_t length;								// bytes that follow this header
+	int64_t ns;										// host monotonic ns since capture start
+} CAPTURE_RECORD_HEADER;							// sizeof(CAPTURE_RECORD_HEADER) = 16 bytes
+
+class RecordingTransport : public McaTransport {	// passes through to a transport and records
+public:
+	McaTransport *inner;
+	FILE *file;
+	double start;									// monotonic seconds at Open()
+	uint64_t records, bytes;
+
+	RecordingTransport( McaTransport *transport );	// constructor
+	~RecordingTransport();							// destructor closes capture file
+	bool Open( const char *path, int source, const char *description );
+	int Write( const uint8_t *bytes, int length );
+	int Read( uint8_t *bytes, int length, int timeoutMs );
+	void Close( void );								// closes the capture, not the inner transport
+	void Record( int direction, int flags, const uint8_t *data, int length );
+};
+
+class ReplayTransport : public McaTransport {		// feeds a capture back to the host stack
+public:
+	CAPTURE_FILE_HEADER header;
+	uint8_t *data;									// whole capture held in memory
+	size_t size, offset;							// offset of next record in data
+	size_t rxOffset, rxRemaining;					// unread part of current response record
+	double speed;									// 1 = recorded speed, 0 = as fast as possible
+	double start;									// monotonic seconds at first Write/Read
+	bool loop;										// start over at end of capture
+	uint64_t commands, mismatches;					// commands written vs. recorded
+	double recordTime;								// realtime of last response record taken
+	double commandTime;								// realtime of last command record taken
+
+	ReplayTransport();								// constructor
+	~ReplayTransport();								// destructor frees capture
+	bool Open( const char *path );
+	void Rewind( void );
+	int Write( const uint8_t *bytes, int length );	// compared with the recorded command
+	int Read( uint8_t *bytes, int length, int timeoutMs );
+	void Close( void );
+	bool NextRecord( CAPTURE_RECORD_HEADER *record, const uint8_t **payload );	// raw record access
+	void Pace( int64_t ns );						// wait until recorded time when speed > 0
+};
@@ -0,0 +1,105 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Class methods for online change-point detection
+//   definitions in mcaChange.h
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <string.h>
+#include <math.h>
+#include "mcaChange.h"
+
+ChangeDetector::ChangeDetector()					// constructor
+{
+	params.threshold = 8.0;
+	params.ratio = 1.5;
+	params.tau = 30.0;
+	params.warmup = 5;
+	streams = 0;
+	changes = 0;
+}
+
+CHANGE_STREAM *ChangeDetector::Stream( uint32_t capemcaId, int band )
+{
+	CHANGE_STREAM *s;
+
+	for (int n=0; n<streams; n++)
+		if ( (stream[n].capemcaId == capemcaId) && (stream[n].band == band) ) return( &stream[n] );
+	if ( streams >= CHANGE_MAX_STREAMS ) return( NULL );
+	s = &stream[streams++];
+	memset(s,0,sizeof(CHANGE_STREAM));
+	s->capemcaId = capemcaId;
+	s->band = band;
+	return( s );
+}
+
+bool ChangeDetector::Update( CHANGE_STREAM *s, double hostTime, double n, double e, CHANGE_POINT *change )
+{
+	double r0, up, down, lnRatio = log(params.ratio), decay = params.tau > 0.0 ? exp(-1.0/params.tau) : 0.0;
+	bool upAlarm, downAlarm;
+
+	if ( !s || (e <= 0.0) ) return( false );
+	if ( (s->intervals < params.warmup) || (s->counts <= 0.0) )	// baseline first
+		{
+		s->counts = decay*s->counts + n;
+		s->exposure = decay*s->exposure + e;
+		s->intervals++;
+		return( false );
+		}
+
+	r0 = s->counts/s->exposure;
+	if ( s->up == 0.0 )								// a CUSUM leaving 0 marks a possible onset
+		{
+		s->upCounts = s->upExposure = 0.0;
+		s->upOnset = hostTime;
+		}
+	if ( s->down == 0.0 )
+		{
+		s->downCounts = s->downExposure = 0.0;
+		s->downOnset = hostTime;
+		}
+	up = s->up + n*lnRatio - (params.ratio - 1.0)*r0*e;
+	down = s->down - n*lnRatio + (1.0 - 1.0/params.ratio)*r0*e;
+	s->up = up > 0.0 ? up : 0.0;
+	s->down = down > 0.0 ? down : 0.0;
+	s->upCounts += n;
+	s->upExposure += e;
+	s->downCounts += n;
+	s->downExposure += e;
+
+	upAlarm = s->up >= params.threshold;
+	downAlarm = s->down >= params.threshold;
+	if ( upAlarm || downAlarm )
+		{
+		bool rise = upAlarm && (!downAlarm || (s->up >= s->down));
+		change->capemcaId = s->capemcaId;
+		change->band = s->band;
+		change->direction = rise ? 1 : -1;
+		change->onsetTime = rise ? s->upOnset : s->downOnset;
+		change->alarmTime = hostTime;
+		change->llr = rise ? s->up : s->down;
+		change->significance = sqrt(2.0*change->llr);
+		change->rateBefore = r0;
+		change->rateAfter = rise ? s->upCounts/s->upExposure : s->downCounts/s->downExposure;
+		s->counts = rise ? s->upCounts : s->downCounts;	// new segment, baseline from its data
+		s->exposure = rise ? s->upExposure : s->downExposure;
+		s->intervals = 0;
+		s->up = s->down = 0.0;
+		changes++;
+		return( true );
+		}
+	if ( (s->up < 0.5*params.threshold) && (s->down < 0.5*params.threshold) )	// in control, follow slow drift
+		{
+		s->counts = decay*s->counts + n;
+		s->exposure = decay*s->exposure + e;
+		s->intervals++;
+		}
+	return( false );
+}
+
+int ChangeDetector::Update( const LIGHT_RECORD_HEADER &record, const uint32_t *counts, int bands, CHANGE_POINT *change )
+{
+	int found = 0;
+
+	for (int k=0; k<bands; k++)
+		found += Update(Stream(record.capemcaId,k),record.hostTime,counts[k],record.liveTime,change+found);
+	return( found );
+}
@@ -0,0 +1,64 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Online change-point detection on count-rate streams
+//   methods in mcaChange.cpp
+//
+// Each stream is one band of one detector, fed interval by interval with counts n and live time e
+// (a LIGHT_RECORD_HEADER and its band counts, see mcaLightCurve.h). While the rate is steady its
+// baseline r0 is a live-time weighted running mean that forgets with a time constant of tau
+// intervals. Two Poisson CUSUMs look for a step to r1 = ratio*r0 and to r0/ratio:
+//   S+ = max(0, S+ + n ln(r1/r0) - (r1 - r0) e)
+// and alarm when S reaches threshold, the log-likelihood ratio of the change. The onset is the
+// last time that CUSUM was 0, and the new rate is counts over live time since then. After an
+// alarm the baseline restarts from the new rate, so the stream is cut into segments of steady
+// rate, like Bayesian Blocks computed online with O(1) work and state per update.
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "mcaLightCurve.h"
+
+#define CHANGE_MAX_STREAMS		(LIGHT_MAX_DEVICES*4)
+
+typedef struct
+{
+	double threshold;								// log-likelihood ratio to alarm (default 8)
+	double ratio;									// smallest rate step of interest (default 1.5)
+	double tau;										// baseline time constant, intervals (default 30)
+	int warmup;										// intervals of baseline before alarms (default 5)
+} CHANGE_PARAMS;
+
+typedef struct
+{
+	uint32_t capemcaId;
+	int band;										// index in the light curve bands
+	int direction;									// +1 rate went up, -1 down
+	double onsetTime;								// hostTime of the first interval after the change
+	double alarmTime;								// hostTime of the interval that raised it
+	double llr;										// log-likelihood ratio at the alarm
+	double significance;							// sqrt(2 llr), in gaussian sigmas
+	double rateBefore, rateAfter;					// counts per live second
+} CHANGE_POINT;
+
+typedef struct
+{
+	uint32_t capemcaId;
+	int band;
+	int intervals;									// since the baseline (re)started
+	double counts, exposure;						// decayed baseline sums
+	double up, down;								// the two CUSUMs
+	double upCounts, upExposure, upOnset;			// since the up CUSUM last left 0
+	double downCounts, downExposure, downOnset;
+} CHANGE_STREAM;
+
+class ChangeDetector {
+public:
+	CHANGE_PARAMS params;
+	int streams;
+	CHANGE_STREAM stream[CHANGE_MAX_STREAMS];
+	uint64_t changes;
+
+	ChangeDetector();								// constructor
+	CHANGE_STREAM *Stream( uint32_t capemcaId, int band );	// added if new
+	bool Update( CHANGE_STREAM *s, double hostTime, double counts, double exposure, CHANGE_POINT *change );
+	int Update( const LIGHT_RECORD_HEADER &record, const uint32_t *counts, int bands, CHANGE_POINT *changes );
+};													// second Update() returns changes found, at most bands
@@ -0,0 +1,322 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Class methods for crash-safe checkpoints
+//   definitions in mcaCheckpoint.h
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "mcaCheckpoint.h"
+
+////// Crc32 ////////////////////////////////////////////////////////////////////////////////////////
+
+uint32_t Crc32( const uint8_t *bytes, size_t length, uint32_t crc )
+{
+	static uint32_t table[256];
+	static bool ready = false;
+
+	if ( !ready )									// same table every time, a race is harmless
+		{
+		for (uint32_t i=0; i<256; i++)
+			{
+			uint32_t c = i;
+			for (int k=0; k<8; k++) c = (c & 1) ? 0xEDB88320U ^ (c >> 1) : c >> 1;
+			table[i] = c;
+			}
+		ready = true;
+		}
+	crc = ~crc;
+	for (size_t i=0; i<length; i++) crc = table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+	return( ~crc );
+}
+
+////// DeviceTally //////////////////////////////////////////////////////////////////////////////////
+
+DeviceTally::DeviceTally()							// constructor
+{
+	Clear();
+}
+
+void DeviceTally::Clear( void )
+{
+	memset(&state,0,sizeof(state));
+}
+
+int DeviceTally::Update( const McaFrame &frame )
+{
+	bool spectra = frame.channels && (frame.channels == (int)state.lastChannels);
+	bool packets = frame.hasPacket0 && state.hasPacket0;
+	bool zeroed = false;
+	uint64_t counts = 0;
+	uint32_t intervals = 0;
+	int result;
+
+	if ( packets ) zeroed = frame.packet0.totalIntervals < state.packet0.totalIntervals;
+	for (int i=0; spectra && !zeroed && (i<frame.channels); i++)	// any channel going down
+		zeroed = frame.spectrum[i] < last[i];
+	if ( !state.lastChannels && !state.hasPacket0 ) result = TALLY_FIRST;
+	else if ( zeroed )								// all the device holds is new
+		{
+		result = TALLY_ZEROED;
+		if ( frame.hasPacket0 ) intervals = frame.packet0.totalIntervals;
+		for (int i=0; i<frame.channels; i++) counts += frame.spectrum[i];
+		if ( !frame.channels && frame.hasPacket0 ) counts = (uint64_t)frame.packet0.totalCount;
+		}
+	else
+		{
+		if ( packets ) intervals = frame.packet0.totalIntervals - state.packet0.totalIntervals;
+		if ( spectra )
+			for (int i=0; i<frame.channels; i++) counts += frame.spectrum[i] - last[i];
+		else if ( packets && (frame.packet0.totalCount > state.packet0.totalCount) )
+			counts = (uint64_t)(frame.packet0.totalCount - state.packet0.totalCount);
+		if ( packets ) result = intervals ? TALLY_CONTINUED : TALLY_SAME;
+		else if ( spectra ) result = counts ? TALLY_CONTINUED : TALLY_SAME;
+		else result = TALLY_CONTINUED;				// resolution changed and no packet0, can't tell
+		}
+
+	state.readouts++;
+	state.intervals += intervals;
+	state.counts += counts;
+	state.request = frame.request;
+	state.hostTime = frame.hostTime;
+	if ( frame.channels )
+		{
+		memcpy(last,frame.spectrum,frame.channels*4);
+		state.lastChannels = frame.channels;
+		}
+	if ( frame.hasPacket0 )
+		{
+		state.packet0 = frame.packet0;
+		state.capemcaId = frame.packet0.capemcaId;
+		state.hasPacket0 = 1;
+		}
+	return( result );
+}
+
+////// Checkpoint ///////////////////////////////////////////////////////////////////////////////////
+
+Checkpoint::Checkpoint()							// constructor
+{
+	path[0] = 0;
+	sequence = 0;
+	buffer = NULL;
+	length = allocated = 0;
+	devices = 0;
+	fd[0] = fd[1] = -1;
+	commitSeconds = 0.0;
+}
+
+Checkpoint::~Checkpoint()							// destructor
+{
+	for (int k=0; k<2; k++)
+		if ( fd[k] >= 0 ) close(fd[k]);
+	free(buffer);
+}
+
+static bool Reserve( uint8_t **buffer, size_t *allocated, size_t bytes )
+{
+	if ( bytes <= *allocated ) return( true );
+	size_t size = *allocated ? *allocated : 65536;
+	while ( size < bytes ) size *= 2;
+	uint8_t *grown = (uint8_t *)realloc(*buffer,size);
+	if ( !grown ) return( false );
+	*buffer = grown;
+	*allocated = size;
+	return( true );
+}
+
+static size_t RecordBytes( const CHECKPOINT_DEVICE *d )
+{
+	return( sizeof(CHECKPOINT_DEVICE) + d->lastChannels*4 + d->sumChannels*8 + d->readoutChannels*4 +
+			d->correctedChannels*8 + d->correctedReadoutChannels*4 );
+}
+
+static bool Valid( const uint8_t *bytes, size_t length, size_t offset[], int *devices )
+{													// whole checkpoint checks out
+	CHECKPOINT_HEADER header;
+	size_t at = sizeof(header);
+
+	if ( length < sizeof(header) ) return( false );
+	memcpy(&header,bytes,sizeof(header));
+	if ( (header.magic != CHECKPOINT_MAGIC) || (header.version != CHECKPOINT_VERSION) ||
+		 (header.bytes != length) || (header.devices > CHECKPOINT_MAX_DEVICES) ) return( false );
+	uint32_t crc = Crc32(bytes,offsetof(CHECKPOINT_HEADER,crc));
+	crc = Crc32((const uint8_t *)"\0\0\0\0",4,crc);
+	crc = Crc32(bytes+offsetof(CHECKPOINT_HEADER,crc)+4,length-offsetof(CHECKPOINT_HEADER,crc)-4,crc);
+	if ( crc != header.crc ) return( false );
+	for (uint32_t n=0; n<header.devices; n++)
+		{
+		CHECKPOINT_DEVICE d;
+		if ( at + sizeof(d) > length ) return( false );
+		memcpy(&d,bytes+at,sizeof(d));
+		if ( (d.lastChannels > MAX_SPECTRUM_SIZE) || (d.sumChannels > MAX_SPECTRUM_SIZE) ||
+			 (d.readoutChannels > MAX_SPECTRUM_SIZE) || (d.correctedChannels > MAX_SPECTRUM_SIZE) ||
+			 (d.correctedReadoutChannels > MAX_SPECTRUM_SIZE) || (at + RecordBytes(&d) > length) ) return( false );
+		offset[n] = at;
+		at += RecordBytes(&d);
+		}
+	*devices = header.devices;
+	return( at == length );
+}
+
+bool Checkpoint::Load( const char *basePath )
+{
+	char name[sizeof(path)+4];
+	uint8_t *bytes[2] = { NULL, NULL };
+	size_t size[2] = { 0, 0 }, offsets[2][CHECKPOINT_MAX_DEVICES];
+	int count[2], best = -1;
+	uint64_t seq[2];
+	struct stat st;
+
+	if ( basePath != path ) snprintf(path,sizeof(path),"%s",basePath);
+	devices = 0;
+	length = 0;
+	sequence = 0;
+	for (int k=0; k<2; k++)							// read both, keep the newest that is whole
+		{
+		int f;
+		snprintf(name,sizeof(name),"%s.%d",path,k);
+		if ( (f = open(name,O_RDONLY)) < 0 ) continue;
+		if ( (fstat(f,&st) == 0) && (st.st_size >= (off_t)sizeof(CHECKPOINT_HEADER)) &&
+			 (bytes[k] = (uint8_t *)malloc(st.st_size)) && (read(f,bytes[k],st.st_size) == st.st_size) &&
+			 Valid(bytes[k],st.st_size,offsets[k],&count[k]) )
+			{
+			size[k] = st.st_size;
+			memcpy(&seq[k],bytes[k]+offsetof(CHECKPOINT_HEADER,sequence),sizeof(seq[k]));
+			if ( (best < 0) || (seq[k] > seq[best]) ) best = k;
+			}
+		close(f);
+		}
+	if ( best >= 0 )
+		{
+		free(buffer);
+		buffer = bytes[best];
+		bytes[best] = NULL;
+		length = allocated = size[best];
+		devices = count[best];
+		memcpy(offset,offsets[best],sizeof(offset));
+		sequence = seq[best];
+		}
+	free(bytes[0]);
+	free(bytes[1]);
+	return( best >= 0 );
+}
+
+int Checkpoint::Find( const char *name )
+{
+	for (int n=0; n<devices; n++)
+		if ( !strncmp(Device(n)->name,name,sizeof(Device(n)->name)) ) return( n );
+	return( -1 );
+}
+
+const CHECKPOINT_DEVICE *Checkpoint::Device( int n )
+{
+	return( (const CHECKPOINT_DEVICE *)(buffer + offset[n]) );	// records are 8-byte multiples
+}
+
+bool Checkpoint::Restore( int n, DeviceTally *tally, ReadoutAccumulator *accumulator, CorrectedSpectrum *corrected )
+{
+	const CHECKPOINT_DEVICE *d;
+	const uint8_t *at;
+
+	if ( (n < 0) || (n >= devices) ) return( false );
+	d = Device(n);
+	at = (const uint8_t *)(d + 1);
+	tally->state = *d;
+	memcpy(tally->last,at,d->lastChannels*4);
+	at += d->lastChannels*4;
+	accumulator->channels = d->sumChannels;
+	accumulator->Clear();
+	accumulator->frames = d->sumFrames;
+	memcpy(accumulator->sum,at,d->sumChannels*8);
+	at += d->sumChannels*8;
+	accumulator->lastChannels = d->readoutChannels;	// next readout is differenced against it
+	memcpy(accumulator->last,at,d->readoutChannels*4);
+	at += d->readoutChannels*4;
+	corrected->channels = d->correctedChannels;
+	corrected->Clear();
+	corrected->frames = d->correctedFrames;
+	memcpy(corrected->sum,at,d->correctedChannels*8);
+	at += d->correctedChannels*8;
+	corrected->lastChannels = d->correctedReadoutChannels;
+	memcpy(corrected->last,at,d->correctedReadoutChannels*4);
+	return( true );
+}
+
+void Checkpoint::Begin( void )
+{
+	devices = 0;
+	length = sizeof(CHECKPOINT_HEADER);
+	if ( !Reserve(&buffer,&allocated,length) ) length = 0;
+}
+
+bool Checkpoint::Add( const DeviceTally &tally, const ReadoutAccumulator &accumulator, const CorrectedSpectrum &corrected )
+{
+	CHECKPOINT_DEVICE d = tally.state;
+
+	if ( !length || (devices == CHECKPOINT_MAX_DEVICES) ) return( false );
+	d.sumChannels = accumulator.channels;
+	d.sumFrames = accumulator.frames;
+	d.readoutChannels = accumulator.lastChannels;
+	d.correctedChannels = corrected.channels;
+	d.correctedFrames = corrected.frames;
+	d.correctedReadoutChannels = corrected.lastChannels;
+	if ( !Reserve(&buffer,&allocated,length + RecordBytes(&d)) ) return( false );
+	offset[devices++] = length;
+	memcpy(buffer+length,&d,sizeof(d));
+	length += sizeof(d);
+	memcpy(buffer+length,tally.last,d.lastChannels*4);
+	length += d.lastChannels*4;
+	memcpy(buffer+length,accumulator.sum,d.sumChannels*8);
+	length += d.sumChannels*8;
+	memcpy(buffer+length,accumulator.last,d.readoutChannels*4);
+	length += d.readoutChannels*4;
+	memcpy(buffer+length,corrected.sum,d.correctedChannels*8);
+	length += d.correctedChannels*8;
+	memcpy(buffer+length,corrected.last,d.correctedReadoutChannels*4);
+	length += d.correctedReadoutChannels*4;
+	return( true );
+}
+
+bool Checkpoint::Commit( void )
+{
+	CHECKPOINT_HEADER header;
+	char name[sizeof(path)+4];
+	double t = MonotonicSeconds();
+	int k;
+
+	if ( !length || !path[0] ) return( false );
+	memset(&header,0,sizeof(header));
+	header.magic = CHECKPOINT_MAGIC;
+	header.version = CHECKPOINT_VERSION;
+	header.sequence = sequence + 1;
+	header.bytes = length;
+	header.devices = devices;
+	header.wallTime = (double)time(NULL);
+	memcpy(buffer,&header,sizeof(header));
+	header.crc = Crc32(buffer,length);				// crc field is still 0
+	memcpy(buffer+offsetof(CHECKPOINT_HEADER,crc),&header.crc,sizeof(header.crc));
+
+	k = header.sequence & 1;						// the file not holding the newest checkpoint
+	if ( fd[k] < 0 )
+		{
+		snprintf(name,sizeof(name),"%s.%d",path,k);
+		if ( (fd[k] = open(name,O_RDWR | O_CREAT,0644)) < 0 )
+			{
+			printf("Cannot write checkpoint %s\n",name);
+			return( false );
+			}
+		}
+	if ( (pwrite(fd[k],buffer,length,0) != (ssize_t)length) || (ftruncate(fd[k],length) < 0) || (fdatasync(fd[k]) < 0) )
+		{
+		printf("Checkpoint to %s.%d failed\n",path,k);
+		return( false );
+		}
+	sequence = header.sequence;
+	commitSeconds = MonotonicSeconds() - t;
+	return( true );
+}
@@ -0,0 +1,99 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Crash-safe checkpoints of host accumulators and running totals, for resuming after a restart
+//   methods in mcaCheckpoint.cpp
+//
+// A checkpoint is one buffer: a header, then per device a CHECKPOINT_DEVICE record followed by
+// its last cumulative spectrum (lastChannels x 32-bit), its accumulator (sumChannels x 64-bit)
+// and the readout the accumulator last differenced (readoutChannels x 32-bit), so the first
+// readout after a resume adds only what the device counted in between. The dead-time corrected
+// sum follows in the same way (correctedChannels x 64-bit double, then its last readout
+// correctedReadoutChannels x 32-bit), so both spectra go on covering the same readouts.
+// Commit() writes the buffer to path.0 and path.1 in turn and syncs it, so a crash while writing
+// only ever tears the older file. Load() keeps the valid one (magic, length and CRC-32) with the
+// higher sequence number.
+//
+// DeviceTally follows the device's cumulative state through packet0 totalIntervals/totalCount and
+// the cumulative spectrum. Its intervals and counts grow by what the device acquired between two
+// readouts, whether the readouts are a second or a restart apart, and never count a readout twice:
+// an unchanged readout adds nothing and a zeroed or rebooted device adds its new cumulative state.
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "mcaFrame.h"
+#include "mcaDeadTime.h"
+
+#define CHECKPOINT_MAGIC		0x4B43434DU			// "MCCK" in little-endian
+#define CHECKPOINT_VERSION		3
+#define CHECKPOINT_MAX_DEVICES	32
+
+#define TALLY_FIRST				0					// baseline readout, nothing to compare with
+#define TALLY_SAME				1					// no acquisition since the previous readout
+#define TALLY_CONTINUED			2					// device kept counting since the previous readout
+#define TALLY_ZEROED			3					// device was zeroed or restarted in between
+
+typedef struct
+{
+	uint32_t magic;									// CHECKPOINT_MAGIC
+	uint32_t version;								// CHECKPOINT_VERSION
+	uint64_t sequence;								// higher is newer
+	uint32_t bytes;									// whole checkpoint including this header
+	uint32_t devices;								// records that follow
+	uint32_t crc;									// CRC-32 of the checkpoint with this field 0
+	uint32_t reserved;
+	double wallTime;								// seconds since 1970 when committed
+} CHECKPOINT_HEADER;
+
+typedef struct
+{
+	char name[32];									// how the writer named the device
+	uint32_t capemcaId;								// from the last packet0, 0 if none yet
+	uint32_t request;								// request code in use
+	uint32_t lastChannels;							// channels in the last cumulative spectrum
+	uint32_t sumChannels;							// channels in the accumulator
+	uint32_t sumFrames;								// spectra in the accumulator
+	uint32_t hasPacket0;							// packet0 below was read
+	uint32_t readoutChannels;						// channels in the accumulator's last readout, 0 if none
+	uint32_t correctedChannels;						// channels in the dead-time corrected sum
+	uint32_t correctedFrames;						// intervals in it
+	uint32_t correctedReadoutChannels;				// channels in its last readout, 0 if none
+	uint64_t readouts;								// frames read since the run began
+	uint64_t intervals;								// device intervals acquired since the run began
+	uint64_t counts;								// counts acquired in those intervals
+	double hostTime;								// writer's monotonic seconds of the last readout
+	PACKET0_TYPE packet0;							// last packet0 read
+} CHECKPOINT_DEVICE;
+
+class DeviceTally {									// running totals of one device
+public:
+	CHECKPOINT_DEVICE state;
+	uint32_t last[MAX_SPECTRUM_SIZE];				// last cumulative spectrum read
+
+	DeviceTally();									// constructor
+	void Clear( void );								// new run
+	int Update( const McaFrame &frame );			// returns TALLY_FIRST ... TALLY_ZEROED
+};
+
+class Checkpoint {
+public:
+	char path[256];									// base name, files are path.0 and path.1
+	uint64_t sequence;								// of the newest checkpoint written or loaded
+	uint8_t *buffer;								// checkpoint being built or loaded
+	size_t length, allocated;
+	int devices;
+	size_t offset[CHECKPOINT_MAX_DEVICES];			// of each record in buffer
+	int fd[2];
+	double commitSeconds;							// duration of the last Commit()
+
+	Checkpoint();									// constructor
+	~Checkpoint();									// destructor closes files
+	bool Load( const char *basePath );				// newest valid checkpoint, false if none
+	int Find( const char *name );					// record index, -1 if not in the checkpoint
+	const CHECKPOINT_DEVICE *Device( int n );
+	bool Restore( int n, DeviceTally *tally, ReadoutAccumulator *accumulator, CorrectedSpectrum *corrected );
+	void Begin( void );								// start building the next checkpoint
+	bool Add( const DeviceTally &tally, const ReadoutAccumulator &accumulator, const CorrectedSpectrum &corrected );
+	bool Commit( void );							// write and sync the older file
+};
+
+uint32_t Crc32( const uint8_t *bytes, size_t length, uint32_t crc = 0 );	// CRC-32 (IEEE 802.3)
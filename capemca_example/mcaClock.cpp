@@ -0,0 +1,158 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Per-device clock models and UTC timestamps for every acquisition interval
+//   definitions in mcaClock.h
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "mcaClock.h"
+
+#define CLOCK_DRIFT_PRIOR		1.0e-3				// sd of the drift before any fit, a poor crystal
+#define CLOCK_WARMUP			10					// readouts fitted before any is dropped
+
+double MeasureUtcOffset( double *uncertainty )
+{
+	double best = HUGE_VAL, offset = 0.0;
+	struct timespec ts;
+
+	for (int n=0; n<5; n++)							// the read least disturbed by a preemption
+		{
+		double before = MonotonicSeconds();
+		clock_gettime(CLOCK_REALTIME,&ts);
+		double after = MonotonicSeconds();
+		if ( after - before < best )
+			{
+			best = after - before;
+			offset = ts.tv_sec + ts.tv_nsec*1.0e-9 - 0.5*(before + after);
+			}
+		}
+	if ( uncertainty ) *uncertainty = 0.5*best;
+	return( offset );
+}
+
+////// ClockTracker /////////////////////////////////////////////////////////////////////////////////
+
+ClockTracker::ClockTracker()						// constructor
+{
+	utcOffset = 0.0;
+	window = 0.05;									// a few kB over USB or a fast uart
+	forget = 1.0 - 1.0/CLOCK_MEMORY;
+	devices = 0;
+}
+
+CLOCK_DEVICE *ClockTracker::Device( uint32_t capemcaId )
+{
+	CLOCK_DEVICE *d;
+
+	for (int n=0; n<devices; n++)
+		if ( device[n].capemcaId == capemcaId ) return( &device[n] );
+	if ( devices >= CLOCK_MAX_DEVICES ) return( NULL );
+	d = &device[devices++];
+	memset(d,0,sizeof(CLOCK_DEVICE));
+	d->capemcaId = capemcaId;
+	d->P[2] = CLOCK_DRIFT_PRIOR*CLOCK_DRIFT_PRIOR;
+	d->chi2 = 1.0;
+	return( d );
+}
+
+bool ClockTracker::Observe( CLOCK_DEVICE *d, double sendTime, double receiveTime, double deviceSeconds, double quantum )
+{
+	double half = receiveTime > sendTime ? 0.5*(receiveTime - sendTime) : 0.0;
+	double y = 0.5*(sendTime + receiveTime);
+	double variance = half*half/3.0 + quantum*quantum/12.0;	// uniform in the window and the interval
+	double dx, r, Pg0, Pg1, gPg, z, scale, k, w, denominator, K0, K1, alpha;
+
+	if ( variance <= 0.0 ) variance = 1.0e-12;
+	if ( d->points == 0 )							// first readout of an epoch fixes the origin
+		{
+		d->x0 = deviceSeconds;
+		d->y0 = y;
+		d->offset = 0.0;
+		d->P[0] = variance;
+		d->P[1] = 0.0;								// the drift, and its variance, carry over
+		d->points = 1;
+		return( true );
+		}
+
+	dx = deviceSeconds - d->x0;
+	r = y - (d->y0 + dx + d->offset + d->drift*dx);
+	Pg0 = d->P[0] + d->P[1]*dx;
+	Pg1 = d->P[1] + d->P[2]*dx;
+	gPg = Pg0 + dx*Pg1;
+	z = r/sqrt(variance + (gPg > 0.0 ? gPg : 0.0));
+	scale = sqrt(d->chi2 > 1.0 ? d->chi2 : 1.0);	// when the windows understate the scatter
+	k = CLOCK_HUBER*scale;
+	if ( (d->points >= CLOCK_WARMUP) && (fabs(z) > CLOCK_OUTLIER*scale) )
+		{
+		d->rejected++;								// e.g. a readout delayed by a stall
+		return( false );
+		}
+	w = fabs(z) > k ? k/fabs(z) : 1.0;				// Huber: linear, not quadratic, loss out there
+	alpha = 1.0/(d->points + 1);					// plain mean at first, then exponential
+	if ( alpha < 1.0 - forget ) alpha = 1.0 - forget;
+	d->chi2 += alpha*((fabs(z) > k ? k*k : z*z) - d->chi2);
+
+	denominator = forget*variance/w + gPg;			// recursive least squares with forgetting
+	K0 = Pg0/denominator;
+	K1 = Pg1/denominator;
+	d->offset += K0*r;
+	d->drift += K1*r;
+	d->P[0] = (d->P[0] - K0*Pg0)/forget;
+	d->P[1] = (d->P[1] - K0*Pg1)/forget;
+	d->P[2] = (d->P[2] - K1*Pg1)/forget;
+	d->points++;
+	return( true );
+}
+
+double ClockTracker::HostTime( const CLOCK_DEVICE *d, double deviceSeconds, double *sigma ) const
+{
+	double dx = deviceSeconds - d->x0;
+	double variance = d->P[0] + 2.0*dx*d->P[1] + dx*dx*d->P[2];
+
+	if ( sigma ) *sigma = sqrt((variance > 0.0 ? variance : 0.0)*(d->chi2 > 1.0 ? d->chi2 : 1.0));
+	return( d->y0 + dx + d->offset + d->drift*dx );
+}
+
+bool ClockTracker::Process( const McaFrame &frame, CLOCK_INTERVAL *interval )
+{
+	CLOCK_DEVICE *d;
+	const PACKET0_TYPE &p = frame.packet0;
+	double quantum, deviceSeconds, sendTime, startSigma, stopSigma;
+	bool zeroed, ready;
+
+	if ( !frame.hasPacket0 || (p.usPerInterval == 0) || !(d = Device(p.capemcaId)) ) return( false );
+	quantum = p.usPerInterval*1.0e-6;
+	zeroed = d->havePrevious && (p.totalIntervals < d->previousIntervals);
+	if ( zeroed )
+		{
+		d->epoch++;									// the device count starts over at the zero
+		d->points = 0;
+		d->previousIntervals = 0;
+		d->previousDevice = 0.0;
+		}
+	if ( !d->havePrevious || zeroed ) deviceSeconds = p.totalIntervals*quantum;
+	else deviceSeconds = d->previousDevice + (p.totalIntervals - d->previousIntervals)*quantum;
+	sendTime = frame.sendTime > 0.0 ? frame.sendTime : frame.hostTime - window;
+	Observe(d,sendTime,frame.hostTime,deviceSeconds + 0.5*quantum,quantum);	// latched in the running interval
+
+	ready = d->havePrevious && (p.totalIntervals > d->previousIntervals);
+	if ( ready )
+		{
+		interval->capemcaId = p.capemcaId;
+		interval->firstInterval = d->previousIntervals;
+		interval->lastInterval = p.totalIntervals;
+		interval->utcStart = HostTime(d,d->previousDevice,&startSigma) + utcOffset;
+		interval->utcStop = HostTime(d,deviceSeconds,&stopSigma) + utcOffset;
+		interval->sigma = startSigma > stopSigma ? startSigma : stopSigma;
+		interval->hostStart = zeroed ? 0.0 : d->previousHost;
+		interval->hostStop = frame.hostTime;
+		interval->drift = d->drift;
+		interval->epoch = d->epoch;
+		}
+	d->havePrevious = true;
+	d->previousIntervals = p.totalIntervals;
+	d->previousDevice = deviceSeconds;
+	d->previousHost = frame.hostTime;
+	return( ready );
+}
@@ -0,0 +1,78 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Per-device clock models and UTC timestamps for every acquisition interval
+//   methods in mcaClock.cpp
+//
+// The MCA keeps no time of day. All it reports is usPerInterval and totalIntervals in packet0,
+// i.e. how far its own oscillator has counted since the last zero. Each readout with packet0
+// is one observation: the device latched totalIntervals = N somewhere in the host window
+// [sendTime, hostTime] of the transfer, at device time (N + 1/2) usPerInterval give or take
+// half an interval. The host time of that latch is fitted per capemcaId as
+//   host = y0 + (x - x0) + offset + drift (x - x0),   x = device seconds since the zero
+// by recursive least squares weighted by each window's variance, with exponential forgetting
+// so a drift that wanders with temperature is followed, and Huber weights so a readout held
+// up by the host scheduler cannot pull the line. A zero starts a new epoch: the offset is
+// found again and the drift is kept.
+//
+// Interval boundaries are exact device times (k usPerInterval), so the spectrum between two
+// readouts, intervals (Nprev,N], gets start and stop times from the model instead of from the
+// jittery receipt times, with a 1-sigma uncertainty from the fit. Adding utcOffset, measured
+// with MeasureUtcOffset() for live data or 0 for captures whose times are already realtime,
+// gives UTC. Times of different detectors are on the same host clock and so comparable.
+// Assumes the spectrum is updated at interval boundaries, as packet0's cps is, and that the
+// readouts are not locked to the intervals, so the latch falls anywhere within one.
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "mcaFrame.h"
+
+#define CLOCK_MAX_DEVICES		256					// as many as WinUSBDs can enumerate
+#define CLOCK_MEMORY			1000				// default readouts the fit remembers
+#define CLOCK_HUBER				3.0					// residuals beyond this many sigma are downweighted
+#define CLOCK_OUTLIER			20.0				// and beyond this many, dropped
+
+typedef struct
+{
+	uint32_t capemcaId;
+	uint32_t firstInterval;							// the spectrum covers intervals (first,last]
+	uint32_t lastInterval;
+	double utcStart, utcStop;						// corrected times of those boundaries
+	double sigma;									// 1-sigma of utcStart and utcStop, seconds
+	double hostStart, hostStop;						// receipt times of the two readouts, for comparison
+	double drift;									// host seconds per device second - 1
+	int epoch;										// zeros seen before this interval
+} CLOCK_INTERVAL;
+
+typedef struct
+{
+	uint32_t capemcaId;
+	int epoch;										// zeros seen, a new offset for each
+	int points;										// readouts fitted this epoch
+	uint64_t rejected;								// readouts dropped as outliers
+	bool havePrevious;
+	uint32_t previousIntervals;						// totalIntervals of the last readout
+	double previousDevice;							// device seconds at that boundary
+	double previousHost;							// receipt time of the last readout
+	double x0, y0;									// device and host seconds of the first readout
+	double offset, drift;							// the model above
+	double P[3];									// covariance of offset and drift: aa, ad, dd
+	double chi2;									// running mean of squared normalized residuals
+} CLOCK_DEVICE;
+
+class ClockTracker {
+public:
+	double utcOffset;								// UTC = host seconds + utcOffset
+	double window;									// transfer window when a frame has no sendTime
+	double forget;									// 1 - 1/readouts remembered
+	int devices;
+	CLOCK_DEVICE device[CLOCK_MAX_DEVICES];
+
+	ClockTracker();									// constructor
+	CLOCK_DEVICE *Device( uint32_t capemcaId );		// table entry, made on first use
+	bool Process( const McaFrame &frame, CLOCK_INTERVAL *interval );	// true once there is an interval
+	bool Observe( CLOCK_DEVICE *d, double sendTime, double receiveTime, double deviceSeconds,
+				  double quantum );					// one latch in a host window, false if dropped
+	double HostTime( const CLOCK_DEVICE *d, double deviceSeconds, double *sigma ) const;
+};
+
+double MeasureUtcOffset( double *uncertainty = NULL );	// CLOCK_REALTIME - CLOCK_MONOTONIC, tightest of a few reads
@@ -0,0 +1,202 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Class methods for cross-detector coincidence
+//   definitions in mcaCoincidence.h
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+#include "mcaCoincidence.h"
+
+static inline void MaskSet( DEVICE_MASK *m, int d )
+{
+	m->word[d >> 6] |= 1ULL << (d & 63);
+}
+
+static inline bool MaskTest( const DEVICE_MASK &m, int d )
+{
+	return( (m.word[d >> 6] >> (d & 63)) & 1 );
+}
+
+CoincidenceEngine::CoincidenceEngine( int nChannels, double toleranceSeconds, int minOthers )	// constructor
+{
+	channels = nChannels;
+	devices = 0;
+	memset(&vetoMask,0,sizeof(vetoMask));
+	minCoincident = minOthers;
+	tolerance = toleranceSeconds;
+	groups = 0;
+}
+
+CoincidenceEngine::~CoincidenceEngine()				// destructor
+{
+	for (int d=0; d<devices; d++)
+		{
+		for (int q=0; q<COINC_QUEUE; q++) delete[] device[d]->queue[q].spectrum;
+		delete[] device[d]->lastReadout;
+		delete[] device[d]->all;
+		delete[] device[d]->coincident;
+		delete[] device[d]->anticoincident;
+		delete device[d];
+		}
+}
+
+int CoincidenceEngine::AddDevice( uint32_t capemcaId, bool veto, int roiLo, int roiHi, uint32_t threshold )
+{
+	COINC_DEVICE *c;
+
+	if ( (devices >= COINC_MAX_DEVICES) || (Find(capemcaId) >= 0) ) return( -1 );
+	c = new COINC_DEVICE;
+	memset(c,0,sizeof(COINC_DEVICE));
+	c->capemcaId = capemcaId;
+	c->veto = veto;
+	c->roiLo = roiLo < 0 ? 0 : (roiLo > channels ? channels : roiLo);
+	c->roiHi = roiHi > channels ? channels : roiHi;
+	c->threshold = threshold;
+	c->lastReadout = new uint32_t[channels];
+	for (int q=0; q<COINC_QUEUE; q++) c->queue[q].spectrum = new uint32_t[channels];
+	c->all = new uint64_t[channels]();
+	c->coincident = new uint64_t[channels]();
+	c->anticoincident = new uint64_t[channels]();
+	if ( veto ) MaskSet(&vetoMask,devices);
+	device[devices] = c;
+	return( devices++ );
+}
+
+int CoincidenceEngine::Find( uint32_t capemcaId )
+{
+	for (int d=0; d<devices; d++)
+		if ( device[d]->capemcaId == capemcaId ) return( d );
+	return( -1 );
+}
+
+bool CoincidenceEngine::AddReadout( int d, const McaFrame &frame )
+{
+	COINC_DEVICE *c;
+	COINC_INTERVAL *slot;
+
+	if ( (d < 0) || (d >= devices) || (frame.channels != channels) ) return( false );
+	c = device[d];
+	if ( !c->haveReadout )							// first readout only primes the difference
+		{
+		memcpy(c->lastReadout,frame.spectrum,channels*4);
+		c->lastTotalIntervals = frame.hasPacket0 ? frame.packet0.totalIntervals : 0;
+		c->haveReadout = true;
+		return( true );
+		}
+	if ( c->queued == COINC_QUEUE )					// detector far ahead of the others
+		{
+		c->head = (c->head + 1) % COINC_QUEUE;
+		c->queued--;
+		c->dropped++;
+		}
+	slot = &c->queue[(c->head + c->queued) % COINC_QUEUE];
+	slot->time = frame.hostTime;
+	if ( !IntervalSpectrum(frame.spectrum,c->lastReadout,slot->spectrum,channels) ) c->lastTotalIntervals = 0;
+	slot->newIntervals = frame.hasPacket0 ? frame.packet0.totalIntervals - c->lastTotalIntervals : 0;
+	memcpy(c->lastReadout,frame.spectrum,channels*4);
+	c->lastTotalIntervals = frame.hasPacket0 ? frame.packet0.totalIntervals : 0;
+	c->queued++;
+	return( true );
+}
+
+int CoincidenceEngine::Process( bool flush )
+{
+	int formed = 0, earliest, member[COINC_MAX_DEVICES], members, others, d;
+	bool ready, full;
+	double t0;
+	uint32_t reference;
+	DEVICE_MASK hits;
+	COINC_DEVICE *c;
+	COINC_INTERVAL *head;
+
+	for (;;)
+		{
+		ready = true;								// wait for every detector unless one is
+		full = false;								// backed up or the stream has ended
+		earliest = -1;
+		for (d=0; d<devices; d++)
+			{
+			c = device[d];
+			if ( !c->queued ) ready = false;
+			else
+				{
+				if ( c->queued == COINC_QUEUE ) full = true;
+				if ( (earliest < 0) || (c->queue[c->head].time < device[earliest]->queue[device[earliest]->head].time) )
+					earliest = d;
+				}
+			}
+		if ( (earliest < 0) || !(ready || full || flush) ) break;
+
+		t0 = device[earliest]->queue[device[earliest]->head].time;
+		reference = device[earliest]->queue[device[earliest]->head].newIntervals;
+		members = 0;
+		memset(&hits,0,sizeof(hits));
+		for (d=0; d<devices; d++)					// members and their hits
+			{
+			c = device[d];
+			if ( !c->queued ) continue;
+			head = &c->queue[c->head];
+			if ( head->time > t0 + tolerance ) continue;
+			if ( reference && head->newIntervals && (head->newIntervals != reference) ) continue;
+			member[members++] = d;
+			uint64_t roi = 0;
+			for (int i=c->roiLo; i<c->roiHi; i++) roi += head->spectrum[i];
+			if ( roi >= c->threshold ) MaskSet(&hits,d);
+			}
+
+		int hitsNotVeto = 0;						// popcount of hits outside the veto set
+		bool anyVeto = false;
+		for (int w=0; w<COINC_MASK_WORDS; w++)
+			{
+			hitsNotVeto += __builtin_popcountll(hits.word[w] & ~vetoMask.word[w]);
+			anyVeto |= (hits.word[w] & vetoMask.word[w]) != 0;
+			}
+
+		for (int m=0; m<members; m++)				// gate and accumulate each member
+			{
+			d = member[m];
+			c = device[d];
+			head = &c->queue[c->head];
+			bool hit = MaskTest(hits,d);
+			bool vetoed = anyVeto;
+			if ( c->veto && hit )					// a veto does not veto itself
+				{
+				DEVICE_MASK otherVetoHits = hits;
+				otherVetoHits.word[d >> 6] &= ~(1ULL << (d & 63));
+				vetoed = false;
+				for (int w=0; w<COINC_MASK_WORDS; w++) vetoed |= (otherVetoHits.word[w] & vetoMask.word[w]) != 0;
+				}
+			others = hitsNotVeto - ((hit && !c->veto) ? 1 : 0);
+			bool coincident = hit && (others >= minCoincident);
+
+			for (int i=0; i<channels; i++) c->all[i] += head->spectrum[i];
+			if ( coincident )
+				{
+				for (int i=0; i<channels; i++) c->coincident[i] += head->spectrum[i];
+				c->coincidentIntervals++;
+				}
+			if ( !vetoed )
+				for (int i=0; i<channels; i++) c->anticoincident[i] += head->spectrum[i];
+			else c->vetoedIntervals++;
+			c->intervals++;
+			c->head = (c->head + 1) % COINC_QUEUE;
+			c->queued--;
+			}
+		groups++;
+		formed++;
+		}
+	return( formed );
+}
+
+void CoincidenceEngine::Reset( void )
+{
+	groups = 0;
+	for (int d=0; d<devices; d++)
+		{
+		COINC_DEVICE *c = device[d];
+		memset(c->all,0,channels*8);
+		memset(c->coincident,0,channels*8);
+		memset(c->anticoincident,0,channels*8);
+		c->intervals = c->coincidentIntervals = c->vetoedIntervals = c->dropped = 0;
+		}
+}
@@ -0,0 +1,69 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Cross-detector coincidence and anticoincidence over aligned acquisition intervals
+//   methods in mcaCoincidence.cpp
+//
+// The MCAs report spectra per readout, not per event, so coincidence is decided per aligned
+// interval. Cumulative readouts of each detector are differenced into interval spectra and
+// queued. An interval group is formed from the earliest queued interval and every other
+// detector's head interval within the time tolerance that covers the same number of new MCA
+// intervals (totalIntervals step). A detector is hit in the group when its counts in its
+// region of interest reach its threshold. Hits are a bitset over detector numbers, so each
+// group costs one pass over the members plus a few word operations:
+//   all[d]            every interval of detector d
+//   coincident[d]     d hit and at least minCoincident other non-veto detectors hit
+//   anticoincident[d] no veto detector hit (veto-subtracted spectrum)
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "mcaFrame.h"
+
+#define COINC_MAX_DEVICES		256					// as many as WinUSBDs can enumerate
+#define COINC_MASK_WORDS		(COINC_MAX_DEVICES/64)
+#define COINC_QUEUE				16					// intervals held per detector while aligning
+
+typedef struct
+{
+	uint64_t word[COINC_MASK_WORDS];				// bit d set for detector number d
+} DEVICE_MASK;
+
+typedef struct
+{
+	double time;									// hostTime of the readout ending the interval
+	uint32_t newIntervals;							// MCA totalIntervals step, 0 if no packet0
+	uint32_t *spectrum;
+} COINC_INTERVAL;
+
+typedef struct
+{
+	uint32_t capemcaId;
+	bool veto;
+	int roiLo, roiHi;								// hit test channels [roiLo,roiHi)
+	uint32_t threshold;								// counts in roi for a hit
+	bool haveReadout;
+	uint32_t lastTotalIntervals;
+	uint32_t *lastReadout;
+	COINC_INTERVAL queue[COINC_QUEUE];
+	int head, queued;
+	uint64_t *all, *coincident, *anticoincident;	// accumulated spectra
+	uint64_t intervals, coincidentIntervals, vetoedIntervals, dropped;
+} COINC_DEVICE;
+
+class CoincidenceEngine {
+public:
+	int channels;
+	int devices;
+	COINC_DEVICE *device[COINC_MAX_DEVICES];
+	DEVICE_MASK vetoMask;
+	int minCoincident;								// other detectors needed for coincidence
+	double tolerance;								// seconds between readouts of one group
+	uint64_t groups;
+
+	CoincidenceEngine( int nChannels, double toleranceSeconds = 0.25, int minOthers = 1 );
+	~CoincidenceEngine();
+	int AddDevice( uint32_t capemcaId, bool veto, int roiLo, int roiHi, uint32_t threshold );
+	int Find( uint32_t capemcaId );					// detector number, -1 if not added
+	bool AddReadout( int d, const McaFrame &frame );	// cumulative readout of detector d
+	int Process( bool flush = false );				// form groups, returns number formed
+	void Reset( void );								// clear accumulated spectra and counters
+};
@@ -0,0 +1,138 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Client side of the acquisition daemon protocol
+//   definitions in mcaDaemon.h
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "mcaDaemon.h"
+
+bool DaemonSendAll( int fd, const void *bytes, size_t length )
+{
+	const uint8_t *p = (const uint8_t *)bytes;
+	ssize_t n;
+
+	while ( length )
+		{
+		n = send(fd,p,length,MSG_NOSIGNAL);
+		if ( n < 0 )
+			{
+			if ( errno == EINTR ) continue;
+			return( false );
+			}
+		p += n;
+		length -= n;
+		}
+	return( true );
+}
+
+bool DaemonReceiveAll( int fd, void *bytes, size_t length )
+{
+	uint8_t *p = (uint8_t *)bytes;
+	ssize_t n;
+
+	while ( length )
+		{
+		n = recv(fd,p,length,0);
+		if ( n < 0 )
+			{
+			if ( errno == EINTR ) continue;
+			return( false );
+			}
+		if ( n == 0 ) return( false );				// daemon closed the connection
+		p += n;
+		length -= n;
+		}
+	return( true );
+}
+
+////// DaemonClient /////////////////////////////////////////////////////////////////////////////////
+
+DaemonClient::DaemonClient()						// constructor
+{
+	fd = -1;
+	nextTag = 1;
+	payload = NULL;
+	payloadAllocated = 0;
+}
+
+DaemonClient::~DaemonClient()						// destructor
+{
+	Close();
+	free(payload);
+}
+
+bool DaemonClient::Connect( const char *path )
+{
+	struct sockaddr_un address;
+
+	Close();
+	if ( strlen(path) >= sizeof(address.sun_path) ) return( false );
+	fd = socket(AF_UNIX,SOCK_STREAM,0);
+	if ( fd < 0 ) return( false );
+	memset(&address,0,sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path,path);
+	if ( connect(fd,(struct sockaddr *)&address,sizeof(address)) < 0 )
+		{
+		Close();
+		return( false );
+		}
+	return( true );
+}
+
+void DaemonClient::Close( void )
+{
+	if ( fd >= 0 ) close(fd);
+	fd = -1;
+}
+
+uint32_t DaemonClient::Queue( uint8_t *batch, int *batchLength, uint16_t command, uint16_t device, uint32_t arg )
+{
+	DAEMON_MESSAGE m;
+
+	m.command = command;
+	m.device = device;
+	m.tag = nextTag++;
+	m.arg = arg;
+	m.length = 0;
+	memcpy(batch+*batchLength,&m,sizeof(m));
+	*batchLength += sizeof(m);
+	return( m.tag );
+}
+
+bool DaemonClient::Send( const uint8_t *batch, int batchLength )
+{
+	return( (fd >= 0) && DaemonSendAll(fd,batch,batchLength) );
+}
+
+bool DaemonClient::Receive( DAEMON_MESSAGE *reply )
+{
+	if ( (fd < 0) || !DaemonReceiveAll(fd,reply,sizeof(DAEMON_MESSAGE)) ) return( false );
+	if ( reply->length > payloadAllocated )
+		{
+		uint8_t *grown = (uint8_t *)realloc(payload,reply->length);
+		if ( !grown ) return( false );
+		payload = grown;
+		payloadAllocated = reply->length;
+		}
+	return( DaemonReceiveAll(fd,payload,reply->length) );
+}
+
+bool DaemonClient::Call( uint16_t command, uint16_t device, uint32_t arg, DAEMON_MESSAGE *reply )
+{
+	uint8_t batch[sizeof(DAEMON_MESSAGE)];
+	int length = 0;
+	uint32_t tag = Queue(batch,&length,command,device,arg);
+
+	if ( !Send(batch,length) ) return( false );
+	do
+		if ( !Receive(reply) ) return( false );
+	while ( reply->tag != tag );					// skip frames pushed meanwhile
+	return( true );
+}
@@ -0,0 +1,91 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Binary protocol of the acquisition daemon (capeMCAd.cpp) and the client side of it
+//   methods in mcaDaemon.cpp
+//
+// Clients connect to a Unix stream socket and write any number of 16-byte DAEMON_MESSAGE
+// requests back to back; the daemon answers each with a DAEMON_MESSAGE whose command has
+// DAEMON_REPLY set, arg holding a DAEMON_STATUS_ code, the request tag echoed, and length
+// bytes of payload following. Replies come in request order, except that ZERO is answered
+// only once the device threads have done it, so match replies by tag. After SUBSCRIBE the
+// daemon also pushes one DAEMON_CMD_FRAME message per new readout with the subscribe tag.
+//
+//   request            arg                       reply payload
+//   LIST               -                         DAEMON_DEVICE_INFO per device
+//   ZERO               -                         - (sent once the MCA echoed {1,1})
+//   SET_REQUEST        request code              -
+//   SNAPSHOT           DAEMON_FLAG_ bits         DAEMON_DEVICE_INFO, PACKET0_TYPE, then
+//                                                uint32 latest[channels] if DAEMON_FLAG_LATEST,
+//                                                uint64 accumulated[channels] if _ACCUMULATED,
+//                                                double corrected[channels] if _CORRECTED
+//   SUBSCRIBE          DAEMON_FLAG_ bits         - (then FRAME messages as SNAPSHOT payload)
+//   UNSUBSCRIBE        -                         -
+// device is the index in the LIST reply, or DAEMON_ALL_DEVICES for ZERO and SUBSCRIBE.
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "mcaFrame.h"
+
+#define DAEMON_SOCKET_PATH		"/tmp/capemca.sock"
+#define DAEMON_MAX_DEVICES		32					// bits of a subscription mask
+#define DAEMON_ALL_DEVICES		0xFFFF
+
+#define DAEMON_CMD_LIST			1
+#define DAEMON_CMD_ZERO			2
+#define DAEMON_CMD_SET_REQUEST	3
+#define DAEMON_CMD_SNAPSHOT		4
+#define DAEMON_CMD_SUBSCRIBE	5
+#define DAEMON_CMD_UNSUBSCRIBE	6
+#define DAEMON_CMD_FRAME		7					// pushed to subscribers only
+#define DAEMON_REPLY			0x8000
+
+#define DAEMON_STATUS_OK		0
+#define DAEMON_STATUS_BAD_COMMAND	1
+#define DAEMON_STATUS_BAD_DEVICE	2
+#define DAEMON_STATUS_BAD_ARG	3
+#define DAEMON_STATUS_NO_DATA	4
+#define DAEMON_STATUS_FAILED	5
+
+#define DAEMON_FLAG_LATEST		1					// include the latest readout
+#define DAEMON_FLAG_ACCUMULATED	2					// include the 64-bit sum of readouts
+#define DAEMON_FLAG_CORRECTED	4					// include the dead-time corrected sum
+
+typedef struct
+{
+	uint16_t command;								// DAEMON_CMD_, | DAEMON_REPLY in replies
+	uint16_t device;
+	uint32_t tag;									// chosen by client, echoed in the reply
+	uint32_t arg;									// argument, or DAEMON_STATUS_ in replies
+	uint32_t length;								// payload bytes that follow
+} DAEMON_MESSAGE;									// sizeof(DAEMON_MESSAGE) = 16 bytes
+
+typedef struct
+{
+	uint32_t capemcaId;								// from the latest packet0, 0 if none yet
+	uint32_t channels;								// of the latest readout
+	uint32_t request;								// request code being polled
+	uint32_t errors;								// failed requests
+	uint64_t frames;								// readouts since the daemon started
+	double hostTime;								// MonotonicSeconds() of the latest readout
+	char name[32];									// port or "simulator n"
+} DAEMON_DEVICE_INFO;								// sizeof(DAEMON_DEVICE_INFO) = 64 bytes
+
+bool DaemonSendAll( int fd, const void *bytes, size_t length );		// blocking, whole buffer
+bool DaemonReceiveAll( int fd, void *bytes, size_t length );
+
+class DaemonClient {								// blocking client for tools and scripts
+public:
+	int fd;
+	uint32_t nextTag;
+	uint8_t *payload;								// payload of the last Receive()
+	uint32_t payloadAllocated;
+
+	DaemonClient();									// constructor
+	~DaemonClient();								// destructor closes the socket
+	bool Connect( const char *path = DAEMON_SOCKET_PATH );
+	void Close( void );
+	uint32_t Queue( uint8_t *batch, int *batchLength, uint16_t command, uint16_t device, uint32_t arg );
+	bool Send( const uint8_t *batch, int batchLength );	// one write for many requests
+	bool Receive( DAEMON_MESSAGE *reply );			// next reply or pushed frame
+	bool Call( uint16_t command, uint16_t device, uint32_t arg, DAEMON_MESSAGE *reply );	// one round trip
+};
@@ -0,0 +1,210 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Functions and class methods for dead-time correction
+//   definitions in mcaDeadTime.h
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "mcaDeadTime.h"
+
+static const char *modelNames[] = { "none", "live", "nonparalyzable", "paralyzable" };
+
+const char *DeadTimeModelName( int model )
+{
+	return( (model >= DEADTIME_NONE) && (model <= DEADTIME_PARALYZABLE) ? modelNames[model] : "unknown" );
+}
+
+static double ParalyzableTrueRate( double m, double tau, bool *saturated )
+{												// solve m = n exp(-n tau) with n tau < 1
+	double n = m, f, df;
+
+	*saturated = (m*tau >= 1.0/M_E);
+	if ( *saturated ) return( 1.0/tau );			// the peak of m(n), rate cannot be resolved
+	for (int i=0; i<50; i++)						// Newton from below converges monotonically
+		{
+		f = n*exp(-n*tau) - m;
+		df = (1.0 - n*tau)*exp(-n*tau);
+		if ( df <= 0.0 ) break;
+		n -= f/df;
+		if ( fabs(f) <= 1.0e-12*m ) break;
+		}
+	return( n );
+}
+
+bool DeadTimeCorrect( const DEADTIME_PARAMS &params, double realTime, double pulseTime, double counts,
+						DEADTIME_RESULT *result )
+{
+	double tau = params.tau, tauPileup = params.tauPileup, m, n;
+
+	memset(result,0,sizeof(DEADTIME_RESULT));
+	if ( (realTime <= 0.0) || (counts < 0.0) ) return( false );
+	if ( pulseTime < 0.0 ) pulseTime = 0.0;
+	if ( pulseTime > realTime ) pulseTime = realTime;
+	m = counts/realTime;
+	if ( (tau <= 0.0) && (counts > 0.0) ) tau = pulseTime/counts;	// measured mean pulse width
+
+	switch (params.model)
+		{
+		case DEADTIME_LIVE:
+			n = pulseTime < realTime ? counts/(realTime - pulseTime) : m;
+			break;
+		case DEADTIME_NONPARALYZABLE:
+			n = m*tau < 1.0 ? m/(1.0 - m*tau) : m;
+			break;
+		case DEADTIME_PARALYZABLE:
+			n = ParalyzableTrueRate(m,tau,&result->saturated);
+			break;
+		default:
+			n = m;
+		}
+
+	result->realTime = realTime;
+	result->liveTime = realTime - pulseTime;
+	result->measuredRate = m;
+	result->trueRate = n;
+	result->factor = m > 0.0 ? n/m : 1.0;
+	if ( tauPileup <= 0.0 ) tauPileup = counts > 0.0 ? pulseTime/counts : 0.0;
+	result->pileupFraction = 1.0 - exp(-n*tauPileup);
+	return( true );
+}
+
+void ScaleSpectrum( const uint32_t * __restrict counts, float * __restrict scaled, int channels, float factor )
+{
+	for (int i=0; i<channels; i++)					// simple loop so gcc -O3 vectorizes it
+		scaled[i] = (float)counts[i]*factor;
+}
+
+////// CorrectedSpectrum ////////////////////////////////////////////////////////////////////////////
+
+CorrectedSpectrum::CorrectedSpectrum()				// constructor
+{
+	channels = 0;
+	lastChannels = 0;
+	Clear();
+}
+
+void CorrectedSpectrum::Clear( void )				// e.g. after zeroing the device
+{
+	frames = 0;
+	memset(sum,0,sizeof(sum));
+}
+
+bool CorrectedSpectrum::Add( const McaFrame &frame, const DEADTIME_RESULT *result )
+{
+	if ( !frame.channels ) return( false );
+	if ( channels && (channels != frame.channels) )	// resolution changed, restart the sum
+		{
+		Clear();
+		channels = 0;
+		}
+	if ( lastChannels != frame.channels )			// first readout holds all counts since the zero
+		memset(last,0,frame.channels*4);
+	IntervalSpectrum(frame.spectrum,last,interval,frame.channels);	// whole readout after a zero too
+	memcpy(last,frame.spectrum,frame.channels*4);
+	lastChannels = frame.channels;
+	if ( !result ) return( false );					// no factor for this interval
+
+	ScaleSpectrum(interval,scaled,frame.channels,(float)result->factor);
+	channels = frame.channels;
+	for (int i=0; i<channels; i++) sum[i] += scaled[i];
+	frames++;
+	return( true );
+}
+
+////// DeadTimeCorrector ////////////////////////////////////////////////////////////////////////////
+
+DeadTimeCorrector::DeadTimeCorrector()				// constructor
+{
+	memset(&defaults,0,sizeof(defaults));
+	defaults.model = DEADTIME_LIVE;
+	devices = 0;
+}
+
+DEADTIME_DEVICE *DeadTimeCorrector::Device( uint32_t capemcaId )
+{
+	DEADTIME_DEVICE *d;
+
+	for (int n=0; n<devices; n++)
+		if ( device[n].params.capemcaId == capemcaId ) return( &device[n] );
+	if ( devices >= DEADTIME_MAX_DEVICES ) return( NULL );
+	d = &device[devices++];
+	memset(d,0,sizeof(DEADTIME_DEVICE));
+	d->params = defaults;
+	d->params.capemcaId = capemcaId;
+	return( d );
+}
+
+bool DeadTimeCorrector::Configure( const DEADTIME_PARAMS &params )
+{
+	DEADTIME_DEVICE *d = Device(params.capemcaId);
+
+	if ( !d ) return( false );
+	d->params = params;
+	return( true );
+}
+
+bool DeadTimeCorrector::LoadConfig( const char *path )
+{
+	FILE *f;
+	char line[256], name[32];
+	unsigned int id;
+	double tauUs, pileupUs;
+	int fields, lineNumber = 0, model;
+	DEADTIME_PARAMS params;
+
+	if ( !(f = fopen(path,"r")) )
+		{
+		printf("Cannot open %s\n",path);
+		return( false );
+		}
+	while ( fgets(line,sizeof(line),f) )
+		{
+		lineNumber++;
+		if ( (line[0] == '#') || (line[0] == '\n') || (line[0] == '\r') ) continue;
+		tauUs = pileupUs = 0.0;
+		fields = sscanf(line,"%u %31s %lf %lf",&id,name,&tauUs,&pileupUs);
+		for (model=DEADTIME_NONE; model<=DEADTIME_PARALYZABLE; model++)
+			if ( !strcmp(name,modelNames[model]) ) break;
+		if ( (fields < 2) || (model > DEADTIME_PARALYZABLE) || (tauUs < 0.0) || (pileupUs < 0.0) )
+			{
+			printf("%s line %d: expected \"capemcaId none|live|nonparalyzable|paralyzable [tauUs [pileupUs]]\"\n",
+					path,lineNumber);
+			fclose(f);
+			return( false );
+			}
+		params.capemcaId = id;
+		params.model = model;
+		params.tau = tauUs*1.0e-6;
+		params.tauPileup = pileupUs*1.0e-6;
+		if ( !Configure(params) ) break;
+		}
+	fclose(f);
+	return( true );
+}
+
+bool DeadTimeCorrector::Correct( const McaFrame &frame, DEADTIME_RESULT *result )
+{
+	DEADTIME_DEVICE *d;
+	const PACKET0_TYPE &p = frame.packet0;
+	double intervals, pulseTime, counts;
+
+	if ( !frame.hasPacket0 || !(d = Device(p.capemcaId)) ) return( false );
+	if ( !d->havePrevious || (p.totalIntervals < d->previous.totalIntervals) )
+		{											// first frame, or MCA zeroed since
+		intervals = p.totalIntervals;
+		pulseTime = p.totalPulseTime;
+		counts = p.totalCount;
+		}
+	else
+		{
+		intervals = p.totalIntervals - d->previous.totalIntervals;
+		pulseTime = p.totalPulseTime - d->previous.totalPulseTime;
+		counts = p.totalCount - d->previous.totalCount;
+		}
+	d->previous = p;
+	d->havePrevious = true;
+	if ( intervals <= 0.0 ) return( false );		// nothing new to correct
+	return( DeadTimeCorrect(d->params,intervals*p.usPerInterval*1.0e-6,pulseTime,counts,result) );
+}
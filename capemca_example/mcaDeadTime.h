@@ -0,0 +1,90 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Dead-time, live-time and pile-up correction of count rates and spectra
+//   methods in mcaDeadTime.cpp
+//
+// Each frame with packet0 is compared with the previous one from the same capemcaId, the first
+// frame and one after a zero with nothing, so they are corrected with the whole packet0 totals:
+//   real time = new intervals * usPerInterval,  live time = real time - new totalPulseTime
+//   measured rate m = new totalCount / real time
+// and the true rate n is estimated with the model configured for that detector:
+//   DEADTIME_LIVE            n = counts / live time (dead time measured by the MCA itself)
+//   DEADTIME_NONPARALYZABLE  m = n / (1 + n tau)
+//   DEADTIME_PARALYZABLE     m = n exp(-n tau), solved on the n tau < 1 branch
+// The spectrum of the interval is scaled by n/m. The pile-up fraction is the probability that
+// a recorded pulse holds two or more events, 1 - exp(-n tauPileup).
+//
+// CorrectedSpectrum does that for every readout as it arrives: it differences the cumulative
+// spectrum against the previous readout and adds the interval scaled by that interval's own
+// factor, so a run whose rate changes is not corrected with one average factor. The first
+// readout, and one after a resolution change, is taken whole, as ReadoutAccumulator does. Only
+// readouts with packet0 have a factor; the counts of one without are left out.
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "mcaFrame.h"
+
+#define DEADTIME_NONE				0				// rates passed through
+#define DEADTIME_LIVE				1				// default
+#define DEADTIME_NONPARALYZABLE		2
+#define DEADTIME_PARALYZABLE		3
+#define DEADTIME_MAX_DEVICES		256				// as many as WinUSBDs can enumerate
+
+typedef struct
+{
+	uint32_t capemcaId;
+	int model;										// DEADTIME_...
+	double tau;										// seconds of dead time per event, 0 = measured
+	double tauPileup;								// pulse resolving time, 0 = mean pulse width
+} DEADTIME_PARAMS;
+
+typedef struct
+{
+	double realTime;								// seconds in the new intervals
+	double liveTime;
+	double measuredRate;							// counts per second as recorded
+	double trueRate;								// corrected counts per second
+	double factor;									// trueRate / measuredRate
+	double pileupFraction;
+	bool saturated;									// paralyzable rate beyond 1/(e tau)
+} DEADTIME_RESULT;
+
+typedef struct
+{
+	DEADTIME_PARAMS params;
+	bool havePrevious;
+	PACKET0_TYPE previous;
+} DEADTIME_DEVICE;
+
+class DeadTimeCorrector {
+public:
+	DEADTIME_PARAMS defaults;						// for detectors not in the table
+	int devices;
+	DEADTIME_DEVICE device[DEADTIME_MAX_DEVICES];
+
+	DeadTimeCorrector();							// constructor
+	bool Configure( const DEADTIME_PARAMS &params );	// per capemcaId, replaces earlier entry
+	bool LoadConfig( const char *path );			// lines of "capemcaId model tauUs pileupUs"
+	DEADTIME_DEVICE *Device( uint32_t capemcaId );	// table entry, added with defaults if new
+	bool Correct( const McaFrame &frame, DEADTIME_RESULT *result );	// false without packet0 or new intervals
+};
+
+class CorrectedSpectrum {							// dead-time corrected sum of one device's intervals
+public:
+	int channels;
+	uint32_t frames;								// intervals added since Clear()
+	int lastChannels;								// of the last readout, 0 if none yet
+	uint32_t last[MAX_SPECTRUM_SIZE];				// last cumulative readout
+	uint32_t interval[MAX_SPECTRUM_SIZE];			// counts of the last interval
+	float scaled[MAX_SPECTRUM_SIZE];				// and corrected by its factor
+	double sum[MAX_SPECTRUM_SIZE];
+
+	CorrectedSpectrum();							// constructor
+	void Clear( void );								// zero the sum, the last readout stays the base
+	bool Add( const McaFrame &frame, const DEADTIME_RESULT *result );	// result of Correct() for
+};													// this frame or NULL; false if nothing added
+
+bool DeadTimeCorrect( const DEADTIME_PARAMS &params, double realTime, double pulseTime, double counts,
+						DEADTIME_RESULT *result );
+void ScaleSpectrum( const uint32_t *counts, float *scaled, int channels, float factor );
+const char *DeadTimeModelName( int model );
@@ -0,0 +1,182 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Class methods for the USB endpoint cache
+//   definitions in mcaDeviceCache.h
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <ctype.h>
+#include <string.h>
+#include <time.h>
+#include "mcaDeviceCache.h"
+
+#define CACHE_HEADER	"# capeMCA device cache: serial port capemcaId interface in out maxPacket lastRequest savedTime\n"
+
+bool DeviceCacheValid( const DEVICE_CACHE_ENTRY &entry )
+{
+	int units = entry.lastRequest % 32;
+
+	if ( !entry.serial[0] ) return( false );
+	if ( !(entry.pipeInId & 0x80) || (entry.pipeOutId & 0x80) ) return( false );	// directions
+	if ( !(entry.pipeInId & 0x0F) || !(entry.pipeOutId & 0x0F) || (entry.pipeInId & 0x70) || (entry.pipeOutId & 0x70) )
+		return( false );							// endpoints 1..15, never control endpoint 0
+	if ( (entry.maxPacketSize < 8) || (entry.maxPacketSize > 1024) || (entry.maxPacketSize & (entry.maxPacketSize - 1)) )
+		return( false );							// bulk packets are a power of 2
+	if ( (entry.lastRequest < 0) || (entry.lastRequest >= 64) ) return( false );
+	if ( entry.lastRequest && (units & (units - 1)) ) return( false );	// same codes as ValidRequest()
+	if ( (entry.lastRequest > 0) && (entry.lastRequest < 32) && !units ) return( false );
+	return( true );
+}
+
+static void EscapeSerial( const char *serial, char *escaped )	// spaces, '%' and '#' as %XX
+{
+	for (const unsigned char *s=(const unsigned char *)serial; *s; s++)
+		if ( (*s <= ' ') || (*s >= 0x7F) || (*s == '%') || (*s == '#') ) escaped += sprintf(escaped,"%%%02X",*s);
+		else *escaped++ = *s;
+	*escaped = 0;
+}
+
+static bool UnescapeSerial( const char *escaped, char *serial, size_t size )
+{
+	size_t n = 0;
+	unsigned int c;
+
+	for (; *escaped; escaped++)
+		{
+		if ( n + 1 >= size ) return( false );
+		if ( *escaped != '%' ) serial[n++] = *escaped;
+		else if ( isxdigit((unsigned char)escaped[1]) && isxdigit((unsigned char)escaped[2]) &&
+				  (sscanf(escaped+1,"%2x",&c) == 1) )
+			{
+			serial[n++] = (char)c;
+			escaped += 2;
+			}
+		else return( false );
+		}
+	serial[n] = 0;
+	return( n > 0 );
+}
+
+DeviceCache::DeviceCache()							// constructor
+{
+	path[0] = 0;
+	entries = 0;
+	dirty = false;
+}
+
+bool DeviceCache::Load( const char *cachePath )
+{
+	FILE *f;
+	char line[512], port[sizeof(entry[0].port)], serial[3*sizeof(entry[0].serial)];
+	DEVICE_CACHE_ENTRY e;
+	unsigned int id, iface, in, out, packet;
+
+	snprintf(path,sizeof(path),"%s",cachePath);
+	entries = 0;
+	dirty = false;
+	if ( !(f = fopen(path,"r")) ) return( true );	// nothing cached yet
+	while ( fgets(line,sizeof(line),f) && (entries < DEVICE_CACHE_MAX) )
+		{
+		memset(&e,0,sizeof(e));
+		if ( line[0] == '#' ) continue;
+		if ( sscanf(line,"%191s %31s %u %u %x %x %u %d %lf",serial,port,&id,&iface,&in,&out,&packet,
+					&e.lastRequest,&e.savedTime) != 9 ) continue;
+		if ( !UnescapeSerial(serial,e.serial,sizeof(e.serial)) ) continue;
+		if ( strcmp(port,"-") ) memcpy(e.port,port,sizeof(e.port));
+		e.capemcaId = id;
+		e.interfaceNumber = iface;
+		e.pipeInId = in;
+		e.pipeOutId = out;
+		e.maxPacketSize = packet;
+		if ( DeviceCacheValid(e) && (iface < 256) && (in < 256) && (out < 256) ) entry[entries++] = e;
+		}
+	fclose(f);
+	return( true );
+}
+
+bool DeviceCache::Save( void )
+{
+	FILE *f;
+	char temporary[sizeof(path)+8], serial[3*sizeof(entry[0].serial)];
+	bool ok;
+
+	if ( !dirty || !path[0] ) return( true );
+	snprintf(temporary,sizeof(temporary),"%s.tmp",path);
+	if ( !(f = fopen(temporary,"w")) )
+		{
+		printf("Cannot write %s\n",temporary);
+		return( false );
+		}
+	fputs(CACHE_HEADER,f);
+	for (int n=0; n<entries; n++)
+		{
+		EscapeSerial(entry[n].serial,serial);
+		fprintf(f,"%s %s %u %u %02x %02x %u %d %.0f\n",serial,entry[n].port[0] ? entry[n].port : "-",
+				entry[n].capemcaId,entry[n].interfaceNumber,entry[n].pipeInId,entry[n].pipeOutId,
+				entry[n].maxPacketSize,entry[n].lastRequest,entry[n].savedTime);
+		}
+	ok = (fflush(f) == 0);
+	ok = (fclose(f) == 0) && ok;
+#ifdef _WIN32
+	if ( ok ) remove(path);							// rename() does not replace on Windows
+#endif
+	if ( !ok || rename(temporary,path) )
+		{
+		printf("Cannot write %s\n",path);
+		remove(temporary);
+		return( false );
+		}
+	dirty = false;
+	return( true );
+}
+
+DEVICE_CACHE_ENTRY *DeviceCache::Find( const char *serial )
+{
+	for (int n=0; n<entries; n++)
+		if ( !strcmp(entry[n].serial,serial) ) return( &entry[n] );
+	return( NULL );
+}
+
+DEVICE_CACHE_ENTRY *DeviceCache::FindPort( const char *port )
+{
+	for (int n=0; port[0] && (n<entries); n++)
+		if ( !strcmp(entry[n].port,port) ) return( &entry[n] );
+	return( NULL );
+}
+
+DEVICE_CACHE_ENTRY *DeviceCache::FindId( uint32_t capemcaId )
+{
+	for (int n=0; capemcaId && (n<entries); n++)
+		if ( entry[n].capemcaId == capemcaId ) return( &entry[n] );
+	return( NULL );
+}
+
+void DeviceCache::Update( const DEVICE_CACHE_ENTRY &device )
+{
+	DEVICE_CACHE_ENTRY *e = Find(device.serial);
+
+	if ( !DeviceCacheValid(device) ) return;
+	for (int n=0; device.port[0] && (n<entries); n++)	// another device now on that port
+		if ( strcmp(entry[n].serial,device.serial) && !strcmp(entry[n].port,device.port) ) entry[n].port[0] = 0;
+	if ( !e )
+		{
+		if ( entries < DEVICE_CACHE_MAX ) e = &entry[entries++];
+		else										// full, forget the oldest
+			{
+			e = &entry[0];
+			for (int n=1; n<entries; n++)
+				if ( entry[n].savedTime < e->savedTime ) e = &entry[n];
+			}
+		}
+	*e = device;
+	e->savedTime = (double)time(NULL);
+	dirty = true;
+}
+
+void DeviceCache::Remove( const char *serial )
+{
+	DEVICE_CACHE_ENTRY *e = Find(serial);
+
+	if ( !e ) return;
+	*e = entry[--entries];
+	dirty = true;
+}
@@ -0,0 +1,49 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Persisted cache of USB endpoint details per MCA, so a reconnect skips descriptor discovery
+//   methods in mcaDeviceCache.cpp
+//
+// One line per device, keyed by serial number (the USB serial string on Linux, the identifier
+// in the device path on Windows, written with spaces, '%' and '#' as %XX) and also findable by capemcaId or by the bus port it was last
+// seen on. An entry is used only if DeviceCacheValid() passes and the transport's own cheap
+// check of the endpoints against the device succeeds; otherwise descriptors are discovered as
+// before and the entry is replaced. Save() writes a temporary file and renames it, so a crash
+// never leaves half a cache. No platform headers, so it builds on Linux and Windows alike.
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <stdint.h>
+
+#define DEVICE_CACHE_MAX		64
+#define DEVICE_CACHE_PATH		"capemca.cache"		// default, in the working directory
+
+typedef struct
+{
+	char serial[64];
+	char port[32];									// "bus-port.port..." where last seen, "" if unknown
+	uint32_t capemcaId;								// from packet0, 0 if never read
+	uint8_t interfaceNumber;
+	uint8_t pipeInId, pipeOutId;					// bulk endpoint addresses
+	uint16_t maxPacketSize;
+	int lastRequest;								// last request answered, 0 if none
+	double savedTime;								// seconds since 1970 of the last Update()
+} DEVICE_CACHE_ENTRY;
+
+bool DeviceCacheValid( const DEVICE_CACHE_ENTRY &entry );	// fields in range and self-consistent
+
+class DeviceCache {
+public:
+	char path[256];
+	int entries;
+	DEVICE_CACHE_ENTRY entry[DEVICE_CACHE_MAX];
+	bool dirty;										// updated since Load() or Save()
+
+	DeviceCache();									// constructor
+	bool Load( const char *cachePath = DEVICE_CACHE_PATH );	// a missing file is an empty cache
+	bool Save( void );								// only if dirty
+	DEVICE_CACHE_ENTRY *Find( const char *serial );
+	DEVICE_CACHE_ENTRY *FindPort( const char *port );
+	DEVICE_CACHE_ENTRY *FindId( uint32_t capemcaId );
+	void Update( const DEVICE_CACHE_ENTRY &device );	// replaces the entry of its serial
+	void Remove( const char *serial );				// e.g. after its endpoints failed
+};
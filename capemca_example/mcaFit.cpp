@@ -0,0 +1,313 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Functions and class methods for peak fitting
+//   definitions in mcaFit.h
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <string.h>
+#include <math.h>
+#include "mcaFit.h"
+
+#define SQRT2			1.41421356237309504880
+#define SQRT2PI			2.50662827463100050242
+#define TWO_OVER_SQRTPI	1.12837916709551257390
+#define FWHM_PER_SIGMA	2.35482004503094938202
+
+////// model ////////////////////////////////////////////////////////////////////////////////////////
+
+static void FreeParameters( const PEAK_MODEL &model, bool *isFree )
+{
+	isFree[FIT_A] = isFree[FIT_MU] = isFree[FIT_SIGMA] = true;
+	isFree[FIT_TAIL] = isFree[FIT_BETA] = model.tail;
+	isFree[FIT_C0] = (model.background >= 0);
+	isFree[FIT_C1] = (model.background >= 1);
+	isFree[FIT_C2] = (model.background >= 2);
+}
+
+static double Model( double x, double xc, const double *p, bool tail, double *J )
+{													// returns y(x), fills dy/dp when J given
+	double u = x - p[FIT_MU], s = p[FIT_SIGMA], g, y, dx = x - xc;
+
+	g = exp(-0.5*u*u/(s*s));
+	y = p[FIT_A]*g + p[FIT_C0] + p[FIT_C1]*dx + p[FIT_C2]*dx*dx;
+	if ( J )
+		{
+		J[FIT_A] = g;
+		J[FIT_MU] = p[FIT_A]*g*u/(s*s);
+		J[FIT_SIGMA] = p[FIT_A]*g*u*u/(s*s*s);
+		J[FIT_TAIL] = J[FIT_BETA] = 0.0;
+		J[FIT_C0] = 1.0;
+		J[FIT_C1] = dx;
+		J[FIT_C2] = dx*dx;
+		}
+
+	if ( tail )
+		{
+		double b = p[FIT_BETA], T = p[FIT_TAIL];
+		double z = u/(SQRT2*s) + s/(SQRT2*b), E, C, D, EC;
+
+		if ( z < 26.0 )								// beyond this erfc underflows, term is 0
+			{
+			E = exp(u/b);
+			C = erfc(z);
+			D = TWO_OVER_SQRTPI*exp(-z*z);			// -d erfc(z)/dz
+			EC = 0.5*E*C;
+			y += T*EC;
+			if ( J )
+				{
+				J[FIT_TAIL] = EC;
+				J[FIT_MU] += 0.5*T*E*(-C/b + D/(SQRT2*s));
+				J[FIT_SIGMA] += -0.5*T*E*D*(-u/(SQRT2*s*s) + 1.0/(SQRT2*b));
+				J[FIT_BETA] = 0.5*T*E*(-u*C/(b*b) + D*s/(SQRT2*b*b));
+				}
+			}
+		}
+	return( y );
+}
+
+static double Chi2( const double *y, int lo, int hi, const double *p, bool tail )
+{
+	double chi2 = 0.0, r, xc = 0.5*(lo + hi - 1);
+
+	for (int x=lo; x<hi; x++)						// Neyman weights 1/max(y,1)
+		{
+		r = y[x] - Model(x,xc,p,tail,NULL);
+		chi2 += r*r/(y[x] > 1.0 ? y[x] : 1.0);
+		}
+	return( chi2 );
+}
+
+static bool Cholesky( double *a, int n )			// in place, lower triangle, a is n x n
+{
+	for (int j=0; j<n; j++)
+		{
+		double d = a[j*n+j];
+		for (int k=0; k<j; k++) d -= a[j*n+k]*a[j*n+k];
+		if ( d <= 0.0 ) return( false );
+		a[j*n+j] = sqrt(d);
+		for (int i=j+1; i<n; i++)
+			{
+			double s = a[i*n+j];
+			for (int k=0; k<j; k++) s -= a[i*n+k]*a[j*n+k];
+			a[i*n+j] = s/a[j*n+j];
+			}
+		}
+	return( true );
+}
+
+static void CholeskySolve( const double *l, int n, const double *b, double *x )
+{
+	for (int i=0; i<n; i++)							// L y = b
+		{
+		double s = b[i];
+		for (int k=0; k<i; k++) s -= l[i*n+k]*x[k];
+		x[i] = s/l[i*n+i];
+		}
+	for (int i=n-1; i>=0; i--)						// L' x = y
+		{
+		double s = x[i];
+		for (int k=i+1; k<n; k++) s -= l[k*n+i]*x[k];
+		x[i] = s/l[i*n+i];
+		}
+}
+
+static void Constrain( double *p, int lo, int hi )	// keep parameters physical
+{
+	double width = hi - lo;
+
+	if ( p[FIT_A] < 0.0 ) p[FIT_A] = 0.0;
+	if ( p[FIT_MU] < lo ) p[FIT_MU] = lo;
+	if ( p[FIT_MU] > hi - 1 ) p[FIT_MU] = hi - 1;
+	if ( p[FIT_SIGMA] < 0.3 ) p[FIT_SIGMA] = 0.3;
+	if ( p[FIT_SIGMA] > width ) p[FIT_SIGMA] = width;
+	if ( p[FIT_TAIL] < 0.0 ) p[FIT_TAIL] = 0.0;
+	if ( p[FIT_BETA] < 0.2 ) p[FIT_BETA] = 0.2;
+	if ( p[FIT_BETA] > width ) p[FIT_BETA] = width;
+}
+
+static void InitialGuess( const double *y, int lo, int hi, const PEAK_MODEL &model, double *p )
+{
+	int edge = (hi - lo)/8 > 0 ? ((hi - lo)/8 < 4 ? (hi - lo)/8 : 4) : 1;
+	double left = 0.0, right = 0.0, bg, peak = -1.0e300, half, xc = 0.5*(lo + hi - 1);
+	int top = lo, above = 0;
+
+	for (int i=0; i<edge; i++)						// background from the window edges
+		{
+		left += y[lo+i];
+		right += y[hi-1-i];
+		}
+	left /= edge;
+	right /= edge;
+	memset(p,0,FIT_PARAMS*sizeof(double));
+	if ( model.background >= 0 ) p[FIT_C0] = 0.5*(left + right);
+	if ( model.background >= 1 ) p[FIT_C1] = (right - left)/(hi - lo - edge);
+
+	for (int x=lo; x<hi; x++)						// tallest point above background
+		{
+		bg = p[FIT_C0] + p[FIT_C1]*(x - xc);
+		if ( y[x] - bg > peak )
+			{
+			peak = y[x] - bg;
+			top = x;
+			}
+		}
+	half = 0.5*peak;
+	for (int x=lo; x<hi; x++)
+		if ( y[x] - p[FIT_C0] - p[FIT_C1]*(x - xc) > half ) above++;
+
+	p[FIT_A] = peak > 1.0 ? peak : 1.0;
+	p[FIT_MU] = top;
+	p[FIT_SIGMA] = above/FWHM_PER_SIGMA;
+	p[FIT_BETA] = 1.0;
+	if ( model.tail )
+		{
+		p[FIT_TAIL] = 0.05*p[FIT_A];
+		p[FIT_BETA] = p[FIT_SIGMA] > 1.0 ? p[FIT_SIGMA] : 1.0;
+		}
+	Constrain(p,lo,hi);
+}
+
+////// Levenberg-Marquardt //////////////////////////////////////////////////////////////////////////
+
+bool FitPeak( const double *y, int lo, int hi, const PEAK_MODEL &model, PEAK_FIT *fit )
+{
+	bool isFree[FIT_PARAMS];
+	int index[FIT_PARAMS], n = 0;
+	double p[FIT_PARAMS], trial[FIT_PARAMS], J[FIT_PARAMS];
+	double alpha[FIT_PARAMS*FIT_PARAMS], beta[FIT_PARAMS], m[FIT_PARAMS*FIT_PARAMS], step[FIT_PARAMS];
+	double chi2, trialChi2, lambda = 1.0e-3, xc = 0.5*(lo + hi - 1), w, r, yModel;
+	bool accepted, held[FIT_PARAMS];
+
+	FreeParameters(model,isFree);
+	for (int k=0; k<FIT_PARAMS; k++)
+		if ( isFree[k] ) index[n++] = k;
+	fit->converged = false;
+	fit->dof = (hi - lo) - n;
+	if ( fit->dof < 1 ) return( fit->valid = false );
+
+	if ( fit->valid ) memcpy(p,fit->params,sizeof(p));	// warm start from previous interval
+	else InitialGuess(y,lo,hi,model,p);
+	for (int k=0; k<FIT_PARAMS; k++)
+		if ( !isFree[k] && (k != FIT_BETA) ) p[k] = 0.0;
+	Constrain(p,lo,hi);
+	chi2 = Chi2(y,lo,hi,p,model.tail);
+
+	for (fit->iterations=0; fit->iterations<FIT_MAX_ITERATIONS; fit->iterations++)
+		{
+		memset(alpha,0,sizeof(alpha));				// J'WJ and J'Wr over free parameters
+		memset(beta,0,sizeof(beta));
+		for (int x=lo; x<hi; x++)
+			{
+			yModel = Model(x,xc,p,model.tail,J);
+			w = 1.0/(y[x] > 1.0 ? y[x] : 1.0);
+			r = y[x] - yModel;
+			for (int i=0; i<n; i++)
+				{
+				double wj = w*J[index[i]];
+				beta[i] += wj*r;
+				for (int j=0; j<=i; j++) alpha[i*n+j] += wj*J[index[j]];
+				}
+			}
+		for (int i=0; i<n; i++)
+			for (int j=0; j<i; j++) alpha[j*n+i] = alpha[i*n+j];
+		for (int i=0; i<n; i++)						// a parameter with no effect (tail b once
+			if ( (held[i] = !(alpha[i*n+i] > 0.0)) )	// T is 0) is held where it is
+				{
+				for (int j=0; j<n; j++) alpha[i*n+j] = alpha[j*n+i] = 0.0;
+				alpha[i*n+i] = 1.0;
+				beta[i] = 0.0;
+				}
+
+		accepted = false;
+		while ( !accepted && (lambda < 1.0e10) )	// raise damping until chi2 drops
+			{
+			memcpy(m,alpha,n*n*sizeof(double));
+			for (int i=0; i<n; i++) m[i*n+i] *= 1.0 + lambda;
+			if ( Cholesky(m,n) )
+				{
+				CholeskySolve(m,n,beta,step);
+				memcpy(trial,p,sizeof(p));
+				for (int i=0; i<n; i++) trial[index[i]] += step[i];
+				Constrain(trial,lo,hi);
+				trialChi2 = Chi2(y,lo,hi,trial,model.tail);
+				if ( trialChi2 <= chi2 ) accepted = true;
+				}
+			if ( !accepted ) lambda *= 10.0;
+			}
+		if ( !accepted ) break;						// at a minimum within precision
+
+		lambda = lambda > 1.0e-7 ? lambda*0.1 : lambda;
+		memcpy(p,trial,sizeof(p));
+		if ( chi2 - trialChi2 < 1.0e-6*(trialChi2 + 1.0e-3) )
+			{
+			chi2 = trialChi2;
+			fit->converged = true;
+			fit->iterations++;
+			break;
+			}
+		chi2 = trialChi2;
+		}
+	if ( !accepted ) fit->converged = true;			// no step improves chi2 any more
+
+	memcpy(fit->params,p,sizeof(p));				// covariance is the inverse of J'WJ
+	fit->chi2 = chi2;
+	memset(fit->errors,0,sizeof(fit->errors));
+	memcpy(m,alpha,n*n*sizeof(double));
+	if ( !Cholesky(m,n) ) return( fit->valid = false );
+
+	double covariance[FIT_PARAMS*FIT_PARAMS], e[FIT_PARAMS], column[FIT_PARAMS];
+	for (int j=0; j<n; j++)
+		{
+		memset(e,0,sizeof(e));
+		e[j] = 1.0;
+		CholeskySolve(m,n,e,column);
+		for (int i=0; i<n; i++) covariance[i*n+j] = (held[i] || held[j]) ? 0.0 : column[i];
+		}
+	int slot[FIT_PARAMS];							// parameter -> row in covariance, or -1
+	for (int k=0; k<FIT_PARAMS; k++) slot[k] = -1;
+	for (int i=0; i<n; i++)
+		{
+		slot[index[i]] = i;
+		fit->errors[index[i]] = sqrt(covariance[i*n+i]);
+		}
+
+	double grad[FIT_PARAMS], var = 0.0;				// area = A s sqrt(2 pi) + T b
+	memset(grad,0,sizeof(grad));
+	grad[FIT_A] = p[FIT_SIGMA]*SQRT2PI;
+	grad[FIT_SIGMA] = p[FIT_A]*SQRT2PI;
+	if ( model.tail )
+		{
+		grad[FIT_TAIL] = p[FIT_BETA];
+		grad[FIT_BETA] = p[FIT_TAIL];
+		}
+	for (int a=0; a<FIT_PARAMS; a++)
+		for (int b=0; b<FIT_PARAMS; b++)
+			if ( (slot[a] >= 0) && (slot[b] >= 0) )
+				var += grad[a]*grad[b]*covariance[slot[a]*n+slot[b]];
+
+	fit->centroid = p[FIT_MU];
+	fit->centroidError = fit->errors[FIT_MU];
+	fit->fwhm = FWHM_PER_SIGMA*p[FIT_SIGMA];
+	fit->fwhmError = FWHM_PER_SIGMA*fit->errors[FIT_SIGMA];
+	fit->area = p[FIT_A]*p[FIT_SIGMA]*SQRT2PI + (model.tail ? p[FIT_TAIL]*p[FIT_BETA] : 0.0);
+	fit->areaError = sqrt(var > 0.0 ? var : 0.0);
+	fit->valid = true;
+	return( true );
+}
+
+////// FitPool //////////////////////////////////////////////////////////////////////////////////////
+
+static void FitJob( void *context, int job )		// one job of a FitPool batch
+{
+	FIT_JOB *j = (FIT_JOB *)context + job;
+
+	j->ok = FitPeak(j->spectrum,j->lo,j->hi,j->model,j->fit);
+}
+
+FitPool::FitPool( int nThreads ) : WorkerPool(nThreads)	// constructor
+{
+}
+
+void FitPool::Run( FIT_JOB *batchJobs, int n )
+{
+	WorkerPool::Run(FitJob,batchJobs,n);
+}
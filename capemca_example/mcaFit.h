@@ -0,0 +1,64 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Levenberg-Marquardt peak fitting with analytic Jacobians, and a thread pool to run fits
+//   methods in mcaFit.cpp
+//
+// Model in a channel window [lo,hi):
+//   y(x) = A exp(-u^2/(2 s^2))                                      gaussian, u = x - mu
+//        + T/2 exp(u/b) erfc(u/(sqrt(2) s) + s/(sqrt(2) b))          optional low-side tail
+//        + c0 + c1 (x - xc) + c2 (x - xc)^2                          background, xc = window center
+// Fits minimize Poisson-weighted chi-square. A fit whose PEAK_FIT is still valid from the
+// previous interval starts from those parameters, so refits usually converge in a few steps.
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "mcaFrame.h"
+#include "mcaPool.h"
+
+#define FIT_PARAMS				8					// A, mu, s, T, b, c0, c1, c2
+#define FIT_A					0
+#define FIT_MU					1
+#define FIT_SIGMA				2
+#define FIT_TAIL				3
+#define FIT_BETA				4
+#define FIT_C0					5
+#define FIT_C1					6
+#define FIT_C2					7
+#define FIT_MAX_ITERATIONS		50
+
+typedef struct
+{
+	bool tail;										// fit T and b of the low-side tail
+	int background;									// polynomial order 0, 1 or 2; -1 for none
+} PEAK_MODEL;
+
+typedef struct
+{
+	bool valid;										// params hold a usable previous solution
+	bool converged;
+	int iterations;
+	double params[FIT_PARAMS];
+	double errors[FIT_PARAMS];						// 1-sigma from the covariance matrix
+	double chi2;
+	int dof;										// channels minus free parameters
+	double centroid, centroidError;					// channels
+	double fwhm, fwhmError;							// channels
+	double area, areaError;							// counts in gaussian plus tail
+} PEAK_FIT;
+
+bool FitPeak( const double *spectrum, int lo, int hi, const PEAK_MODEL &model, PEAK_FIT *fit );
+
+typedef struct
+{
+	const double *spectrum;							// counts per channel
+	int lo, hi;										// window [lo,hi)
+	PEAK_MODEL model;
+	PEAK_FIT *fit;									// in: previous solution, out: new one
+	bool ok;
+} FIT_JOB;
+
+class FitPool : public WorkerPool {					// runs FIT_JOBs on a fixed set of threads
+public:
+	FitPool( int nThreads = 0 );					// 0 = one per online cpu
+	void Run( FIT_JOB *batchJobs, int n );			// returns when every job is fitted
+};
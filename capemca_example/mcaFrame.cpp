@@ -0,0 +1,165 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Class methods for frame decoding and spectrum accumulation
+//   definitions in mcaFrame.h
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <string.h>
+#include <time.h>
+#ifdef _WIN32
+#include <windows.h>								// QueryPerformanceCounter, MSVC has no clock_gettime
+#endif
+#include "mcaFrame.h"
+
+bool ValidRequest( int request )					// {0,1,2,4,8,16,32+1,32+2,32+4,32+8,32+16}
+{
+	int units = request%32;
+
+	if ( request == 0 ) return( true );				// packet0 only
+	if ( (request < 0) || (request/32 > 1) ) return( false );
+	return( (units == 1) || (units == 2) || (units == 4) || (units == 8) || (units == 16) );
+}
+
+int RequestChannels( int request )
+{
+	return( CHANNELS_PER_REQUEST*(request%32) );	// spectrum coming if remainder present
+}
+
+int RequestPacketBytes( int request )
+{
+	if ( (request == 0) || (request/32 == 1) )		// packet coming if multiple of 32
+		return( sizeof(PACKET0_TYPE) );
+	return( 0 );
+}
+
+int RequestResponseBytes( int request )
+{
+	return( RequestChannels(request)*4 + RequestPacketBytes(request) );
+}
+
+double MonotonicSeconds( void )
+{
+#ifdef _WIN32
+	LARGE_INTEGER count, frequency;
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&frequency);
+	return( (double)count.QuadPart/(double)frequency.QuadPart );
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return( ts.tv_sec + ts.tv_nsec*1.0e-9 );
+#endif
+}
+
+////// McaFrame /////////////////////////////////////////////////////////////////////////////////////
+
+McaFrame::McaFrame()								// constructor
+{
+	Clear();
+}
+
+void McaFrame::Clear( void )						// reset to an empty frame
+{
+	request = 0;
+	channels = 0;
+	hasPacket0 = false;
+	hostTime = 0.0;
+	sendTime = 0.0;
+	memset(&packet0,0,sizeof(packet0));
+}
+
+bool McaFrame::Decode( const uint8_t *bytes, int length, int req )
+{
+	int bytesInSpectrum, bytesInPacket;
+
+	if ( !ValidRequest(req) ) return( false );
+	bytesInSpectrum = RequestChannels(req)*4;
+	bytesInPacket = RequestPacketBytes(req);
+	if ( length != bytesInSpectrum + bytesInPacket ) return( false );	// short or garbled transfer
+
+	request = req;
+	channels = bytesInSpectrum/4;
+	if ( bytesInSpectrum )							// move bytes to spectrum
+		memcpy(spectrum,bytes,bytesInSpectrum);
+	hasPacket0 = (bytesInPacket != 0);
+	if ( hasPacket0 )								// move packet bytes to struct
+		memcpy(&packet0,bytes+bytesInSpectrum,bytesInPacket);
+	return( true );
+}
+
+////// SpectrumAccumulator //////////////////////////////////////////////////////////////////////////
+
+SpectrumAccumulator::SpectrumAccumulator()			// constructor
+{
+	channels = 0;
+	Clear();
+}
+
+void SpectrumAccumulator::Clear( void )				// zero sums but keep the channel count
+{
+	frames = 0;
+	memset(sum,0,sizeof(sum));
+}
+
+void SpectrumAccumulator::Add( const uint32_t *s, int nChannels )
+{
+	if ( channels == 0 ) channels = nChannels;		// first spectrum sets the resolution
+	if ( nChannels != channels ) return;			// ignore spectra at other resolutions
+
+	for (int i=0; i<nChannels; i++)					// loop is vectorized by the compiler
+		sum[i] += s[i];
+	frames++;
+}
+
+void SpectrumAccumulator::Add( const McaFrame &frame )
+{
+	if ( frame.channels ) Add(frame.spectrum,frame.channels);
+}
+
+////// ReadoutAccumulator ///////////////////////////////////////////////////////////////////////////
+
+ReadoutAccumulator::ReadoutAccumulator()			// constructor
+{
+	lastChannels = 0;
+}
+
+void ReadoutAccumulator::Clear( void )				// e.g. after zeroing the device
+{
+	SpectrumAccumulator::Clear();
+	lastChannels = 0;
+}
+
+bool ReadoutAccumulator::AddReadout( const McaFrame &frame )
+{
+	uint32_t interval[MAX_SPECTRUM_SIZE];
+	bool continued;
+
+	if ( !frame.channels ) return( true );
+	if ( channels && (channels != frame.channels) )	// resolution changed, restart the sum
+		{
+		Clear();
+		channels = 0;
+		}
+	if ( lastChannels != frame.channels )			// first readout holds all counts since the zero
+		memset(last,0,frame.channels*4);
+	continued = IntervalSpectrum(frame.spectrum,last,interval,frame.channels);
+	Add(interval,frame.channels);
+	memcpy(last,frame.spectrum,frame.channels*4);
+	lastChannels = frame.channels;
+	return( continued );
+}
+
+////// cumulative readouts to interval counts /////////////////////////////////////////////////////
+
+bool IntervalSpectrum( const uint32_t *current, const uint32_t *previous, uint32_t *interval, int channels )
+{
+	uint32_t wrapped = 0;
+
+	for (int i=0; i<channels; i++)					// MCA spectrum is cumulative since last zero
+		{
+		interval[i] = current[i] - previous[i];
+		wrapped |= (uint32_t)(current[i] < previous[i]);
+		}
+	if ( wrapped )									// counts went down, device was zeroed
+		memcpy(interval,current,channels*4);
+	return( !wrapped );
+}
@@ -0,0 +1,69 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Frame decoding and spectrum accumulation for MCA responses
+//   methods in mcaFrame.cpp
+//
+// A response to the 2-byte request {0,request} is a channel block of 1024*(request%32) bytes
+// (256 x 32-bit channels per unit of request) followed by the 64-byte PACKET0_TYPE when
+// request is 0 or 32+n. Valid requests are {0,1,2,4,8,16,32+1,32+2,32+4,32+8,32+16}.
+//
+// Assumes little-endian host, as do the rest of the examples.
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "packet0type.h"
+
+#define MAX_SPECTRUM_SIZE		4096				// channels in the full resolution spectrum
+#define CHANNELS_PER_REQUEST	256					// 1024 bytes per unit of request%32
+#define REQUEST_PACKET0			32					// add to request to get packet0 after spectrum
+#define MAX_RESPONSE_BYTES		(MAX_SPECTRUM_SIZE*4+sizeof(PACKET0_TYPE))
+
+bool ValidRequest( int request );					// one of the codes listed above
+int RequestChannels( int request );					// channels in the spectrum part of response
+int RequestPacketBytes( int request );				// 64 if packet0 is part of response, else 0
+int RequestResponseBytes( int request );			// total length of response to {0,request}
+
+class McaFrame {									// one decoded response from an MCA
+public:
+	int request;									// request code that produced this frame
+	int channels;									// 0, 256, 512, 1024, 2048 or 4096
+	bool hasPacket0;
+	double hostTime;								// host monotonic seconds at receipt, 0 if unknown
+	double sendTime;								// just before the request went out, 0 if unknown
+	PACKET0_TYPE packet0;							// valid only when hasPacket0
+	uint32_t spectrum[MAX_SPECTRUM_SIZE];			// valid for [0,channels)
+
+	McaFrame();										// constructor
+	void Clear( void );								// reset to empty frame
+	bool Decode( const uint8_t *bytes, int length, int request );	// false if length is wrong
+};
+
+class SpectrumAccumulator {							// 64-bit running sum of spectra from one device
+public:
+	int channels;
+	uint32_t frames;								// number of spectra added since Clear()
+	uint64_t sum[MAX_SPECTRUM_SIZE];
+
+	SpectrumAccumulator();							// constructor
+	void Clear( void );								// zero the sums, keep channels
+	void Add( const uint32_t *spectrum, int nChannels );	// add nChannels (must match once set)
+	void Add( const McaFrame &frame );				// add the spectrum part of a frame, if any
+};
+
+class ReadoutAccumulator : public SpectrumAccumulator {	// counts acquired between cumulative readouts
+public:
+	int lastChannels;								// of the last readout, 0 if none since Clear()
+	uint32_t last[MAX_SPECTRUM_SIZE];				// last cumulative readout
+
+	ReadoutAccumulator();							// constructor
+	void Clear( void );								// zero the sums and forget the last readout
+	bool AddReadout( const McaFrame &frame );		// add its interval counts, false if device was zeroed
+};
+
+double MonotonicSeconds( void );					// CLOCK_MONOTONIC in seconds, for hostTime
+
+													// interval counts from two cumulative readouts;
+													// returns false if device was zeroed in between
+bool IntervalSpectrum( const uint32_t *current, const uint32_t *previous, uint32_t *interval, int channels );
@@ -0,0 +1,281 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Functions and class methods for gain-drift stabilization
+//   definitions in mcaGain.h
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "mcaGain.h"
+
+#define GAIN_DEFAULT_HALF_WIDTH	60.0				// 4096-channel units
+#define GAIN_DEFAULT_TAU		10.0				// intervals
+#define GAIN_DEFAULT_MIN_COUNTS	50.0
+
+bool PeakCentroid( const uint32_t *counts, int channels, double center, double halfWidth, int method,
+					double *centroid, double *net )
+{
+	int lo, hi, top;
+	double bl, br, b, v, sum, sumx, y0, y1, y2, d;
+
+	for (int pass=0; pass<2; pass++)				// second pass recentres a lopsided window
+		{
+		lo = (int)floor(center - halfWidth);
+		hi = (int)ceil(center + halfWidth);
+		if ( lo < 0 ) lo = 0;
+		if ( hi > channels-1 ) hi = channels-1;
+		if ( hi - lo < 4 ) return( false );
+		bl = 0.5*((double)counts[lo] + counts[lo+1]);	// linear background under the peak
+		br = 0.5*((double)counts[hi-1] + counts[hi]);
+		sum = sumx = 0.0;
+		top = lo+2;
+		for (int i=lo+2; i<=hi-2; i++)
+			{
+			b = bl + (br - bl)*(i - lo - 0.5)/(hi - lo - 1);
+			v = counts[i] - b;
+			if ( v > 0.0 )
+				{
+				sum += v;
+				sumx += v*i;
+				}
+			if ( counts[i] > counts[top] ) top = i;
+			}
+		if ( sum <= 0.0 ) return( false );
+		*net = sum;
+		*centroid = sumx/sum;
+		if ( method == GAIN_PARABOLA )				// gaussian through the three highest channels
+			{
+			y0 = counts[top-1] - (bl + (br - bl)*(top - 1 - lo - 0.5)/(hi - lo - 1));
+			y1 = counts[top] - (bl + (br - bl)*(top - lo - 0.5)/(hi - lo - 1));
+			y2 = counts[top+1] - (bl + (br - bl)*(top + 1 - lo - 0.5)/(hi - lo - 1));
+			if ( (y0 <= 0.0) || (y1 <= 0.0) || (y2 <= 0.0) ) return( false );
+			y0 = log(y0);
+			y1 = log(y1);
+			y2 = log(y2);
+			d = y0 - 2.0*y1 + y2;
+			if ( d >= 0.0 ) return( false );		// not a maximum
+			*centroid = top + 0.5*(y0 - y2)/d;
+			return( true );
+			}
+		center = *centroid;
+		}
+	return( true );
+}
+
+void RebinSpectrum( const uint32_t *counts, int channels, double gain, double offset, double *stable )
+{
+	static __thread double cumulative[MAX_SPECTRUM_SIZE+1];
+	double bin = (double)MAX_SPECTRUM_SIZE/channels;
+	double u0 = (offset + 0.5 - 0.5*gain)/bin;		// measured edge of stable channel 0
+	double u, below, above;
+	int i;
+
+	cumulative[0] = 0.0;							// counts below each measured channel edge
+	for (i=0; i<channels; i++) cumulative[i+1] = cumulative[i] + counts[i];
+	below = 0.0;
+	for (int j=0; j<channels; j++)					// stable channel j is measured [u(j),u(j+1)),
+		{											// counts spread evenly inside a measured channel
+		u = u0 + (j+1)*gain;
+		if ( u <= 0.0 ) above = 0.0;
+		else if ( u >= channels ) above = cumulative[channels];
+		else
+			{
+			i = (int)u;
+			above = cumulative[i] + (u - i)*counts[i];
+			}
+		if ( j == 0 )
+			{
+			if ( u0 <= 0.0 ) below = 0.0;
+			else if ( u0 >= channels ) below = cumulative[channels];
+			else below = cumulative[(int)u0] + (u0 - (int)u0)*counts[(int)u0];
+			}
+		stable[j] += above - below;
+		below = above;
+		}
+}
+
+////// GainStabilizer ///////////////////////////////////////////////////////////////////////////////
+
+GainStabilizer::GainStabilizer()					// constructor
+{
+	memset(&defaults,0,sizeof(defaults));
+	defaults.method = GAIN_CENTROID;
+	defaults.tau = GAIN_DEFAULT_TAU;
+	defaults.minCounts = GAIN_DEFAULT_MIN_COUNTS;
+	devices = 0;
+}
+
+GainStabilizer::~GainStabilizer()					// destructor
+{
+	for (int n=0; n<devices; n++)
+		{
+		delete [] device[n].previous;
+		delete [] device[n].stable;
+		}
+}
+
+GAIN_DEVICE *GainStabilizer::Device( uint32_t capemcaId )
+{
+	GAIN_DEVICE *d;
+
+	for (int n=0; n<devices; n++)
+		if ( device[n].params.capemcaId == capemcaId ) return( &device[n] );
+	if ( devices >= GAIN_MAX_DEVICES ) return( NULL );
+	d = &device[devices++];
+	memset(d,0,sizeof(GAIN_DEVICE));
+	d->params = defaults;
+	d->params.capemcaId = capemcaId;
+	d->gain = 1.0;
+	return( d );
+}
+
+bool GainStabilizer::Configure( const GAIN_PARAMS &params )
+{
+	GAIN_DEVICE *d = Device(params.capemcaId);
+
+	if ( !d || (params.peaks < 0) || (params.peaks > GAIN_MAX_PEAKS) ) return( false );
+	d->params = params;
+	memset(d->track,0,sizeof(d->track));
+	return( true );
+}
+
+bool GainStabilizer::LoadConfig( const char *path )
+{
+	FILE *f;
+	char line[256], *token, *colon;
+	int lineNumber = 0;
+	unsigned int id;
+	bool ok;
+	GAIN_PARAMS params;
+
+	if ( !(f = fopen(path,"r")) )
+		{
+		printf("Cannot open %s\n",path);
+		return( false );
+		}
+	while ( fgets(line,sizeof(line),f) )
+		{
+		lineNumber++;
+		if ( (line[0] == '#') || (line[0] == '\n') || (line[0] == '\r') ) continue;
+		params = defaults;
+		ok = (token = strtok(line," \t\r\n")) && (sscanf(token,"%u",&id) == 1);
+		params.capemcaId = id;
+		while ( ok && (token = strtok(NULL," \t\r\n")) )
+			{
+			if ( !strcmp(token,"centroid") ) params.method = GAIN_CENTROID;
+			else if ( !strcmp(token,"parabola") ) params.method = GAIN_PARABOLA;
+			else if ( !strncmp(token,"tau=",4) ) ok = (params.tau = atof(token+4)) >= 0.0;
+			else if ( !strncmp(token,"min=",4) ) ok = (params.minCounts = atof(token+4)) >= 0.0;
+			else if ( params.peaks < GAIN_MAX_PEAKS )
+				{
+				colon = strchr(token,':');
+				params.reference[params.peaks] = atof(token);
+				params.halfWidth[params.peaks] = colon ? atof(colon+1) : GAIN_DEFAULT_HALF_WIDTH;
+				ok = (params.reference[params.peaks] > 0.0) && (params.halfWidth[params.peaks] > 0.0);
+				params.peaks++;
+				}
+			else ok = false;
+			}
+		if ( !ok || !params.peaks )
+			{
+			printf("%s line %d: expected \"capemcaId [centroid|parabola] [tau=10] [min=50] ref[:halfWidth] ...\""
+					" with up to %d peaks\n",path,lineNumber,GAIN_MAX_PEAKS);
+			fclose(f);
+			return( false );
+			}
+		if ( !Configure(params) ) break;
+		}
+	fclose(f);
+	return( true );
+}
+
+bool GainStabilizer::Process( uint32_t capemcaId, const McaFrame &frame, GAIN_RESULT *result )
+{
+	static __thread uint32_t interval[MAX_SPECTRUM_SIZE];
+	GAIN_DEVICE *d;
+	double bin, decay, c, net, sw, sr, sm, srr, srm, det, gain = 1.0, offset = 0.0;
+	int n = frame.channels, used = 0;
+
+	memset(result,0,sizeof(GAIN_RESULT));
+	if ( !n || !(d = Device(capemcaId)) ) return( false );
+	if ( !d->previous )
+		{
+		d->previous = new uint32_t[MAX_SPECTRUM_SIZE];
+		d->stable = new double[MAX_SPECTRUM_SIZE];
+		memset(d->stable,0,MAX_SPECTRUM_SIZE*sizeof(double));
+		d->channels = n;
+		}
+	if ( n != d->channels ) return( false );		// other resolutions are not stabilized
+	if ( !d->havePrevious )
+		{
+		memcpy(d->previous,frame.spectrum,n*sizeof(uint32_t));
+		d->havePrevious = true;
+		return( false );
+		}
+	if ( !IntervalSpectrum(frame.spectrum,d->previous,interval,n) )
+		memcpy(interval,frame.spectrum,n*sizeof(uint32_t));	// zeroed since, counts are all new
+	memcpy(d->previous,frame.spectrum,n*sizeof(uint32_t));
+
+	bin = (double)MAX_SPECTRUM_SIZE/n;				// full resolution channels per frame channel
+	decay = d->params.tau > 0.0 ? exp(-1.0/d->params.tau) : 0.0;
+	for (int k=0; k<d->params.peaks; k++)			// track each line near its predicted place
+		{
+		GAIN_TRACK &t = d->track[k];
+		c = t.s0 > 0.0 ? t.level + t.slope : d->gain*d->params.reference[k] + d->offset;
+		t.s2 = decay*(t.s2 - 2.0*t.s1 + t.s0);		// age the sums by one interval
+		t.s1 = decay*(t.s1 - t.s0);
+		t.sty = decay*(t.sty - t.sy);
+		t.s0 *= decay;
+		t.sy *= decay;
+		if ( PeakCentroid(interval,n,(c - 0.5*(bin - 1.0))/bin,d->params.halfWidth[k]/bin,d->params.method,&c,&net) &&
+			 (net >= d->params.minCounts) )
+			{
+			c = c*bin + 0.5*(bin - 1.0);
+			result->centroid[k] = c;
+			result->counts[k] = net;
+			result->measured++;
+			t.s0 += net;							// new point at t = 0
+			t.sy += net*c;
+			}
+		if ( t.s0 <= 0.0 ) continue;
+		det = t.s0*t.s2 - t.s1*t.s1;				// weighted line c = level + slope*t
+		t.slope = det > 1.0e-9*t.s0*t.s0 ? (t.s0*t.sty - t.s1*t.sy)/det : 0.0;
+		t.level = (t.sy - t.slope*t.s1)/t.s0;
+		}
+
+	sw = sr = sm = srr = srm = 0.0;					// weighted line through the current levels
+	for (int k=0; k<d->params.peaks; k++)
+		if ( d->track[k].s0 > 0.0 )
+			{
+			double w = d->track[k].s0, r = d->params.reference[k], m = d->track[k].level;
+			sw += w;
+			sr += w*r;
+			sm += w*m;
+			srr += w*r*r;
+			srm += w*r*m;
+			used++;
+			}
+	if ( used == 1 )
+		{
+		gain = sm/sr;
+		offset = 0.0;
+		}
+	else if ( used > 1 )
+		{
+		det = sw*srr - sr*sr;
+		gain = det > 0.0 ? (sw*srm - sr*sm)/det : d->gain;
+		offset = det > 0.0 ? (sm - gain*sr)/sw : d->offset;
+		}
+	if ( used && (gain > 0.5) && (gain < 2.0) )		// ignore a fit that lost the lines
+		{
+		d->gain = gain;
+		d->offset = offset;
+		}
+
+	RebinSpectrum(interval,n,d->gain,d->offset,d->stable);
+	d->intervals++;
+	result->gain = d->gain;
+	result->offset = d->offset;
+	return( true );
+}
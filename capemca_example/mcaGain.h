@@ -0,0 +1,82 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Gain-drift stabilization from reference peak centroids
+//   methods in mcaGain.cpp
+//
+// Detector gain moves with temperature and pressure, so a line at reference channel r shows up
+// at measured channel m = gain*r + offset. For every new interval spectrum of a detector the
+// stabilizer finds each reference peak near where the current trajectory predicts it, by a
+// background-subtracted centroid or a parabola through the logs of the three highest channels,
+// and folds it into a count-weighted straight line over time that forgets with a time constant
+// of tau intervals, so a steady drift is followed without lag and the next search window is
+// placed ahead of it. Gain and offset are the weighted least squares line through the current
+// levels of those trends (gain alone with one peak). The interval is then rebinned onto the
+// reference grid, each measured channel's counts shared among the stable channels it overlaps,
+// and accumulated.
+// Channels and widths are given in 4096-channel units and scaled to each frame's resolution;
+// the stable spectrum keeps the resolution of the first frame, like SpectrumAccumulator.
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "mcaFrame.h"
+
+#define GAIN_MAX_PEAKS			4
+#define GAIN_MAX_DEVICES		256					// as many as WinUSBDs can enumerate
+
+#define GAIN_CENTROID			0					// default
+#define GAIN_PARABOLA			1
+
+typedef struct
+{
+	uint32_t capemcaId;
+	int peaks;
+	double reference[GAIN_MAX_PEAKS];				// line positions on the stable grid
+	double halfWidth[GAIN_MAX_PEAKS];				// search window either side of prediction
+	int method;										// GAIN_CENTROID or GAIN_PARABOLA
+	double tau;										// smoothing time constant in intervals
+	double minCounts;								// net peak counts needed to use an interval
+} GAIN_PARAMS;
+
+typedef struct
+{
+	double gain, offset;							// trajectory after this interval
+	int measured;									// peaks found in this interval
+	double centroid[GAIN_MAX_PEAKS];				// this interval, 0 if not found
+	double counts[GAIN_MAX_PEAKS];					// net counts in each window
+} GAIN_RESULT;
+
+typedef struct										// centroid trend of one peak, time 0 = latest
+{
+	double s0, s1, s2, sy, sty;						// decayed count-weighted sums over t and c
+	double level, slope;							// centroid now and per interval
+} GAIN_TRACK;
+
+typedef struct
+{
+	GAIN_PARAMS params;
+	GAIN_TRACK track[GAIN_MAX_PEAKS];
+	double gain, offset;
+	int channels;									// resolution of previous and stable
+	bool havePrevious;
+	uint32_t intervals;								// rebinned into stable so far
+	uint32_t *previous;								// last cumulative readout
+	double *stable;									// accumulated stabilized spectrum
+} GAIN_DEVICE;
+
+class GainStabilizer {
+public:
+	GAIN_PARAMS defaults;							// peaks = 0, so unconfigured detectors pass through
+	int devices;
+	GAIN_DEVICE device[GAIN_MAX_DEVICES];
+
+	GainStabilizer();								// constructor
+	~GainStabilizer();								// destructor frees spectra
+	bool Configure( const GAIN_PARAMS &params );	// per capemcaId, replaces earlier entry
+	bool LoadConfig( const char *path );			// lines of "capemcaId ref[:halfWidth] ..."
+	GAIN_DEVICE *Device( uint32_t capemcaId );		// table entry, added with defaults if new
+	bool Process( uint32_t capemcaId, const McaFrame &frame, GAIN_RESULT *result );	// false if no new interval
+};
+
+bool PeakCentroid( const uint32_t *counts, int channels, double center, double halfWidth, int method,
+					double *centroid, double *net );	// in the units of counts
+void RebinSpectrum( const uint32_t *counts, int channels, double gain, double offset, double *stable );
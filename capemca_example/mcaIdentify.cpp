@@ -0,0 +1,346 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Class methods and functions for template library identification
+//   definitions in mcaIdentify.h
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "mcaIdentify.h"
+
+typedef float v4sf __attribute__((vector_size(16)));	// SSE on x86, NEON on ARM
+
+static inline v4sf Load4( const float *p )			// unaligned load
+{
+	v4sf v;
+	memcpy(&v,p,sizeof(v));
+	return( v );
+}
+
+static void Dot2( const float * __restrict r, const float * __restrict w, const float * __restrict t, int n,
+					float *num, float *den )		// sum(r t) and sum(w t t)
+{
+	v4sf sn = { 0, 0, 0, 0 }, sd = { 0, 0, 0, 0 }, tv;
+	float a, b;
+	int i;
+
+	for (i=0; i+4<=n; i+=4)
+		{
+		tv = Load4(t+i);
+		sn += Load4(r+i)*tv;
+		sd += Load4(w+i)*tv*tv;
+		}
+	a = sn[0] + sn[1] + sn[2] + sn[3];
+	b = sd[0] + sd[1] + sd[2] + sd[3];
+	for (; i<n; i++)
+		{
+		a += r[i]*t[i];
+		b += w[i]*t[i]*t[i];
+		}
+	*num = a;
+	*den = b;
+}
+
+void SnipBackground( const uint32_t *counts, int channels, int halfWidth, float *background )
+{
+	static __thread float v[MAX_SPECTRUM_SIZE], w[MAX_SPECTRUM_SIZE];
+
+	for (int i=0; i<channels; i++)					// log-log-sqrt so peaks clip evenly
+		v[i] = logf(logf(sqrtf(counts[i] + 1.0f) + 1.0f) + 1.0f);
+	for (int p=1; p<=halfWidth; p++)				// clip each channel to the mean p either side
+		{
+		memcpy(w,v,channels*sizeof(float));
+		for (int i=p; i<channels-p; i++)
+			{
+			float m = 0.5f*(w[i-p] + w[i+p]);
+			if ( m < v[i] ) v[i] = m;
+			}
+		}
+	for (int i=0; i<channels; i++)
+		{
+		float e = expf(expf(v[i]) - 1.0f) - 1.0f;
+		background[i] = e*e - 1.0f;
+		}
+}
+
+////// IdentifyLibrary //////////////////////////////////////////////////////////////////////////////
+
+IdentifyLibrary::IdentifyLibrary()					// constructor
+{
+	templates = allocated = channels = 0;
+	entry = NULL;
+	projection = NULL;
+	segment = NULL;
+	segmentCount = segmentAllocated = 0;
+	pool = NULL;
+	poolCount = poolAllocated = 0;
+	weighted = (float *)malloc(MAX_SPECTRUM_SIZE*sizeof(float));
+	inverse = (float *)malloc(MAX_SPECTRUM_SIZE*sizeof(float));
+	positive = (double *)malloc((MAX_SPECTRUM_SIZE+1)*sizeof(double));
+	background = (double *)malloc((MAX_SPECTRUM_SIZE+1)*sizeof(double));
+	scored = pruned = 0;
+}
+
+IdentifyLibrary::~IdentifyLibrary()					// destructor
+{
+	for (int n=0; n<templates; n++) free(entry[n].spectrum);
+	free(entry);
+	free(projection);
+	free(segment);
+	free(pool);
+	free(weighted);
+	free(inverse);
+	free(positive);
+	free(background);
+}
+
+static IDENTIFY_TEMPLATE *NewTemplate( IdentifyLibrary *library, const char *name )
+{
+	IDENTIFY_TEMPLATE *t;
+
+	if ( library->templates == library->allocated )
+		{
+		library->allocated = library->allocated ? 2*library->allocated : 64;
+		library->entry = (IDENTIFY_TEMPLATE *)realloc(library->entry,library->allocated*sizeof(IDENTIFY_TEMPLATE));
+		}
+	t = &library->entry[library->templates++];
+	memset(t,0,sizeof(IDENTIFY_TEMPLATE));
+	snprintf(t->name,sizeof(t->name),"%s",name);
+	library->channels = 0;							// projection is out of date
+	return( t );
+}
+
+bool IdentifyLibrary::AddLines( const char *name, int lines, const float *channel, const float *sigma,
+								const float *intensity )
+{
+	IDENTIFY_TEMPLATE *t;
+
+	if ( (lines < 1) || (lines > IDENTIFY_MAX_LINES) ) return( false );
+	for (int l=0; l<lines; l++)
+		if ( (channel[l] < 0.0f) || (channel[l] >= MAX_SPECTRUM_SIZE) || (sigma[l] <= 0.0f) || (intensity[l] <= 0.0f) )
+			return( false );
+	t = NewTemplate(this,name);
+	t->lines = lines;
+	memcpy(t->channel,channel,lines*sizeof(float));
+	memcpy(t->sigma,sigma,lines*sizeof(float));
+	memcpy(t->intensity,intensity,lines*sizeof(float));
+	return( true );
+}
+
+bool IdentifyLibrary::AddSpectrum( const char *name, const float *counts, int nChannels )
+{
+	IDENTIFY_TEMPLATE *t;
+
+	if ( (nChannels < 1) || (nChannels > MAX_SPECTRUM_SIZE) || (MAX_SPECTRUM_SIZE % nChannels) ) return( false );
+	t = NewTemplate(this,name);
+	t->channels = nChannels;
+	t->spectrum = (float *)malloc(nChannels*sizeof(float));
+	memcpy(t->spectrum,counts,nChannels*sizeof(float));
+	return( true );
+}
+
+static bool LoadTemplateCsv( IdentifyLibrary *library, const char *name, const char *path )
+{
+	FILE *f;
+	char line[128];
+	static float counts[MAX_SPECTRUM_SIZE];
+	int channel, n = 1;								// CSV starts at channel 1
+	float count;
+
+	if ( !(f = fopen(path,"r")) )
+		{
+		printf("Cannot open %s\n",path);
+		return( false );
+		}
+	counts[0] = 0.0f;
+	while ( fgets(line,sizeof(line),f) )
+		if ( (sscanf(line,"%d,%f",&channel,&count) == 2) && (channel == n) && (n < MAX_SPECTRUM_SIZE) )
+			counts[n++] = count;
+	fclose(f);
+	for (int c=CHANNELS_PER_REQUEST; c<=MAX_SPECTRUM_SIZE; c*=2)	// 255 rows is a 256-channel spectrum
+		if ( n == c ) return( library->AddSpectrum(name,counts,n) );
+	printf("%s: %d channels is not a spectrum resolution\n",path,n);
+	return( false );
+}
+
+bool IdentifyLibrary::Load( const char *path )
+{
+	FILE *f;
+	char line[1024], name[32], *token;
+	float channel[IDENTIFY_MAX_LINES], sigma[IDENTIFY_MAX_LINES], intensity[IDENTIFY_MAX_LINES];
+	int lineNumber = 0, lines;
+	bool ok;
+
+	if ( !(f = fopen(path,"r")) )
+		{
+		printf("Cannot open %s\n",path);
+		return( false );
+		}
+	while ( fgets(line,sizeof(line),f) )
+		{
+		lineNumber++;
+		if ( !(token = strtok(line," \t\r\n")) || (token[0] == '#') ) continue;
+		snprintf(name,sizeof(name),"%s",token);
+		lines = 0;
+		ok = true;
+		token = strtok(NULL," \t\r\n");
+		if ( token && (token[0] == '@') )
+			ok = LoadTemplateCsv(this,name,token+1);
+		else
+			{
+			for (; ok && token; token=strtok(NULL," \t\r\n"))
+				{
+				intensity[lines] = 1.0f;
+				ok = (lines < IDENTIFY_MAX_LINES) &&
+					 (sscanf(token,"%f:%f:%f",&channel[lines],&sigma[lines],&intensity[lines]) >= 2);
+				lines++;
+				}
+			ok = ok && AddLines(name,lines,channel,sigma,intensity);
+			}
+		if ( !ok )
+			{
+			printf("%s line %d: expected \"name channel:sigma[:intensity] ...\" with up to %d lines,"
+					" or \"name @template.csv\"\n",path,lineNumber,IDENTIFY_MAX_LINES);
+			fclose(f);
+			return( false );
+			}
+		}
+	fclose(f);
+	return( true );
+}
+
+bool IdentifyLibrary::Project( int nChannels )
+{
+	static float dense[MAX_SPECTRUM_SIZE];
+	double bin = (double)MAX_SPECTRUM_SIZE/nChannels, total;
+	float peak;
+
+	if ( (nChannels < 1) || (nChannels > MAX_SPECTRUM_SIZE) || (MAX_SPECTRUM_SIZE % nChannels) ) return( false );
+	projection = (IDENTIFY_PROJECTION *)realloc(projection,(templates ? templates : 1)*sizeof(IDENTIFY_PROJECTION));
+	segmentCount = poolCount = 0;
+	for (int n=0; n<templates; n++)
+		{
+		const IDENTIFY_TEMPLATE &t = entry[n];
+		memset(dense,0,nChannels*sizeof(float));
+		for (int l=0; l<t.lines; l++)				// each line integrated over the grid channels
+			{
+			double center = (t.channel[l] - 0.5*(bin - 1.0))/bin, s = t.sigma[l]/bin;
+			int lo = (int)floor(center - IDENTIFY_LINE_SIGMAS*s), hi = (int)ceil(center + IDENTIFY_LINE_SIGMAS*s);
+			if ( lo < 0 ) lo = 0;
+			if ( hi > nChannels-1 ) hi = nChannels-1;
+			for (int i=lo; i<=hi; i++)
+				dense[i] += t.intensity[l]*0.5*(erf((i + 0.5 - center)/(M_SQRT2*s)) - erf((i - 0.5 - center)/(M_SQRT2*s)));
+			}
+		if ( t.spectrum )							// rebin a template spectrum to the grid
+			{
+			if ( t.channels >= nChannels )
+				for (int i=0; i<t.channels; i++) dense[i/(t.channels/nChannels)] += t.spectrum[i];
+			else
+				for (int i=0; i<nChannels; i++) dense[i] = t.spectrum[i/(nChannels/t.channels)]*t.channels/nChannels;
+			dense[0] = 0.0f;						// channel 0 is not part of the spectrum
+			}
+		total = 0.0;
+		for (int i=0; i<nChannels; i++)
+			{
+			if ( dense[i] < 0.0f ) dense[i] = 0.0f;
+			total += dense[i];
+			}
+		projection[n].firstSegment = segmentCount;
+		projection[n].segments = 0;
+		projection[n].peak = 0.0f;
+		if ( total <= 0.0 ) continue;				// off the grid, never matches
+		peak = 0.0f;
+		for (int i=0; i<nChannels; )				// runs of non-zero values become segments
+			{
+			if ( dense[i] <= 1.0e-7*total )
+				{
+				i++;
+				continue;
+				}
+			if ( segmentCount == segmentAllocated )
+				{
+				segmentAllocated = segmentAllocated ? 2*segmentAllocated : 256;
+				segment = (IDENTIFY_SEGMENT *)realloc(segment,segmentAllocated*sizeof(IDENTIFY_SEGMENT));
+				}
+			if ( poolCount + nChannels > poolAllocated )
+				{
+				poolAllocated = 2*(poolCount + nChannels);
+				pool = (float *)realloc(pool,poolAllocated*sizeof(float));
+				}
+			IDENTIFY_SEGMENT &g = segment[segmentCount++];
+			g.start = i;
+			g.value = poolCount;
+			for (; (i < nChannels) && (dense[i] > 1.0e-7*total); i++)
+				{
+				pool[poolCount] = (float)(dense[i]/total);	// unit area
+				if ( pool[poolCount] > peak ) peak = pool[poolCount];
+				poolCount++;
+				}
+			g.length = i - g.start;
+			projection[n].segments++;
+			}
+		projection[n].peak = peak;
+		}
+	channels = nChannels;
+	return( true );
+}
+
+void IdentifyLibrary::Prepare( const uint32_t *counts, int nChannels )
+{
+	static __thread float b[MAX_SPECTRUM_SIZE];
+	int bin = MAX_SPECTRUM_SIZE/nChannels;
+
+	SnipBackground(counts,nChannels,(IDENTIFY_SNIP_WIDTH + bin - 1)/bin,b);
+	positive[0] = background[0] = 0.0;
+	for (int i=0; i<nChannels; i++)
+		{
+		float bi = b[i] > 1.0f ? b[i] : 1.0f;		// Poisson variance, at least one count
+		weighted[i] = (counts[i] - bi)/bi;
+		inverse[i] = 1.0f/bi;
+		positive[i+1] = positive[i] + (weighted[i] > 0.0f ? weighted[i] : 0.0f);
+		background[i+1] = background[i] + bi;
+		}
+}
+
+int IdentifyLibrary::Score( const uint32_t *counts, int nChannels, int k, IDENTIFY_CANDIDATE *top, float minScore )
+{
+	int found = 0, j;
+	float threshold = minScore, num, den, sn, sd, z;
+	double r, b;
+
+	if ( (k < 1) || (k > IDENTIFY_MAX_TOP) ) return( 0 );
+	if ( (channels != nChannels) && !Project(nChannels) ) return( 0 );
+	Prepare(counts,nChannels);
+	for (int n=0; n<templates; n++)
+		{
+		const IDENTIFY_PROJECTION &p = projection[n];
+		const IDENTIFY_SEGMENT *g = segment + p.firstSegment;
+		r = b = 0.0;
+		for (int s=0; s<p.segments; s++)			// bound from prefix sums, O(segments)
+			{
+			r += positive[g[s].start+g[s].length] - positive[g[s].start];
+			b += background[g[s].start+g[s].length] - background[g[s].start];
+			}
+		if ( !p.segments || (1.0001*p.peak*r*sqrt(b) < threshold) )
+			{
+			pruned++;
+			continue;
+			}
+		num = den = 0.0f;
+		for (int s=0; s<p.segments; s++)
+			{
+			Dot2(weighted+g[s].start,inverse+g[s].start,pool+g[s].value,g[s].length,&sn,&sd);
+			num += sn;
+			den += sd;
+			}
+		if ( (den <= 0.0f) || ((z = num/sqrtf(den)) < threshold) ) continue;
+		for (j=found < k ? found++ : k-1; (j > 0) && (top[j-1].score < z); j--) top[j] = top[j-1];
+		top[j].index = n;							// insertion into the sorted top k
+		top[j].score = z;
+		top[j].amplitude = num/den;
+		if ( found == k ) threshold = top[k-1].score > minScore ? top[k-1].score : minScore;
+		}
+	scored += templates;
+	return( found );
+}
@@ -0,0 +1,81 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Line and source identification by matching spectra against a template library
+//   methods in mcaIdentify.cpp
+//
+// A library holds line lists (gaussians at channel:sigma:intensity in 4096-channel units) and
+// template spectra read from "channel,count" files. Project() turns every template into unit
+// area float segments on a detector's channel grid once; each line covers +/- 4 sigma.
+//
+// Scoring is a Poisson-weighted matched filter. The background b under the spectrum d comes from
+// a SNIP clip, and for a template t the best amplitude and its significance are
+//   a = sum((d-b) t / b) / sum(t^2 / b),   z = sum((d-b) t / b) / sqrt(sum(t^2 / b))
+// which are two dot products over the template segments, done four floats at a time with gcc
+// vector extensions (SSE or NEON). Before that, z is bounded in O(segments) from prefix sums:
+//   z <= max(t) * sum over segments of max(d-b,0)/b * sqrt(sum over segments of b)
+// and a template whose bound cannot beat the k'th best score so far is skipped.
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "mcaFrame.h"
+
+#define IDENTIFY_MAX_LINES		16					// per line-list template
+#define IDENTIFY_MAX_TOP		32					// largest k for Score()
+#define IDENTIFY_SNIP_WIDTH		24					// background clip half-width, 4096-channel units
+#define IDENTIFY_LINE_SIGMAS	4.0					// line support either side of its channel
+
+typedef struct
+{
+	char name[32];
+	int lines;										// 0 for a template spectrum
+	float channel[IDENTIFY_MAX_LINES];				// 4096-channel units
+	float sigma[IDENTIFY_MAX_LINES];
+	float intensity[IDENTIFY_MAX_LINES];			// relative, any scale
+	int channels;									// of spectrum, a template spectrum only
+	float *spectrum;
+} IDENTIFY_TEMPLATE;
+
+typedef struct
+{
+	int start, length;								// grid channels [start,start+length)
+	int value;										// offset of the first value in the pool
+} IDENTIFY_SEGMENT;
+
+typedef struct
+{
+	int firstSegment, segments;
+	float peak;										// largest projected value, for the bound
+} IDENTIFY_PROJECTION;
+
+typedef struct
+{
+	int index;										// template number in the library
+	float score;									// significance z
+	float amplitude;								// counts attributed to the template
+} IDENTIFY_CANDIDATE;
+
+class IdentifyLibrary {
+public:
+	int templates, allocated;
+	IDENTIFY_TEMPLATE *entry;
+	int channels;									// grid of the current projection, 0 = none
+	IDENTIFY_PROJECTION *projection;
+	IDENTIFY_SEGMENT *segment;
+	int segmentCount, segmentAllocated;
+	float *pool;									// projected values
+	int poolCount, poolAllocated;
+	float *weighted, *inverse;						// (d-b)/b and 1/b of the spectrum being scored
+	double *positive, *background;					// prefix sums of max(d-b,0)/b and of b
+	uint64_t scored, pruned;						// templates over all Score() calls
+
+	IdentifyLibrary();								// constructor
+	~IdentifyLibrary();								// destructor frees everything
+	bool AddLines( const char *name, int lines, const float *channel, const float *sigma, const float *intensity );
+	bool AddSpectrum( const char *name, const float *counts, int nChannels );
+	bool Load( const char *path );					// lines of "name ch:sigma[:intensity] ..." or "name @file.csv"
+	bool Project( int nChannels );					// onto this grid, once per resolution change
+	void Prepare( const uint32_t *counts, int nChannels );	// background and weights of a spectrum
+	int Score( const uint32_t *counts, int nChannels, int k, IDENTIFY_CANDIDATE *top, float minScore = 3.0f );
+};												// Score() returns candidates found, best first
+
+void SnipBackground( const uint32_t *counts, int channels, int halfWidth, float *background );
@@ -0,0 +1,285 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Class methods for the prefix-sum time index
+//   definitions in mcaIndex.h
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "mcaIndex.h"
+
+#define INDEX_READ_BLOCK		64					// interval records per pread when walking
+
+SpectrumIndex::SpectrumIndex()						// constructor
+{
+	memset(&header,0,sizeof(header));
+	cumFd = -1;
+	intervalFd = -1;
+	intervals = 0;
+	startTimes = NULL;
+	stopTimes = NULL;
+	timesAllocated = 0;
+	block = NULL;
+	haveReadout = false;
+	lastReadoutTime = 0.0;
+}
+
+SpectrumIndex::~SpectrumIndex()						// destructor
+{
+	Close();
+}
+
+void SpectrumIndex::Close( void )
+{
+	if ( cumFd >= 0 ) close(cumFd);
+	if ( intervalFd >= 0 ) close(intervalFd);
+	cumFd = -1;
+	intervalFd = -1;
+	free(startTimes);
+	free(stopTimes);
+	startTimes = NULL;
+	stopTimes = NULL;
+	timesAllocated = 0;
+	free(block);
+	block = NULL;
+	intervals = 0;
+	haveReadout = false;
+}
+
+static bool OpenPair( const char *base, int flags, int *cumFd, int *intervalFd )
+{
+	char path[512];
+
+	snprintf(path,sizeof(path),"%s.sidx",base);
+	*cumFd = open(path,flags,0644);
+	snprintf(path,sizeof(path),"%s.sivl",base);
+	*intervalFd = open(path,flags,0644);
+	if ( (*cumFd >= 0) && (*intervalFd >= 0) ) return( true );
+	printf("Cannot open index %s.sidx/.sivl\n",base);
+	if ( *cumFd >= 0 ) close(*cumFd);
+	if ( *intervalFd >= 0 ) close(*intervalFd);
+	*cumFd = -1;
+	*intervalFd = -1;
+	return( false );
+}
+
+bool SpectrumIndex::Create( const char *base, int channels, int checkpointEvery, uint32_t capemcaId )
+{
+	Close();
+	if ( (channels < 1) || (channels > MAX_SPECTRUM_SIZE) || (checkpointEvery < 1) ) return( false );
+	if ( !OpenPair(base,O_RDWR | O_CREAT | O_TRUNC,&cumFd,&intervalFd) ) return( false );
+	block = (uint8_t *)malloc(INDEX_READ_BLOCK*(sizeof(INDEX_INTERVAL_HEADER) + channels*4));
+
+	header.magic = INDEX_MAGIC;
+	header.version = INDEX_VERSION;
+	header.channels = channels;
+	header.checkpointEvery = checkpointEvery;
+	header.capemcaId = capemcaId;
+	memset(running,0,sizeof(running));				// checkpoint 0 is all zeros
+	INDEX_FILE_HEADER h = header;
+	if ( (pwrite(cumFd,&h,sizeof(h),0) != (ssize_t)sizeof(h)) ||
+		 (pwrite(cumFd,running,channels*8,sizeof(header)) != (ssize_t)channels*8) )
+		{
+		Close();
+		return( false );
+		}
+	return( true );
+}
+
+bool SpectrumIndex::Open( const char *base )
+{
+	struct stat st;
+	size_t recordSize;
+	uint32_t checkpoints, have;
+	INDEX_INTERVAL_HEADER ih;
+
+	Close();
+	if ( !OpenPair(base,O_RDWR,&cumFd,&intervalFd) ) return( false );
+	if ( (pread(cumFd,&header,sizeof(header),0) != (ssize_t)sizeof(header)) ||
+		 (header.magic != INDEX_MAGIC) || (header.version != INDEX_VERSION) ||
+		 (header.channels < 1) || (header.channels > MAX_SPECTRUM_SIZE) || (header.checkpointEvery < 1) )
+		{
+		printf("%s.sidx is not a version %d index\n",base,INDEX_VERSION);
+		Close();
+		return( false );
+		}
+
+	recordSize = sizeof(INDEX_INTERVAL_HEADER) + header.channels*4;
+	block = (uint8_t *)malloc(INDEX_READ_BLOCK*recordSize);
+	fstat(intervalFd,&st);							// partial record from a crash is ignored
+	intervals = (uint32_t)(st.st_size/recordSize);
+	if ( (fstat(cumFd,&st) != 0) || (st.st_size < (off_t)sizeof(header)) )
+		{
+		printf("%s.sidx is truncated\n",base);		// size below would wrap around
+		Close();
+		return( false );
+		}
+	have = (uint32_t)((st.st_size - sizeof(header))/(header.channels*8));
+	checkpoints = intervals/header.checkpointEvery + 1;
+	if ( have == 0 )
+		{
+		Close();
+		return( false );
+		}
+
+	uint32_t complete = intervals;					// rebuild running sum and any checkpoints
+	if ( have < checkpoints )						// lost after their intervals were written
+		intervals = (have - 1)*header.checkpointEvery;
+	else intervals = (checkpoints - 1)*header.checkpointEvery;
+	pread(cumFd,running,header.channels*8,sizeof(header) + (uint64_t)(intervals/header.checkpointEvery)*header.channels*8);
+
+	for (uint32_t x=0; x<complete; x++)				// load times, replay the tail into running
+		{
+		if ( x >= timesAllocated )
+			{
+			timesAllocated = timesAllocated ? 2*timesAllocated : 1024;
+			startTimes = (double *)realloc(startTimes,timesAllocated*sizeof(double));
+			stopTimes = (double *)realloc(stopTimes,timesAllocated*sizeof(double));
+			}
+		pread(intervalFd,&ih,sizeof(ih),(uint64_t)x*recordSize);
+		startTimes[x] = ih.startTime;
+		stopTimes[x] = ih.stopTime;
+		}
+	while ( intervals < complete )
+		{
+		uint32_t s[MAX_SPECTRUM_SIZE];
+		pread(intervalFd,s,header.channels*4,(uint64_t)intervals*recordSize + sizeof(ih));
+		for (uint32_t i=0; i<header.channels; i++) running[i] += s[i];
+		intervals++;
+		if ( intervals%header.checkpointEvery == 0 )
+			pwrite(cumFd,running,header.channels*8,
+					sizeof(header) + (uint64_t)(intervals/header.checkpointEvery)*header.channels*8);
+		}
+	return( true );
+}
+
+bool SpectrumIndex::Append( double startTime, double stopTime, const uint32_t *interval )
+{
+	INDEX_INTERVAL_HEADER ih;
+	size_t recordSize = sizeof(ih) + header.channels*4;
+	uint64_t offset = (uint64_t)intervals*recordSize;
+	int channels = header.channels;
+
+	if ( intervalFd < 0 ) return( false );
+	if ( intervals >= timesAllocated )
+		{
+		timesAllocated = timesAllocated ? 2*timesAllocated : 1024;
+		startTimes = (double *)realloc(startTimes,timesAllocated*sizeof(double));
+		stopTimes = (double *)realloc(stopTimes,timesAllocated*sizeof(double));
+		}
+	ih.startTime = startTime;
+	ih.stopTime = stopTime;
+	if ( (pwrite(intervalFd,&ih,sizeof(ih),offset) != (ssize_t)sizeof(ih)) ||
+		 (pwrite(intervalFd,interval,channels*4,offset+sizeof(ih)) != (ssize_t)channels*4) )
+		return( false );
+
+	for (int i=0; i<channels; i++)					// vectorized by the compiler
+		running[i] += interval[i];
+	startTimes[intervals] = startTime;
+	stopTimes[intervals] = stopTime;
+	intervals++;
+	if ( intervals%header.checkpointEvery == 0 )	// checkpoint after its intervals are on disk
+		if ( pwrite(cumFd,running,channels*8,
+				sizeof(header) + (uint64_t)(intervals/header.checkpointEvery)*channels*8) != (ssize_t)channels*8 )
+			return( false );
+	return( true );
+}
+
+bool SpectrumIndex::AppendReadout( const McaFrame &frame )
+{
+	uint32_t interval[MAX_SPECTRUM_SIZE];
+	bool ok = true;
+
+	if ( frame.channels != (int)header.channels ) return( false );
+	if ( haveReadout )								// a zeroed device starts a new interval
+		{
+		IntervalSpectrum(frame.spectrum,lastReadout,interval,frame.channels);
+		ok = Append(lastReadoutTime,frame.hostTime,interval);
+		}
+	memcpy(lastReadout,frame.spectrum,frame.channels*4);
+	lastReadoutTime = frame.hostTime;
+	haveReadout = true;
+	return( ok );
+}
+
+bool SpectrumIndex::Cumulative( uint32_t x, uint64_t *cum )
+{
+	uint32_t K = header.checkpointEvery, channels = header.channels;
+	uint32_t j = x/K, r = x%K, first, count, n;
+	size_t recordSize = sizeof(INDEX_INTERVAL_HEADER) + channels*4;
+	bool forward;
+
+	if ( (cumFd < 0) || (x > intervals) ) return( false );
+	if ( x == intervals )							// latest sum is always in memory
+		{
+		memcpy(cum,running,channels*8);
+		return( true );
+		}
+
+	forward = (r <= K/2) || ((j+1)*K > intervals);	// walk from the nearest checkpoint
+	if ( !forward ) j++;
+	if ( pread(cumFd,cum,channels*8,sizeof(header) + (uint64_t)j*channels*8) != (ssize_t)channels*8 )
+		return( false );
+	if ( r == 0 ) return( true );
+
+	first = forward ? j*K : x;						// intervals [first,first+count) to add/subtract
+	count = forward ? r : j*K - x;
+	while ( count )
+		{
+		n = count < INDEX_READ_BLOCK ? count : INDEX_READ_BLOCK;
+		if ( pread(intervalFd,block,n*recordSize,(uint64_t)first*recordSize) != (ssize_t)(n*recordSize) )
+			return( false );
+		for (uint32_t k=0; k<n; k++)
+			{
+			const uint32_t *s = (const uint32_t *)(block + k*recordSize + sizeof(INDEX_INTERVAL_HEADER));
+			if ( forward ) for (uint32_t i=0; i<channels; i++) cum[i] += s[i];
+			else for (uint32_t i=0; i<channels; i++) cum[i] -= s[i];
+			}
+		first += n;
+		count -= n;
+		}
+	return( true );
+}
+
+bool SpectrumIndex::SumIntervals( uint32_t a, uint32_t b, uint64_t *sum )
+{
+	uint64_t before[MAX_SPECTRUM_SIZE];
+
+	if ( (a > b) || !Cumulative(a,before) || !Cumulative(b,sum) ) return( false );
+	for (uint32_t i=0; i<header.channels; i++)		// vectorized subtract
+		sum[i] -= before[i];
+	return( true );
+}
+
+static uint32_t LowerBound( const double *t, uint32_t n, double value, bool strict )
+{													// first index with t > value (strict)
+	uint32_t lo = 0, hi = n, mid;					// or t >= value, times ascending
+
+	while ( lo < hi )
+		{
+		mid = lo + (hi - lo)/2;
+		if ( strict ? (t[mid] <= value) : (t[mid] < value) ) lo = mid + 1;
+		else hi = mid;
+		}
+	return( lo );
+}
+
+uint32_t SpectrumIndex::FirstStopAfter( double t )
+{
+	return( LowerBound(stopTimes,intervals,t,true) );
+}
+
+bool SpectrumIndex::SumTime( double t1, double t2, uint64_t *sum, uint32_t *a, uint32_t *b )
+{
+	uint32_t first, last;							// intervals lying entirely inside [t1,t2]
+
+	first = LowerBound(startTimes,intervals,t1,false);
+	last = FirstStopAfter(t2);
+	if ( last < first ) last = first;
+	if ( a ) *a = first;
+	if ( b ) *b = last;
+	return( SumIntervals(first,last,sum) );
+}
@@ -0,0 +1,61 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Prefix-sum time index of interval spectra for fast arbitrary-window sums
+//   methods in mcaIndex.cpp
+//
+// One index per detector, kept in two files that only ever grow:
+//   <base>.sidx : INDEX_FILE_HEADER, then 64-bit cumulative counts per channel before interval
+//                 0, K, 2K, ... (checkpoint j is the sum of intervals [0,j*K))
+//   <base>.sivl : one INDEX_INTERVAL_HEADER plus 32-bit channel counts per interval
+// The cumulative count before any interval x is the nearest checkpoint plus or minus at most
+// K/2 interval records, so the spectrum of any window [a,b) is Cum(b) - Cum(a). With K = 1 it
+// is exactly two block reads and a subtract. Interval times are kept in memory for lookup.
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "mcaFrame.h"
+
+#define INDEX_MAGIC				0x5844494DU			// "MIDX" in little-endian
+#define INDEX_VERSION			1
+
+typedef struct
+{
+	uint32_t magic;									// INDEX_MAGIC
+	uint32_t version;								// INDEX_VERSION
+	uint32_t channels;								// channels per spectrum
+	uint32_t checkpointEvery;						// K intervals between checkpoints
+	uint32_t capemcaId;								// detector this index belongs to
+	uint32_t reserved[11];
+} INDEX_FILE_HEADER;								// sizeof(INDEX_FILE_HEADER) = 64 bytes
+
+typedef struct
+{
+	double startTime;								// seconds, same clock as frame hostTime
+	double stopTime;
+} INDEX_INTERVAL_HEADER;							// sizeof(INDEX_INTERVAL_HEADER) = 16 bytes
+
+class SpectrumIndex {
+public:
+	INDEX_FILE_HEADER header;
+	int cumFd, intervalFd;							// .sidx and .sivl files
+	uint32_t intervals;								// complete interval records
+	double *startTimes, *stopTimes;					// per interval, in memory for lookup
+	uint32_t timesAllocated;
+	uint8_t *block;									// scratch for walking interval records
+	uint64_t running[MAX_SPECTRUM_SIZE];			// Cum(intervals), next checkpoint source
+	uint32_t lastReadout[MAX_SPECTRUM_SIZE];		// previous cumulative readout from device
+	double lastReadoutTime;
+	bool haveReadout;
+
+	SpectrumIndex();								// constructor
+	~SpectrumIndex();								// destructor closes files
+	bool Create( const char *base, int channels, int checkpointEvery, uint32_t capemcaId );
+	bool Open( const char *base );					// reopen and continue appending
+	void Close( void );
+	bool Append( double startTime, double stopTime, const uint32_t *interval );	// one interval
+	bool AppendReadout( const McaFrame &frame );	// cumulative device readout, first one primes
+	bool Cumulative( uint32_t x, uint64_t *cum );	// counts in intervals [0,x)
+	bool SumIntervals( uint32_t a, uint32_t b, uint64_t *sum );	// counts in intervals [a,b)
+	bool SumTime( double t1, double t2, uint64_t *sum, uint32_t *a = NULL, uint32_t *b = NULL );
+	uint32_t FirstStopAfter( double t );			// first interval with stopTime > t
+};
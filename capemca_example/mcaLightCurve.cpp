@@ -0,0 +1,219 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Class methods and functions for multi-band light curves
+//   definitions in mcaLightCurve.h
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdlib.h>
+#include <string.h>
+#include "mcaLightCurve.h"
+
+static uint64_t SegmentSum( const uint32_t * __restrict s, int n )
+{
+	uint64_t sum = 0;
+
+	for (int i=0; i<n; i++) sum += s[i];			// widening reduction, vectorized by gcc -O3
+	return( sum );
+}
+
+static int CompareInts( const void *a, const void *b )
+{
+	return( *(const int *)a - *(const int *)b );
+}
+
+LightCurve::LightCurve()							// constructor
+{
+	bands = segments = devices = 0;
+	store = NULL;
+	records = 0;
+	memset(cover,0,sizeof(cover));
+}
+
+LightCurve::~LightCurve()							// destructor
+{
+	Close();
+}
+
+bool LightCurve::AddBand( const char *name, int lo, int hi )
+{
+	int n = 0, all[2*LIGHT_MAX_BANDS];
+
+	if ( bands >= LIGHT_MAX_BANDS ) return( false );
+	if ( (lo != LIGHT_BAND_RANGE) && ((lo < 0) || (hi <= lo) || (hi > MAX_SPECTRUM_SIZE)) ) return( false );
+	memset(&band[bands],0,sizeof(LIGHT_BAND));
+	strncpy(band[bands].name,name,sizeof(band[bands].name)-1);
+	if ( lo != LIGHT_BAND_RANGE )					// a channel at the lowest resolution
+		{
+		lo = lo/LIGHT_BAND_ALIGN*LIGHT_BAND_ALIGN;
+		hi = (hi + LIGHT_BAND_ALIGN - 1)/LIGHT_BAND_ALIGN*LIGHT_BAND_ALIGN;
+		}
+	band[bands].lo = lo;
+	band[bands].hi = lo == LIGHT_BAND_RANGE ? 0 : hi;
+	bands++;
+
+	for (int k=0; k<bands; k++)						// rebuild segments from the distinct edges
+		if ( band[k].lo != LIGHT_BAND_RANGE )
+			{
+			all[n++] = band[k].lo;
+			all[n++] = band[k].hi;
+			}
+	qsort(all,n,sizeof(int),CompareInts);
+	segments = 0;
+	for (int i=0; i<n; i++)
+		if ( !i || (all[i] != all[i-1]) ) edge[segments++] = all[i];
+	if ( segments ) segments--;
+	for (int k=0; k<bands; k++)
+		{
+		cover[k] = 0;
+		for (int s=0; s<segments; s++)
+			if ( (band[k].lo <= edge[s]) && (edge[s+1] <= band[k].hi) ) cover[k] |= 1ULL << s;
+		}
+	return( true );
+}
+
+bool LightCurve::ParseBand( const char *text )
+{
+	char name[16];
+	const char *colon = strchr(text,':');
+	int lo, hi;
+
+	if ( sscanf(text,"%15[^:]:%d:%d",name,&lo,&hi) == 3 ) return( AddBand(name,lo,hi) );
+	if ( colon && !strcmp(colon+1,"range") && (sscanf(text,"%15[^:]",name) == 1) )
+		return( AddBand(name,LIGHT_BAND_RANGE,0) );
+	return( false );
+}
+
+void LightCurve::DefaultBands( void )
+{
+	AddBand("soft",16,512);
+	AddBand("mid",512,1536);
+	AddBand("hard",1536,MAX_SPECTRUM_SIZE);
+	AddBand("range",LIGHT_BAND_RANGE,0);
+}
+
+void LightCurve::Sums( const McaFrame &frame, uint64_t *sums )
+{
+	uint64_t segment[2*LIGHT_MAX_BANDS];
+	int bin;
+
+	memset(sums,0,bands*sizeof(uint64_t));
+	if ( !frame.channels ) return;
+	bin = MAX_SPECTRUM_SIZE/frame.channels;
+	for (int s=0; s<segments; s++)					// each channel read once
+		segment[s] = SegmentSum(frame.spectrum + edge[s]/bin,edge[s+1]/bin - edge[s]/bin);
+	for (int k=0; k<bands; k++)
+		for (int s=0; s<segments; s++)
+			if ( cover[k] & (1ULL << s) ) sums[k] += segment[s];
+}
+
+LIGHT_DEVICE *LightCurve::Device( uint32_t capemcaId )
+{
+	LIGHT_DEVICE *d;
+
+	for (int n=0; n<devices; n++)
+		if ( device[n].capemcaId == capemcaId ) return( &device[n] );
+	if ( devices >= LIGHT_MAX_DEVICES ) return( NULL );
+	d = &device[devices++];
+	memset(d,0,sizeof(LIGHT_DEVICE));
+	d->capemcaId = capemcaId;
+	return( d );
+}
+
+bool LightCurve::Process( uint32_t capemcaId, const McaFrame &frame, LIGHT_RECORD_HEADER *record, uint32_t *counts )
+{
+	LIGHT_DEVICE *d = Device(capemcaId);
+	uint64_t sums[LIGHT_MAX_BANDS];
+	bool zeroed = false, packets;
+	double intervals = 0.0, pulseTime = 0.0;
+
+	if ( !d || (!frame.channels && !frame.hasPacket0) ) return( false );
+	if ( !frame.channels )							// packet0 only: spectral bands wait for the
+		for (int k=0; k<bands; k++)					// next spectrum, whose interval covers this one
+			if ( band[k].lo != LIGHT_BAND_RANGE ) return( false );
+	Sums(frame,sums);
+	packets = frame.hasPacket0 && d->hasPacket0;
+	if ( d->havePrevious )
+		{
+		for (int k=0; k<bands; k++) zeroed |= (sums[k] < d->sum[k]);
+		if ( packets ) zeroed |= (frame.packet0.totalIntervals < d->previous.totalIntervals);
+		}
+	if ( packets )
+		{
+		intervals = frame.packet0.totalIntervals - (zeroed ? 0 : d->previous.totalIntervals);
+		pulseTime = frame.packet0.totalPulseTime - (zeroed ? 0.0f : d->previous.totalPulseTime);
+		}
+
+	memset(record,0,sizeof(LIGHT_RECORD_HEADER));
+	record->hostTime = frame.hostTime;
+	record->capemcaId = capemcaId;
+	record->realTime = packets ? intervals*frame.packet0.usPerInterval*1.0e-6 : frame.hostTime - d->previousTime;
+	record->liveTime = pulseTime < record->realTime ? record->realTime - pulseTime : 0.0f;
+	for (int k=0; k<bands; k++)
+		if ( band[k].lo == LIGHT_BAND_RANGE )		// packet0 count is for its latest interval only
+			counts[k] = frame.hasPacket0 ? (uint32_t)(frame.packet0.countInRangeArray*(packets ? intervals : 1.0)) : 0;
+		else counts[k] = (uint32_t)(zeroed ? sums[k] : sums[k] - d->sum[k]);
+
+	bool first = !d->havePrevious;
+	memcpy(d->sum,sums,bands*sizeof(uint64_t));
+	d->havePrevious = true;
+	d->previousTime = frame.hostTime;
+	if ( frame.hasPacket0 ) d->previous = frame.packet0;
+	d->hasPacket0 = frame.hasPacket0;
+	return( !first && (record->realTime > 0.0f) );
+}
+
+bool LightCurve::Create( const char *path )
+{
+	LIGHT_FILE_HEADER header;
+
+	Close();
+	if ( !(store = fopen(path,"wb")) )
+		{
+		printf("Cannot create %s\n",path);
+		return( false );
+		}
+	memset(&header,0,sizeof(header));
+	header.magic = LIGHT_MAGIC;
+	header.version = LIGHT_VERSION;
+	header.bands = bands;
+	memcpy(header.band,band,bands*sizeof(LIGHT_BAND));
+	return( fwrite(&header,sizeof(header),1,store) == 1 );
+}
+
+bool LightCurve::Append( const LIGHT_RECORD_HEADER &record, const uint32_t *counts )
+{
+	if ( !store ) return( false );
+	if ( (fwrite(&record,sizeof(record),1,store) != 1) || (fwrite(counts,4,bands,store) != (size_t)bands) )
+		return( false );
+	records++;
+	return( true );
+}
+
+void LightCurve::Close( void )
+{
+	if ( store ) fclose(store);
+	store = NULL;
+}
+
+bool OpenLightStore( const char *path, FILE **f, LIGHT_FILE_HEADER *header )
+{
+	if ( !(*f = fopen(path,"rb")) )
+		{
+		printf("Cannot open %s\n",path);
+		return( false );
+		}
+	if ( (fread(header,sizeof(LIGHT_FILE_HEADER),1,*f) != 1) || (header->magic != LIGHT_MAGIC) ||
+		 (header->version != LIGHT_VERSION) || (header->bands > LIGHT_MAX_BANDS) )
+		{
+		printf("%s is not a light curve store\n",path);
+		fclose(*f);
+		*f = NULL;
+		return( false );
+		}
+	return( true );
+}
+
+bool ReadLightRecord( FILE *f, const LIGHT_FILE_HEADER &header, LIGHT_RECORD_HEADER *record, uint32_t *counts )
+{
+	return( (fread(record,sizeof(LIGHT_RECORD_HEADER),1,f) == 1) &&
+			(fread(counts,4,header.bands,f) == header.bands) );
+}
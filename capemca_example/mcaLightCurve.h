@@ -0,0 +1,92 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Multi-band light curves computed in one pass over each frame
+//   methods in mcaLightCurve.cpp
+//
+// Bands are channel ranges [lo,hi) in 4096-channel units and may overlap. Their edges cut the
+// spectrum into at most 2*LIGHT_MAX_BANDS segments; each frame is summed once segment by segment
+// and every band is the sum of the segments it covers. Because sums are linear, the counts of a
+// band in the interval since the previous readout are its cumulative sum now minus the one
+// kept from last time, so a detector needs only O(bands) state and no previous spectrum.
+// AddBand() widens edges to multiples of 16, which give the same sums at every resolution, so a
+// switch of request code is not taken for counts going down at a zero. The extra band
+// LIGHT_BAND_RANGE takes countInRangeArray from packet0 instead of the spectrum. A packet0-only
+// frame gives no record while any band is spectral; the next spectrum then covers its interval.
+//
+// Live time comes from the packet0 differences (real time minus new totalPulseTime), or the
+// hostTime step when frames have no packet0. A store file is a LIGHT_FILE_HEADER with the band
+// table, then one LIGHT_RECORD_HEADER plus uint32 counts[bands] per interval and detector.
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <stdio.h>
+#include "mcaFrame.h"
+
+#define LIGHT_MAGIC				0x4356434CU			// "LCVC" in little-endian
+#define LIGHT_VERSION			1
+#define LIGHT_MAX_BANDS			16
+#define LIGHT_MAX_DEVICES		256					// as many as WinUSBDs can enumerate
+#define LIGHT_BAND_RANGE		-1					// lo of the packet0 countInRangeArray band
+#define LIGHT_BAND_ALIGN		(MAX_SPECTRUM_SIZE/CHANNELS_PER_REQUEST)	// 16 channels
+
+typedef struct
+{
+	char name[16];
+	int32_t lo, hi;									// 4096-channel units, LIGHT_BAND_RANGE for packet0
+} LIGHT_BAND;										// sizeof(LIGHT_BAND) = 24 bytes
+
+typedef struct
+{
+	uint32_t magic;									// LIGHT_MAGIC
+	uint32_t version;								// LIGHT_VERSION
+	uint32_t bands;
+	uint32_t reserved;
+	LIGHT_BAND band[LIGHT_MAX_BANDS];
+} LIGHT_FILE_HEADER;								// sizeof(LIGHT_FILE_HEADER) = 400 bytes
+
+typedef struct
+{
+	double hostTime;								// end of the interval
+	uint32_t capemcaId;
+	float realTime;									// seconds in the interval
+	float liveTime;									// seconds not inside pulses
+	uint32_t reserved;
+} LIGHT_RECORD_HEADER;								// sizeof(LIGHT_RECORD_HEADER) = 24 bytes
+
+typedef struct
+{
+	uint32_t capemcaId;
+	bool havePrevious;
+	double previousTime;
+	PACKET0_TYPE previous;							// valid when hasPacket0 was set
+	bool hasPacket0;
+	uint64_t sum[LIGHT_MAX_BANDS];					// cumulative band sums of the last readout
+} LIGHT_DEVICE;
+
+class LightCurve {
+public:
+	int bands;
+	LIGHT_BAND band[LIGHT_MAX_BANDS];
+	int segments;									// between consecutive distinct edges
+	int edge[2*LIGHT_MAX_BANDS];					// segment s is [edge[s],edge[s+1])
+	uint64_t cover[LIGHT_MAX_BANDS];				// bit s set if band covers segment s
+	int devices;
+	LIGHT_DEVICE device[LIGHT_MAX_DEVICES];
+	FILE *store;
+	uint64_t records;
+
+	LightCurve();									// constructor
+	~LightCurve();									// destructor closes the store
+	bool AddBand( const char *name, int lo, int hi );	// hi exclusive, or lo = LIGHT_BAND_RANGE
+	bool ParseBand( const char *text );				// "name:lo:hi" or "name:range"
+	void DefaultBands( void );						// soft, mid, hard and range
+	void Sums( const McaFrame &frame, uint64_t *sums );	// cumulative band sums, one pass
+	LIGHT_DEVICE *Device( uint32_t capemcaId );		// table entry, added if new
+	bool Process( uint32_t capemcaId, const McaFrame &frame, LIGHT_RECORD_HEADER *record, uint32_t *counts );
+	bool Create( const char *path );				// start a store with the current bands
+	bool Append( const LIGHT_RECORD_HEADER &record, const uint32_t *counts );
+	void Close( void );
+};
+
+bool OpenLightStore( const char *path, FILE **f, LIGHT_FILE_HEADER *header );	// for readers
+bool ReadLightRecord( FILE *f, const LIGHT_FILE_HEADER &header, LIGHT_RECORD_HEADER *record, uint32_t *counts );
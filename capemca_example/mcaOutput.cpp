@@ -0,0 +1,242 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Functions for CSV and binary output of decoded MCA frames
+//   definitions in mcaOutput.h
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdlib.h>
+#include <string.h>
+#include "mcaOutput.h"
+
+////// integer to ASCII /////////////////////////////////////////////////////////////////////////////
+
+static const char digitPairs[] =					// "00" to "99"
+	"0001020304050607080910111213141516171819202122232425262728293031323334353637383940414243444546474849"
+	"5051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+
+char *FormatUnsigned( char *out, uint32_t value )
+{
+	int digits = value < 10 ? 1 : value < 100 ? 2 : value < 1000 ? 3 : value < 10000 ? 4 : value < 100000 ? 5 :
+				 value < 1000000 ? 6 : value < 10000000 ? 7 : value < 100000000 ? 8 : value < 1000000000 ? 9 : 10;
+	char *end = out + digits, *p = end;
+
+	while ( value >= 100 )							// two digits per division, from the right
+		{
+		const char *pair = digitPairs + 2*(value % 100);
+		value /= 100;
+		p -= 2;
+		p[0] = pair[0];
+		p[1] = pair[1];
+		}
+	if ( value >= 10 )
+		{
+		p[-2] = digitPairs[2*value];
+		p[-1] = digitPairs[2*value+1];
+		}
+	else p[-1] = (char)('0' + value);
+	return( end );
+}
+
+////// CsvWriter ////////////////////////////////////////////////////////////////////////////////////
+
+CsvWriter::CsvWriter( FILE *file, size_t bufferBytes )	// constructor
+{
+	f = file;
+	columns = CSV_COLUMNS_ALL;
+	nonzeroOnly = false;
+	size = bufferBytes;
+	buffer = size > sizeof(fallback) ? (char *)malloc(size) : NULL;
+	if ( !buffer )									// a line at a time still works
+		{
+		buffer = fallback;
+		size = sizeof(fallback);
+		}
+	length = 0;
+	bytes = 0;
+}
+
+CsvWriter::~CsvWriter()								// destructor
+{
+	Flush();
+	if ( buffer != fallback ) free(buffer);
+}
+
+void CsvWriter::Flush( void )
+{
+	if ( length ) bytes += fwrite(buffer,1,length,f);
+	length = 0;
+}
+
+void CsvWriter::Text( const char *text )
+{
+	size_t n = strlen(text);
+
+	if ( length + n > size ) Flush();
+	if ( n > size )									// too long to buffer
+		{
+		bytes += fwrite(text,1,n,f);
+		return;
+		}
+	memcpy(buffer+length,text,n);
+	length += n;
+}
+
+void CsvWriter::Spectrum( const uint32_t *spectrum, int channels )
+{
+	char *p, *limit = buffer + size - CSV_LINE_BYTES;
+
+	if ( columns == CSV_COLUMN_CHANNEL ) Text("channel\n");
+	else if ( columns == CSV_COLUMN_COUNT ) Text("count\n");
+	else Text("channel,count\n");
+	p = buffer + length;
+	for (int i=1; i<channels; i++)					// channel 0 is left out, like capeMCAcli
+		{
+		if ( nonzeroOnly && !spectrum[i] ) continue;
+		if ( p > limit )
+			{
+			length = p - buffer;
+			Flush();
+			p = buffer;
+			}
+		if ( columns & CSV_COLUMN_CHANNEL )
+			{
+			p = FormatUnsigned(p,i);
+			if ( columns & CSV_COLUMN_COUNT ) *p++ = ',';
+			}
+		if ( columns & CSV_COLUMN_COUNT ) p = FormatUnsigned(p,spectrum[i]);
+		*p++ = '\n';
+		}
+	length = p - buffer;
+}
+
+void CsvWriter::Packet0( const PACKET0_TYPE &packet0 )
+{
+	char line[CSV_LINE_BYTES];						// one line a frame, printf is fine here
+
+	Text("cps,totalCount,totalPulseTime,usPerInterval,totalIntervals,capemcaId\n");
+	snprintf(line,sizeof(line),"%g,%g,%g,%d,%d,%d\n",packet0.cps,packet0.totalCount,packet0.totalPulseTime,
+								packet0.usPerInterval,packet0.totalIntervals,packet0.capemcaId);
+	Text(line);
+}
+
+////// one-shot output //////////////////////////////////////////////////////////////////////////////
+
+void WriteSpectrumCsv( FILE *f, const uint32_t *spectrum, int channels )
+{
+	CsvWriter csv(f);
+
+	csv.Spectrum(spectrum,channels);
+}
+
+void WritePacket0Csv( FILE *f, const PACKET0_TYPE &packet0 )
+{
+	fprintf(f,"cps,totalCount,totalPulseTime,usPerInterval,totalIntervals,capemcaId\n");
+	fprintf(f,"%g,%g,%g,%d,%d,%d\n",packet0.cps,packet0.totalCount,packet0.totalPulseTime,
+								packet0.usPerInterval,packet0.totalIntervals,packet0.capemcaId);
+}
+
+size_t WriteFrameBinary( FILE *f, const McaFrame &frame )
+{
+	FRAME_RECORD_HEADER header;
+	size_t bytes;
+
+	header.magic = FRAME_RECORD_MAGIC;
+	header.request = (uint16_t)frame.request;
+	header.channels = (uint16_t)frame.channels;
+	header.packetBytes = frame.hasPacket0 ? sizeof(PACKET0_TYPE) : 0;
+	header.reserved = 0;
+	header.hostTime = frame.hostTime;
+
+	bytes = fwrite(&header,1,sizeof(header),f);
+	if ( frame.channels )
+		bytes += fwrite(frame.spectrum,1,frame.channels*4,f);
+	if ( frame.hasPacket0 )
+		bytes += fwrite(&frame.packet0,1,sizeof(PACKET0_TYPE),f);
+	return( bytes );
+}
+
+static bool ReadFrameSparse( FILE *f, const FRAME_RECORD_HEADER &header, McaFrame *frame )
+{
+	uint8_t packed[FRAME_SPARSE_BYTES];
+	SparseDelta delta;
+
+	if ( (header.reserved > sizeof(packed)) || (fread(packed,1,header.reserved,f) != header.reserved) ||
+		 (delta.Unpack(packed,header.reserved) != header.reserved) || (delta.channels != header.channels) ||
+		 (frame->channels != header.channels) || !delta.Fits(frame->spectrum) ) return( false );
+	delta.ApplyTo(frame->spectrum);					// only the channels that changed
+	frame->request = header.request;
+	frame->hostTime = header.hostTime;
+	frame->sendTime = 0.0;
+	frame->hasPacket0 = (header.packetBytes == sizeof(PACKET0_TYPE));
+	if ( header.packetBytes )
+		if ( fread(&frame->packet0,header.packetBytes,1,f) != 1 ) return( false );
+	return( true );
+}
+
+bool ReadFrameBinary( FILE *f, McaFrame *frame )
+{
+	FRAME_RECORD_HEADER header;
+
+	if ( fread(&header,sizeof(header),1,f) != 1 ) return( false );
+	if ( (header.magic == FRAME_SPARSE_MAGIC) && (header.packetBytes <= sizeof(PACKET0_TYPE)) )
+		return( ReadFrameSparse(f,header,frame) );
+	if ( header.magic != FRAME_RECORD_MAGIC ) return( false );
+	if ( (header.channels > MAX_SPECTRUM_SIZE) || (header.packetBytes > sizeof(PACKET0_TYPE)) )
+		return( false );
+
+	frame->Clear();
+	frame->request = header.request;
+	frame->channels = header.channels;
+	frame->hostTime = header.hostTime;
+	if ( header.channels )
+		if ( fread(frame->spectrum,4,header.channels,f) != header.channels ) return( false );
+	frame->hasPacket0 = (header.packetBytes == sizeof(PACKET0_TYPE));
+	if ( header.packetBytes )
+		if ( fread(&frame->packet0,header.packetBytes,1,f) != 1 ) return( false );
+	return( true );
+}
+
+////// SparseFrameWriter ////////////////////////////////////////////////////////////////////////////
+
+SparseFrameWriter::SparseFrameWriter( FILE *file )	// constructor
+{
+	f = file;
+	channels = 0;
+	records = 0;
+	sparseRecords = 0;
+	bytes = 0;
+	denseBytes = 0;
+}
+
+size_t SparseFrameWriter::Write( const McaFrame &frame )
+{
+	FRAME_RECORD_HEADER header;
+	size_t n;
+
+	records++;
+	denseBytes += sizeof(header) + frame.channels*4 + (frame.hasPacket0 ? sizeof(PACKET0_TYPE) : 0);
+	if ( frame.channels && (frame.channels == channels) )
+		{
+		delta.Encode(frame.spectrum,previous,channels);
+		if ( delta.Bytes() < (size_t)channels*4 )	// busy spectra stay dense
+			{
+			header.magic = FRAME_SPARSE_MAGIC;
+			header.request = (uint16_t)frame.request;
+			header.channels = (uint16_t)frame.channels;
+			header.packetBytes = frame.hasPacket0 ? sizeof(PACKET0_TYPE) : 0;
+			header.reserved = (uint32_t)delta.Pack(packed);
+			header.hostTime = frame.hostTime;
+			n = fwrite(&header,1,sizeof(header),f);
+			n += fwrite(packed,1,header.reserved,f);
+			if ( frame.hasPacket0 ) n += fwrite(&frame.packet0,1,sizeof(PACKET0_TYPE),f);
+			delta.ApplyTo(previous);				// previous becomes this readout
+			sparseRecords++;
+			bytes += n;
+			return( n );
+			}
+		}
+	n = WriteFrameBinary(f,frame);
+	channels = frame.channels;						// a packet0-only record clears the reader's frame
+	memcpy(previous,frame.spectrum,channels*4);
+	bytes += n;
+	return( n );
+}
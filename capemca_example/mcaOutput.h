@@ -0,0 +1,84 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// CSV and binary output of decoded MCA frames
+//   methods in mcaOutput.cpp
+//
+// CSV matches the console output of capeMCAcli and capeMCAuart: a "channel,count" header and
+// one line per channel starting at channel 1, and the packet0 summary line of capeMCAuart.
+// Binary records are a FRAME_RECORD_HEADER followed by the channel block and packet0.
+// SparseFrameWriter stores a readout as a FRAME_SPARSE_MAGIC record instead when its change
+// from the readout before it in the same file packs smaller (see mcaSparse.h), a header, the
+// packed delta and packet0. ReadFrameBinary() applies such a record to the spectrum already in
+// frame, so read a file into one McaFrame in a loop; a record that does not fit it is refused.
+//
+// CsvWriter formats integers two digits at a time from a table into one large buffer that is
+// reused from frame to frame and written out in blocks, instead of a printf call per channel.
+// With the default columns and all channels its output is byte for byte that of printf; it
+// can also leave out a column or the channels that are zero. Flush() before printing anything
+// else to the same FILE.
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <stdio.h>
+#include "mcaFrame.h"
+#include "mcaSparse.h"
+
+#define FRAME_RECORD_MAGIC		0x3046434DU			// "MCF0" in little-endian
+#define FRAME_SPARSE_MAGIC		0x5346434DU			// "MCFS": a delta on the previous record
+#define FRAME_SPARSE_BYTES		(sizeof(SPARSE_HEADER) + MAX_SPECTRUM_SIZE/8 + MAX_SPECTRUM_SIZE*4)
+
+typedef struct
+{
+	uint32_t magic;									// FRAME_RECORD_MAGIC
+	uint16_t request;								// request code of the frame
+	uint16_t channels;								// 32-bit channels that follow
+	uint32_t packetBytes;							// 0 or sizeof(PACKET0_TYPE), after channels
+	uint32_t reserved;								// sparse records: bytes of packed delta
+	double hostTime;								// host monotonic seconds at receipt
+} FRAME_RECORD_HEADER;								// sizeof(FRAME_RECORD_HEADER) = 24 bytes
+
+#define CSV_BUFFER_BYTES		65536				// written to the FILE when full
+#define CSV_LINE_BYTES			256					// room kept for the longest line
+
+#define CSV_COLUMN_CHANNEL		1					// columns of spectrum lines
+#define CSV_COLUMN_COUNT		2
+#define CSV_COLUMNS_ALL			(CSV_COLUMN_CHANNEL | CSV_COLUMN_COUNT)
+
+class CsvWriter {									// buffered CSV of spectra and packet0
+public:
+	FILE *f;
+	int columns;									// CSV_COLUMN_CHANNEL and/or CSV_COLUMN_COUNT
+	bool nonzeroOnly;								// skip channels with no counts
+	char *buffer;									// allocated, or fallback when out of memory
+	size_t length, size;							// bytes waiting in buffer, its capacity
+	char fallback[2*CSV_LINE_BYTES];
+	uint64_t bytes;									// written to f since constructed
+
+	CsvWriter( FILE *file, size_t bufferBytes = CSV_BUFFER_BYTES );	// constructor
+	~CsvWriter();									// destructor flushes
+	void Spectrum( const uint32_t *spectrum, int channels );	// header and a line per channel
+	void Packet0( const PACKET0_TYPE &packet0 );	// header and summary line
+	void Text( const char *text );					// anything else, kept in order
+	void Flush( void );								// block write of the buffer
+};
+
+class SparseFrameWriter {							// binary frame records as deltas where smaller
+public:
+	FILE *f;
+	int channels;									// of the last record, 0 before the first
+	uint32_t previous[MAX_SPECTRUM_SIZE];			// its spectrum, the base of the next delta
+	SparseDelta delta;
+	uint8_t packed[FRAME_SPARSE_BYTES];
+	uint64_t records, sparseRecords;
+	uint64_t bytes, denseBytes;						// written, and what WriteFrameBinary() would write
+
+	SparseFrameWriter( FILE *file );				// constructor
+	size_t Write( const McaFrame &frame );			// returns bytes written
+};
+
+char *FormatUnsigned( char *out, uint32_t value );	// decimal digits, returns the end
+
+void WriteSpectrumCsv( FILE *f, const uint32_t *spectrum, int channels );
+void WritePacket0Csv( FILE *f, const PACKET0_TYPE &packet0 );
+size_t WriteFrameBinary( FILE *f, const McaFrame &frame );	// returns bytes written
+bool ReadFrameBinary( FILE *f, McaFrame *frame );			// false at end of file or bad record
@@ -0,0 +1,96 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Class methods for the worker thread pool
+//   definitions in mcaPool.h
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <unistd.h>
+#include "mcaPool.h"
+
+static void *PoolWorker( void *arg )				// run jobs until the pool quits
+{
+	WorkerPool *pool = (WorkerPool *)arg;
+	uint32_t seen = 0;
+	int job;
+
+	pthread_mutex_lock(&pool->mutex);
+	for (;;)
+		{
+		while ( !pool->quit && (pool->batch == seen) )
+			pthread_cond_wait(&pool->work,&pool->mutex);
+		if ( pool->quit ) break;
+		seen = pool->batch;
+		while ( pool->TakeJob(seen,&job) )
+			{
+			pthread_mutex_unlock(&pool->mutex);
+			pool->function(pool->context,job);
+			pthread_mutex_lock(&pool->mutex);
+			if ( ++pool->finished == pool->jobCount ) pthread_cond_signal(&pool->done);
+			}
+		}
+	pthread_mutex_unlock(&pool->mutex);
+	return( NULL );
+}
+
+WorkerPool::WorkerPool( int nThreads )				// constructor
+{
+	if ( nThreads <= 0 ) nThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if ( nThreads < 1 ) nThreads = 1;
+	if ( nThreads > POOL_MAX_THREADS ) nThreads = POOL_MAX_THREADS;
+	pthread_mutex_init(&mutex,NULL);
+	pthread_cond_init(&work,NULL);
+	pthread_cond_init(&done,NULL);
+	function = NULL;
+	context = NULL;
+	jobCount = nextJob = finished = 0;
+	batch = 0;
+	quit = false;
+	threads = 0;									// caller of Run() is one of the threads
+	for (int t=0; t<nThreads-1; t++)
+		if ( pthread_create(&thread[threads],NULL,PoolWorker,this) == 0 ) threads++;
+}
+
+WorkerPool::~WorkerPool()							// destructor
+{
+	pthread_mutex_lock(&mutex);
+	quit = true;
+	pthread_cond_broadcast(&work);
+	pthread_mutex_unlock(&mutex);
+	for (int t=0; t<threads; t++) pthread_join(thread[t],NULL);
+	pthread_cond_destroy(&done);
+	pthread_cond_destroy(&work);
+	pthread_mutex_destroy(&mutex);
+}
+
+bool WorkerPool::TakeJob( uint32_t forBatch, int *job )
+{
+	if ( (batch != forBatch) || (nextJob >= jobCount) ) return( false );
+	*job = nextJob++;
+	return( true );
+}
+
+void WorkerPool::Run( POOL_JOB batchFunction, void *batchContext, int n )
+{
+	uint32_t mine;
+	int job;
+
+	if ( n <= 0 ) return;
+	pthread_mutex_lock(&mutex);
+	function = batchFunction;
+	context = batchContext;
+	jobCount = n;
+	nextJob = 0;
+	finished = 0;
+	mine = ++batch;
+	pthread_cond_broadcast(&work);
+
+	while ( TakeJob(mine,&job) )					// help with the batch
+		{
+		pthread_mutex_unlock(&mutex);
+		batchFunction(batchContext,job);
+		pthread_mutex_lock(&mutex);
+		++finished;
+		}
+
+	while ( finished < jobCount ) pthread_cond_wait(&done,&mutex);
+	pthread_mutex_unlock(&mutex);
+}
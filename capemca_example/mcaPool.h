@@ -0,0 +1,36 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Fixed set of worker threads running batches of numbered jobs
+//   methods in mcaPool.cpp
+//
+// Run() hands jobs 0..n-1 to the workers and to the calling thread, and returns once every one
+// has finished. Jobs are handed out under the pool mutex, which a job takes anyway to count
+// itself finished, and only for the batch the worker woke up for: a worker still leaving one
+// batch cannot take a job of the next before its counters are reset.
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <stdint.h>
+#include <pthread.h>
+
+#define POOL_MAX_THREADS		32
+
+typedef void (*POOL_JOB)( void *context, int job );
+
+class WorkerPool {
+public:
+	int threads;									// workers, besides the caller of Run()
+	pthread_t thread[POOL_MAX_THREADS];
+	pthread_mutex_t mutex;							// guards everything below
+	pthread_cond_t work, done;
+	POOL_JOB function;								// current batch
+	void *context;
+	int jobCount, nextJob, finished;
+	uint32_t batch;									// increments for each Run()
+	bool quit;
+
+	WorkerPool( int nThreads = 0 );					// 0 = one per online cpu
+	~WorkerPool();
+	void Run( POOL_JOB batchFunction, void *batchContext, int n );	// returns when every job is done
+	bool TakeJob( uint32_t forBatch, int *job );	// mutex held, false once the batch is handed out
+};
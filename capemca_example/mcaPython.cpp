@@ -0,0 +1,803 @@
+///////////////////////////////////////////////////////////////////////////////////////////
+//  Python bindings to the acquisition and decode code: import capemca                  //
+//                                                                                       //
+//  Frame, Accumulator and Packet0 export their C++ storage through the buffer protocol, //
+//  so numpy.asarray(frame) is a uint32 view of the spectrum, numpy.asarray(accumulator) //
+//  a uint64 view of the running sum and numpy.asarray(frame.packet0) a structured view  //
+//  of PACKET0_TYPE, none of them copied. Device talks to a serial, USB, simulated or    //
+//  replayed MCA with McaRequest() and releases the GIL while it waits on the device;    //
+//  Device.stream() is an iterator of frames at a fixed rate. Built by make when         //
+//  python3-config is found, as capemca.<suffix>.so next to the tools:                   //
+//                                                                                       //
+//      import capemca, numpy                                                            //
+//      with capemca.Device(port="/dev/ttyUSB0") as mca:                                 //
+//          sum = capemca.Accumulator(1024)                                              //
+//          for frame in mca.stream(36, interval=1.0, count=60):                         //
+//              sum.add_readout(frame)                                                   //
+//              print(frame.packet0.cps, numpy.asarray(frame)[1100:1300].sum())          //
+//                                                                                       //
+///////////////////////////////////////////////////////////////////////////////////////////
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "version.h"
+#include "mcaFrame.h"
+#include "mcaOutput.h"
+#include "mcaTransport.h"
+#include "mcaCapture.h"
+
+#define WAIT_SLICE_SECONDS		0.1					// Ctrl-C is seen this often while waiting
+
+													// PEP 3118 layout of PACKET0_TYPE, so numpy
+													// gets a structured dtype with the C names
+static char packet0Format[] = "T{<f:cps:<f:totalCount:<f:totalPulseTime:<I:usPerInterval:<I:totalIntervals:"
+	"<I:capemcaId:<I:detectors:<I:cpiArray:<I:countInRangeArray:<f:xDirection:<f:yDirection:<f:zDirection:"
+	"(4)<I:reserved:}";
+
+////// Packet0 //////////////////////////////////////////////////////////////////////////////////////
+
+typedef struct
+{
+	PyObject_HEAD
+	PyObject *owner;								// Frame holding the record, NULL if own copy
+	PACKET0_TYPE *packet0;							// into owner, or &own
+	PACKET0_TYPE own;
+} Packet0Object;
+
+static PyTypeObject Packet0Type = { PyVarObject_HEAD_INIT(NULL, 0) };
+
+static PyObject *NewPacket0( PyObject *owner, PACKET0_TYPE *packet0 )
+{
+	Packet0Object *self = PyObject_New(Packet0Object,&Packet0Type);
+
+	if ( !self ) return( NULL );
+	Py_XINCREF(owner);
+	self->owner = owner;
+	self->packet0 = owner ? packet0 : &self->own;
+	if ( !owner ) self->own = *packet0;
+	return( (PyObject *)self );
+}
+
+static PyObject *Packet0New( PyTypeObject *type, PyObject *args, PyObject *kwds )
+{													// Packet0(bytes) copies a raw 64-byte record
+	static const char *keywords[] = { "data", NULL };
+	Py_buffer data;
+	PyObject *result;
+
+	if ( !PyArg_ParseTupleAndKeywords(args,kwds,"y*",(char **)keywords,&data) ) return( NULL );
+	if ( data.len != (Py_ssize_t)sizeof(PACKET0_TYPE) )
+		{
+		PyBuffer_Release(&data);
+		return( PyErr_Format(PyExc_ValueError,"packet0 is %d bytes, not %zd",(int)sizeof(PACKET0_TYPE),data.len) );
+		}
+	PACKET0_TYPE packet0;
+	memcpy(&packet0,data.buf,sizeof(packet0));
+	PyBuffer_Release(&data);
+	result = NewPacket0(NULL,&packet0);
+	return( result );
+}
+
+static void Packet0Dealloc( Packet0Object *self )
+{
+	Py_XDECREF(self->owner);
+	PyObject_Del(self);
+}
+
+static int Packet0GetBuffer( Packet0Object *self, Py_buffer *view, int flags )
+{
+	if ( PyBuffer_FillInfo(view,(PyObject *)self,self->packet0,sizeof(PACKET0_TYPE),1,flags) < 0 ) return( -1 );
+	if ( flags & PyBUF_FORMAT )						// else plain bytes
+		{
+		view->format = packet0Format;
+		view->itemsize = sizeof(PACKET0_TYPE);
+		view->ndim = 0;								// one record
+		view->shape = NULL;
+		view->strides = NULL;
+		}
+	return( 0 );
+}
+
+typedef struct
+{
+	size_t offset;
+	bool isFloat;
+} PACKET0_FIELD;
+
+static PACKET0_FIELD packet0Fields[] = {
+	{ offsetof(PACKET0_TYPE,cps), true },
+	{ offsetof(PACKET0_TYPE,totalCount), true },
+	{ offsetof(PACKET0_TYPE,totalPulseTime), true },
+	{ offsetof(PACKET0_TYPE,usPerInterval), false },
+	{ offsetof(PACKET0_TYPE,totalIntervals), false },
+	{ offsetof(PACKET0_TYPE,capemcaId), false },
+	{ offsetof(PACKET0_TYPE,detectors), false },
+	{ offsetof(PACKET0_TYPE,cpiArray), false },
+	{ offsetof(PACKET0_TYPE,countInRangeArray), false },
+	{ offsetof(PACKET0_TYPE,xDirection), true },
+	{ offsetof(PACKET0_TYPE,yDirection), true },
+	{ offsetof(PACKET0_TYPE,zDirection), true } };
+
+static PyObject *Packet0Field( Packet0Object *self, void *closure )
+{
+	const PACKET0_FIELD *field = (const PACKET0_FIELD *)closure;
+	const uint8_t *at = (const uint8_t *)self->packet0 + field->offset;
+
+	if ( field->isFloat ) return( PyFloat_FromDouble(*(const float *)at) );
+	return( PyLong_FromUnsignedLong(*(const uint32_t *)at) );
+}
+
+static PyGetSetDef packet0GetSet[] = {
+	{ "cps", (getter)Packet0Field, NULL, "count rate of the most recent interval", &packet0Fields[0] },
+	{ "totalCount", (getter)Packet0Field, NULL, "sum of all spectrum channels", &packet0Fields[1] },
+	{ "totalPulseTime", (getter)Packet0Field, NULL, "seconds inside pulses", &packet0Fields[2] },
+	{ "usPerInterval", (getter)Packet0Field, NULL, "microseconds in the most recent interval", &packet0Fields[3] },
+	{ "totalIntervals", (getter)Packet0Field, NULL, "intervals acquired since the last zero", &packet0Fields[4] },
+	{ "capemcaId", (getter)Packet0Field, NULL, "device id", &packet0Fields[5] },
+	{ "detectors", (getter)Packet0Field, NULL, "detectors in the array", &packet0Fields[6] },
+	{ "cpiArray", (getter)Packet0Field, NULL, "counts per interval across all detectors", &packet0Fields[7] },
+	{ "countInRangeArray", (getter)Packet0Field, NULL, "counts in the channel range across all detectors", &packet0Fields[8] },
+	{ "xDirection", (getter)Packet0Field, NULL, "source direction", &packet0Fields[9] },
+	{ "yDirection", (getter)Packet0Field, NULL, "source direction", &packet0Fields[10] },
+	{ "zDirection", (getter)Packet0Field, NULL, "source direction", &packet0Fields[11] },
+	{ NULL } };
+
+static PyObject *Packet0Repr( Packet0Object *self )
+{
+	char text[200];									// PyUnicode_FromFormat has no %g
+
+	snprintf(text,sizeof(text),"Packet0(capemcaId=%u, cps=%g, totalCount=%g, totalIntervals=%u, usPerInterval=%u)",
+			self->packet0->capemcaId,self->packet0->cps,self->packet0->totalCount,self->packet0->totalIntervals,
+			self->packet0->usPerInterval);
+	return( PyUnicode_FromString(text) );
+}
+
+static PyBufferProcs packet0Buffer = { (getbufferproc)Packet0GetBuffer, NULL };
+
+////// Frame ////////////////////////////////////////////////////////////////////////////////////////
+
+typedef struct
+{
+	PyObject_HEAD
+	McaFrame *frame;								// never changes once handed to Python
+	Py_ssize_t shape[1];
+} FrameObject;
+
+static PyTypeObject FrameType = { PyVarObject_HEAD_INIT(NULL, 0) };
+
+static FrameObject *NewFrame( void )
+{
+	FrameObject *self = PyObject_New(FrameObject,&FrameType);
+
+	if ( !self ) return( NULL );
+	self->frame = new McaFrame;
+	return( self );
+}
+
+static void FrameDealloc( FrameObject *self )
+{
+	delete self->frame;
+	PyObject_Del(self);
+}
+
+static int FrameGetBuffer( FrameObject *self, Py_buffer *view, int flags )
+{
+	if ( PyBuffer_FillInfo(view,(PyObject *)self,self->frame->spectrum,self->frame->channels*4,1,flags) < 0 ) return( -1 );
+	self->shape[0] = self->frame->channels;
+	if ( flags & PyBUF_FORMAT )						// else plain bytes
+		{
+		view->format = (char *)"<I";
+		view->itemsize = 4;
+		if ( flags & PyBUF_ND ) view->shape = self->shape;
+		}
+	return( 0 );
+}
+
+static Py_ssize_t FrameLength( FrameObject *self )
+{
+	return( self->frame->channels );
+}
+
+static PyObject *FramePacket0( FrameObject *self, void *closure )
+{
+	if ( !self->frame->hasPacket0 ) Py_RETURN_NONE;
+	return( NewPacket0((PyObject *)self,&self->frame->packet0) );
+}
+
+static PyObject *FrameRequest( FrameObject *self, void *closure )
+{
+	return( PyLong_FromLong(self->frame->request) );
+}
+
+static PyObject *FrameChannels( FrameObject *self, void *closure )
+{
+	return( PyLong_FromLong(self->frame->channels) );
+}
+
+static PyObject *FrameHostTime( FrameObject *self, void *closure )
+{
+	return( PyFloat_FromDouble(self->frame->hostTime) );
+}
+
+static PyObject *FrameRepr( FrameObject *self )
+{
+	return( PyUnicode_FromFormat("Frame(request=%d, channels=%d, packet0=%s)",self->frame->request,
+			self->frame->channels,self->frame->hasPacket0 ? "yes" : "no") );
+}
+
+static PyGetSetDef frameGetSet[] = {
+	{ "request", (getter)FrameRequest, NULL, "request code that produced the frame", NULL },
+	{ "channels", (getter)FrameChannels, NULL, "channels in the spectrum, 0 for a packet0-only frame", NULL },
+	{ "hostTime", (getter)FrameHostTime, NULL, "host monotonic seconds at receipt, 0 if unknown", NULL },
+	{ "packet0", (getter)FramePacket0, NULL, "Packet0 view into the frame, None if not requested", NULL },
+	{ NULL } };
+
+static PyBufferProcs frameBuffer = { (getbufferproc)FrameGetBuffer, NULL };
+static PySequenceMethods frameSequence = { (lenfunc)FrameLength };
+
+////// Accumulator //////////////////////////////////////////////////////////////////////////////////
+
+typedef struct
+{
+	PyObject_HEAD
+	ReadoutAccumulator *accumulator;
+	Py_ssize_t shape[1];
+	int exports;									// buffers handed out, resolution is then fixed
+} AccumulatorObject;
+
+static PyTypeObject AccumulatorType = { PyVarObject_HEAD_INIT(NULL, 0) };
+
+static PyObject *AccumulatorNew( PyTypeObject *type, PyObject *args, PyObject *kwds )
+{
+	static const char *keywords[] = { "channels", NULL };
+	int channels = 0;
+	AccumulatorObject *self;
+
+	if ( !PyArg_ParseTupleAndKeywords(args,kwds,"|i",(char **)keywords,&channels) ) return( NULL );
+	if ( (channels < 0) || (channels > MAX_SPECTRUM_SIZE) || (channels % CHANNELS_PER_REQUEST) ||
+		 !ValidRequest(channels/CHANNELS_PER_REQUEST) )
+		return( PyErr_Format(PyExc_ValueError,"%d is not a spectrum resolution",channels) );
+	if ( !(self = (AccumulatorObject *)type->tp_alloc(type,0)) ) return( NULL );
+	self->accumulator = new ReadoutAccumulator;
+	self->accumulator->channels = channels;			// 0 = set by the first frame added
+	self->exports = 0;
+	return( (PyObject *)self );
+}
+
+static void AccumulatorDealloc( AccumulatorObject *self )
+{
+	delete self->accumulator;
+	Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static int AccumulatorGetBuffer( AccumulatorObject *self, Py_buffer *view, int flags )
+{
+	SpectrumAccumulator *a = self->accumulator;
+
+	if ( PyBuffer_FillInfo(view,(PyObject *)self,a->sum,a->channels*8,1,flags) < 0 ) return( -1 );
+	self->shape[0] = a->channels;
+	if ( flags & PyBUF_FORMAT )						// else plain bytes
+		{
+		view->format = (char *)"<Q";
+		view->itemsize = 8;
+		if ( flags & PyBUF_ND ) view->shape = self->shape;
+		}
+	self->exports++;
+	return( 0 );
+}
+
+static void AccumulatorReleaseBuffer( AccumulatorObject *self, Py_buffer *view )
+{
+	self->exports--;
+}
+
+static PyObject *AccumulatorAdd( AccumulatorObject *self, PyObject *arg )
+{													// True if added, False at another resolution
+	SpectrumAccumulator *a = self->accumulator;
+	McaFrame *frame;
+
+	if ( !PyObject_TypeCheck(arg,&FrameType) ) return( PyErr_Format(PyExc_TypeError,"add() takes a Frame") );
+	frame = ((FrameObject *)arg)->frame;
+	if ( !frame->channels ) Py_RETURN_FALSE;
+	if ( !a->channels && self->exports )			// views already handed out are 0 long
+		return( PyErr_Format(PyExc_BufferError,"set the accumulator's channels before viewing it") );
+	uint32_t before = a->frames;
+	a->Add(*frame);
+	return( PyBool_FromLong(a->frames != before) );
+}
+
+static PyObject *AccumulatorAddReadout( AccumulatorObject *self, PyObject *arg )
+{													// counts since the previous readout, as add()
+	ReadoutAccumulator *a = self->accumulator;
+	McaFrame *frame;
+
+	if ( !PyObject_TypeCheck(arg,&FrameType) ) return( PyErr_Format(PyExc_TypeError,"add_readout() takes a Frame") );
+	frame = ((FrameObject *)arg)->frame;
+	if ( !frame->channels || (a->channels && (a->channels != frame->channels)) ) Py_RETURN_FALSE;
+	if ( !a->channels && self->exports )
+		return( PyErr_Format(PyExc_BufferError,"set the accumulator's channels before viewing it") );
+	a->AddReadout(*frame);
+	return( PyBool_FromLong(1) );
+}
+
+static PyObject *AccumulatorClear( AccumulatorObject *self, PyObject *unused )
+{
+	self->accumulator->Clear();
+	Py_RETURN_NONE;
+}
+
+static PyObject *AccumulatorChannels( AccumulatorObject *self, void *closure )
+{
+	return( PyLong_FromLong(self->accumulator->channels) );
+}
+
+static PyObject *AccumulatorFrames( AccumulatorObject *self, void *closure )
+{
+	return( PyLong_FromUnsignedLong(self->accumulator->frames) );
+}
+
+static Py_ssize_t AccumulatorLength( AccumulatorObject *self )
+{
+	return( self->accumulator->channels );
+}
+
+static PyMethodDef accumulatorMethods[] = {
+	{ "add", (PyCFunction)AccumulatorAdd, METH_O, "add(frame): add the frame's whole spectrum, False if its resolution differs" },
+	{ "add_readout", (PyCFunction)AccumulatorAddReadout, METH_O,
+	  "add_readout(frame): add the counts since the previous cumulative readout, False if its resolution differs" },
+	{ "clear", (PyCFunction)AccumulatorClear, METH_NOARGS, "clear(): zero the sums and forget the last readout, keep the resolution" },
+	{ NULL } };
+
+static PyGetSetDef accumulatorGetSet[] = {
+	{ "channels", (getter)AccumulatorChannels, NULL, "resolution, 0 until the first frame is added", NULL },
+	{ "frames", (getter)AccumulatorFrames, NULL, "spectra added since the last clear()", NULL },
+	{ NULL } };
+
+static PyBufferProcs accumulatorBuffer = { (getbufferproc)AccumulatorGetBuffer, (releasebufferproc)AccumulatorReleaseBuffer };
+static PySequenceMethods accumulatorSequence = { (lenfunc)AccumulatorLength };
+
+////// Device ///////////////////////////////////////////////////////////////////////////////////////
+
+typedef struct
+{
+	PyObject_HEAD
+	McaTransport *transport;						// NULL once closed
+	McaSim *sim;									// acquired before each request when simulated
+	DeviceCache *cache;								// USB endpoint cache, may be NULL
+	int timeoutMs;
+	bool busy;										// a request is running without the GIL
+} DeviceObject;
+
+static PyTypeObject DeviceType = { PyVarObject_HEAD_INIT(NULL, 0) };
+
+static void DeviceClose( DeviceObject *self )
+{
+	if ( self->transport )
+		{
+		self->transport->Close();
+		delete self->transport;
+		}
+	if ( self->cache ) self->cache->Save();
+	delete self->cache;
+	delete self->sim;
+	self->transport = NULL;
+	self->cache = NULL;
+	self->sim = NULL;
+}
+
+static int DeviceInit( DeviceObject *self, PyObject *args, PyObject *kwds )
+{
+	static const char *keywords[] = { "port", "baud", "usb", "sim", "replay", "speed", "cache", "timeout", NULL };
+	const char *port = NULL, *replay = NULL, *cachePath = NULL;
+	int baudRate = 115200, usb = -1, sim = 0, timeoutMs = SERIAL_TIMEOUT_MS;
+	double speed = 0.0;
+	bool opened = false;
+
+	if ( !PyArg_ParseTupleAndKeywords(args,kwds,"|ziiizdzi",(char **)keywords,&port,&baudRate,&usb,&sim,
+			&replay,&speed,&cachePath,&timeoutMs) ) return( -1 );
+	if ( (port != NULL) + (usb >= 0) + (sim != 0) + (replay != NULL) != 1 )
+		{
+		PyErr_SetString(PyExc_ValueError,"give exactly one of port=, usb=, sim= or replay=");
+		return( -1 );
+		}
+	if ( self->busy )
+		{
+		PyErr_SetString(PyExc_RuntimeError,"device is busy in another thread");
+		return( -1 );
+		}
+	DeviceClose(self);								// __init__ called again
+	self->timeoutMs = timeoutMs;
+	if ( port )
+		{
+		UartTransport *uart = new UartTransport;
+		self->transport = uart;
+		Py_BEGIN_ALLOW_THREADS
+		opened = uart->Open(port,baudRate);
+		Py_END_ALLOW_THREADS
+		}
+	else if ( usb >= 0 )
+		{
+#ifdef HAVE_LIBUSB
+		UsbTransport *device = new UsbTransport;
+		self->transport = device;
+		if ( cachePath )
+			{
+			self->cache = new DeviceCache;
+			self->cache->Load(cachePath);
+			}
+		Py_BEGIN_ALLOW_THREADS
+		opened = device->Open(usb,self->cache);
+		Py_END_ALLOW_THREADS
+#else
+		PyErr_SetString(PyExc_NotImplementedError,"capemca was built without libusb");
+		return( -1 );
+#endif
+		}
+	else if ( sim )
+		{
+		self->sim = new McaSim(sim,sim);
+		self->transport = new SimTransport(self->sim,64);
+		opened = true;
+		}
+	else
+		{
+		ReplayTransport *capture = new ReplayTransport;
+		self->transport = capture;
+		capture->speed = speed;
+		opened = capture->Open(replay);
+		}
+	if ( !opened )
+		{
+		DeviceClose(self);
+		PyErr_Format(PyExc_OSError,"cannot open %s",port ? port : replay ? replay : "USB MCA");
+		return( -1 );
+		}
+	return( 0 );
+}
+
+static void DeviceDealloc( DeviceObject *self )
+{
+	DeviceClose(self);
+	Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static bool DeviceReady( DeviceObject *self )		// sets the exception when not
+{
+	if ( !self->transport ) PyErr_SetString(PyExc_ValueError,"device is closed");
+	else if ( self->busy ) PyErr_SetString(PyExc_RuntimeError,"device is busy in another thread");
+	else return( true );
+	return( false );
+}
+
+static PyObject *DeviceRequest( DeviceObject *self, int request )
+{													// one readout, the GIL released meanwhile
+	FrameObject *result;
+	bool ok;
+
+	if ( !ValidRequest(request) ) return( PyErr_Format(PyExc_ValueError,"%d is not a request code",request) );
+	if ( !DeviceReady(self) || !(result = NewFrame()) ) return( NULL );
+	self->busy = true;
+	Py_BEGIN_ALLOW_THREADS
+	if ( self->sim ) self->sim->Acquire(1);
+	ok = McaRequest(self->transport,request,result->frame,self->timeoutMs);
+	Py_END_ALLOW_THREADS
+	self->busy = false;
+	if ( !ok )
+		{
+		Py_DECREF(result);
+		return( PyErr_Format(PyExc_OSError,"no response to request %d",request) );
+		}
+	return( (PyObject *)result );
+}
+
+static PyObject *DeviceRequestMethod( DeviceObject *self, PyObject *args, PyObject *kwds )
+{
+	static const char *keywords[] = { "request", NULL };
+	int request = 34;
+
+	if ( !PyArg_ParseTupleAndKeywords(args,kwds,"|i",(char **)keywords,&request) ) return( NULL );
+	return( DeviceRequest(self,request) );
+}
+
+static PyObject *DeviceZero( DeviceObject *self, PyObject *unused )
+{
+	bool ok;
+
+	if ( !DeviceReady(self) ) return( NULL );
+	self->busy = true;
+	Py_BEGIN_ALLOW_THREADS
+	if ( self->sim ) self->sim->Zero();
+	ok = self->sim || McaZero(self->transport,self->timeoutMs);
+	Py_END_ALLOW_THREADS
+	self->busy = false;
+	if ( !ok ) return( PyErr_Format(PyExc_OSError,"zero command was not echoed") );
+	Py_RETURN_NONE;
+}
+
+static PyObject *DeviceCloseMethod( DeviceObject *self, PyObject *unused )
+{
+	if ( self->busy ) return( PyErr_Format(PyExc_RuntimeError,"device is busy in another thread") );
+	DeviceClose(self);
+	Py_RETURN_NONE;
+}
+
+static PyObject *DeviceEnter( DeviceObject *self, PyObject *unused )
+{
+	Py_INCREF(self);
+	return( (PyObject *)self );
+}
+
+static PyObject *DeviceExit( DeviceObject *self, PyObject *args )
+{
+	return( DeviceCloseMethod(self,NULL) );
+}
+
+static PyObject *DeviceStream( DeviceObject *self, PyObject *args, PyObject *kwds );
+
+static PyObject *DeviceAnswers( DeviceObject *self, void *closure )
+{
+	return( PyLong_FromUnsignedLong(self->transport ? self->transport->answers : 0) );
+}
+
+static PyObject *DeviceCapemcaId( DeviceObject *self, void *closure )
+{
+	return( PyLong_FromUnsignedLong(self->transport ? self->transport->capemcaId : 0) );
+}
+
+static PyMethodDef deviceMethods[] = {
+	{ "request", (PyCFunction)DeviceRequestMethod, METH_VARARGS | METH_KEYWORDS, "request(request=34): read one Frame" },
+	{ "stream", (PyCFunction)DeviceStream, METH_VARARGS | METH_KEYWORDS,
+		"stream(request=34, interval=0.0, count=0): iterator of Frames, one every interval seconds, count=0 for no end" },
+	{ "zero", (PyCFunction)DeviceZero, METH_NOARGS, "zero(): clear the device's cumulative spectrum" },
+	{ "close", (PyCFunction)DeviceCloseMethod, METH_NOARGS, "close(): release the port" },
+	{ "__enter__", (PyCFunction)DeviceEnter, METH_NOARGS, NULL },
+	{ "__exit__", (PyCFunction)DeviceExit, METH_VARARGS, NULL },
+	{ NULL } };
+
+static PyGetSetDef deviceGetSet[] = {
+	{ "answers", (getter)DeviceAnswers, NULL, "requests answered since opened", NULL },
+	{ "capemcaId", (getter)DeviceCapemcaId, NULL, "id from the last packet0 read, 0 if none", NULL },
+	{ NULL } };
+
+////// Stream ///////////////////////////////////////////////////////////////////////////////////////
+
+typedef struct
+{
+	PyObject_HEAD
+	DeviceObject *device;
+	int request;
+	double interval;								// seconds between requests, 0 = back to back
+	uint64_t count, frames;							// count = 0 for no end
+	double due;										// monotonic seconds of the next request
+} StreamObject;
+
+static PyTypeObject StreamType = { PyVarObject_HEAD_INIT(NULL, 0) };
+
+static PyObject *DeviceStream( DeviceObject *self, PyObject *args, PyObject *kwds )
+{
+	static const char *keywords[] = { "request", "interval", "count", NULL };
+	int request = 34;
+	double interval = 0.0;
+	unsigned long long count = 0;
+	StreamObject *stream;
+
+	if ( !PyArg_ParseTupleAndKeywords(args,kwds,"|idK",(char **)keywords,&request,&interval,&count) ) return( NULL );
+	if ( !ValidRequest(request) ) return( PyErr_Format(PyExc_ValueError,"%d is not a request code",request) );
+	if ( interval < 0.0 ) return( PyErr_Format(PyExc_ValueError,"interval must not be negative") );
+	if ( !(stream = PyObject_New(StreamObject,&StreamType)) ) return( NULL );
+	Py_INCREF(self);
+	stream->device = self;
+	stream->request = request;
+	stream->interval = interval;
+	stream->count = count;
+	stream->frames = 0;
+	stream->due = MonotonicSeconds();
+	return( (PyObject *)stream );
+}
+
+static void StreamDealloc( StreamObject *self )
+{
+	Py_DECREF(self->device);
+	PyObject_Del(self);
+}
+
+static bool WaitUntil( double due )					// without the GIL, false on Ctrl-C
+{
+	double left;
+
+	while ( (left = due - MonotonicSeconds()) > 0.0 )
+		{
+		if ( left > WAIT_SLICE_SECONDS ) left = WAIT_SLICE_SECONDS;
+		Py_BEGIN_ALLOW_THREADS
+		usleep((useconds_t)(left*1.0e6));
+		Py_END_ALLOW_THREADS
+		if ( PyErr_CheckSignals() < 0 ) return( false );
+		}
+	return( true );
+}
+
+static PyObject *StreamNext( StreamObject *self )
+{
+	PyObject *frame;
+	double now;
+
+	if ( self->count && (self->frames == self->count) ) return( NULL );	// StopIteration
+	if ( !WaitUntil(self->due) || !(frame = DeviceRequest(self->device,self->request)) ) return( NULL );
+	self->frames++;
+	now = MonotonicSeconds();
+	self->due = self->interval ? self->due + self->interval : now;	// fixed rate, not fixed gap
+	if ( self->due < now ) self->due = now;
+	return( frame );
+}
+
+////// FrameReader //////////////////////////////////////////////////////////////////////////////////
+
+typedef struct
+{
+	PyObject_HEAD
+	FILE *f;										// binary frame records (see mcaOutput.h)
+	McaFrame *base;									// last record, sparse records apply to it
+} FrameReaderObject;
+
+static PyTypeObject FrameReaderType = { PyVarObject_HEAD_INIT(NULL, 0) };
+
+static PyObject *ReadFrames( PyObject *module, PyObject *args )
+{
+	const char *path;
+	FrameReaderObject *reader;
+	FILE *f;
+
+	if ( !PyArg_ParseTuple(args,"s",&path) ) return( NULL );
+	if ( !(f = fopen(path,"rb")) ) return( PyErr_SetFromErrnoWithFilename(PyExc_OSError,path) );
+	if ( !(reader = PyObject_New(FrameReaderObject,&FrameReaderType)) )
+		{
+		fclose(f);
+		return( NULL );
+		}
+	reader->f = f;
+	reader->base = new McaFrame;
+	return( (PyObject *)reader );
+}
+
+static void FrameReaderDealloc( FrameReaderObject *self )
+{
+	if ( self->f ) fclose(self->f);
+	delete self->base;
+	PyObject_Del(self);
+}
+
+static PyObject *FrameReaderNext( FrameReaderObject *self )
+{
+	FrameObject *frame;
+	bool ok;
+
+	if ( !self->f || !(frame = NewFrame()) ) return( NULL );
+	Py_BEGIN_ALLOW_THREADS
+	ok = ReadFrameBinary(self->f,self->base);
+	if ( ok ) *frame->frame = *self->base;
+	Py_END_ALLOW_THREADS
+	if ( ok ) return( (PyObject *)frame );
+	Py_DECREF(frame);
+	fclose(self->f);								// end of file or a torn last record
+	self->f = NULL;
+	return( NULL );
+}
+
+////// module ///////////////////////////////////////////////////////////////////////////////////////
+
+static PyObject *Decode( PyObject *module, PyObject *args )
+{													// a response read by other means, e.g. pyserial
+	Py_buffer data;
+	int request;
+	FrameObject *frame;
+	bool ok;
+
+	if ( !PyArg_ParseTuple(args,"y*i",&data,&request) ) return( NULL );
+	if ( !(frame = NewFrame()) )
+		{
+		PyBuffer_Release(&data);
+		return( NULL );
+		}
+	ok = (data.len <= (Py_ssize_t)MAX_RESPONSE_BYTES) && frame->frame->Decode((const uint8_t *)data.buf,(int)data.len,request);
+	PyBuffer_Release(&data);
+	if ( ok ) return( (PyObject *)frame );
+	Py_DECREF(frame);
+	return( PyErr_Format(PyExc_ValueError,"not a response to request %d",request) );
+}
+
+static PyObject *ResponseBytes( PyObject *module, PyObject *args )
+{
+	int request;
+
+	if ( !PyArg_ParseTuple(args,"i",&request) ) return( NULL );
+	if ( !ValidRequest(request) ) return( PyErr_Format(PyExc_ValueError,"%d is not a request code",request) );
+	return( PyLong_FromLong(RequestResponseBytes(request)) );
+}
+
+static PyMethodDef moduleMethods[] = {
+	{ "decode", Decode, METH_VARARGS, "decode(data, request): Frame from the raw response to {0,request}" },
+	{ "response_bytes", ResponseBytes, METH_VARARGS, "response_bytes(request): length of the response to {0,request}" },
+	{ "read_frames", ReadFrames, METH_VARARGS, "read_frames(path): iterator of Frames in a binary frame file" },
+	{ NULL } };
+
+static struct PyModuleDef capemcaModule = { PyModuleDef_HEAD_INIT, "capemca",
+	"CapeMCA acquisition and decoding, with spectra exported through the buffer protocol", -1, moduleMethods };
+
+PyMODINIT_FUNC PyInit_capemca( void )
+{
+	PyObject *module;
+
+	Packet0Type.tp_name = "capemca.Packet0";
+	Packet0Type.tp_basicsize = sizeof(Packet0Object);
+	Packet0Type.tp_flags = Py_TPFLAGS_DEFAULT;
+	Packet0Type.tp_doc = "PACKET0_TYPE record, numpy.asarray() gives a structured view of it";
+	Packet0Type.tp_new = Packet0New;
+	Packet0Type.tp_dealloc = (destructor)Packet0Dealloc;
+	Packet0Type.tp_repr = (reprfunc)Packet0Repr;
+	Packet0Type.tp_getset = packet0GetSet;
+	Packet0Type.tp_as_buffer = &packet0Buffer;
+
+	FrameType.tp_name = "capemca.Frame";
+	FrameType.tp_basicsize = sizeof(FrameObject);
+	FrameType.tp_flags = Py_TPFLAGS_DEFAULT;
+	FrameType.tp_doc = "one decoded response, numpy.asarray() gives a uint32 view of its spectrum";
+	FrameType.tp_dealloc = (destructor)FrameDealloc;
+	FrameType.tp_repr = (reprfunc)FrameRepr;
+	FrameType.tp_getset = frameGetSet;
+	FrameType.tp_as_buffer = &frameBuffer;
+	FrameType.tp_as_sequence = &frameSequence;
+
+	AccumulatorType.tp_name = "capemca.Accumulator";
+	AccumulatorType.tp_basicsize = sizeof(AccumulatorObject);
+	AccumulatorType.tp_flags = Py_TPFLAGS_DEFAULT;
+	AccumulatorType.tp_doc = "Accumulator(channels=0): 64-bit running sum of spectra, numpy.asarray() gives a live uint64 view";
+	AccumulatorType.tp_new = AccumulatorNew;
+	AccumulatorType.tp_dealloc = (destructor)AccumulatorDealloc;
+	AccumulatorType.tp_methods = accumulatorMethods;
+	AccumulatorType.tp_getset = accumulatorGetSet;
+	AccumulatorType.tp_as_buffer = &accumulatorBuffer;
+	AccumulatorType.tp_as_sequence = &accumulatorSequence;
+
+	DeviceType.tp_name = "capemca.Device";
+	DeviceType.tp_basicsize = sizeof(DeviceObject);
+	DeviceType.tp_flags = Py_TPFLAGS_DEFAULT;
+	DeviceType.tp_doc = "Device(port=None, baud=115200, usb=-1, sim=0, replay=None, speed=0.0, cache=None, timeout=1000)\n"
+		"one MCA on a serial port, the usb'th USB MCA, a simulated MCA with id sim, or a capture file replayed";
+	DeviceType.tp_new = PyType_GenericNew;			// zeroed, so DeviceClose() has nothing to do
+	DeviceType.tp_init = (initproc)DeviceInit;
+	DeviceType.tp_dealloc = (destructor)DeviceDealloc;
+	DeviceType.tp_methods = deviceMethods;
+	DeviceType.tp_getset = deviceGetSet;
+
+	StreamType.tp_name = "capemca.Stream";
+	StreamType.tp_basicsize = sizeof(StreamObject);
+	StreamType.tp_flags = Py_TPFLAGS_DEFAULT;
+	StreamType.tp_dealloc = (destructor)StreamDealloc;
+	StreamType.tp_iter = PyObject_SelfIter;
+	StreamType.tp_iternext = (iternextfunc)StreamNext;
+
+	FrameReaderType.tp_name = "capemca.FrameReader";
+	FrameReaderType.tp_basicsize = sizeof(FrameReaderObject);
+	FrameReaderType.tp_flags = Py_TPFLAGS_DEFAULT;
+	FrameReaderType.tp_dealloc = (destructor)FrameReaderDealloc;
+	FrameReaderType.tp_iter = PyObject_SelfIter;
+	FrameReaderType.tp_iternext = (iternextfunc)FrameReaderNext;
+
+	if ( (PyType_Ready(&Packet0Type) < 0) || (PyType_Ready(&FrameType) < 0) || (PyType_Ready(&AccumulatorType) < 0) ||
+		 (PyType_Ready(&DeviceType) < 0) || (PyType_Ready(&StreamType) < 0) || (PyType_Ready(&FrameReaderType) < 0) )
+		return( NULL );
+	if ( !(module = PyModule_Create(&capemcaModule)) ) return( NULL );
+	Py_INCREF(&Packet0Type);
+	PyModule_AddObject(module,"Packet0",(PyObject *)&Packet0Type);
+	Py_INCREF(&FrameType);
+	PyModule_AddObject(module,"Frame",(PyObject *)&FrameType);
+	Py_INCREF(&AccumulatorType);
+	PyModule_AddObject(module,"Accumulator",(PyObject *)&AccumulatorType);
+	Py_INCREF(&DeviceType);
+	PyModule_AddObject(module,"Device",(PyObject *)&DeviceType);
+	PyModule_AddIntConstant(module,"MAX_SPECTRUM_SIZE",MAX_SPECTRUM_SIZE);
+	PyModule_AddStringConstant(module,"VERSION",VERSION_STRING);
+	return( module );
+}
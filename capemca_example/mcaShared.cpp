@@ -0,0 +1,221 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Class methods for live spectrum publication in shared memory
+//   definitions in mcaShared.h
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mcaShared.h"
+
+SharedSpectra::SharedSpectra()						// constructor
+{
+	region = NULL;
+	size = 0;
+	writer = false;
+	name[0] = 0;
+}
+
+SharedSpectra::~SharedSpectra()						// destructor
+{
+	Detach();
+}
+
+static size_t RegionSize( int maxDevices )
+{
+	return( sizeof(SHARED_REGION) + (maxDevices-1)*sizeof(SHARED_DEVICE) );
+}
+
+bool SharedSpectra::Create( const char *shmName, int maxDevices )
+{
+	int fd;
+
+	Detach();
+	if ( maxDevices < 1 ) return( false );
+	size = RegionSize(maxDevices);
+	fd = shm_open(shmName,O_RDWR | O_CREAT | O_TRUNC,0644);
+	if ( fd < 0 )
+		{
+		printf("shm_open %s failed\n",shmName);
+		return( false );
+		}
+	if ( ftruncate(fd,size) < 0 )
+		{
+		close(fd);
+		shm_unlink(shmName);
+		return( false );
+		}
+	region = (SHARED_REGION *)mmap(NULL,size,PROT_READ | PROT_WRITE,MAP_SHARED,fd,0);
+	close(fd);										// mapping keeps the memory
+	if ( region == MAP_FAILED )
+		{
+		region = NULL;
+		shm_unlink(shmName);
+		return( false );
+		}
+
+	memset(region,0,size);							// fresh pages are zero anyway
+	region->version = SHARED_VERSION;
+	region->maxDevices = maxDevices;
+	region->writerPid = getpid();
+	__atomic_store_n(&region->magic,SHARED_MAGIC,__ATOMIC_RELEASE);	// readers check magic last
+	writer = true;
+	strncpy(name,shmName,sizeof(name)-1);
+	return( true );
+}
+
+bool SharedSpectra::Attach( const char *shmName )
+{
+	int fd;
+	struct stat st;
+
+	Detach();
+	fd = shm_open(shmName,O_RDONLY,0);
+	if ( fd < 0 ) return( false );
+	if ( (fstat(fd,&st) < 0) || (st.st_size < (off_t)sizeof(SHARED_REGION)) )
+		{
+		close(fd);
+		return( false );
+		}
+	size = st.st_size;
+	region = (SHARED_REGION *)mmap(NULL,size,PROT_READ,MAP_SHARED,fd,0);
+	close(fd);
+	if ( region == MAP_FAILED )
+		{
+		region = NULL;
+		return( false );
+		}
+	if ( (__atomic_load_n(&region->magic,__ATOMIC_ACQUIRE) != SHARED_MAGIC) ||
+		 (region->version != SHARED_VERSION) || (RegionSize(region->maxDevices) > size) )
+		{
+		Detach();
+		return( false );
+		}
+	writer = false;
+	strncpy(name,shmName,sizeof(name)-1);
+	return( true );
+}
+
+void SharedSpectra::Detach( void )
+{
+	if ( region ) munmap(region,size);
+	if ( region && writer ) shm_unlink(name);		// readers keep their mappings
+	region = NULL;
+	size = 0;
+	writer = false;
+	name[0] = 0;
+}
+
+int SharedSpectra::Slot( uint32_t capemcaId )
+{
+	uint32_t n;
+
+	if ( !region || !writer ) return( -1 );
+	for (n=0; n<region->devices; n++)
+		if ( region->device[n].capemcaId == capemcaId ) return( n );
+	if ( n >= region->maxDevices ) return( -1 );
+	region->device[n].capemcaId = capemcaId;		// slot is empty so no lock needed
+	__atomic_store_n(&region->devices,n+1,__ATOMIC_RELEASE);
+	return( n );
+}
+
+void SharedSpectra::Publish( int slot, const McaFrame &frame, const SpectrumAccumulator *accumulator,
+							 const CorrectedSpectrum *corrected )
+{
+	SHARED_DEVICE *d;
+	uint32_t seq;
+
+	if ( !region || !writer || (slot < 0) || (slot >= (int)region->devices) ) return;
+	d = &region->device[slot];
+	seq = d->sequence;
+	__atomic_store_n(&d->sequence,seq+1,__ATOMIC_RELAXED);	// odd: update in progress
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	if ( frame.channels )
+		{
+		if ( frame.channels != (int)d->channels )	// the old sums are at another resolution
+			{
+			memset(d->accumulated,0,sizeof(d->accumulated));
+			memset(d->corrected,0,sizeof(d->corrected));
+			}
+		d->channels = frame.channels;
+		memcpy(d->latest,frame.spectrum,frame.channels*4);
+		}
+	if ( accumulator && (accumulator->channels == (int)d->channels) )
+		memcpy(d->accumulated,accumulator->sum,accumulator->channels*8);
+	if ( corrected && (corrected->channels == (int)d->channels) )
+		memcpy(d->corrected,corrected->sum,corrected->channels*8);
+	d->hasPacket0 = frame.hasPacket0;
+	if ( frame.hasPacket0 ) d->packet0 = frame.packet0;
+	d->hostTime = frame.hostTime;
+	d->frames++;
+
+	__atomic_store_n(&d->sequence,seq+2,__ATOMIC_RELEASE);	// even: consistent again
+}
+
+void SharedSpectra::PublishDelta( int slot, const McaFrame &frame, const SparseDelta &delta,
+								  const SpectrumAccumulator *accumulator, const CorrectedSpectrum *corrected )
+{
+	SHARED_DEVICE *d;
+	uint32_t seq;
+
+	if ( !region || !writer || (slot < 0) || (slot >= (int)region->devices) ) return;
+	if ( delta.channels != (int)region->device[slot].channels )
+		{
+		Publish(slot,frame,accumulator,corrected);	// first readout, or a new resolution
+		return;
+		}
+	d = &region->device[slot];
+	seq = d->sequence;
+	__atomic_store_n(&d->sequence,seq+1,__ATOMIC_RELAXED);	// odd: update in progress
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	delta.ApplyTo(d->latest);
+	if ( accumulator && (accumulator->channels == (int)d->channels) )
+		memcpy(d->accumulated,accumulator->sum,accumulator->channels*8);
+	if ( corrected && (corrected->channels == (int)d->channels) )
+		memcpy(d->corrected,corrected->sum,corrected->channels*8);
+	d->hasPacket0 = frame.hasPacket0;
+	if ( frame.hasPacket0 ) d->packet0 = frame.packet0;
+	d->hostTime = frame.hostTime;
+	d->frames++;
+
+	__atomic_store_n(&d->sequence,seq+2,__ATOMIC_RELEASE);	// even: consistent again
+}
+
+uint32_t SharedSpectra::BeginRead( int slot )
+{
+	uint32_t seq;
+
+	for (int spin=0;; spin++)
+		{
+		seq = __atomic_load_n(&region->device[slot].sequence,__ATOMIC_ACQUIRE);
+		if ( !(seq & 1) ) return( seq );
+		if ( spin > 100 ) sched_yield();			// writer was descheduled mid-update
+		}
+}
+
+bool SharedSpectra::EndRead( int slot, uint32_t seq )
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);		// order the data reads before the check
+	return( __atomic_load_n(&region->device[slot].sequence,__ATOMIC_RELAXED) == seq );
+}
+
+bool SharedSpectra::Snapshot( int slot, SHARED_DEVICE *copy )
+{
+	uint32_t seq;
+
+	if ( !region || (slot < 0) || (slot >= (int)__atomic_load_n(&region->devices,__ATOMIC_ACQUIRE)) )
+		return( false );
+	do
+		{
+		seq = BeginRead(slot);
+		memcpy(copy,&region->device[slot],sizeof(SHARED_DEVICE));
+		}
+	while ( !EndRead(slot,seq) );
+	return( true );
+}
@@ -0,0 +1,70 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Live spectrum publication in POSIX shared memory for any number of local readers
+//   methods in mcaShared.cpp
+//
+// The acquiring process creates the region and is its only writer. Each device has a slot
+// guarded by a sequence lock: the writer makes the sequence odd, updates the slot, then makes
+// it even again. A reader notes an even sequence, reads the slot in place, and keeps what it
+// read only if the sequence is unchanged afterward. Readers never block the writer.
+// PublishDelta() updates only the channels of latest[] that changed since the readout the slot
+// already holds, so a quiet detector costs the writer a few cache lines instead of the spectrum.
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "mcaFrame.h"
+#include "mcaSparse.h"
+#include "mcaDeadTime.h"
+
+#define SHARED_MAGIC			0x4853434DU			// "MCSH" in little-endian
+#define SHARED_VERSION			2
+#define SHARED_DEFAULT_NAME		"/capemca"			// shm_open name, appears in /dev/shm
+#define SHARED_MAX_DEVICES		16
+
+typedef struct
+{
+	uint32_t sequence;								// odd while the writer is updating
+	uint32_t capemcaId;								// 0 until first publication
+	uint32_t channels;								// channels valid in latest[], accumulated[], corrected[]
+	uint32_t hasPacket0;
+	uint64_t frames;								// publications so far
+	double hostTime;								// host monotonic seconds of latest frame
+	PACKET0_TYPE packet0;							// latest packet0, if hasPacket0
+	uint32_t latest[MAX_SPECTRUM_SIZE];				// most recent spectrum from the device
+	uint64_t accumulated[MAX_SPECTRUM_SIZE];		// host accumulator for this device
+	double corrected[MAX_SPECTRUM_SIZE];			// the same with each interval dead-time corrected
+} SHARED_DEVICE;
+
+typedef struct
+{
+	uint32_t magic;									// SHARED_MAGIC
+	uint32_t version;								// SHARED_VERSION
+	uint32_t maxDevices;							// slots that follow the header
+	uint32_t devices;								// slots in use
+	uint32_t writerPid;								// process id of the publisher
+	uint32_t reserved[11];
+	SHARED_DEVICE device[1];						// really maxDevices slots
+} SHARED_REGION;
+
+class SharedSpectra {
+public:
+	SHARED_REGION *region;
+	size_t size;
+	bool writer;
+	char name[64];
+
+	SharedSpectra();								// constructor
+	~SharedSpectra();								// destructor unmaps (and unlinks if writer)
+	bool Create( const char *shmName, int maxDevices = SHARED_MAX_DEVICES );	// publisher
+	bool Attach( const char *shmName );				// reader, read-only mapping
+	void Detach( void );
+	int Slot( uint32_t capemcaId );					// writer: slot for a device, -1 if full
+	void Publish( int slot, const McaFrame &frame, const SpectrumAccumulator *accumulator,
+				  const CorrectedSpectrum *corrected = NULL );
+	void PublishDelta( int slot, const McaFrame &frame, const SparseDelta &delta,	// writer: the slot holds the
+					   const SpectrumAccumulator *accumulator = NULL,	// delta's base, sums if given
+					   const CorrectedSpectrum *corrected = NULL );
+	uint32_t BeginRead( int slot );					// reader: wait for even sequence
+	bool EndRead( int slot, uint32_t sequence );	// reader: true if what was read is consistent
+	bool Snapshot( int slot, SHARED_DEVICE *copy );	// reader: consistent copy, retries as needed
+};
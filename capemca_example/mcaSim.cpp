@@ -0,0 +1,199 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Class methods for the simulated MCA
+//   definitions in mcaSim.h
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <termios.h>
+#include "mcaSim.h"
+
+McaSim::McaSim( uint32_t id, uint64_t seed )		// constructor
+{
+	capemcaId = id;
+	usPerInterval = 1000000;
+	meanCps = 2000.0;
+	gain = 1.0;
+	rng = seed ? seed : 0x9E3779B97F4A7C15ULL;		// xorshift state must not be zero
+	Zero();
+}
+
+void McaSim::Zero( void )							// clear spectrum and packet0 counters
+{
+	memset(spectrum,0,sizeof(spectrum));
+	memset(&packet0,0,sizeof(packet0));
+	packet0.capemcaId = capemcaId;
+	packet0.detectors = 1;
+	packet0.usPerInterval = usPerInterval;
+}
+
+uint32_t McaSim::Random( void )						// xorshift64*
+{
+	rng ^= rng >> 12;
+	rng ^= rng << 25;
+	rng ^= rng >> 27;
+	return( (uint32_t)((rng*0x2545F4914F6CDD1DULL) >> 32) );
+}
+
+double McaSim::Uniform( void )
+{
+	return( Random()*(1.0/4294967296.0) );
+}
+
+void McaSim::Acquire( int intervals )
+{
+	double seconds, gauss;
+	int events, channel;
+	uint32_t total;
+
+	for (int n=0; n<intervals; n++)
+		{
+		seconds = usPerInterval*1.0e-6;				// Poisson-like spread of +/- 10% around mean
+		events = (int)(meanCps*seconds*(0.9 + 0.2*Uniform()));
+		for (int e=0; e<events; e++)
+			{
+			gauss = Uniform() + Uniform() + Uniform() + Uniform() - 2.0;	// std. dev. 1/sqrt(3)
+			if ( (Random() & 7) == 0 )				// line at 1200 with sigma 30
+				channel = 1200 + (int)(gauss*52.0);
+			else if ( (Random() & 15) == 0 )		// line at 2600 with sigma 45
+				channel = 2600 + (int)(gauss*78.0);
+			else									// exponentially falling background
+				channel = (int)(-600.0*log(1.0 - Uniform()));
+			if ( gain != 1.0 ) channel = (int)((channel + Uniform())*gain);	// detector gain drift
+			if ( (channel >= 0) && (channel < MAX_SPECTRUM_SIZE) )
+				spectrum[channel]++;
+			}
+		total = (uint32_t)packet0.totalCount + events;
+		packet0.cps = (float)(events/seconds);
+		packet0.totalCount = (float)total;
+		packet0.totalPulseTime += (float)(events*SIM_PULSE_SECONDS);
+		packet0.usPerInterval = usPerInterval;
+		packet0.totalIntervals++;
+		}
+}
+
+int McaSim::Respond( const uint8_t *cmd, int cmdLength, uint8_t *response )
+{
+	int channels, bin, packetBytes;
+	uint32_t s;
+
+	if ( cmdLength != 2 ) return( 0 );				// device ignores partial commands
+	if ( (cmd[0] == 1) && (cmd[1] == 1) )			// zero command is echoed
+		{
+		Zero();
+		response[0] = 1;
+		response[1] = 1;
+		return( 2 );
+		}
+	if ( (cmd[0] != 0) || !ValidRequest(cmd[1]) ) return( 0 );
+
+	channels = RequestChannels(cmd[1]);
+	packetBytes = RequestPacketBytes(cmd[1]);
+	if ( channels )									// bin 4096 channels down to requested size
+		{
+		bin = MAX_SPECTRUM_SIZE/channels;
+		for (int i=0; i<channels; i++)
+			{
+			s = 0;
+			for (int j=0; j<bin; j++) s += spectrum[i*bin+j];
+			memcpy(response+i*4,&s,4);				// response buffer may be unaligned
+			}
+		}
+	if ( packetBytes )
+		memcpy(response+channels*4,&packet0,packetBytes);
+	return( channels*4 + packetBytes );
+}
+
+////// SimPty ///////////////////////////////////////////////////////////////////////////////////////
+
+SimPty::SimPty()									// constructor
+{
+	sim = NULL;
+	masterFd = -1;
+	slaveName[0] = 0;
+	running = false;
+}
+
+SimPty::~SimPty()									// destructor
+{
+	Stop();
+}
+
+static void *SimPtyThread( void *arg )				// answer each 2-byte command on the master side
+{
+	SimPty *pty = (SimPty *)arg;
+	static const int pollMs = 50;					// how often to check for Stop()
+	uint8_t cmd[2], response[MAX_RESPONSE_BYTES];
+	struct pollfd pfd;
+	int got = 0, length, sent, n;
+
+	pfd.fd = pty->masterFd;
+	pfd.events = POLLIN;
+	while ( pty->running )
+		{
+		if ( poll(&pfd,1,pollMs) <= 0 ) continue;
+		n = read(pty->masterFd,cmd+got,2-got);
+		if ( n <= 0 ) continue;
+		got += n;
+		if ( got < 2 ) continue;					// wait for second command byte
+		got = 0;
+		length = pty->sim->Respond(cmd,2,response);
+		sent = 0;
+		while ( (sent < length) && pty->running )	// pty buffer is small, keep writing
+			{
+			n = write(pty->masterFd,response+sent,length-sent);
+			if ( n > 0 ) sent += n;
+			else
+				{
+				pfd.events = POLLOUT;
+				poll(&pfd,1,pollMs);
+				pfd.events = POLLIN;
+				}
+			}
+		}
+	return( NULL );
+}
+
+bool SimPty::Start( McaSim *device )
+{
+	int slaveFd;
+	struct termios tio;
+
+	if ( running ) return( false );
+	if ( openpty(&masterFd,&slaveFd,slaveName,NULL,NULL) < 0 )
+		{
+		masterFd = -1;
+		return( false );
+		}
+	tcgetattr(slaveFd,&tio);						// raw on both ends so no bytes are translated
+	cfmakeraw(&tio);
+	tcsetattr(slaveFd,TCSANOW,&tio);
+	close(slaveFd);									// reopened by name as the serial port
+	fcntl(masterFd,F_SETFL,fcntl(masterFd,F_GETFL) | O_NONBLOCK);
+
+	sim = device;
+	running = true;
+	if ( pthread_create(&thread,NULL,SimPtyThread,this) != 0 )
+		{
+		running = false;
+		close(masterFd);
+		masterFd = -1;
+		return( false );
+		}
+	return( true );
+}
+
+void SimPty::Stop( void )
+{
+	if ( running )
+		{
+		running = false;
+		pthread_join(thread,NULL);
+		}
+	if ( masterFd >= 0 ) close(masterFd);
+	masterFd = -1;
+}
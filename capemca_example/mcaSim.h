@@ -0,0 +1,47 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Simulated MCA that answers the 2-byte command protocol like the real device
+//   methods in mcaSim.cpp
+//
+// The simulator keeps a cumulative 4096-channel spectrum (two gaussian lines on a falling
+// background) and a PACKET0_TYPE, and bins the spectrum down to the requested resolution.
+// Random numbers come from a seeded xorshift generator so runs are repeatable.
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <pthread.h>
+#include "mcaFrame.h"
+
+#define SIM_PULSE_SECONDS		2.0e-6				// time inside each simulated pulse
+
+class McaSim {
+public:
+	uint32_t capemcaId;								// reported in packet0
+	uint32_t usPerInterval;							// simulated acquisition interval
+	double meanCps;									// mean count rate of simulated source
+	double gain;									// scales every event's channel, 1 = no drift
+	uint64_t rng;									// xorshift64 state, never zero
+	PACKET0_TYPE packet0;
+	uint32_t spectrum[MAX_SPECTRUM_SIZE];			// cumulative counts since last zero
+
+	McaSim( uint32_t id = 1, uint64_t seed = 1 );	// constructor
+	void Zero( void );								// what the {1,1} command does
+	void Acquire( int intervals );					// accumulate simulated events
+	int Respond( const uint8_t *cmd, int cmdLength, uint8_t *response );	// returns response bytes
+	uint32_t Random( void );						// next 32-bit random number
+	double Uniform( void );							// uniform in [0,1)
+};
+
+class SimPty {										// simulator served on a pseudo-terminal, so
+public:												// the UART path can be tested without an MCA
+	McaSim *sim;
+	int masterFd;									// simulator side
+	char slaveName[64];								// open this path as the serial port
+	volatile bool running;
+	pthread_t thread;
+
+	SimPty();										// constructor
+	~SimPty();										// destructor stops the thread
+	bool Start( McaSim *device );					// create pty and start answering commands
+	void Stop( void );
+};
@@ -0,0 +1,229 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Sparse encoding of the change between two cumulative readouts
+//   definitions in mcaSparse.h
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <string.h>
+#include "mcaSparse.h"
+#if defined(__SSE2__) || defined(_M_X64)			// MSVC has SSE2 on every x64 target
+#define SPARSE_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+static inline int LowestBit( uint64_t bits )		// index of the lowest set bit, bits != 0
+{
+#ifdef _MSC_VER
+	unsigned long k;
+	_BitScanForward64(&k,bits);
+	return( (int)k );
+#else
+	return( __builtin_ctzll(bits) );
+#endif
+}
+
+static inline int BitCount( uint64_t bits )
+{
+#ifdef _MSC_VER
+	return( (int)__popcnt64(bits) );
+#else
+	return( __builtin_popcountll(bits) );
+#endif
+}
+
+static const uint32_t empty[MAX_SPECTRUM_SIZE] = { 0 };	// base of a delta after a zero
+
+static uint32_t SpectrumSum( const uint32_t *spectrum, int channels )
+{
+	uint32_t sum = 0;
+
+	for (int i=0; i<channels; i++) sum += spectrum[i];	// mod 2^32, vectorized by the compiler
+	return( sum );
+}
+
+													// bitmap of channels that differ and the sum of
+													// previous in one pass, true if any went down
+static bool CompareSpectra( const uint32_t *current, const uint32_t *previous, int channels, uint64_t *bitmap,
+							uint32_t *previousSum )
+{
+#ifdef SPARSE_SSE2
+	const __m128i sign = _mm_set1_epi32((int)0x80000000);	// flips unsigned order into signed
+	__m128i down = _mm_setzero_si128(), sum = _mm_setzero_si128();
+	uint32_t lanes[4];
+
+	for (int w=0; w<channels/64; w++)
+		{
+		uint64_t bits = 0;
+		for (int j=0; j<64; j+=4)
+			{
+			__m128i c = _mm_loadu_si128((const __m128i *)(current + 64*w + j));
+			__m128i p = _mm_loadu_si128((const __m128i *)(previous + 64*w + j));
+			int same = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(c,p)));
+			bits |= (uint64_t)(~same & 15) << j;
+			down = _mm_or_si128(down,_mm_cmplt_epi32(_mm_xor_si128(c,sign),_mm_xor_si128(p,sign)));
+			sum = _mm_add_epi32(sum,p);
+			}
+		bitmap[w] = bits;
+		}
+	_mm_storeu_si128((__m128i *)lanes,sum);
+	*previousSum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	return( _mm_movemask_epi8(down) != 0 );
+#else
+	bool down = false;
+
+	*previousSum = SpectrumSum(previous,channels);
+
+	for (int w=0; w<channels/64; w++)
+		{
+		uint64_t bits = 0;
+		for (int j=0; j<64; j++)
+			{
+			bits |= (uint64_t)(current[64*w+j] != previous[64*w+j]) << j;
+			down |= current[64*w+j] < previous[64*w+j];
+			}
+		bitmap[w] = bits;
+		}
+	return( down );
+#endif
+}
+
+////// SparseDelta //////////////////////////////////////////////////////////////////////////////////
+
+SparseDelta::SparseDelta()							// constructor
+{
+	channels = 0;
+	changed = 0;
+	width = 1;
+	flags = 0;
+	baseSum = 0;
+}
+
+bool SparseDelta::Encode( const uint32_t *current, const uint32_t *previous, int nChannels )
+{
+	uint32_t any = 0;
+
+	changed = 0;
+	width = 1;
+	flags = 0;
+	if ( (nChannels < 0) || (nChannels > MAX_SPECTRUM_SIZE) || (nChannels % 64) )
+		{
+		channels = 0;								// frames are multiples of 256 channels
+		return( false );
+		}
+	channels = nChannels;
+	if ( CompareSpectra(current,previous,channels,bitmap,&baseSum) )
+		{
+		uint32_t zero;
+		flags = SPARSE_FLAG_ZEROED;					// counts went down, device was zeroed
+		previous = empty;
+		CompareSpectra(current,previous,channels,bitmap,&zero);
+		}
+
+	for (int w=0; w<channels/64; w++)				// increments of the set bits, in order
+		for (uint64_t bits=bitmap[w]; bits; bits&=bits-1)
+			{
+			int k = 64*w + LowestBit(bits);
+			uint32_t d = current[k] - previous[k];
+			increment[changed++] = d;
+			any |= d;
+			}
+	width = any < 0x100 ? 1 : any < 0x10000 ? 2 : 4;
+	return( !(flags & SPARSE_FLAG_ZEROED) );
+}
+
+size_t SparseDelta::Bytes( void ) const
+{
+	return( sizeof(SPARSE_HEADER) + channels/8 + (size_t)changed*width );
+}
+
+size_t SparseDelta::Pack( uint8_t *out ) const
+{
+	SPARSE_HEADER h;
+	uint8_t *p = out + sizeof(h) + channels/8;
+
+	h.channels = (uint16_t)channels;
+	h.changed = (uint16_t)changed;
+	h.width = (uint8_t)width;
+	h.flags = (uint8_t)flags;
+	h.reserved = 0;
+	h.baseSum = baseSum;
+	memcpy(out,&h,sizeof(h));
+	memcpy(out+sizeof(h),bitmap,channels/8);		// little-endian words are the byte order above
+	switch (width)
+		{
+		case 1: for (int n=0; n<changed; n++) p[n] = (uint8_t)increment[n]; break;
+		case 2: for (int n=0; n<changed; n++) { uint16_t v = (uint16_t)increment[n]; memcpy(p+2*n,&v,2); } break;
+		default: memcpy(p,increment,(size_t)changed*4);
+		}
+	return( Bytes() );
+}
+
+size_t SparseDelta::Unpack( const uint8_t *in, size_t length )
+{
+	SPARSE_HEADER h;
+	const uint8_t *p;
+	int bits = 0;
+
+	if ( length < sizeof(h) ) return( 0 );
+	memcpy(&h,in,sizeof(h));
+	if ( (h.channels > MAX_SPECTRUM_SIZE) || (h.channels % 64) || (h.changed > h.channels) ||
+		 ((h.width != 1) && (h.width != 2) && (h.width != 4)) ||
+		 (length < sizeof(h) + h.channels/8 + (size_t)h.changed*h.width) ) return( 0 );
+	channels = h.channels;
+	changed = h.changed;
+	width = h.width;
+	flags = h.flags;
+	baseSum = h.baseSum;
+	memcpy(bitmap,in+sizeof(h),channels/8);
+	for (int w=0; w<channels/64; w++) bits += BitCount(bitmap[w]);
+	if ( bits != changed ) return( 0 );
+	p = in + sizeof(h) + channels/8;
+	switch (width)
+		{
+		case 1: for (int n=0; n<changed; n++) increment[n] = p[n]; break;
+		case 2: for (int n=0; n<changed; n++) { uint16_t v; memcpy(&v,p+2*n,2); increment[n] = v; } break;
+		default: memcpy(increment,p,(size_t)changed*4);
+		}
+	return( Bytes() );
+}
+
+bool SparseDelta::Fits( const uint32_t *spectrum ) const
+{
+	return( (flags & SPARSE_FLAG_ZEROED) || (SpectrumSum(spectrum,channels) == baseSum) );
+}
+
+void SparseDelta::ApplyTo( uint32_t *spectrum ) const
+{
+	int n = 0;
+
+	if ( flags & SPARSE_FLAG_ZEROED ) memset(spectrum,0,channels*4);
+	for (int w=0; w<channels/64; w++)
+		for (uint64_t bits=bitmap[w]; bits; bits&=bits-1)
+			spectrum[64*w + LowestBit(bits)] += increment[n++];
+}
+
+void SparseDelta::AddTo( uint64_t *sum ) const
+{
+	int n = 0;
+
+	for (int w=0; w<channels/64; w++)
+		for (uint64_t bits=bitmap[w]; bits; bits&=bits-1)
+			sum[64*w + LowestBit(bits)] += increment[n++];
+}
+
+bool SparseDelta::AddTo( SpectrumAccumulator *accumulator ) const
+{
+	if ( accumulator->channels == 0 ) accumulator->channels = channels;
+	if ( accumulator->channels != channels ) return( false );
+	AddTo(accumulator->sum);
+	accumulator->frames++;
+	return( true );
+}
+
+void SparseDelta::Expand( uint32_t *interval ) const
+{
+	memset(interval,0,channels*4);
+	ApplyTo(interval);
+}
@@ -0,0 +1,56 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Sparse encoding of the change between two cumulative readouts
+//   methods in mcaSparse.cpp
+//
+// At low count rates consecutive readouts differ in a few channels, so instead of the whole
+// spectrum a delta keeps a bitmap of the channels that changed and their increments, in
+// channel order, packed to the fewest bytes (1, 2 or 4) that hold the largest one. Encode()
+// compares four channels at a time with SSE2 and turns each compare into bitmap bits with a
+// movemask, so unchanged stretches cost one pass and no branches; other targets use a plain
+// loop. If any channel went down the device was zeroed, and the delta then holds the new
+// readout itself against an empty spectrum, like IntervalSpectrum().
+//
+// Packed form, also the payload of sparse frame records (see mcaOutput.h):
+//   SPARSE_HEADER, bitmap of channels/8 bytes (bit i of byte j = channel 8j+i),
+//   changed increments of width bytes each, little-endian
+// ApplyTo() and AddTo() consume a delta in place, touching only the changed channels.
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "mcaFrame.h"
+
+#define SPARSE_WORDS			(MAX_SPECTRUM_SIZE/64)	// 64-bit bitmap words
+#define SPARSE_FLAG_ZEROED		0x01				// increments are from an empty spectrum
+
+typedef struct
+{
+	uint16_t channels;								// multiple of 64, at most MAX_SPECTRUM_SIZE
+	uint16_t changed;								// increments that follow the bitmap
+	uint8_t width;									// bytes per increment: 1, 2 or 4
+	uint8_t flags;									// SPARSE_FLAG_xxx
+	uint16_t reserved;
+	uint32_t baseSum;								// sum of the base spectrum mod 2^32, to check it
+} SPARSE_HEADER;									// sizeof(SPARSE_HEADER) = 12 bytes
+
+class SparseDelta {
+public:
+	int channels;
+	int changed;									// channels with a nonzero increment
+	int width;										// packed bytes per increment
+	int flags;
+	uint32_t baseSum;
+	uint64_t bitmap[SPARSE_WORDS];					// bit k%64 of word k/64 = channel k changed
+	uint32_t increment[MAX_SPECTRUM_SIZE];			// [0,changed), in channel order
+
+	SparseDelta();									// constructor
+	bool Encode( const uint32_t *current, const uint32_t *previous, int channels );	// false if zeroed
+	size_t Bytes( void ) const;						// packed size
+	size_t Pack( uint8_t *out ) const;				// returns Bytes()
+	size_t Unpack( const uint8_t *in, size_t length );	// bytes used, 0 if malformed
+	bool Fits( const uint32_t *spectrum ) const;	// is this the base the delta was encoded against
+	void ApplyTo( uint32_t *spectrum ) const;		// base readout becomes the new one
+	void AddTo( uint64_t *sum ) const;				// add the increments
+	bool AddTo( SpectrumAccumulator *accumulator ) const;	// as one more spectrum, false if channels differ
+	void Expand( uint32_t *interval ) const;		// dense increments, for code that wants them
+};
@@ -0,0 +1,98 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Functions for synchronized zero and readout of several MCAs
+//   definitions in mcaSync.h
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "mcaSync.h"
+
+static int CompareDoubles( const void *a, const void *b )
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return( (x > y) - (x < y) );
+}
+
+static void Submit( McaTransport **devices, int n, const uint8_t *cmd, SYNC_RESULT *result )
+{
+	memset(result,0,sizeof(SYNC_RESULT));
+	result->devices = n;
+	for (int d=0; d<n; d++)							// back to back, nothing else in between
+		{
+		result->ok[d] = (devices[d]->Submit(cmd,2) == 2);
+		result->submitTime[d] = MonotonicSeconds();
+		}
+}
+
+static void Skew( SYNC_RESULT *result )				// submit times relative to the median
+{
+	double sorted[SYNC_MAX_DEVICES], median;
+	int good = 0, n = result->devices;
+
+	result->failures = 0;
+	result->latency = 0.0;
+	for (int d=0; d<n; d++)							// sequential reads stretch all windows but one
+		if ( result->ok[d] )
+			{
+			double window = result->responseTime[d] - result->submitTime[d];
+			if ( !good || (window < result->latency) ) result->latency = window;
+			sorted[good++] = result->submitTime[d];
+			}
+		else result->failures++;
+	if ( n ) result->submitSpread = result->submitTime[n-1] - result->submitTime[0];
+	for (int d=0; d<n; d++) result->uncertainty[d] = 0.5*result->latency;
+	if ( !good ) return;
+	qsort(sorted,good,sizeof(double),CompareDoubles);
+	median = good & 1 ? sorted[good/2] : 0.5*(sorted[good/2-1] + sorted[good/2]);
+	for (int d=0; d<n; d++)
+		{
+		result->skew[d] = result->submitTime[d] - median;
+		if ( result->ok[d] && (fabs(result->skew[d]) > result->maxSkew) ) result->maxSkew = fabs(result->skew[d]);
+		}
+}
+
+bool SyncZero( McaTransport **devices, int n, SYNC_RESULT *result, int timeoutMs )
+{
+	uint8_t zerocmd[2] = { 1, 1 };
+	uint8_t echo[2];
+
+	if ( (n < 1) || (n > SYNC_MAX_DEVICES) ) return( false );
+	Submit(devices,n,zerocmd,result);
+	for (int d=0; d<n; d++)							// then collect every echo
+		{
+		echo[0] = echo[1] = 0;
+		if ( result->ok[d] )
+			result->ok[d] = (devices[d]->Read(echo,2,timeoutMs) == 2) && (echo[0] == 1) && (echo[1] == 1);
+		result->responseTime[d] = MonotonicSeconds();
+		}
+	Skew(result);
+	return( result->failures == 0 );
+}
+
+bool SyncReadout( McaTransport **devices, int n, int request, McaFrame **frames, SYNC_RESULT *result, int timeoutMs )
+{
+	uint8_t cmd[2] = { 0, (uint8_t)request };
+	static __thread uint8_t allBytes[MAX_RESPONSE_BYTES];
+	int bytesToRead = RequestResponseBytes(request), bytesRead;
+
+	if ( (n < 1) || (n > SYNC_MAX_DEVICES) || !ValidRequest(request) ) return( false );
+	Submit(devices,n,cmd,result);
+	for (int d=0; d<n; d++)
+		{
+		if ( result->ok[d] )
+			{
+			bytesRead = devices[d]->Read(allBytes,bytesToRead,timeoutMs);
+			result->ok[d] = frames[d]->Decode(allBytes,bytesRead,request);
+			}
+		result->responseTime[d] = MonotonicSeconds();
+		}
+	Skew(result);
+	for (int d=0; d<n; d++)							// the latch window of each device
+		{
+		frames[d]->sendTime = result->submitTime[d];
+		frames[d]->hostTime = result->submitTime[d] + result->latency;
+		}
+	return( result->failures == 0 );
+}
@@ -0,0 +1,39 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Synchronized zero and readout of several MCAs with measured inter-device skew
+//   functions in mcaSync.cpp
+//
+// All commands are built first and then submitted back to back with McaTransport::Submit(),
+// which does not wait for the transfer on USB, before any response is read. Each device acts
+// on its command somewhere between its submit time and the arrival of its response, but the
+// responses are read one device after the other, so a later device's window also holds the
+// reads of the devices before it and says nothing about when it acted. The only window that
+// does is the shortest one, latency below: the round trip of a device read without waiting on
+// the others. Assuming the devices answer alike, each latched within latency of its submit, so
+// skew is the submit time relative to the median over the group and the uncertainty is half
+// the latency. Frames from SyncReadout() carry that window, [submit, submit + latency], as
+// sendTime and hostTime.
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "mcaTransport.h"
+
+#define SYNC_MAX_DEVICES		256
+
+typedef struct
+{
+	int devices;
+	int failures;									// devices without a valid echo or frame
+	double submitTime[SYNC_MAX_DEVICES];			// MonotonicSeconds() after each Submit()
+	double responseTime[SYNC_MAX_DEVICES];			// after each response was read
+	double skew[SYNC_MAX_DEVICES];					// seconds from the group median
+	double uncertainty[SYNC_MAX_DEVICES];			// half the latency below
+	bool ok[SYNC_MAX_DEVICES];
+	double latency;									// shortest submit to response of a good device
+	double submitSpread;							// last minus first submit
+	double maxSkew;									// largest |skew| of a good device
+} SYNC_RESULT;
+
+bool SyncZero( McaTransport **devices, int n, SYNC_RESULT *result, int timeoutMs = SERIAL_TIMEOUT_MS );
+bool SyncReadout( McaTransport **devices, int n, int request, McaFrame **frames, SYNC_RESULT *result,
+					int timeoutMs = SERIAL_TIMEOUT_MS );		// true if every device returned a frame
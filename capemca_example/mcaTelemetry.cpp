@@ -0,0 +1,303 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Class methods for the telemetry multiplexer
+//   definitions in mcaTelemetry.h
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <string.h>
+#include "mcaTelemetry.h"
+
+#define ENTRY_HEADER	6							// length(2) ms(4) in front of each queued payload
+
+void TelemetryQueue::Init( uint8_t *buffer, uint16_t bytes )
+{
+	ring = buffer;
+	size = bytes;
+	head = used = records = 0;
+}
+
+bool TelemetryQueue::Push( const uint8_t *payload, uint16_t length, uint32_t ms )
+{
+	uint8_t header[ENTRY_HEADER];
+	uint16_t at;
+
+	if ( (uint32_t)used + ENTRY_HEADER + length > size ) return( false );
+	header[0] = length & 0xFF;
+	header[1] = length >> 8;
+	for (int b=0; b<4; b++) header[2+b] = (ms >> 8*b) & 0xFF;
+	at = (head + used) % size;
+	for (int b=0; b<ENTRY_HEADER; b++)
+		{
+		ring[at] = header[b];
+		if ( ++at == size ) at = 0;
+		}
+	for (uint16_t b=0; b<length; b++)
+		{
+		ring[at] = payload[b];
+		if ( ++at == size ) at = 0;
+		}
+	used += ENTRY_HEADER + length;
+	records++;
+	return( true );
+}
+
+bool TelemetryQueue::Peek( uint16_t *length, uint32_t *ms )
+{
+	uint8_t header[ENTRY_HEADER];
+
+	if ( !records ) return( false );
+	for (int b=0; b<ENTRY_HEADER; b++) header[b] = ring[(head + b) % size];
+	*length = header[0] | (header[1] << 8);
+	*ms = header[2] | (header[3] << 8) | ((uint32_t)header[4] << 16) | ((uint32_t)header[5] << 24);
+	return( true );
+}
+
+int TelemetryQueue::Payload( const uint8_t **part, uint16_t *partLength )
+{
+	uint16_t length, start = (head + ENTRY_HEADER) % size;
+	uint32_t ms;
+
+	if ( !Peek(&length,&ms) ) return( 0 );
+	part[0] = ring + start;
+	if ( (uint32_t)start + length <= size )
+		{
+		partLength[0] = length;
+		return( 1 );
+		}
+	partLength[0] = size - start;					// wraps around the end of the ring
+	part[1] = ring;
+	partLength[1] = length - partLength[0];
+	return( 2 );
+}
+
+void TelemetryQueue::Pop( void )
+{
+	uint16_t length;
+	uint32_t ms;
+
+	if ( !Peek(&length,&ms) ) return;
+	head = (head + ENTRY_HEADER + length) % size;
+	used -= ENTRY_HEADER + length;
+	records--;
+}
+
+TelemetryMux::TelemetryMux( uint32_t rate, uint32_t burst, uint16_t duty )	// constructor
+{
+	static const uint16_t bytes[TELEMETRY_CLASSES] = { TELEMETRY_EVENT_BYTES, TELEMETRY_SUMMARY_BYTES,
+			TELEMETRY_LIGHTCURVE_BYTES, TELEMETRY_SPECTRUM_BYTES };
+	uint8_t *at = storage;
+
+	bytesPerSecond = rate;
+	burstBytes = burst ? burst : rate;
+	tokens = burstBytes;
+	lastMs = 0;
+	started = false;
+	spectrumDuty = spectrumEvery = duty ? duty : 1;
+	spectrumCount = 0;
+	memset(sequence,0,sizeof(sequence));
+	memset(stats,0,sizeof(stats));
+	for (int c=0; c<TELEMETRY_CLASSES; c++)
+		{
+		queue[c].Init(at,bytes[c]);
+		at += bytes[c];
+		}
+}
+
+bool TelemetryMux::Submit( int cls, const void *payload, uint16_t length, uint32_t ms )
+{
+	if ( (cls < 0) || (cls >= TELEMETRY_CLASSES) ) return( false );
+	TelemetryQueue &q = queue[cls];
+	stats[cls].offered++;
+	if ( (length > TELEMETRY_MAX_PAYLOAD) || ((uint32_t)length + TELEMETRY_OVERHEAD > burstBytes) )
+		{
+		stats[cls].dropped++;						// could never be sent
+		return( false );
+		}
+
+	if ( cls == TELEMETRY_SPECTRUM )				// duty cycle and decimation
+		{
+		if ( ++spectrumCount < spectrumEvery )
+			{
+			stats[cls].decimated++;
+			return( false );
+			}
+		spectrumCount = 0;
+		if ( q.records )							// previous one still waiting, link is saturated
+			{
+			stats[cls].dropped += q.records;
+			while ( q.records ) q.Pop();
+			spectrumEvery = spectrumEvery*2 < TELEMETRY_MAX_DECIMATION ? spectrumEvery*2 : TELEMETRY_MAX_DECIMATION;
+			}
+		else if ( spectrumEvery > spectrumDuty ) spectrumEvery--;
+		}
+
+	while ( !q.Push((const uint8_t *)payload,length,ms) )
+		{
+		if ( !q.records )
+			{
+			stats[cls].dropped++;					// larger than the whole ring
+			return( false );
+			}
+		q.Pop();									// oldest goes first
+		stats[cls].dropped++;
+		}
+	stats[cls].queued++;
+	return( true );
+}
+
+int TelemetryMux::Service( uint32_t ms, TelemetryWriter write, void *context )
+{
+	int sent = 0;
+
+	if ( !started )
+		{
+		lastMs = ms;
+		started = true;
+		}
+	tokens += (double)(uint32_t)(ms - lastMs)*bytesPerSecond/1000.0;	// unsigned difference survives millis() wrap
+	if ( tokens > burstBytes ) tokens = burstBytes;
+	lastMs = ms;
+
+	for (;;)
+		{
+		int cls = 0, parts;
+		uint16_t length, partLength[2];
+		uint32_t queuedMs, latency;
+		const uint8_t *part[2];
+		uint8_t header[6], crc[2];
+		uint16_t check;
+
+		while ( (cls < TELEMETRY_CLASSES) && !queue[cls].records ) cls++;
+		if ( cls == TELEMETRY_CLASSES ) break;
+		queue[cls].Peek(&length,&queuedMs);
+		if ( tokens < length + TELEMETRY_OVERHEAD ) break;	// lower classes wait too, no overtaking
+
+		header[0] = TELEMETRY_SYNC0;
+		header[1] = TELEMETRY_SYNC1;
+		header[2] = cls;
+		header[3] = sequence[cls]++;
+		header[4] = length & 0xFF;
+		header[5] = length >> 8;
+		parts = queue[cls].Payload(part,partLength);
+		check = TelemetryCrc(header+2,4);
+		for (int p=0; p<parts; p++) check = TelemetryCrc(part[p],partLength[p],check);
+		crc[0] = check & 0xFF;
+		crc[1] = check >> 8;
+		write(header,sizeof(header),context);
+		for (int p=0; p<parts; p++) write(part[p],partLength[p],context);
+		write(crc,sizeof(crc),context);
+
+		latency = ms - queuedMs;
+		stats[cls].sent++;
+		stats[cls].bytes += length + TELEMETRY_OVERHEAD;
+		stats[cls].latencySum += latency;
+		if ( latency > stats[cls].latencyMax ) stats[cls].latencyMax = latency;
+		tokens -= length + TELEMETRY_OVERHEAD;
+		queue[cls].Pop();
+		sent++;
+		}
+	return( sent );
+}
+
+uint32_t TelemetryMux::Pending( void )
+{
+	uint32_t bytes = 0;
+
+	for (int c=0; c<TELEMETRY_CLASSES; c++)
+		bytes += queue[c].used + queue[c].records*(TELEMETRY_OVERHEAD - ENTRY_HEADER);
+	return( bytes );
+}
+
+uint16_t TelemetryCrc( const uint8_t *bytes, size_t length, uint16_t crc )
+{
+	for (size_t i=0; i<length; i++)					// bitwise, no table to spare sketch memory
+		{
+		crc ^= (uint16_t)bytes[i] << 8;
+		for (int b=0; b<8; b++) crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+		}
+	return( crc );
+}
+
+int TelemetryPackSpectrum( const uint32_t *spectrum, int channels, uint8_t *out, int outSize )
+{													// zigzag deltas of neighbours as LEB128 varints
+	uint32_t previous = 0;
+	int n = 0;
+
+	for (int i=0; i<channels; i++)
+		{
+		int32_t delta = (int32_t)(spectrum[i] - previous);
+		uint32_t v = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+		previous = spectrum[i];
+		do	{
+			if ( n >= outSize ) return( 0 );
+			out[n++] = (v & 0x7F) | (v > 0x7F ? 0x80 : 0);
+			v >>= 7;
+			} while ( v );
+		}
+	return( n );
+}
+
+int TelemetryUnpackSpectrum( const uint8_t *bytes, int length, uint32_t *spectrum, int channels )
+{
+	uint32_t previous = 0;
+	int n = 0, i;
+
+	for (i=0; (i<channels) && (n<length); i++)
+		{
+		uint32_t v = 0;
+		int shift = 0;
+		do	{
+			if ( (n >= length) || (shift > 28) ) return( i );
+			v |= (uint32_t)(bytes[n] & 0x7F) << shift;
+			shift += 7;
+			} while ( bytes[n++] & 0x80 );
+		previous += (v >> 1) ^ (0 - (v & 1));
+		spectrum[i] = previous;
+		}
+	return( i );
+}
+
+TelemetryParser::TelemetryParser()					// constructor
+{
+	have = 0;
+	frames = badCrc = lost = 0;
+	memset(nextSequence,0,sizeof(nextSequence));
+	memset(seen,0,sizeof(seen));
+}
+
+bool TelemetryParser::Feed( uint8_t byte, int *cls, const uint8_t **payload, int *length )
+{
+	int frameLength;
+	uint16_t check;
+
+	if ( (have == 0) && (byte != TELEMETRY_SYNC0) ) return( false );
+	if ( (have == 1) && (byte != TELEMETRY_SYNC1) )
+		{
+		have = byte == TELEMETRY_SYNC0 ? 1 : 0;
+		return( false );
+		}
+	buffer[have++] = byte;
+	if ( have < 6 ) return( false );
+	frameLength = (buffer[4] | (buffer[5] << 8)) + TELEMETRY_OVERHEAD;
+	if ( (buffer[2] >= TELEMETRY_CLASSES) || (frameLength > (int)sizeof(buffer)) )
+		{
+		have = 0;									// not a frame header, hunt for sync again
+		return( false );
+		}
+	if ( have < frameLength ) return( false );
+
+	have = 0;
+	check = TelemetryCrc(buffer+2,frameLength-4);
+	if ( (buffer[frameLength-2] != (check & 0xFF)) || (buffer[frameLength-1] != (check >> 8)) )
+		{
+		badCrc++;
+		return( false );
+		}
+	*cls = buffer[2];
+	if ( seen[*cls] ) lost += (uint8_t)(buffer[3] - nextSequence[*cls]);
+	seen[*cls] = true;
+	nextSequence[*cls] = buffer[3] + 1;
+	*payload = buffer + 6;
+	*length = frameLength - TELEMETRY_OVERHEAD;
+	frames++;
+	return( true );
+}
@@ -0,0 +1,119 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Bandwidth-budgeted telemetry multiplexer for a slow downlink
+//   methods in mcaTelemetry.cpp
+//
+// Records of four classes wait in fixed-size ring buffers and leave through a token bucket
+// that refills at bytesPerSecond up to burstBytes. The highest priority class with a record
+// waiting is always served first and records are never split or reordered within a class:
+//   TELEMETRY_EVENT       errors and rcode events, sent as soon as tokens allow
+//   TELEMETRY_SUMMARY     packet0 summary of every frame
+//   TELEMETRY_LIGHTCURVE  band counts of every interval
+//   TELEMETRY_SPECTRUM    packed spectra, only every spectrumEvery'th one offered is kept
+// When a spectrum is offered while the previous one is still queued the link is saturated:
+// the stale one is dropped and spectrumEvery doubles, up to TELEMETRY_MAX_DECIMATION. Each
+// spectrum offered to an empty queue steps it back down towards the configured duty cycle.
+// Queues of the other classes drop their oldest record when full.
+//
+// On the link each record is framed as
+//   0xA5 0x5A class seq length(2) payload crc(2)
+// with seq counting per class so the ground can see losses, and CRC-16/CCITT over class through
+// payload. No heap and no stdio, so the same code can go into a sketch; times are milliseconds
+// from any clock such as millis().
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define TELEMETRY_EVENT			0					// highest priority
+#define TELEMETRY_SUMMARY		1
+#define TELEMETRY_LIGHTCURVE	2
+#define TELEMETRY_SPECTRUM		3
+#define TELEMETRY_CLASSES		4
+
+#define TELEMETRY_SYNC0			0xA5
+#define TELEMETRY_SYNC1			0x5A
+#define TELEMETRY_OVERHEAD		8					// framing bytes around a payload
+#define TELEMETRY_MAX_PAYLOAD	2048
+#define TELEMETRY_MAX_DECIMATION	64
+
+#ifndef TELEMETRY_EVENT_BYTES						// ring sizes per class, smaller on a sketch
+#define TELEMETRY_EVENT_BYTES		512
+#define TELEMETRY_SUMMARY_BYTES		1024
+#define TELEMETRY_LIGHTCURVE_BYTES	1024
+#define TELEMETRY_SPECTRUM_BYTES	4096
+#endif
+#define TELEMETRY_STORAGE_BYTES		(TELEMETRY_EVENT_BYTES + TELEMETRY_SUMMARY_BYTES + \
+									 TELEMETRY_LIGHTCURVE_BYTES + TELEMETRY_SPECTRUM_BYTES)
+
+typedef struct
+{
+	uint32_t ms;									// time of the frame
+	float cps;
+	float totalCount;
+	float totalPulseTime;
+	uint32_t totalIntervals;
+	uint32_t countInRangeArray;
+} TELEMETRY_SUMMARY_PAYLOAD;						// sizeof = 24 bytes, from PACKET0_TYPE
+
+typedef struct
+{
+	uint32_t offered, queued, sent;					// records
+	uint32_t dropped;								// stale or overflowed after queueing
+	uint32_t decimated;								// spectra skipped before queueing
+	uint64_t bytes;									// framed bytes sent
+	uint64_t latencySum;							// ms from Submit() to Service() sending it
+	uint32_t latencyMax;
+} TELEMETRY_CLASS_STATS;
+
+typedef void (*TelemetryWriter)( const uint8_t *bytes, size_t length, void *context );	// must take all bytes
+
+class TelemetryQueue {								// ring of [length(2) ms(4) payload] entries
+public:
+	uint8_t *ring;
+	uint16_t size, head, used;						// bytes
+	uint16_t records;
+
+	void Init( uint8_t *buffer, uint16_t bytes );
+	bool Push( const uint8_t *payload, uint16_t length, uint32_t ms );	// false if it cannot fit
+	bool Peek( uint16_t *length, uint32_t *ms );	// oldest entry
+	int Payload( const uint8_t **part, uint16_t *partLength );	// oldest payload, 1 or 2 parts of the ring
+	void Pop( void );
+};
+
+class TelemetryMux {
+public:
+	uint32_t bytesPerSecond, burstBytes;
+	double tokens;									// bytes that may go now
+	uint32_t lastMs;
+	bool started;
+	uint16_t spectrumDuty;							// configured: keep every n'th spectrum
+	uint16_t spectrumEvery;							// current, spectrumDuty or more when saturated
+	uint16_t spectrumCount;
+	uint8_t sequence[TELEMETRY_CLASSES];
+	TelemetryQueue queue[TELEMETRY_CLASSES];
+	TELEMETRY_CLASS_STATS stats[TELEMETRY_CLASSES];
+	uint8_t storage[TELEMETRY_STORAGE_BYTES];
+
+	TelemetryMux( uint32_t rate, uint32_t burst = 0, uint16_t duty = 1 );	// burst 0 = one second of rate
+	bool Submit( int cls, const void *payload, uint16_t length, uint32_t ms );	// false if not queued
+	int Service( uint32_t ms, TelemetryWriter write, void *context );	// records sent
+	uint32_t Pending( void );						// framed bytes waiting in all queues
+};
+
+uint16_t TelemetryCrc( const uint8_t *bytes, size_t length, uint16_t crc = 0xFFFF );	// CRC-16/CCITT
+int TelemetryPackSpectrum( const uint32_t *spectrum, int channels, uint8_t *out, int outSize );	// bytes, 0 if too big
+int TelemetryUnpackSpectrum( const uint8_t *bytes, int length, uint32_t *spectrum, int channels );	// channels read
+
+class TelemetryParser {								// ground side, bytes in any chunks
+public:
+	uint8_t buffer[TELEMETRY_MAX_PAYLOAD + TELEMETRY_OVERHEAD];
+	int have;										// bytes of the current frame so far
+	uint32_t frames, badCrc, lost;					// lost counts sequence gaps
+	uint8_t nextSequence[TELEMETRY_CLASSES];
+	bool seen[TELEMETRY_CLASSES];
+
+	TelemetryParser();								// constructor
+	bool Feed( uint8_t byte, int *cls, const uint8_t **payload, int *length );	// true when a frame completes
+};
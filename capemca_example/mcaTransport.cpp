@@ -0,0 +1,498 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Class methods for MCA byte transports on Linux
+//   definitions in mcaTransport.h
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include "mcaTransport.h"
+
+////// SimTransport /////////////////////////////////////////////////////////////////////////////////
+
+SimTransport::SimTransport( McaSim *device, int packetBytes )	// constructor
+{
+	sim = device;
+	packetSize = packetBytes;
+	pendingLength = 0;
+	pendingOffset = 0;
+}
+
+int SimTransport::Write( const uint8_t *bytes, int length )
+{
+	pendingLength = sim->Respond(bytes,length,pending);	// device answers immediately
+	pendingOffset = 0;
+	return( length );
+}
+
+int SimTransport::Read( uint8_t *bytes, int length, int timeoutMs )
+{
+	int n, chunk, i = 0;
+
+	n = pendingLength - pendingOffset;				// nothing more arrives until next Write
+	if ( n > length ) n = length;
+	chunk = packetSize ? packetSize : n;
+	while ( i < n )									// one copy per packet, as the host
+		{											// controller delivers them
+		if ( chunk > n - i ) chunk = n - i;
+		memcpy(bytes+i,pending+pendingOffset+i,chunk);
+		i += chunk;
+		}
+	pendingOffset += n;
+	return( n );
+}
+
+////// UartTransport ////////////////////////////////////////////////////////////////////////////////
+
+UartTransport::UartTransport()						// constructor
+{
+	fd = -1;
+}
+
+UartTransport::~UartTransport()						// destructor
+{
+	Close();
+}
+
+static speed_t BaudConstant( int baudRate )			// termios speed for bit/s
+{
+	switch ( baudRate )
+		{
+		case 9600:		return( B9600 );
+		case 19200:		return( B19200 );
+		case 38400:		return( B38400 );
+		case 57600:		return( B57600 );
+		case 115200:	return( B115200 );
+		case 230400:	return( B230400 );
+		case 460800:	return( B460800 );
+		case 921600:	return( B921600 );
+		case 1000000:	return( B1000000 );
+		case 2000000:	return( B2000000 );
+		case 4000000:	return( B4000000 );
+		}
+	return( 0 );
+}
+
+int OpenSerialPort( const char *port, int baudRate )
+{
+	struct termios tio;
+	speed_t speed = BaudConstant(baudRate);
+	int fd;
+
+	if ( !speed )
+		{
+		printf("Unsupported baud rate %d.\n",baudRate);
+		return( -1 );
+		}
+	fd = open(port,O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if ( fd < 0 )
+		{
+		printf("open %s failed: %s\n",port,strerror(errno));
+		return( -1 );
+		}
+	if ( tcgetattr(fd,&tio) < 0 )					// build on current settings
+		{
+		printf("tcgetattr failed on %s: %s\n",port,strerror(errno));
+		close(fd);
+		return( -1 );
+		}
+	cfmakeraw(&tio);								// 8 data, no parity, no translation
+	tio.c_cflag &= ~(CSTOPB | CRTSCTS);				// 1 stop bit, no RTS/CTS handshaking
+	tio.c_cflag |= CLOCAL | CREAD;
+	tio.c_iflag &= ~(IXON | IXOFF | IXANY);			// no XON/XOFF either
+	cfsetispeed(&tio,speed);
+	cfsetospeed(&tio,speed);
+	if ( tcsetattr(fd,TCSANOW,&tio) < 0 )
+		{
+		printf("tcsetattr failed on %s: %s\n",port,strerror(errno));
+		close(fd);
+		return( -1 );
+		}
+	tcflush(fd,TCIOFLUSH);							// discard anything left from before
+	return( fd );
+}
+
+bool UartTransport::Open( const char *port, int baudRate )
+{
+	Close();
+	fd = OpenSerialPort(port,baudRate);
+	return( fd >= 0 );
+}
+
+int UartTransport::Write( const uint8_t *bytes, int length )
+{
+	struct pollfd pfd;
+	int n, i = 0;
+
+	pfd.fd = fd;
+	pfd.events = POLLOUT;
+	while ( (fd >= 0) && (i < length) )
+		{
+		n = write(fd,bytes+i,length-i);
+		if ( n > 0 ) i += n;
+		else if ( (n < 0) && (errno != EAGAIN) && (errno != EINTR) ) break;
+		else poll(&pfd,1,SERIAL_TIMEOUT_MS);
+		}
+	return( i );
+}
+
+int UartTransport::Read( uint8_t *bytes, int length, int timeoutMs )
+{
+	struct pollfd pfd;
+	int n, i = 0;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	while ( (fd >= 0) && (i < length) )				// until timeout between bytes
+		{
+		if ( poll(&pfd,1,timeoutMs) <= 0 ) break;
+		n = read(fd,bytes+i,length-i);				// take as many bytes as are waiting
+		if ( n > 0 ) i += n;
+		else if ( (n < 0) && (errno != EAGAIN) && (errno != EINTR) ) break;
+		}
+	return( i );									// return number of bytes read
+}
+
+void UartTransport::Close( void )
+{
+	if ( fd >= 0 ) close(fd);
+	fd = -1;
+}
+
+////// UsbTransport /////////////////////////////////////////////////////////////////////////////////
+
+#ifdef HAVE_LIBUSB
+
+#include <pthread.h>
+
+static pthread_mutex_t cacheLock = PTHREAD_MUTEX_INITIALIZER;	// device threads share one cache
+
+UsbTransport::UsbTransport()						// constructor
+{
+	context = NULL;
+	handle = NULL;
+	serial[0] = 0;
+	port[0] = 0;
+	interfaceNumber = 0;
+	epIn = USB_EP_IN;
+	epOut = USB_EP_OUT;
+	maxPacketSize = 64;
+	cached = false;
+	index = 0;
+	cache = NULL;
+	outTransfer = NULL;
+	outPending = 0;
+	outDone = 0;
+}
+
+UsbTransport::~UsbTransport()						// destructor
+{
+	Close();
+}
+
+bool UsbTransport::Open( int deviceIndex, DeviceCache *deviceCache )
+{
+	int err;
+
+	Close();
+	index = deviceIndex;
+	cache = deviceCache;
+	err = libusb_init(&context);
+	if ( err < 0 )
+		{
+		printf("libusb_init returned error = %s\n",libusb_error_name(err));
+		context = NULL;
+		return( false );
+		}
+	return( Attach() );
+}
+
+bool UsbTransport::Reopen( void )
+{
+	if ( !context ) return( false );
+	Detach();
+	if ( cached && !answers && cache )				// the cached endpoints never worked
+		{
+		pthread_mutex_lock(&cacheLock);
+		cache->Remove(serial);
+		pthread_mutex_unlock(&cacheLock);
+		}
+	return( Attach() );
+}
+
+bool UsbTransport::FindEndpoints( libusb_device *dev )
+{
+	struct libusb_config_descriptor *config;
+	bool found = false;
+
+	if ( libusb_get_active_config_descriptor(dev,&config) ) return( false );
+	for (int i=0; !found && (i<config->bNumInterfaces); i++)
+		{
+		const struct libusb_interface_descriptor *alt = &config->interface[i].altsetting[0];
+		int in = 0, out = 0, packet = 0;
+		if ( !config->interface[i].num_altsetting ) continue;
+		for (int e=0; e<alt->bNumEndpoints; e++)
+			{
+			const struct libusb_endpoint_descriptor *ep = &alt->endpoint[e];
+			if ( (ep->bmAttributes & LIBUSB_TRANSFER_TYPE_MASK) != LIBUSB_TRANSFER_TYPE_BULK ) continue;
+			if ( (ep->bEndpointAddress & LIBUSB_ENDPOINT_IN) && !in )
+				{
+				in = ep->bEndpointAddress;
+				packet = ep->wMaxPacketSize;
+				}
+			else if ( !(ep->bEndpointAddress & LIBUSB_ENDPOINT_IN) && !out ) out = ep->bEndpointAddress;
+			}
+		if ( in && out )
+			{
+			interfaceNumber = alt->bInterfaceNumber;
+			epIn = in;
+			epOut = out;
+			maxPacketSize = packet;
+			found = true;
+			}
+		}
+	libusb_free_config_descriptor(config);
+	return( found );
+}
+
+bool UsbTransport::CheckEndpoints( libusb_device *dev, const DEVICE_CACHE_ENTRY &entry )
+{												// descriptors libusb holds, no bus traffic
+	struct libusb_config_descriptor *config;
+	int matched = 0;
+
+	if ( !DeviceCacheValid(entry) || libusb_get_active_config_descriptor(dev,&config) ) return( false );
+	for (int i=0; i<config->bNumInterfaces; i++)
+		{
+		const struct libusb_interface_descriptor *alt = &config->interface[i].altsetting[0];
+		if ( !config->interface[i].num_altsetting || (alt->bInterfaceNumber != entry.interfaceNumber) ) continue;
+		for (int e=0; e<alt->bNumEndpoints; e++)
+			{
+			const struct libusb_endpoint_descriptor *ep = &alt->endpoint[e];
+			if ( (ep->bmAttributes & LIBUSB_TRANSFER_TYPE_MASK) != LIBUSB_TRANSFER_TYPE_BULK ) continue;
+			if ( (ep->bEndpointAddress == entry.pipeInId) && (ep->wMaxPacketSize == entry.maxPacketSize) ) matched |= 1;
+			if ( ep->bEndpointAddress == entry.pipeOutId ) matched |= 2;
+			}
+		}
+	libusb_free_config_descriptor(config);
+	return( matched == 3 );
+}
+
+void UsbTransport::ReadSerial( void )
+{
+	struct libusb_device_descriptor desc;
+
+	serial[0] = 0;
+	if ( !libusb_get_device_descriptor(libusb_get_device(handle),&desc) && desc.iSerialNumber )
+		libusb_get_string_descriptor_ascii(handle,desc.iSerialNumber,(unsigned char *)serial,sizeof(serial));
+	if ( !serial[0] ) snprintf(serial,sizeof(serial),"port-%s",port);	// cache key all the same
+}
+
+bool UsbTransport::Attach( void )
+{
+	libusb_device **devs = NULL;
+	libusb_device *dev;
+	struct libusb_device_descriptor desc;
+	DEVICE_CACHE_ENTRY entry;
+	bool haveEntry = false;
+	uint8_t path[8];
+	int err, i = 0, found = 0, depth;
+
+	answers = 0;
+	if ( libusb_get_device_list(context,&devs) < 0 ) return( false );
+
+	while ( (dev = devs[i++]) != NULL )				// find MCA by vendor and product id values
+		{
+		if ( libusb_get_device_descriptor(dev,&desc) ) continue;
+		if ( (desc.idVendor != USB_VENDOR_ID) || (desc.idProduct != USB_PRODUCT_ID) ) continue;
+		if ( found++ != index ) continue;
+
+		depth = libusb_get_port_numbers(dev,path,sizeof(path));
+		snprintf(port,sizeof(port),"%d",libusb_get_bus_number(dev));
+		for (int p=0; p<depth; p++)
+			snprintf(port+strlen(port),sizeof(port)-strlen(port),"%c%d",p ? '.' : '-',path[p]);
+		if ( cache )
+			{
+			pthread_mutex_lock(&cacheLock);
+			DEVICE_CACHE_ENTRY *e = cache->FindPort(port);
+			if ( e ) entry = *e;
+			haveEntry = (e != NULL);
+			pthread_mutex_unlock(&cacheLock);
+			}
+		cached = haveEntry && CheckEndpoints(dev,entry);
+		if ( cached )								// as last time on this port
+			{
+			memcpy(serial,entry.serial,sizeof(serial));
+			interfaceNumber = entry.interfaceNumber;
+			epIn = entry.pipeInId;
+			epOut = entry.pipeOutId;
+			maxPacketSize = entry.maxPacketSize;
+			if ( !lastRequest ) lastRequest = entry.lastRequest;
+			}
+		else if ( !FindEndpoints(dev) )
+			{
+			printf("No bulk endpoints on MCA at %s, using 0x%02x and 0x%02x\n",port,USB_EP_IN,USB_EP_OUT);
+			interfaceNumber = 0;
+			epIn = USB_EP_IN;
+			epOut = USB_EP_OUT;
+			maxPacketSize = 64;
+			}
+
+		err = libusb_open(dev,&handle);
+		if ( err < 0 )
+			{
+			printf("libusb_open returned error = %s\n",libusb_error_name(err));
+			handle = NULL;
+			break;
+			}
+		if ( !cached ) ReadSerial();
+		err = libusb_claim_interface(handle,interfaceNumber);
+		if ( err < 0 )
+			{
+			printf("libusb_claim_interface returned error = %s\n",libusb_error_name(err));
+			libusb_close(handle);
+			handle = NULL;
+			}
+		break;
+		}
+
+	libusb_free_device_list(devs,1);
+	if ( handle && !cached ) Remember();
+	return( handle != NULL );
+}
+
+void UsbTransport::Remember( void )
+{
+	DEVICE_CACHE_ENTRY entry, *old;
+
+	if ( !cache || !handle ) return;
+	pthread_mutex_lock(&cacheLock);
+	old = cache->Find(serial);
+	if ( old && old->capemcaId && capemcaId && (old->capemcaId != capemcaId) )
+		{
+		ReadSerial();								// another MCA took the cached one's port
+		old = cache->Find(serial);
+		}
+	memset(&entry,0,sizeof(entry));
+	memcpy(entry.serial,serial,sizeof(entry.serial));
+	memcpy(entry.port,port,sizeof(entry.port));
+	entry.capemcaId = capemcaId ? capemcaId : (old ? old->capemcaId : 0);
+	entry.interfaceNumber = interfaceNumber;
+	entry.pipeInId = epIn;
+	entry.pipeOutId = epOut;
+	entry.maxPacketSize = maxPacketSize;
+	entry.lastRequest = lastRequest ? lastRequest : (old ? old->lastRequest : 0);
+	cache->Update(entry);
+	pthread_mutex_unlock(&cacheLock);
+}
+
+int UsbTransport::Write( const uint8_t *bytes, int length )
+{
+	int bytesWritten = 0;
+
+	if ( !handle ) return( 0 );
+	if ( libusb_bulk_transfer(handle,epOut,(unsigned char *)bytes,length,&bytesWritten,SERIAL_TIMEOUT_MS) < 0 )
+		return( 0 );
+	return( bytesWritten );
+}
+
+static void LIBUSB_CALL SubmitDone( libusb_transfer *transfer )
+{
+	*(int *)transfer->user_data = 1;				// outDone of the transport
+}
+
+int UsbTransport::Submit( const uint8_t *bytes, int length )
+{
+	if ( !handle || outPending || (length > (int)sizeof(outBuffer)) ) return( 0 );
+	if ( !outTransfer && !(outTransfer = libusb_alloc_transfer(0)) ) return( 0 );
+	memcpy(outBuffer,bytes,length);
+	libusb_fill_bulk_transfer(outTransfer,handle,epOut,outBuffer,length,SubmitDone,&outDone,SERIAL_TIMEOUT_MS);
+	outPending = 1;
+	outDone = 0;
+	if ( libusb_submit_transfer(outTransfer) < 0 )
+		{
+		outPending = 0;
+		return( 0 );
+		}
+	return( length );
+}
+
+int UsbTransport::Read( uint8_t *bytes, int length, int timeoutMs )
+{
+	int bytesRead = 0;
+
+	if ( !handle ) return( 0 );						// a timeout still reports partial bytes
+	if ( outPending )								// command from Submit() must be out first
+		{
+		while ( !outDone )							// libusb handles events only while this is 0
+			if ( libusb_handle_events_completed(context,&outDone) < 0 ) break;
+		if ( !outDone ) return( 0 );				// still in flight, wait again next time
+		outPending = 0;
+		if ( outTransfer->status != LIBUSB_TRANSFER_COMPLETED ) return( 0 );
+		}
+	libusb_bulk_transfer(handle,epIn,bytes,length,&bytesRead,timeoutMs);
+	return( bytesRead );
+}
+
+void UsbTransport::Detach( void )
+{
+	if ( outPending )								// let a submitted command finish
+		{
+		libusb_cancel_transfer(outTransfer);
+		while ( !outDone )
+			if ( libusb_handle_events_completed(context,&outDone) < 0 ) break;
+		}
+	if ( outTransfer ) libusb_free_transfer(outTransfer);
+	outTransfer = NULL;
+	outPending = 0;
+	if ( handle )
+		{
+		libusb_release_interface(handle,interfaceNumber);	// must release before closing handle
+		libusb_close(handle);
+		}
+	handle = NULL;
+}
+
+void UsbTransport::Close( void )
+{
+	Detach();
+	if ( context ) libusb_exit(context);
+	context = NULL;
+}
+
+#endif
+
+////// protocol helpers /////////////////////////////////////////////////////////////////////////////
+
+bool McaRequest( McaTransport *transport, int request, McaFrame *frame, int timeoutMs )
+{
+	uint8_t cmd[2] = { 0, (uint8_t)request };
+	uint8_t allBytes[MAX_RESPONSE_BYTES];
+	int bytesToRead, bytesRead;
+	double sendTime = MonotonicSeconds();			// the device latches somewhere after this
+
+	if ( !ValidRequest(request) ) return( false );
+	bytesToRead = RequestResponseBytes(request);
+	if ( transport->Write(cmd,2) != 2 ) return( false );
+	bytesRead = transport->Read(allBytes,bytesToRead,timeoutMs);
+	if ( !frame->Decode(allBytes,bytesRead,request) ) return( false );
+	frame->hostTime = MonotonicSeconds();
+	frame->sendTime = sendTime;
+	transport->lastRequest = request;
+	transport->answers++;
+	if ( frame->hasPacket0 ) transport->capemcaId = frame->packet0.capemcaId;
+	return( true );
+}
+
+bool McaZero( McaTransport *transport, int timeoutMs )
+{
+	uint8_t zerocmd[2] = { 1, 1 };					// cmd to zero out the MCA
+	uint8_t echo[2] = { 0, 0 };
+
+	if ( transport->Write(zerocmd,2) != 2 ) return( false );
+	if ( transport->Read(echo,2,timeoutMs) != 2 ) return( false );
+	return( (echo[0] == 1) && (echo[1] == 1) );		// reply should be zero cmd echo
+}
@@ -0,0 +1,106 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Byte transports to an MCA on Linux: UART (termios), USB (libusb) and in-process simulator
+//   methods in mcaTransport.cpp
+//
+// Every transport carries the same protocol: a 2-byte command is written and the response is
+// read back, RequestResponseBytes(request) long for data requests and 2 bytes for {1,1} zero.
+// The USB transport is compiled only when HAVE_LIBUSB is defined (see Makefile). Given a
+// DeviceCache it takes the interface and bulk endpoints of a device it has seen before on the
+// same port from the cache, checked against the descriptors libusb already holds, and skips the
+// serial string read and endpoint search, so Reopen() after a bus glitch takes milliseconds.
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "mcaFrame.h"
+#include "mcaSim.h"
+#include "mcaDeviceCache.h"
+
+#define USB_VENDOR_ID		0x4701					// USB vendor ID of STM32 microcontroller
+#define USB_PRODUCT_ID		0x0290					// USB product ID of same
+#define USB_EP_OUT			0x01					// bulk endpoint for commands, if not found
+#define USB_EP_IN			0x81					// bulk endpoint for responses, if not found
+#define SERIAL_TIMEOUT_MS	1000					// 1 second timeout
+
+class McaTransport {								// base class for all byte transports
+public:
+	int lastRequest;								// last request answered, set by McaRequest()
+	uint32_t capemcaId;								// from the last packet0 answered, 0 if none
+	uint32_t answers;								// requests answered since opened
+
+	McaTransport() { lastRequest = 0; capemcaId = 0; answers = 0; }
+	virtual ~McaTransport() {}
+	virtual int Write( const uint8_t *bytes, int length ) = 0;			// returns bytes written
+	virtual int Submit( const uint8_t *bytes, int length ) { return( Write(bytes,length) ); }
+																		// may return before the bytes
+																		// are sent, next Read waits
+	virtual int Read( uint8_t *bytes, int length, int timeoutMs ) = 0;	// returns bytes read
+	virtual void Close( void ) {}
+	virtual bool Reopen( void ) { return( false ); }	// reconnect the same device after errors
+	virtual void Remember( void ) {}				// note lastRequest and capemcaId in a cache
+};
+
+class SimTransport : public McaTransport {			// in-process simulator, no system calls
+public:
+	McaSim *sim;
+	int packetSize;									// copy in chunks like USB packets, 0 = all
+	int pendingLength, pendingOffset;				// response not yet read
+	uint8_t pending[MAX_RESPONSE_BYTES];
+
+	SimTransport( McaSim *device, int packetBytes = 64 );	// constructor
+	int Write( const uint8_t *bytes, int length );
+	int Read( uint8_t *bytes, int length, int timeoutMs );
+};
+
+class UartTransport : public McaTransport {			// termios serial port, 8N1, no handshaking
+public:
+	int fd;
+
+	UartTransport();								// constructor
+	~UartTransport();								// destructor closes port
+	bool Open( const char *port, int baudRate );	// e.g. /dev/ttyUSB0 at 115200
+	int Write( const uint8_t *bytes, int length );
+	int Read( uint8_t *bytes, int length, int timeoutMs );	// timeout is between bytes
+	void Close( void );
+};
+
+#ifdef HAVE_LIBUSB
+#include <libusb.h>
+
+class UsbTransport : public McaTransport {			// libusb bulk transfers to one MCA
+public:
+	libusb_context *context;
+	libusb_device_handle *handle;
+	char serial[64];								// serial number string of open device
+	char port[32];									// bus-port.port... path of open device
+	uint8_t interfaceNumber, epIn, epOut;			// found in descriptors or taken from cache
+	uint16_t maxPacketSize;
+	bool cached;									// endpoints came from the cache
+	int index;										// as given to Open(), for Reopen()
+	DeviceCache *cache;								// NULL to always search the descriptors
+	libusb_transfer *outTransfer;					// for Submit()
+	uint8_t outBuffer[64];
+	int outPending;									// submitted and not yet waited for
+	int outDone;									// set by the completion callback
+
+	UsbTransport();									// constructor
+	~UsbTransport();								// destructor closes device
+	bool Open( int deviceIndex, DeviceCache *deviceCache = NULL );	// the index'th MCA on the bus
+	bool Reopen( void );							// same index, keeps the libusb context
+	void Remember( void );							// update the cache entry of this device
+	int Write( const uint8_t *bytes, int length );
+	int Submit( const uint8_t *bytes, int length );	// asynchronous bulk out transfer
+	int Read( uint8_t *bytes, int length, int timeoutMs );
+	void Close( void );
+
+	bool Attach( void );							// find, open and claim the device
+	void Detach( void );							// release and close the device handle
+	bool FindEndpoints( libusb_device *dev );		// first interface with bulk in and out
+	bool CheckEndpoints( libusb_device *dev, const DEVICE_CACHE_ENTRY &entry );
+	void ReadSerial( void );							// string descriptor, a control transfer
+};
+#endif
+
+int OpenSerialPort( const char *port, int baudRate );	// raw 8N1 non-blocking fd, -1 on failure
+bool McaRequest( McaTransport *transport, int request, McaFrame *frame, int timeoutMs = SERIAL_TIMEOUT_MS );
+bool McaZero( McaTransport *transport, int timeoutMs = SERIAL_TIMEOUT_MS );	// true if echo received
@@ -0,0 +1,103 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Class methods for resolution switching on ROI or rate triggers
+//   definitions in mcaTrigger.h
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "mcaTrigger.h"
+
+uint64_t RoiSum( const McaFrame &frame, int lo, int hi )
+{
+	uint64_t sum = 0;
+	int bin;
+
+	if ( !frame.channels ) return( 0 );
+	bin = MAX_SPECTRUM_SIZE/frame.channels;			// full resolution channels per frame channel
+	for (int i=lo/bin; i<hi/bin; i++) sum += frame.spectrum[i];
+	return( sum );
+}
+
+ResolutionTrigger::ResolutionTrigger( int quietRequest, int triggeredRequest )
+{
+	lowRequest = quietRequest;
+	highRequest = triggeredRequest;
+	high = false;
+	roiLo = roiHi = 0;
+	roiCounts = cps = 0.0;
+	release = 0.5;
+	holdReadouts = 3;
+	switches = highReadouts = readouts = 0;
+	Reset();
+}
+
+bool ResolutionTrigger::SetRoi( int lo, int hi )
+{
+	if ( (lo < 0) || (hi <= lo) || (hi > MAX_SPECTRUM_SIZE) ) return( false );
+	roiLo = lo/TRIGGER_ROI_ALIGN*TRIGGER_ROI_ALIGN;
+	roiHi = (hi + TRIGGER_ROI_ALIGN - 1)/TRIGGER_ROI_ALIGN*TRIGGER_ROI_ALIGN;
+	havePrevious = false;
+	return( true );
+}
+
+int ResolutionTrigger::Request( void )
+{
+	return( high ? highRequest : lowRequest );
+}
+
+void ResolutionTrigger::Reset( void )
+{
+	quiet = 0;
+	havePrevious = false;
+	previousRoi = 0;
+	lastRoiCounts = lastCps = 0.0;
+}
+
+void ResolutionTrigger::Hold( void )
+{
+	if ( !high ) switches++;
+	high = true;
+	quiet = 0;
+}
+
+int ResolutionTrigger::Update( const McaFrame &frame )
+{
+	bool fired = false, calm = true;				// a trigger without data is calm
+
+	readouts++;
+	if ( frame.request == highRequest ) highReadouts++;
+	if ( (roiCounts > 0.0) && frame.channels )
+		{
+		uint64_t sum = RoiSum(frame,roiLo,roiHi);
+		if ( havePrevious && (sum >= previousRoi) )	// smaller sum means the MCA was zeroed
+			{
+			lastRoiCounts = (double)(sum - previousRoi);
+			fired |= (lastRoiCounts >= roiCounts);
+			calm &= (lastRoiCounts < release*roiCounts);
+			}
+		previousRoi = sum;
+		havePrevious = true;
+		}
+	if ( (cps > 0.0) && frame.hasPacket0 )
+		{
+		lastCps = frame.packet0.cps;
+		fired |= (lastCps >= cps);
+		calm &= (lastCps < release*cps);
+		}
+
+	if ( !high && fired )
+		{
+		high = true;
+		quiet = 0;
+		switches++;
+		}
+	else if ( high )								// hysteresis and hold-off on the way down
+		{
+		if ( !calm ) quiet = 0;
+		else if ( ++quiet >= holdReadouts )
+			{
+			high = false;
+			quiet = 0;
+			switches++;
+			}
+		}
+	return( Request() );
+}
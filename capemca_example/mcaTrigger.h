@@ -0,0 +1,43 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Switching between cheap and full resolution readouts on ROI or rate triggers
+//   methods in mcaTrigger.cpp
+//
+// The MCA keeps one cumulative 4096-channel spectrum and bins it down for the lower resolution
+// requests, so the counts in an ROI whose ends fall on 16-channel boundaries (one channel at
+// 256) are the same whatever request read them. The trigger differences those ROI sums between
+// consecutive readouts and fires when the new counts, or packet0 cps, reach their thresholds.
+// It then asks for highRequest until holdReadouts readouts in a row fall below release times
+// the thresholds, and goes back to lowRequest. A threshold of 0 disables that trigger; the ROI
+// trigger needs a lowRequest with channels, the rate trigger one with packet0.
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "mcaFrame.h"
+
+#define TRIGGER_ROI_ALIGN		(MAX_SPECTRUM_SIZE/CHANNELS_PER_REQUEST)	// 16 channels
+
+class ResolutionTrigger {
+public:
+	int lowRequest, highRequest;					// quiet and triggered request codes
+	int roiLo, roiHi;								// 4096-channel units, aligned, hi exclusive
+	double roiCounts;								// new ROI counts per readout to trigger
+	double cps;										// packet0 cps to trigger
+	double release;									// fraction of the thresholds to fall back
+	int holdReadouts;								// quiet readouts before falling back
+	bool high;										// currently asking for highRequest
+	int quiet;										// quiet readouts so far while high
+	bool havePrevious;
+	uint64_t previousRoi;							// cumulative ROI sum of the last readout
+	double lastRoiCounts, lastCps;					// what the last Update() saw
+	uint32_t switches, highReadouts, readouts;
+
+	ResolutionTrigger( int quietRequest = 32+1, int triggeredRequest = 32+16 );	// constructor
+	bool SetRoi( int lo, int hi );					// widened to TRIGGER_ROI_ALIGN boundaries
+	int Request( void );							// request code for the next readout
+	int Update( const McaFrame &frame );			// returns request code for the next readout
+	void Reset( void );								// after a zero, cumulative sums restart
+	void Hold( void );								// go to highRequest now, as if a trigger fired
+};
+
+uint64_t RoiSum( const McaFrame &frame, int lo, int hi );	// lo, hi in 4096-channel units
@@ -0,0 +1,244 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Class methods for the epoll serial engine
+//   definitions in mcaUartEngine.h
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <sys/epoll.h>
+#include "mcaUartEngine.h"
+#include "mcaTransport.h"
+
+UartPort::UartPort()								// constructor
+{
+	name[0] = 0;
+	index = 0;
+	fd = -1;
+	request = 34;
+	state = UART_PORT_IDLE;
+	commandSent = 0;
+	wantWrite = false;
+	expected = received = 0;
+	due = deadline = sentTime = 0.0;
+	frames = timeouts = badFrames = strayBytes = bytes = 0;
+	latencySum = 0.0;
+}
+
+UartEngine::UartEngine()							// constructor
+{
+	epollFd = epoll_create1(EPOLL_CLOEXEC);
+	ports = 0;
+	intervalMs = 0;
+	timeoutMs = SERIAL_TIMEOUT_MS;
+	handler = NULL;
+	context = NULL;
+}
+
+UartEngine::~UartEngine()							// destructor
+{
+	Close();
+	if ( epollFd >= 0 ) close(epollFd);
+}
+
+int UartEngine::Open( const char *device, int baudRate, int request )
+{
+	int fd = OpenSerialPort(device,baudRate);
+
+	if ( fd < 0 ) return( -1 );
+	int n = Adopt(fd,device,request);
+	if ( n < 0 ) close(fd);
+	return( n );
+}
+
+int UartEngine::Adopt( int fd, const char *name, int request )
+{
+	struct epoll_event ev;
+	UartPort *p;
+
+	if ( (epollFd < 0) || (ports == UART_ENGINE_MAX_PORTS) || !ValidRequest(request) ) return( -1 );
+	fcntl(fd,F_SETFL,fcntl(fd,F_GETFL) | O_NONBLOCK);
+	memset(&ev,0,sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u32 = ports;
+	if ( epoll_ctl(epollFd,EPOLL_CTL_ADD,fd,&ev) < 0 )
+		{
+		printf("epoll_ctl failed on %s: %s\n",name,strerror(errno));
+		return( -1 );
+		}
+	p = port[ports] = new UartPort;
+	snprintf(p->name,sizeof(p->name),"%s",name);
+	p->index = ports;
+	p->fd = fd;
+	p->request = request;
+	p->due = MonotonicSeconds();					// ask right away
+	return( ports++ );
+}
+
+static void WantWrite( int epollFd, UartPort *p, bool want )
+{
+	struct epoll_event ev;
+
+	if ( p->wantWrite == want ) return;
+	memset(&ev,0,sizeof(ev));
+	ev.events = want ? EPOLLIN | EPOLLOUT : EPOLLIN;
+	ev.data.u32 = p->index;
+	epoll_ctl(epollFd,EPOLL_CTL_MOD,p->fd,&ev);
+	p->wantWrite = want;
+}
+
+void UartEngine::Send( UartPort *p, double now )
+{
+	int n;
+
+	if ( p->state == UART_PORT_IDLE )
+		{
+		p->command[0] = 0;
+		p->command[1] = (uint8_t)p->request;
+		p->commandSent = 0;
+		p->received = 0;
+		p->expected = RequestResponseBytes(p->request);
+		p->sentTime = now;
+		p->state = UART_PORT_SENDING;
+		}
+	n = write(p->fd,p->command+p->commandSent,2-p->commandSent);
+	if ( n > 0 ) p->commandSent += n;
+	else if ( (n < 0) && (errno != EAGAIN) && (errno != EINTR) )
+		{
+		Timeout(p,now);								// port is gone or broken, retry later
+		p->due = now + timeoutMs*1.0e-3;
+		return;
+		}
+	p->deadline = now + timeoutMs*1.0e-3;
+	if ( p->commandSent == 2 ) p->state = UART_PORT_RECEIVING;
+	WantWrite(epollFd,p,p->commandSent < 2);		// rest of the command when there is room
+}
+
+void UartEngine::Receive( UartPort *p, double now )
+{
+	uint8_t stray[256];
+	int n;
+
+	for (;;)										// everything waiting, without blocking
+		{
+		if ( p->state == UART_PORT_RECEIVING ) n = read(p->fd,p->response+p->received,p->expected-p->received);
+		else n = read(p->fd,stray,sizeof(stray));	// late bytes of a response given up on
+		if ( n == 0 )								// hangup, e.g. the far end of a pty closed
+			{
+			epoll_ctl(epollFd,EPOLL_CTL_DEL,p->fd,NULL);
+			p->state = UART_PORT_IDLE;
+			p->due = HUGE_VAL;
+			return;
+			}
+		if ( n < 0 ) return;						// EAGAIN: drained
+		p->bytes += n;
+		if ( p->state != UART_PORT_RECEIVING )
+			{
+			p->strayBytes += n;
+			continue;
+			}
+		p->received += n;
+		p->deadline = now + timeoutMs*1.0e-3;		// timeout is between bytes, like UartTransport
+		if ( p->received < p->expected ) continue;
+
+		if ( p->frame.Decode(p->response,p->received,p->request) )
+			{
+			p->frame.hostTime = now;
+			p->frame.sendTime = p->sentTime;
+			p->frames++;
+			p->latencySum += now - p->sentTime;
+			if ( handler ) handler(p->index,p->frame,context);
+			}
+		else p->badFrames++;
+		p->state = UART_PORT_IDLE;
+		p->due = intervalMs ? p->sentTime + intervalMs*1.0e-3 : now;	// fixed rate, not fixed gap
+		if ( p->due < now ) p->due = now;
+		}
+}
+
+void UartEngine::Timeout( UartPort *p, double now )
+{
+	p->timeouts++;
+	WantWrite(epollFd,p,false);
+	tcflush(p->fd,TCIFLUSH);						// a partial response is useless
+	p->state = UART_PORT_IDLE;
+	p->due = now;
+}
+
+double UartEngine::NextDeadline( void )
+{
+	double next = HUGE_VAL;
+
+	for (int n=0; n<ports; n++)
+		{
+		double t = port[n]->state == UART_PORT_IDLE ? port[n]->due : port[n]->deadline;
+		if ( t < next ) next = t;
+		}
+	return( next );
+}
+
+void UartEngine::Poll( int waitMs )
+{
+	struct epoll_event events[UART_ENGINE_MAX_PORTS];
+	double now = MonotonicSeconds(), next = NextDeadline();
+	int ready, ms = waitMs;
+
+	if ( next < now + waitMs*1.0e-3 ) ms = next <= now ? 0 : (int)ceil((next - now)*1.0e3);
+	ready = epoll_wait(epollFd,events,UART_ENGINE_MAX_PORTS,ms);
+	now = MonotonicSeconds();
+	for (int e=0; e<ready; e++)
+		{
+		UartPort *p = port[events[e].data.u32];
+		if ( events[e].events & (EPOLLIN | EPOLLHUP | EPOLLERR) ) Receive(p,now);
+		if ( (events[e].events & EPOLLOUT) && (p->state == UART_PORT_SENDING) ) Send(p,now);
+		}
+	for (int n=0; n<ports; n++)						// deadlines that passed
+		{
+		UartPort *p = port[n];
+		if ( (p->state != UART_PORT_IDLE) && (now >= p->deadline) ) Timeout(p,now);
+		if ( (p->state == UART_PORT_IDLE) && (now >= p->due) ) Send(p,now);
+		}
+}
+
+uint64_t UartEngine::Frames( void )
+{
+	uint64_t frames = 0;
+
+	for (int n=0; n<ports; n++) frames += port[n]->frames;
+	return( frames );
+}
+
+uint64_t UartEngine::Run( double seconds )
+{
+	uint64_t start = Frames();
+	double stop = MonotonicSeconds() + seconds;
+
+	while ( MonotonicSeconds() < stop )
+		{
+		double left = stop - MonotonicSeconds();
+		Poll(left > 0.1 ? 100 : (int)(left*1.0e3) + 1);
+		}
+	return( Frames() - start );
+}
+
+uint64_t UartEngine::RunFrames( uint64_t count )
+{
+	uint64_t start = Frames();
+
+	while ( (Frames() - start < count) && (NextDeadline() < HUGE_VAL) ) Poll(timeoutMs);
+	return( Frames() - start );
+}
+
+void UartEngine::Close( void )
+{
+	for (int n=0; n<ports; n++)
+		{
+		if ( port[n]->fd >= 0 ) close(port[n]->fd);	// also leaves the epoll set
+		delete port[n];
+		}
+	ports = 0;
+}
@@ -0,0 +1,71 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Many serial MCAs driven from one epoll loop on Linux
+//   methods in mcaUartEngine.cpp
+//
+// Each port runs the protocol as a small state machine: when its next request is due it writes
+// the 2-byte command, then collects exactly RequestResponseBytes(request) bytes as they arrive
+// and hands the decoded frame to the handler. A port that stays silent for timeoutMs while its
+// response is incomplete is flushed and asked again. One thread serves every port, sleeping in
+// epoll_wait until a byte arrives or the earliest per-port deadline passes, so slow and fast
+// ports (direct UARTs, Arduino Serial1 bridges, ptys) never hold each other up.
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "mcaFrame.h"
+
+#define UART_ENGINE_MAX_PORTS	32
+
+#define UART_PORT_IDLE			0					// waiting until the next request is due
+#define UART_PORT_SENDING		1					// command partly written
+#define UART_PORT_RECEIVING		2					// command out, response incomplete
+
+typedef void (*UartFrameHandler)( int port, const McaFrame &frame, void *context );
+
+class UartPort {									// one serial MCA
+public:
+	char name[64];
+	int index;										// in UartEngine::port[]
+	int fd;
+	int request;									// request code sent every time
+	int state;										// UART_PORT_IDLE ...
+	uint8_t command[2];
+	int commandSent;
+	bool wantWrite;									// EPOLLOUT is in the interest set
+	int expected, received;							// response bytes
+	uint8_t response[MAX_RESPONSE_BYTES];
+	double due;										// monotonic seconds of next request
+	double deadline;								// give up on the response after this
+	double sentTime;								// when the command went out
+	McaFrame frame;									// last decoded response
+	uint64_t frames, timeouts, badFrames, strayBytes, bytes;
+	double latencySum;								// command to last byte, over frames
+
+	UartPort();										// constructor
+};
+
+class UartEngine {
+public:
+	int epollFd;
+	int ports;
+	UartPort *port[UART_ENGINE_MAX_PORTS];
+	int intervalMs;									// request period of each port, 0 = back to back
+	int timeoutMs;									// silence allowed inside a response
+	UartFrameHandler handler;						// called for every frame, may be NULL
+	void *context;
+
+	UartEngine();									// constructor
+	~UartEngine();									// destructor closes every port
+	int Open( const char *device, int baudRate, int request );	// port number, -1 on failure
+	int Adopt( int fd, const char *name, int request );	// an already configured descriptor
+	void Poll( int waitMs );						// one epoll_wait and whatever became due
+	uint64_t Run( double seconds );					// poll until seconds passed, returns frames
+	uint64_t RunFrames( uint64_t count );			// poll until count more frames arrived
+	uint64_t Frames( void );						// over all ports
+	void Close( void );
+
+	void Send( UartPort *p, double now );			// state machine steps
+	void Receive( UartPort *p, double now );
+	void Timeout( UartPort *p, double now );
+	double NextDeadline( void );
+};
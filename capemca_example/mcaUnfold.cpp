@@ -0,0 +1,462 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Class methods for response-matrix unfolding
+//   definitions in mcaUnfold.h
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "mcaUnfold.h"
+
+#define UNFOLD_PEAK_SIGMAS		4.0					// photopeak support either side of E
+#define UNFOLD_MIN_RESPONSE		1.0e-9				// smaller matrix elements are dropped
+#define ELECTRON_KEV			511.0
+
+typedef float v4sf __attribute__((vector_size(16)));	// SSE on x86, NEON on ARM
+
+static inline v4sf Load4( const float *p )			// unaligned load
+{
+	v4sf v;
+	memcpy(&v,p,sizeof(v));
+	return( v );
+}
+
+static inline void Store4( float *p, v4sf v )		// unaligned store
+{
+	memcpy(p,&v,sizeof(v));
+}
+
+static inline float Dot( const float * __restrict a, const float * __restrict b, int n )
+{
+	v4sf sum = { 0, 0, 0, 0 };
+	float total;
+	int i;
+
+	for (i=0; i+4<=n; i+=4) sum += Load4(a+i)*Load4(b+i);
+	total = sum[0] + sum[1] + sum[2] + sum[3];
+	for (; i<n; i++) total += a[i]*b[i];
+	return( total );
+}
+
+static inline void Axpy( float a, const float * __restrict v, float * __restrict to, int n )	// to += a v
+{
+	v4sf av = { a, a, a, a };
+	int i;
+
+	for (i=0; i+4<=n; i+=4) Store4(to+i,Load4(to+i) + av*Load4(v+i));
+	for (; i<n; i++) to[i] += a*v[i];
+}
+
+////// Unfolder /////////////////////////////////////////////////////////////////////////////////////
+
+Unfolder::Unfolder()								// constructor
+{
+	model.keVPerChannel = 0.5;
+	model.offsetKeV = 0.0;
+	model.fwhm662 = 0.07;
+	model.peakFraction = 0.6;
+	model.minKeV = 20.0;
+	model.maxKeV = 2000.0;
+	model.bins = 256;
+	model.logBins = false;
+	layers = 0;
+	iterations = 50;
+	tolerance = 1.0e-4;
+	subsets = 1;
+	warm = true;
+	channels = bins = 0;
+	haveEdges = false;
+	nonZeros = 0;
+	rowStart = NULL;
+	run = NULL;
+	value = NULL;
+	sensitivitySubsets = 0;
+	sensitivity = total = x = y = partial = NULL;
+	counted = NULL;
+	runPhase = subset = rowJobs = 0;
+	haveSolution = false;
+	lastIterations = 0;
+	lastChange = 0.0;
+	pool = NULL;
+}
+
+Unfolder::~Unfolder()								// destructor
+{
+	delete pool;
+	free(rowStart);
+	free(run);
+	free(value);
+	free(sensitivity);
+	free(total);
+	free(x);
+	free(y);
+	free(counted);
+	free(partial);
+}
+
+bool Unfolder::AddLayer( const char *path, double gPerCm2 )
+{
+	FILE *f;
+	char line[256];
+	UNFOLD_LAYER *l;
+	double keV, mu;
+
+	if ( layers >= UNFOLD_MAX_LAYERS ) return( false );
+	if ( !(f = fopen(path,"r")) )
+		{
+		printf("Cannot open %s\n",path);
+		return( false );
+		}
+	l = &layer[layers];
+	l->points = 0;
+	l->gPerCm2 = gPerCm2;
+	while ( fgets(line,sizeof(line),f) )			// header and comment lines do not parse
+		if ( (sscanf(line,"%lf,%lf",&keV,&mu) == 2) && (keV > 0.0) && (mu > 0.0) &&
+			 (l->points < UNFOLD_MAX_POINTS) && (!l->points || (keV > l->keV[l->points-1])) )
+			{
+			l->keV[l->points] = keV;
+			l->mu[l->points++] = mu;
+			}
+	fclose(f);
+	if ( l->points < 2 )
+		{
+		printf("%s needs at least two increasing keV,mu lines\n",path);
+		return( false );
+		}
+	layers++;
+	return( true );
+}
+
+double Unfolder::Transmission( double keV )
+{
+	double exponent = 0.0;
+
+	for (int n=0; n<layers; n++)					// mu(E) log-log between table points, ends held
+		{
+		const UNFOLD_LAYER &l = layer[n];
+		int k = 1;
+		double mu, f;
+		if ( keV <= l.keV[0] ) mu = l.mu[0];
+		else if ( keV >= l.keV[l.points-1] ) mu = l.mu[l.points-1];
+		else
+			{
+			while ( l.keV[k] < keV ) k++;
+			f = log(keV/l.keV[k-1])/log(l.keV[k]/l.keV[k-1]);
+			mu = exp(log(l.mu[k-1]) + f*log(l.mu[k]/l.mu[k-1]));
+			}
+		exponent += mu*l.gPerCm2;
+		}
+	return( exp(-exponent) );
+}
+
+bool Unfolder::Build( int nChannels )
+{
+	double kpc, e, t, sigma, comptonEdge, a, b, v, peak;
+	uint32_t n = 0, capacity = 1 << 16;
+	uint16_t *channel, *bin;
+	float *element;
+	int last;
+	bool ok;
+
+	if ( (nChannels < 1) || (nChannels > MAX_SPECTRUM_SIZE) || (model.bins < 1) || (model.bins > UNFOLD_MAX_BINS) ||
+		 (model.minKeV < 0.0) || (model.maxKeV <= model.minKeV) || (model.logBins && (model.minKeV <= 0.0)) ||
+		 (model.keVPerChannel <= 0.0) || (model.fwhm662 <= 0.0) )
+		return( false );
+	for (int j=0; j<=model.bins; j++)
+		edge[j] = model.logBins ? model.minKeV*pow(model.maxKeV/model.minKeV,(double)j/model.bins) :
+				model.minKeV + (model.maxKeV - model.minKeV)*j/model.bins;
+
+	channel = (uint16_t *)malloc(capacity*sizeof(uint16_t));
+	bin = (uint16_t *)malloc(capacity*sizeof(uint16_t));
+	element = (float *)malloc(capacity*sizeof(float));
+	kpc = model.keVPerChannel*MAX_SPECTRUM_SIZE/nChannels;
+	for (int j=0; j<model.bins; j++)				// one column per incident energy
+		{
+		e = model.logBins ? sqrt(edge[j]*edge[j+1]) : 0.5*(edge[j] + edge[j+1]);
+		t = Transmission(e);
+		sigma = model.fwhm662*662.0/2.3548*sqrt(e/662.0);
+		comptonEdge = e*(2.0*e/ELECTRON_KEV)/(1.0 + 2.0*e/ELECTRON_KEV);
+		last = (int)ceil((e + UNFOLD_PEAK_SIGMAS*sigma - model.offsetKeV)/kpc);
+		if ( last > nChannels ) last = nChannels;
+		for (int c=0; c<last; c++)
+			{
+			a = model.offsetKeV + kpc*c;			// channel covers [a,b) keV
+			b = a + kpc;
+			peak = 0.0;
+			if ( (b > e - UNFOLD_PEAK_SIGMAS*sigma) && (a < e + UNFOLD_PEAK_SIGMAS*sigma) )
+				peak = 0.5*(erf((b - e)/(M_SQRT2*sigma)) - erf((a - e)/(M_SQRT2*sigma)));
+			v = model.peakFraction*peak;
+			if ( (a < comptonEdge) && (b > 0.0) )	// flat continuum on [0,comptonEdge)
+				v += (1.0 - model.peakFraction)*((b < comptonEdge ? b : comptonEdge) - (a > 0.0 ? a : 0.0))/comptonEdge;
+			v *= t;
+			if ( v < UNFOLD_MIN_RESPONSE ) continue;
+			if ( n == capacity )
+				{
+				capacity *= 2;
+				channel = (uint16_t *)realloc(channel,capacity*sizeof(uint16_t));
+				bin = (uint16_t *)realloc(bin,capacity*sizeof(uint16_t));
+				element = (float *)realloc(element,capacity*sizeof(float));
+				}
+			channel[n] = c;
+			bin[n] = j;
+			element[n++] = (float)v;
+			}
+		}
+	ok = SetMatrix(nChannels,model.bins,n,channel,bin,element);
+	haveEdges = ok;
+	free(channel);
+	free(bin);
+	free(element);
+	return( ok );
+}
+
+bool Unfolder::Load( const char *path, int nChannels )
+{
+	FILE *f;
+	char line[256];
+	int c, j, nBins = 0;
+	float v;
+	uint32_t n = 0, capacity = 1 << 16;
+	uint16_t *channel, *bin;
+	float *element;
+	bool ok;
+
+	if ( !(f = fopen(path,"r")) )
+		{
+		printf("Cannot open %s\n",path);
+		return( false );
+		}
+	channel = (uint16_t *)malloc(capacity*sizeof(uint16_t));
+	bin = (uint16_t *)malloc(capacity*sizeof(uint16_t));
+	element = (float *)malloc(capacity*sizeof(float));
+	while ( fgets(line,sizeof(line),f) )			// header and comment lines do not parse
+		{
+		if ( (sscanf(line,"%d,%d,%f",&c,&j,&v) != 3) || (v <= 0.0f) ) continue;
+		if ( (c < 0) || (c >= nChannels) || (j < 0) || (j >= UNFOLD_MAX_BINS) ) continue;
+		if ( n == capacity )
+			{
+			capacity *= 2;
+			channel = (uint16_t *)realloc(channel,capacity*sizeof(uint16_t));
+			bin = (uint16_t *)realloc(bin,capacity*sizeof(uint16_t));
+			element = (float *)realloc(element,capacity*sizeof(float));
+			}
+		channel[n] = c;
+		bin[n] = j;
+		element[n++] = v;
+		if ( j >= nBins ) nBins = j + 1;
+		}
+	fclose(f);
+	ok = n && SetMatrix(nChannels,nBins,n,channel,bin,element);
+	if ( !ok ) printf("%s has no channel,bin,value lines for %d channels\n",path,nChannels);
+	haveEdges = false;
+	free(channel);
+	free(bin);
+	free(element);
+	return( ok );
+}
+
+bool Unfolder::SetMatrix( int nChannels, int nBins, uint32_t n, const uint16_t *channel, const uint16_t *bin, const float *v )
+{
+	uint32_t *count, *order, *sorted, runs = 0, values = 0;
+
+	if ( (nChannels < 1) || (nChannels > MAX_SPECTRUM_SIZE) || (nBins < 1) || (nBins > UNFOLD_MAX_BINS) ) return( false );
+	channels = nChannels;
+	bins = nBins;
+	nonZeros = n;
+
+	count = (uint32_t *)calloc((channels > bins ? channels : bins) + 1,sizeof(uint32_t));
+	order = (uint32_t *)malloc((n ? n : 1)*sizeof(uint32_t));
+	sorted = (uint32_t *)malloc((n ? n : 1)*sizeof(uint32_t));
+	for (uint32_t k=0; k<n; k++) count[bin[k]+1]++;	// counting sort by bin, then stable by channel
+	for (int j=0; j<bins; j++) count[j+1] += count[j];
+	for (uint32_t k=0; k<n; k++) order[count[bin[k]]++] = k;
+	memset(count,0,(channels+1)*sizeof(uint32_t));
+	for (uint32_t k=0; k<n; k++) count[channel[k]+1]++;
+	for (int i=0; i<channels; i++) count[i+1] += count[i];
+	rowStart = (uint32_t *)realloc(rowStart,(channels+1)*sizeof(uint32_t));
+	for (uint32_t k=0; k<n; k++) sorted[count[channel[order[k]]]++] = order[k];
+
+	run = (UNFOLD_RUN *)realloc(run,(n ? n : 1)*sizeof(UNFOLD_RUN));
+	value = (float *)realloc(value,(n ? n : 1)*sizeof(float));
+	for (uint32_t k=0, i=0; i<=(uint32_t)channels; i++)	// runs of consecutive bins in each row
+		{
+		rowStart[i] = runs;
+		if ( i == (uint32_t)channels ) break;
+		for (; (k<n) && (channel[sorted[k]] == i); k++)
+			{
+			uint32_t e = sorted[k];
+			if ( (runs > rowStart[i]) && (bin[e] == run[runs-1].bin + run[runs-1].length - 1) )
+				value[values-1] += v[e];			// same element again
+			else if ( (runs > rowStart[i]) && (bin[e] == run[runs-1].bin + run[runs-1].length) )
+				{
+				run[runs-1].length++;
+				value[values++] = v[e];
+				}
+			else
+				{
+				run[runs].bin = bin[e];
+				run[runs].length = 1;
+				run[runs++].value = values;
+				value[values++] = v[e];
+				}
+			}
+		}
+	free(count);
+	free(order);
+	free(sorted);
+
+	total = (float *)realloc(total,bins*sizeof(float));
+	x = (float *)realloc(x,bins*sizeof(float));
+	y = (float *)realloc(y,channels*sizeof(float));
+	counted = (int *)realloc(counted,channels*sizeof(int));
+	partial = (float *)realloc(partial,UNFOLD_ROW_JOBS*bins*sizeof(float));
+	sensitivitySubsets = 0;							// summed again on the next Unfold()
+	haveSolution = false;
+	return( true );
+}
+
+void Unfolder::Sensitivities( void )
+{
+	int S = subsets < 1 ? 1 : subsets > UNFOLD_MAX_SUBSETS ? UNFOLD_MAX_SUBSETS : subsets;
+
+	subsets = sensitivitySubsets = S;
+	sensitivity = (float *)realloc(sensitivity,S*bins*sizeof(float));
+	memset(sensitivity,0,S*bins*sizeof(float));
+	memset(total,0,bins*sizeof(float));
+	for (int i=0; i<channels; i++)
+		for (uint32_t r=rowStart[i]; r<rowStart[i+1]; r++)
+			{
+			float *s = sensitivity + (i % S)*bins + run[r].bin;
+			for (int k=0; k<run[r].length; k++)
+				{
+				s[k] += value[run[r].value+k];
+				total[run[r].bin+k] += value[run[r].value+k];
+				}
+			}
+}
+
+void Unfolder::SetThreads( int n )
+{
+	delete pool;
+	pool = NULL;
+	if ( n == 1 ) return;
+	pool = new WorkerPool(n);
+	if ( !pool->threads )							// one cpu, no point in handing jobs around
+		{
+		delete pool;
+		pool = NULL;
+		}
+}
+
+static void UnfoldJob( void *context, int job )	// one job of a pool batch
+{
+	Unfolder *u = (Unfolder *)context;
+
+	u->Job(u->runPhase,job);
+}
+
+void Unfolder::Run( int phase, int n )
+{
+	runPhase = phase;
+	if ( pool ) pool->Run(UnfoldJob,this,n);
+	else for (int job=0; job<n; job++) Job(phase,job);
+}
+
+void Unfolder::Job( int phase, int job )
+{
+	if ( phase == UNFOLD_PHASE_ROWS )				// partial = R^T (y / R x) over a block of counted rows
+		{
+		float *back = partial + job*bins;
+		int first = countedStart[subset] + job*UNFOLD_ROW_BLOCK;
+		int end = first + UNFOLD_ROW_BLOCK < countedStart[subset+1] ? first + UNFOLD_ROW_BLOCK : countedStart[subset+1];
+		memset(back,0,bins*sizeof(float));
+		for (int c=first; c<end; c++)
+			{
+			int i = counted[c];
+			float predicted = 0.0f, ratio;
+			for (uint32_t r=rowStart[i]; r<rowStart[i+1]; r++)
+				predicted += Dot(value+run[r].value,x+run[r].bin,run[r].length);
+			if ( predicted <= 0.0f ) continue;
+			ratio = y[i]/predicted;
+			for (uint32_t r=rowStart[i]; r<rowStart[i+1]; r++)	// row is still in cache
+				Axpy(ratio,value+run[r].value,back+run[r].bin,run[r].length);
+			}
+		}
+	else											// x *= sum of partials / s over a block of bins
+		{
+		const float *s = sensitivity + subset*bins;
+		int end = (job+1)*UNFOLD_BIN_BLOCK < bins ? (job+1)*UNFOLD_BIN_BLOCK : bins;
+		double change = 0.0, sum = 0.0;
+		for (int j=job*UNFOLD_BIN_BLOCK; j<end; j++)
+			{
+			float back = 0.0f, updated;
+			if ( s[j] <= 0.0f ) continue;
+			for (int p=0; p<rowJobs; p++) back += partial[p*bins + j];
+			updated = x[j]*back/s[j];
+			if ( updated < 1.0e-20f ) updated = 0.0f;	// no denormals, the warm start floor revives it
+			change += fabs(updated - x[j]);
+			sum += updated;
+			x[j] = updated;
+			}
+		jobChange[job] = change;
+		jobSum[job] = sum;
+		}
+}
+
+int Unfolder::Unfold( const uint32_t *counts, int nChannels )
+{
+	double sumCounts = 0.0, predicted = 0.0, sensed = 0.0, change, sum, floor;
+	int pass, binJobs, n = 0;
+
+	if ( !channels || (nChannels != channels) ) return( -1 );
+	if ( sensitivitySubsets != subsets ) Sensitivities();
+	for (int s=0; s<subsets; s++)					// counted channels of each subset
+		{
+		countedStart[s] = n;
+		for (int i=s; i<channels; i+=subsets)
+			if ( counts[i] ) counted[n++] = i;
+		}
+	countedStart[subsets] = n;
+	for (int i=0; i<channels; i++) sumCounts += (y[i] = (float)counts[i]);
+	for (int j=0; j<bins; j++)
+		{
+		predicted += (double)x[j]*total[j];
+		sensed += total[j];
+		}
+	lastIterations = 0;
+	lastChange = 0.0;
+	if ( (sumCounts <= 0.0) || (sensed <= 0.0) )
+		{
+		memset(x,0,bins*sizeof(float));
+		haveSolution = false;
+		return( 0 );
+		}
+
+	floor = 1.0e-3*sumCounts/sensed;				// no bin is stuck at 0 by a warm start
+	for (int j=0; j<bins; j++)						// solution rescaled to these counts, or flat
+		if ( total[j] <= 0.0f ) x[j] = 0.0f;
+		else if ( warm && haveSolution && (predicted > 0.0) )
+			x[j] = (float)fmax(x[j]*sumCounts/predicted,floor);
+		else x[j] = (float)(sumCounts/sensed);
+
+	binJobs = (bins + UNFOLD_BIN_BLOCK - 1)/UNFOLD_BIN_BLOCK;
+	for (pass=0; pass<iterations; )
+		{
+		change = sum = 0.0;
+		for (subset=0; subset<subsets; subset++)
+			{
+			rowJobs = (countedStart[subset+1] - countedStart[subset] + UNFOLD_ROW_BLOCK - 1)/UNFOLD_ROW_BLOCK;
+			Run(UNFOLD_PHASE_ROWS,rowJobs);
+			Run(UNFOLD_PHASE_BINS,binJobs);
+			for (int job=0; job<binJobs; job++) change += jobChange[job];
+			}
+		for (int job=0; job<binJobs; job++) sum += jobSum[job];
+		pass++;
+		lastChange = sum > 0.0 ? change/sum : 0.0;
+		if ( lastChange < tolerance ) break;
+		}
+	haveSolution = true;
+	lastIterations = pass;
+	return( pass );
+}
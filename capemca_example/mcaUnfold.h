@@ -0,0 +1,110 @@
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// Response-matrix unfolding of measured spectra into incident photon spectra (MLEM / OSEM)
+//   methods in mcaUnfold.cpp
+//
+// The response R[i][j] is the expected count in channel i per photon in incident energy bin j.
+// It is loaded as "channel,bin,value" triplets, or built from a simple detector model: a
+// gaussian photopeak with FWHM growing as sqrt(E), a flat Compton continuum up to the Compton
+// edge, all times the transmission exp(-sum mu(E) x) of absorber layers read from "keV,mu"
+// tables (mass attenuation in cm^2/g, x in g/cm^2, e.g. air and iron).
+//
+// For counts y the MLEM update is
+//   x[j] <- x[j] / s[j] * sum_i R[i][j] y[i] / (R x)[i],   s[j] = sum_i R[i][j]
+// and OSEM applies it once per subset of channels (every subsets'th channel), which gives about
+// subsets times the progress per pass. Channels with no counts add nothing to the sum, so only
+// the rows of counted channels are read, and each is read once per pass: the forward product
+// (R x)[i] and the back projection of its ratio are done together while the row is in cache.
+// A row is stored as runs of consecutive bins (the photopeak and the continuum both cover a
+// range of incident energies), so both are contiguous loops four floats at a time. Jobs are
+// blocks of counted rows that back project into their own partial sums, then blocks of bins
+// that add those up and update x, on a pool of threads without locks. The previous solution,
+// rescaled to the new counts, is the starting point of the next Unfold(), so steady intervals
+// need fewer passes.
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "mcaFrame.h"
+#include "mcaPool.h"
+
+#define UNFOLD_MAX_BINS			1024
+#define UNFOLD_MAX_SUBSETS		16
+#define UNFOLD_MAX_LAYERS		4
+#define UNFOLD_MAX_POINTS		128					// per attenuation table
+#define UNFOLD_ROW_BLOCK		128					// counted rows per row job
+#define UNFOLD_BIN_BLOCK		32					// bins per update job
+#define UNFOLD_ROW_JOBS			(MAX_SPECTRUM_SIZE/UNFOLD_ROW_BLOCK)
+#define UNFOLD_BIN_JOBS			(UNFOLD_MAX_BINS/UNFOLD_BIN_BLOCK)
+#define UNFOLD_PHASE_ROWS		0					// forward and back projection of row blocks
+#define UNFOLD_PHASE_BINS		1					// sum the partials and update blocks of x
+
+typedef struct
+{
+	double keVPerChannel;							// calibration in 4096-channel units
+	double offsetKeV;
+	double fwhm662;									// fractional FWHM at 662 keV (default 0.07)
+	double peakFraction;							// of the detected photons in the photopeak (default 0.6)
+	double minKeV, maxKeV;							// incident energy range
+	int bins;
+	bool logBins;									// else equal width
+} UNFOLD_MODEL;
+
+typedef struct
+{
+	uint16_t bin, length;							// bins [bin,bin+length) of one row
+	uint32_t value;									// offset of the first value in the pool
+} UNFOLD_RUN;
+
+typedef struct
+{
+	int points;
+	double keV[UNFOLD_MAX_POINTS];
+	double mu[UNFOLD_MAX_POINTS];					// cm^2/g, interpolated log-log
+	double gPerCm2;									// areal density of the layer
+} UNFOLD_LAYER;
+
+class Unfolder {
+public:
+	UNFOLD_MODEL model;
+	int layers;
+	UNFOLD_LAYER layer[UNFOLD_MAX_LAYERS];
+	int iterations;									// largest number of passes (default 50)
+	double tolerance;								// stop when sum |dx| / sum x is below (default 1e-4)
+	int subsets;									// 1 = MLEM (default), more for OSEM
+	bool warm;										// start from the previous solution (default true)
+
+	int channels, bins;								// of the current matrix, 0 if none
+	bool haveEdges;									// edge[] is known (model built)
+	double edge[UNFOLD_MAX_BINS+1];					// keV
+	uint32_t nonZeros;
+	uint32_t *rowStart;								// channels+1, first run of each row
+	UNFOLD_RUN *run;
+	float *value;									// pool of run values, in row order
+	int sensitivitySubsets;							// subsets sensitivity[] was summed for
+	float *sensitivity;								// sensitivitySubsets*bins, column sums per subset
+	float *total;									// bins, column sums over every channel
+	float *x;										// bins, the solution
+	float *y;										// channels, counts being unfolded
+	int *counted;									// channels with counts, subset by subset
+	int countedStart[UNFOLD_MAX_SUBSETS+1];
+	float *partial;									// UNFOLD_ROW_JOBS*bins back projection sums
+	double jobChange[UNFOLD_BIN_JOBS], jobSum[UNFOLD_BIN_JOBS];
+	int runPhase, subset, rowJobs;					// of the running batch
+	bool haveSolution;
+	int lastIterations;								// passes used by the last Unfold()
+	double lastChange;
+	WorkerPool *pool;
+
+	Unfolder();										// constructor
+	~Unfolder();									// destructor
+	bool AddLayer( const char *path, double gPerCm2 );	// "keV,mu" lines
+	double Transmission( double keV );
+	bool Build( int nChannels );					// response from model and layers
+	bool Load( const char *path, int nChannels );	// "channel,bin,value" lines
+	bool SetMatrix( int nChannels, int nBins, uint32_t n, const uint16_t *channel, const uint16_t *bin, const float *value );
+	void SetThreads( int n );						// 0 = one per online cpu, 1 = no pool
+	int Unfold( const uint32_t *counts, int nChannels );	// passes run, -1 if channels do not match
+	void Sensitivities( void );						// column sums for the subsets
+	void Run( int phase, int n );					// jobs 0..n-1, on the pool if there is one
+	void Job( int phase, int job );					// one block of a pass
+};
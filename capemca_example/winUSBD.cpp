@@ -18,6 +18,8 @@ WinUSBD::WinUSBD()									// constructor
     devicePath[0] = 0;
 	pipeInId = 0;
     pipeOutId = 0;
+	interfaceNumber = 0;
+	maxPacketSize = 0;
 }
 
 bool WinUSBD::IsValid( void )						// test validity of ptr
@@ -36,6 +38,8 @@ WinUSBD & WinUSBD::operator=(const WinUSBD &assignfrom)
 	deviceInfoData = assignfrom.deviceInfoData;
 	pipeInId = assignfrom.pipeInId;
 	pipeOutId = assignfrom.pipeOutId;
+	interfaceNumber = assignfrom.interfaceNumber;
+	maxPacketSize = assignfrom.maxPacketSize;
 	strcpy(devicePath,assignfrom.devicePath);
 	return (*this);
 }
@@ -58,6 +62,8 @@ void WinUSBD::Clear( void )							// reset all variables
     devicePath[0] = 0;
 	pipeInId = 0;
     pipeOutId = 0;
+	interfaceNumber = 0;
+	maxPacketSize = 0;
 }
 
 
@@ -180,6 +186,7 @@ BOOL WinUSBD::FindBulkTransferEndpoints( bool printToConsole )
 		if (bResult)
 			{
 			if ( printToConsole ) printf("Number of Endpoints for Interface 0 is %d\n",InterfaceDescriptor.bNumEndpoints);
+			interfaceNumber = InterfaceDescriptor.bInterfaceNumber;
 
 			for (int index = 0; index < InterfaceDescriptor.bNumEndpoints; index++)
 				{
@@ -195,6 +202,7 @@ BOOL WinUSBD::FindBulkTransferEndpoints( bool printToConsole )
 							{
 							if ( printToConsole ) printf(", Direction: IN");
 							pipeInId = Pipe.PipeId;
+							maxPacketSize = Pipe.MaximumPacketSize;
 							//WinUsb_SetPipePolicy(winusbHandle,Pipe.PipeId,PIPE_TRANSFER_TIMEOUT,sizeof(timeout),&timeout);
 							WinUsb_SetPipePolicy(winusbHandle,Pipe.PipeId,ALLOW_PARTIAL_READS,sizeof(value),&value);
 
@@ -224,6 +232,42 @@ BOOL WinUSBD::FindBulkTransferEndpoints( bool printToConsole )
     return bResult;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//  UseCachedEndpoints() takes the endpoints found on an earlier connect (see mcaDeviceCache.h)
+//   instead of querying every pipe. Setting the in pipe policy and reading the out pipe policy
+//   both fail for a pipe the interface does not have, so a stale entry is refused.
+
+BOOL WinUSBD::UseCachedEndpoints( const DEVICE_CACHE_ENTRY *entry )
+{
+	BYTE value = 0;										// disable ALLOW_PARTIAL_READS
+	ULONG timeout, length = sizeof(timeout);
+
+	if ( self != this ) return( FALSE );				// validate object exists
+	if ( !entry || !handlesOpen || !DeviceCacheValid(*entry) ) return( FALSE );
+	if ( !WinUsb_SetPipePolicy(winusbHandle,entry->pipeInId,ALLOW_PARTIAL_READS,sizeof(value),&value) ) return( FALSE );
+	if ( !WinUsb_GetPipePolicy(winusbHandle,entry->pipeOutId,PIPE_TRANSFER_TIMEOUT,&length,&timeout) ) return( FALSE );
+
+	interfaceNumber = entry->interfaceNumber;
+	pipeInId = entry->pipeInId;
+	pipeOutId = entry->pipeOutId;
+	maxPacketSize = entry->maxPacketSize;
+	return( TRUE );
+}
+
+bool WinUSBD::FillCacheEntry( DEVICE_CACHE_ENTRY *entry )	// keyed by the identifier in devicePath
+{
+	char identifier[MAX_PATH];
+
+	if ( (self != this) || !ExtractIdentifierFromPath(identifier) ) return( false );
+	ZeroMemory(entry, sizeof(DEVICE_CACHE_ENTRY));
+	strncpy(entry->serial,identifier,sizeof(entry->serial)-1);
+	entry->interfaceNumber = interfaceNumber;
+	entry->pipeInId = pipeInId;
+	entry->pipeOutId = pipeOutId;
+	entry->maxPacketSize = maxPacketSize;
+	return( DeviceCacheValid(*entry) );
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //  QueryDeviceProperties() writes some diagnostic information to the console window.
 
@@ -17,6 +17,7 @@
 #include <stdlib.h>
 #include <stdio.h>				// for printf to console
 #include "lists.h"
+#include "mcaDeviceCache.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 // Define the Device Interface GUID used by all WinUsb devices that this application talks to.
@@ -47,6 +48,8 @@ public:
     TCHAR                   devicePath[MAX_PATH];
 	UCHAR					pipeInId;
     UCHAR					pipeOutId;
+	UCHAR					interfaceNumber;		// as reported by WinUsb_QueryInterfaceSettings()
+	USHORT					maxPacketSize;			// of the bulk in pipe
 
 	WinUSBD();										// constructor
 	bool IsValid( void );							// for ptr validity testing
@@ -56,6 +59,8 @@ public:
 	HRESULT GetDevicePath( HDEVINFO hDeviceInfo, GUID guid );	// fill devicePath based on deviceInfoData
 	bool ExtractIdentifierFromPath( char * identifier );		// get id string from devicePath
 	BOOL FindBulkTransferEndpoints( bool printToConsole );		// show progress when argument is true
+	BOOL UseCachedEndpoints( const DEVICE_CACHE_ENTRY *entry );	// instead of finding them, if still valid
+	bool FillCacheEntry( DEVICE_CACHE_ENTRY *entry );			// after endpoints were found
 	BOOL QueryDeviceProperties(	void );
 	HRESULT OpenDevice( GUID guid, PBOOL FailureDeviceNotFound, bool printToConsole );
 	void CloseDevice( void );						// open & close called from deviceUSB on local copy